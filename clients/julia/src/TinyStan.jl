@@ -9,6 +9,7 @@ export Model,
     laplace_sample,
     api_version,
     stan_version,
+    algorithm_available,
     compile_model,
     get_tinystan_path,
     set_tinystan_path!,
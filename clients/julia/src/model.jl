@@ -38,7 +38,8 @@ const OPTIMIZE_VARIABLES = ["lp__", "converged__"]
 
 const LAPLACE_VARIABLES = ["log_p__", "log_q__"]
 
-const exceptions = [ErrorException, ArgumentError, _ -> InterruptException()]
+const exceptions =
+    [ErrorException, ArgumentError, _ -> InterruptException(), ErrorException]
 
 """
     Model(model::String; stanc_args::Vector{String} = String[], make_args::Vector{String} = String[], warn::Bool = true)
@@ -195,6 +196,19 @@ function stan_version(model::Model)
     (major[], minor[], patch[])
 end
 
+"""
+    algorithm_available(model::Model, name::AbstractString)
+
+Return whether the algorithm `name` (one of `"nuts_unit"`, `"nuts_dense"`,
+`"nuts_diag"`, `"nuts_lowrank"`, `"nuts_auto"`, `"pathfinder"`, `"newton"`, `"bfgs"`,
+`"lbfgs"`, `"laplace"`, or `"variational"`)
+was compiled into the model. Models built with the `TINYSTAN_ALGORITHMS`
+make variable only contain the algorithms listed there.
+"""
+function algorithm_available(model::Model, name::AbstractString)
+    @ccall $(dlsym(model.lib, :tinystan_algorithm_available))(name::Cstring)::Bool
+end
+
 """
     sample(model::Model, data::String=""; num_chains::Int=4, inits::Union{nothing,AbstractString,AbstractArray{AbstractString}}=nothing, seed::Union{Nothing,UInt32}=nothing, id::Int=1, init_radius=2.0, num_warmup::Int=1000, num_samples::Int=1000, metric::HMCMetric=DIAGONAL, init_inv_metric::Union{Nothing,Array{Float64}}=nothing, save_inv_metric::Bool=false, adapt::Bool=true, delta::Float64=0.8, gamma::Float64=0.05, kappa::Float64=0.75, t0::Int=10, init_buffer::Int=75, term_buffer::Int=50, window::Int=25, save_warmup::Bool=false, stepsize::Float64=1.0, stepsize_jitter::Float64=0.0, max_depth::Int=10, refresh::Int=0, num_threads::Int=-1)
 
@@ -515,7 +529,7 @@ function optimize(
 end
 
 """
-    laplace_sample(model::Model, mode::Union{AbstractString,Array{Float64}}, data::AbstractString=""; num_draws::Int=1000, jacobian::Bool=true, calculate_lp::Bool=true, save_hessian::Bool=false, seed::Union{UInt32,Nothing}=nothing, refresh::Int=0, num_threads::Int=-1)
+    laplace_sample(model::Model, mode::Union{AbstractString,Array{Float64}}, data::AbstractString=""; num_draws::Int=1000, jacobian::Bool=true, calculate_lp::Bool=true, hessian::Union{Matrix{Float64},Nothing}=nothing, save_hessian::Bool=false, seed::Union{UInt32,Nothing}=nothing, refresh::Int=0, num_threads::Int=-1)
 
 Sample from the Laplace approximation of the posterior
 centered at the provided mode. The mode can be either a JSON string
@@ -524,6 +538,8 @@ function.
 
 Returns StanOutput object with the draws, parameter names.
 If `save_hessian` is true, the Hessian matrix is also returned.
+Passing this matrix back in as `hessian` (with the same mode and
+`jacobian`) skips recomputing it.
 """
 function laplace_sample(
     model::Model,
@@ -532,6 +548,7 @@ function laplace_sample(
     num_draws::Int = 1000,
     jacobian::Bool = true,
     calculate_lp::Bool = true,
+    hessian::Union{Matrix{Float64},Nothing} = nothing,
     save_hessian::Bool = false,
     seed::Union{UInt32,Nothing} = nothing,
     refresh::Int = 0,
@@ -571,8 +588,20 @@ function laplace_sample(
         num_params = length(param_names)
         out = zeros(Float64, num_params, num_draws)
 
+        free_params = num_free_params(model, model_ptr)
+        if hessian === nothing
+            hessian_in = C_NULL
+        else
+            if size(hessian) != (free_params, free_params)
+                error(
+                    "Hessian has incorrect size. Expected a " *
+                    "$free_params x $free_params matrix but got $(size(hessian))",
+                )
+            end
+            hessian_in = hessian
+        end
+
         if save_hessian
-            free_params = num_free_params(model, model_ptr)
             hessian_out = zeros(Float64, free_params, free_params)
         else
             hessian_out = C_NULL
@@ -580,8 +609,9 @@ function laplace_sample(
 
 
         err = Ref{Ptr{Cvoid}}()
-        return_code = @ccall $(dlsym(model.lib, :tinystan_laplace_sample))(
+        return_code = @ccall $(dlsym(model.lib, :tinystan_laplace_sample_with_hessian))(
             model_ptr::Ptr{Cvoid},
+            C_NULL::Ptr{Cvoid},
             mode_array::Ptr{Cdouble},
             mode_json::Cstring,
             seed::Cuint,
@@ -592,15 +622,16 @@ function laplace_sample(
             num_threads::Cint,
             out::Ref{Cdouble},
             length(out)::Csize_t,
+            hessian_in::Ptr{Cdouble},
             hessian_out::Ptr{Cdouble},
             err::Ref{Ptr{Cvoid}},
         )::Cint
         raise_for_error(model.lib, return_code, err)
 
-        hessian = nothing
+        hessian_saved = nothing
         if save_hessian
-            hessian = hessian_out
+            hessian_saved = hessian_out
         end
-        return StanOutput{2}(param_names, transpose(out), nothing, nothing, hessian)
+        return StanOutput{2}(param_names, transpose(out), nothing, nothing, hessian_saved)
     end
 end
@@ -71,6 +71,31 @@
         @test out.hessian ≈ [-1.0 0.0 0.0; 0.0 -1.0 0.0; 0.0 0.0 -1.0] atol = 0.1
     end
 
+    @testset "Reuse Hessian" begin
+        out1 = laplace_sample(
+            bernoulli_model,
+            BERNOULLI_MODE,
+            BERNOULLI_DATA;
+            save_hessian = true,
+            seed = UInt32(123),
+        )
+        out2 = laplace_sample(
+            bernoulli_model,
+            BERNOULLI_MODE,
+            BERNOULLI_DATA;
+            hessian = out1.hessian,
+            seed = UInt32(123),
+        )
+        @test out1.draws == out2.draws
+
+        @test_throws "incorrect size" laplace_sample(
+            bernoulli_model,
+            BERNOULLI_MODE,
+            BERNOULLI_DATA;
+            hessian = zeros(2, 2),
+        )
+    end
+
     @testset "Seed" begin
         out1 = laplace_sample(
             bernoulli_model,
@@ -16,4 +16,11 @@
         @test ver[3] >= 0
     end
 
+    @testset "Algorithm available" begin
+        for name in ["nuts_unit", "nuts_dense", "nuts_diag", "pathfinder", "laplace", "variational"]
+            @test algorithm_available(bernoulli_model, name)
+        end
+        @test !algorithm_available(bernoulli_model, "not_an_algorithm")
+    end
+
 end
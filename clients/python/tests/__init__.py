@@ -34,7 +34,10 @@ bernoulli_model = model_fixture("bernoulli")
 BERNOULLI_DATA = json.dumps({"N": 10, "y": [0, 1, 0, 0, 0, 0, 0, 0, 0, 1]})
 
 gaussian_model = model_fixture("gaussian")
+correlated_model = model_fixture("correlated")
 
 empty_model = model_fixture("empty")
 multimodal_model = model_fixture("multimodal")
 simple_jacobian_model = model_fixture("simple_jacobian")
+print_model = model_fixture("print")
+loo_model = model_fixture("loo")
@@ -1,4 +1,5 @@
 import os
+from concurrent.futures import ThreadPoolExecutor
 from pathlib import Path
 from unittest import mock
 
@@ -45,6 +46,82 @@ def test_compile_user_header():
     assert lib.exists()
 
 
+def test_compile_cache(tmp_path):
+    stanfile = STAN_FOLDER / "gaussian" / "gaussian.stan"
+    lib = tinystan.compile.generate_so_name(stanfile)
+    lib.unlink(missing_ok=True)
+    cache = tmp_path / "cache"
+
+    # processes compiling the same model at once share one build
+    with ThreadPoolExecutor(2) as pool:
+        results = list(
+            pool.map(lambda _: tinystan.compile_model(stanfile, cache=cache), range(2))
+        )
+    assert results[0] == results[1]
+    res = Path(results[0])
+    assert res.exists()
+    assert res.parent.parent == cache
+    assert not lib.exists()
+
+    mtime = res.stat().st_mtime_ns
+    assert tinystan.compile_model(stanfile, cache=cache) == results[0]
+    assert res.stat().st_mtime_ns == mtime
+
+    # different arguments are a different model
+    res2 = tinystan.compile_model(stanfile, stanc_args=["--O1"], cache=cache)
+    assert res2 != results[0]
+
+    with mock.patch.dict(os.environ, {"TINYSTAN_CACHE": os.fspath(cache)}):
+        assert tinystan.compile_model(stanfile) == results[0]
+        model = tinystan.Model(stanfile, warn=False)
+        assert model.lib_path == results[0]
+    assert not lib.exists()
+
+
+def test_cache_key(tmp_path):
+    root = tmp_path / "tinystan"
+    (root / "src").mkdir(parents=True)
+    (root / "bin").mkdir()
+    (root / "Makefile").write_text("")
+    source = root / "src" / "tinystan.cpp"
+    source.write_text("// v1")
+    stanc = root / "bin" / ("stanc.exe" if tinystan.compile.IS_WINDOWS else "stanc")
+    stanc.write_bytes(b"stanc 1")
+    includes = tmp_path / "includes"
+    includes.mkdir()
+    included = includes / "functions.stan"
+    included.write_text("functions { }")
+    stanfile = tmp_path / "model.stan"
+    stanfile.write_text('#include "functions.stan"\nparameters { real x; }')
+
+    stanc_args = [f"--include-paths={includes}"]
+
+    def key():
+        return tinystan.compile.cache_key(stanfile, stanc_args, [], os.fspath(root))
+
+    keys = [key()]
+    assert key() == keys[0]
+    for path, content in [
+        (source, b"// v2"),
+        (stanc, b"stanc 2"),
+        (included, b"functions { real f() { return 1; } }"),
+    ]:
+        path.write_bytes(content)
+        keys.append(key())
+    assert len(set(keys)) == len(keys)
+
+    # variables read by the makefiles change the build, whether or not they
+    # are listed in CACHE_ENV_VARS
+    (root / "Makefile").write_text("ifdef MY_FLAG\nCXXFLAGS += -DMY_FLAG\nendif\n")
+    keys = [key()]
+    for name in ["TINYSTAN_SERIAL", "MY_FLAG", "O"]:
+        with mock.patch.dict(os.environ, {name: "1"}):
+            keys.append(key())
+    with mock.patch.dict(os.environ, {"PATH": "/elsewhere"}):
+        assert key() == keys[0]
+    assert len(set(keys)) == len(keys)
+
+
 def test_compile_bad_ext():
     not_stanfile = STAN_FOLDER / "bernoulli" / "bernoulli.data.json"
     with pytest.raises(ValueError, match=r".stan"):
@@ -7,6 +7,7 @@ from tests import (
     STAN_FOLDER,
     bernoulli_model,
     gaussian_model,
+    print_model,
     simple_jacobian_model,
 )
 
@@ -65,6 +66,53 @@ def test_save_hessian(gaussian_model):
     )
 
 
+def test_save_hessian_many_params(gaussian_model):
+    # columns of the Hessian are computed in parallel
+    data = {"N": 50}
+    mode = {"alpha": np.linspace(-1, 1, 50)}
+
+    out = gaussian_model.laplace_sample(mode, data, num_draws=10, save_hessian=True)
+    np.testing.assert_allclose(out.hessian, out.hessian.T)
+    np.testing.assert_allclose(out.hessian, -np.eye(50), atol=1e-6)
+
+
+def test_reuse_hessian(bernoulli_model):
+    out1 = bernoulli_model.laplace_sample(
+        BERNOULLI_MODE, BERNOULLI_DATA, seed=123, save_hessian=True
+    )
+    out2 = bernoulli_model.laplace_sample(
+        BERNOULLI_MODE,
+        BERNOULLI_DATA,
+        seed=123,
+        hessian=out1.hessian,
+        save_hessian=True,
+    )
+    np.testing.assert_equal(out1.data, out2.data)
+    np.testing.assert_equal(out1.hessian, out2.hessian)
+
+
+def test_bad_hessian(bernoulli_model):
+    with pytest.raises(ValueError, match="Invalid Hessian size"):
+        bernoulli_model.laplace_sample(
+            BERNOULLI_MODE, BERNOULLI_DATA, hessian=np.zeros((2, 2))
+        )
+
+    # not negative definite
+    with pytest.raises(RuntimeError, match="negative definite"):
+        bernoulli_model.laplace_sample(
+            BERNOULLI_MODE, BERNOULLI_DATA, hessian=np.ones((1, 1))
+        )
+
+
+def test_num_threads(gaussian_model):
+    # draws are generated in parallel, but do not depend on the thread count
+    data = {"N": 5}
+    mode = {"alpha": [0.1, 0.2, 0.3, 0.4, 0.5]}
+    out1 = gaussian_model.laplace_sample(mode, data, seed=123, num_threads=1)
+    out2 = gaussian_model.laplace_sample(mode, data, seed=123, num_threads=4)
+    np.testing.assert_equal(out1.data, out2.data)
+
+
 def test_seed(bernoulli_model):
     out1 = bernoulli_model.laplace_sample(
         BERNOULLI_MODE,
@@ -145,3 +193,52 @@ def test_bad_mode_json(bernoulli_model):
 def test_bad_argument(bernoulli_model, arg, value, match):
     with pytest.raises(ValueError, match=match):
         bernoulli_model.laplace_sample(BERNOULLI_DATA, **{arg: value})
+
+
+def test_model_output(print_model, capsys):
+    print_model.laplace_sample({"mu": 0.0}, num_draws=10, refresh=1)
+    out = capsys.readouterr().out
+    assert "in transformed data" in out
+    assert out.count("in generated quantities") == 10
+
+    quiet = tinystan.Model(
+        STAN_FOLDER / "print" / "print_model.so", model_output=False, warn=False
+    )
+    quiet.laplace_sample({"mu": 0.0}, num_draws=10, refresh=1)
+    out = capsys.readouterr().out
+    assert "in transformed data" in out
+    assert "in generated quantities" not in out
+    assert "in model" not in out
+
+
+@pytest.mark.parametrize(
+    "algorithm",
+    [
+        tinystan.OptimizationAlgorithm.NEWTON,
+        tinystan.OptimizationAlgorithm.BFGS,
+        tinystan.OptimizationAlgorithm.LBFGS,
+    ],
+)
+def test_optimize_laplace(simple_jacobian_model, algorithm):
+    fused = simple_jacobian_model.optimize_laplace(
+        algorithm=algorithm, seed=1234, num_draws=200, save_hessian=True
+    )
+    mode = simple_jacobian_model.optimize(
+        algorithm=algorithm, jacobian=True, seed=1234
+    )
+    separate = simple_jacobian_model.laplace_sample(
+        mode, seed=1234, num_draws=200, save_hessian=True
+    )
+
+    np.testing.assert_allclose(fused.mode["sigma"], mode["sigma"])
+    assert fused.mode["converged__"] == mode["converged__"]
+    np.testing.assert_allclose(fused.hessian, separate.hessian, rtol=1e-6)
+    np.testing.assert_allclose(fused["sigma"], separate["sigma"], rtol=1e-6)
+    assert np.isclose(fused["sigma"].mean(), 3.3, atol=0.2)
+
+
+def test_optimize_laplace_bad_args(bernoulli_model):
+    with pytest.raises(ValueError, match="num_draws"):
+        bernoulli_model.optimize_laplace(BERNOULLI_DATA, num_draws=0)
+    with pytest.raises(ValueError, match="num_iterations"):
+        bernoulli_model.optimize_laplace(BERNOULLI_DATA, num_iterations=0)
@@ -0,0 +1,84 @@
+import numpy as np
+import pytest
+
+from tests import bernoulli_model, loo_model
+
+rng = np.random.default_rng(1234)
+Y = rng.normal(1.0, 1.0, size=20)
+LOO_DATA = {"N": len(Y), "y": Y}
+
+
+def exact_elpd_loo(y):
+    # with a vague prior, the predictive density of y[i] given the other
+    # observations is normal(mean(y[-i]), 1 + 1 / (N - 1))
+    n = len(y)
+    mean_rest = (y.sum() - y) / (n - 1)
+    var = 1 + 1 / (n - 1)
+    return -0.5 * (np.log(2 * np.pi * var) + (y - mean_rest) ** 2 / var)
+
+
+@pytest.fixture(scope="module")
+def fit(loo_model):
+    return loo_model.sample(LOO_DATA, seed=1234)
+
+
+def test_loo(loo_model, fit):
+    loo = loo_model.loo(fit, LOO_DATA, seed=1)
+    exact = exact_elpd_loo(Y)
+
+    np.testing.assert_allclose(loo.elpd_loo, exact.sum(), atol=0.5)
+    np.testing.assert_allclose(loo.pointwise, exact, atol=0.1)
+    np.testing.assert_allclose(loo.elpd_loo, loo.pointwise.sum())
+    assert 0.5 < loo.p_loo < 1.5
+    assert loo.se_elpd_loo > 0
+    assert loo.pareto_k.shape == (len(Y),)
+    assert np.all(loo.pareto_k < 0.7)
+
+
+def test_loo_array(loo_model, fit):
+    # only the parameters are needed
+    loo1 = loo_model.loo(fit, LOO_DATA, seed=1)
+    loo2 = loo_model.loo(fit["mu"].reshape(-1, 1), LOO_DATA, seed=1)
+    assert loo1.elpd_loo == loo2.elpd_loo
+    np.testing.assert_equal(loo1.pareto_k, loo2.pareto_k)
+
+
+def test_outlier(loo_model):
+    y = Y.copy()
+    y[0] = 10.0
+    data = {"N": len(y), "y": y}
+    out = loo_model.sample(data, seed=1234)
+    loo = loo_model.loo(out, data)
+    assert loo.pareto_k[0] == loo.pareto_k.max()
+    assert loo.pareto_k[0] > 0.7
+
+
+def test_num_threads(loo_model, fit):
+    loo1 = loo_model.loo(fit, LOO_DATA, seed=1, num_threads=1)
+    loo2 = loo_model.loo(fit, LOO_DATA, seed=1, num_threads=4)
+    assert loo1.elpd_loo == loo2.elpd_loo
+    np.testing.assert_equal(loo1.pointwise, loo2.pointwise)
+    np.testing.assert_equal(loo1.pareto_k, loo2.pareto_k)
+
+
+def test_few_draws(loo_model, fit):
+    # too few draws to fit the tail
+    loo = loo_model.loo(fit.data.reshape(-1, fit.data.shape[-1])[:10, 7:], LOO_DATA)
+    assert np.all(np.isinf(loo.pareto_k))
+    assert np.isfinite(loo.elpd_loo)
+
+
+def test_bad_variable(loo_model, bernoulli_model, fit):
+    with pytest.raises(ValueError, match="not found"):
+        loo_model.loo(fit, LOO_DATA, variable="not_here")
+
+    with pytest.raises(ValueError, match="not found"):
+        bernoulli_model.loo(np.full((10, 1), 0.5), '{"N": 0, "y": []}')
+
+
+def test_bad_draws(loo_model):
+    with pytest.raises(ValueError, match="stride"):
+        loo_model.loo(np.zeros((10, 0)), LOO_DATA)
+
+    with pytest.raises(ValueError, match="num_draws"):
+        loo_model.loo(np.zeros((0, 1)), LOO_DATA)
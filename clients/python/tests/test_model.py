@@ -1,5 +1,15 @@
+import contextlib
+import os
+import re
+import signal
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
 from pathlib import Path
 
+import numpy as np
+import pytest
+
 import tinystan
 
 STAN_FOLDER = Path(__file__).parent.parent.parent.parent / "test_models"
@@ -21,3 +31,267 @@ def test_stan_version():
     assert stan_version[0] == 2
     assert stan_version[1] >= 34
     assert stan_version[2] >= 0
+
+
+def test_algorithm_available():
+    model = tinystan.Model(STAN_FOLDER / "bernoulli" / "bernoulli_model.so")
+    # the test models are built with every algorithm
+    for name in [
+        "nuts_unit",
+        "nuts_dense",
+        "nuts_diag",
+        "nuts_lowrank",
+        "nuts_auto",
+        "pathfinder",
+        "newton",
+        "bfgs",
+        "lbfgs",
+        "laplace",
+        "variational",
+    ]:
+        assert model.algorithm_available(name)
+    assert not model.algorithm_available("not_an_algorithm")
+
+
+def test_message_batching(capsys):
+    model = tinystan.Model(
+        STAN_FOLDER / "bernoulli" / "bernoulli_model.so",
+        message_batch_ms=10,
+        warn=False,
+    )
+    data = STAN_FOLDER / "bernoulli" / "bernoulli.data.json"
+    model.sample(data, num_chains=4, num_warmup=100, num_samples=100, refresh=10)
+    out = capsys.readouterr().out
+    # 4 chains, each printing at the first iteration, every 10th, and the
+    # last of warmup and of sampling, all delivered by the end of the run
+    assert out.count("Iteration:") == 4 * (11 + 11)
+
+
+def test_message_tags(capsys):
+    model = tinystan.Model(
+        STAN_FOLDER / "bernoulli" / "bernoulli_model.so",
+        message_batch_ms=10,
+        tag_messages=True,
+        warn=False,
+    )
+    data = STAN_FOLDER / "bernoulli" / "bernoulli.data.json"
+    # isolated chains run one at a time, so their messages know their chain
+    model.sample(
+        data,
+        num_chains=2,
+        num_warmup=100,
+        num_samples=100,
+        refresh=50,
+        isolate_chains=True,
+    )
+    lines = [
+        line for line in capsys.readouterr().out.splitlines() if "Iteration:" in line
+    ]
+    assert len(lines) == 2 * (3 + 3)
+    assert re.match(r"\[chain [12], \d+\.\d{3}s\] ", lines[0])
+    assert {line[: len("[chain 1")] for line in lines} == {"[chain 1", "[chain 2"}
+
+
+def test_message_batching_drop(capsys):
+    model = tinystan.Model(
+        STAN_FOLDER / "bernoulli" / "bernoulli_model.so",
+        message_batch_ms=100_000,
+        message_queue_size=1,
+        drop_messages=True,
+        warn=False,
+    )
+    data = STAN_FOLDER / "bernoulli" / "bernoulli.data.json"
+    model.sample(data, num_chains=1, num_warmup=100, num_samples=100, refresh=10)
+    assert "were dropped" in capsys.readouterr().err
+
+
+def test_message_batching_bad_arguments():
+    with pytest.raises(ValueError, match="non-negative"):
+        tinystan.Model(
+            STAN_FOLDER / "bernoulli" / "bernoulli_model.so",
+            message_batch_ms=-1,
+            warn=False,
+        )
+    with pytest.raises(ValueError, match="positive"):
+        tinystan.Model(
+            STAN_FOLDER / "bernoulli" / "bernoulli_model.so",
+            message_queue_size=0,
+            warn=False,
+        )
+
+
+def test_variable_metadata():
+    model = tinystan.Model(STAN_FOLDER / "shapes" / "shapes_model.so")
+    out = model.sample(num_chains=2, num_warmup=10, num_samples=10, seed=123)
+
+    # the metadata gives the same views as parsing the names
+    parsed = tinystan.StanOutput(out.raw_parameters, out.data)
+    assert out.parameters == parsed.parameters
+    for name in parsed.parameters:
+        np.testing.assert_equal(out[name], parsed[name])
+
+    mu = out["mu"]
+    assert out["m"].shape == (2, 10, 2, 3)
+    np.testing.assert_allclose(out["m"][..., 1, 2], mu + 23)
+    assert out["z"].shape == (2, 10, 2)
+    np.testing.assert_allclose(out["z"][..., 1], 2 * mu + 4j * mu)
+    assert out["a"].shape == (2, 10, 2, 3)
+    np.testing.assert_allclose(out["a"][..., 1, 0], 2 * mu)
+
+
+@contextlib.contextmanager
+def shared_handle(model, data):
+    """
+    Make every call on ``model`` use one C model, rather than creating a new
+    one for each call as the client does.
+    """
+    with model._get_model(data, 1) as handle:
+        model._get_model = lambda *args, **kwargs: contextlib.nullcontext(handle)
+        try:
+            yield handle
+        finally:
+            del model._get_model
+
+
+def test_concurrent_calls():
+    model = tinystan.Model(STAN_FOLDER / "bernoulli" / "bernoulli_model.so")
+    data = STAN_FOLDER / "bernoulli" / "bernoulli.data.json"
+
+    def fit(seed, num_threads):
+        return model.sample(
+            data, num_chains=2, num_threads=num_threads, seed=seed
+        ).data
+
+    with shared_handle(model, data):
+        expected = [fit(seed, 1) for seed in range(4)]
+        with ThreadPoolExecutor(max_workers=4) as pool:
+            results = list(pool.map(fit, range(4), [1, 2, 3, -1]))
+    for e, r in zip(expected, results):
+        np.testing.assert_equal(e, r)
+
+
+def test_concurrent_time_limits():
+    model = tinystan.Model(STAN_FOLDER / "bernoulli" / "bernoulli_model.so")
+    data = STAN_FOLDER / "bernoulli" / "bernoulli.data.json"
+
+    with shared_handle(model, data):
+        with ThreadPoolExecutor(max_workers=2) as pool:
+            # each call has its own deadline, although they share a C model
+            limited = pool.submit(
+                model.sample, data, num_samples=10**6, time_limit=0.05
+            )
+            unlimited = pool.submit(model.sample, data, seed=3)
+            assert limited.result().draw_counts is not None
+            out = unlimited.result()
+    assert out.draw_counts is None
+    assert out["theta"].shape[1] == 1000
+
+
+@pytest.mark.skipif(sys.platform == "win32", reason="needs POSIX signals")
+def test_concurrent_interrupt():
+    model = tinystan.Model(STAN_FOLDER / "bernoulli" / "bernoulli_model.so")
+    data = STAN_FOLDER / "bernoulli" / "bernoulli.data.json"
+
+    def fit():
+        return model.sample(data, num_chains=2, num_threads=2, seed=5).data
+
+    with shared_handle(model, data):
+        expected = fit()
+        with ThreadPoolExecutor(max_workers=2) as pool:
+            stopped = pool.submit(
+                model.sample, data, num_chains=1, num_warmup=10**8, seed=1
+            )
+            time.sleep(1)  # let the long call start and install its handler
+            os.kill(os.getpid(), signal.SIGINT)
+            # a call started after the interrupt runs to completion while
+            # the interrupted one stops
+            unaffected = pool.submit(fit)
+            with pytest.raises(KeyboardInterrupt):
+                stopped.result()
+            np.testing.assert_equal(unaffected.result(), expected)
+
+
+def test_memory_options():
+    model = tinystan.Model(
+        STAN_FOLDER / "bernoulli" / "bernoulli_model.so",
+        release_memory=True,
+        warn=False,
+    )
+    data = STAN_FOLDER / "bernoulli" / "bernoulli.data.json"
+    out = model.sample(data, num_chains=2, num_warmup=100, num_samples=100)
+    peak, arena, output = model.last_call_memory()
+    assert output == out.data.nbytes
+    assert arena > 0
+    if sys.platform in ("linux", "darwin", "win32"):
+        assert peak > 0
+
+    limited = tinystan.Model(
+        STAN_FOLDER / "bernoulli" / "bernoulli_model.so",
+        memory_limit=1,
+        warn=False,
+    )
+    with pytest.raises(MemoryError, match="memory limit"):
+        limited.sample(data, num_warmup=100, num_samples=100)
+
+    with pytest.raises(ValueError, match="positive"):
+        tinystan.Model(
+            STAN_FOLDER / "bernoulli" / "bernoulli_model.so",
+            memory_limit=0,
+            warn=False,
+        )
+
+
+def test_init_screening():
+    data = STAN_FOLDER / "bernoulli" / "bernoulli.data.json"
+    model = tinystan.Model(
+        STAN_FOLDER / "bernoulli" / "bernoulli_model.so",
+        init_candidates=50,
+        warn=False,
+    )
+    out = model.sample(data, num_chains=3, num_warmup=100, num_samples=100)
+    assert 0.2 < out["theta"].mean() < 0.3
+    assert model.last_call_init_screening() == (150, 150)
+
+    model.optimize(data)
+    assert model.last_call_init_screening() == (50, 50)
+
+    # chains with complete inits are not screened
+    model.sample(data, inits={"theta": 0.5}, num_warmup=10, num_samples=10)
+    assert model.last_call_init_screening() == (0, 0)
+
+    # but a restarted chain is
+    out = model.sample(
+        data,
+        num_chains=2,
+        inits=[{"theta": 0.5}, {"theta": 2}],
+        num_warmup=10,
+        num_samples=10,
+        isolate_chains=True,
+        max_chain_restarts=1,
+    )
+    assert out.chain_errors is None
+    assert model.last_call_init_screening() == (50, 50)
+
+    best = tinystan.Model(
+        STAN_FOLDER / "bernoulli" / "bernoulli_model.so",
+        init_candidates=200,
+        select_best_init=True,
+        warn=False,
+    )
+    with best.sampler(data, num_chains=2) as sampler:
+        # the mode of theta^3 (1 - theta)^9 on the log-odds scale
+        np.testing.assert_allclose(sampler.positions, np.log(1 / 3), atol=0.1)
+    assert best.last_call_init_screening() == (400, 400)
+
+    unscreened = tinystan.Model(
+        STAN_FOLDER / "bernoulli" / "bernoulli_model.so", warn=False
+    )
+    unscreened.sample(data, num_warmup=10, num_samples=10)
+    assert unscreened.last_call_init_screening() == (0, 0)
+
+    with pytest.raises(ValueError, match="init_candidates"):
+        tinystan.Model(
+            STAN_FOLDER / "bernoulli" / "bernoulli_model.so",
+            init_candidates=-1,
+            warn=False,
+        )
@@ -161,3 +161,8 @@ def test_bad_argument_bfgs(bernoulli_model, algorithm, arg, value, match):
             )
     else:
         bernoulli_model.optimize(BERNOULLI_DATA, algorithm=algorithm, **{arg: value})
+
+
+def test_time_limit(bernoulli_model):
+    with pytest.raises(TimeoutError):
+        bernoulli_model.optimize(BERNOULLI_DATA, time_limit=1e-9)
@@ -0,0 +1,71 @@
+import numpy as np
+import pytest
+
+import tinystan
+from tests import BERNOULLI_DATA, bernoulli_model, gaussian_model, multimodal_model
+
+ALL_ALGORITHMS = [
+    tinystan.OptimizationAlgorithm.NEWTON,
+    tinystan.OptimizationAlgorithm.BFGS,
+    tinystan.OptimizationAlgorithm.LBFGS,
+]
+
+
+@pytest.mark.parametrize("algorithm", ALL_ALGORITHMS)
+def test_data(bernoulli_model, algorithm):
+    out = bernoulli_model.optimize_multi(
+        BERNOULLI_DATA, num_starts=4, algorithm=algorithm
+    )
+    # every start finds the same mode
+    assert out["theta"].shape == (1,)
+    np.testing.assert_allclose(out["theta"], 0.2, atol=1e-3)
+    np.testing.assert_equal(out.return_codes, 0)
+
+
+def test_multiple_modes(multimodal_model):
+    inits = [{"mu": -1000}, {"mu": 1000}, {"mu": -900}, {"mu": 900}]
+    out = multimodal_model.optimize_multi(num_starts=4, inits=inits, dedupe_tol=0.01)
+    assert out["mu"].shape == (2,)
+    np.testing.assert_allclose(np.sort(out["mu"]), [-100, 100], atol=0.01)
+
+    out = multimodal_model.optimize_multi(num_starts=4, inits=inits, dedupe_tol=0)
+    assert out["mu"].shape == (4,)
+    assert out.return_codes.shape == (4,)
+
+
+def test_sorted(gaussian_model):
+    data = {"N": 2}
+    out = gaussian_model.optimize_multi(
+        data, num_starts=6, num_iterations=2, dedupe_tol=0
+    )
+    lp = out["lp__"]
+    assert np.all(lp[:-1] >= lp[1:])
+
+
+def test_seed(bernoulli_model):
+    out1 = bernoulli_model.optimize_multi(BERNOULLI_DATA, seed=123, dedupe_tol=0)
+    out2 = bernoulli_model.optimize_multi(BERNOULLI_DATA, seed=123, dedupe_tol=0)
+    np.testing.assert_equal(out1.data, out2.data)
+
+
+def test_bad_data(bernoulli_model):
+    data = {"N": -1}
+    with pytest.raises(RuntimeError, match="greater than or equal to 0"):
+        bernoulli_model.optimize_multi(data=data)
+
+
+@pytest.mark.parametrize(
+    "arg, value, match",
+    [
+        ("num_starts", 0, "at least 1"),
+        ("id", 0, "positive"),
+        ("init_radius", -0.1, "non-negative"),
+        ("num_iterations", 0, "positive"),
+        ("dedupe_tol", -1, "non-negative"),
+        ("max_history_size", 0, "positive"),
+        ("init_alpha", 0, "positive"),
+    ],
+)
+def test_bad_argument(bernoulli_model, arg, value, match):
+    with pytest.raises(ValueError, match=match):
+        bernoulli_model.optimize_multi(BERNOULLI_DATA, **{arg: value})
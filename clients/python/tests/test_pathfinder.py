@@ -133,6 +133,33 @@ def test_calculate_lp(bernoulli_model):
     assert np.sum(np.isnan(out_single["lp__"])) < 1000
 
 
+def test_stream_paths(bernoulli_model):
+    out1 = bernoulli_model.pathfinder(
+        BERNOULLI_DATA, num_paths=8, num_multi_draws=500, stream_paths=True, seed=7
+    )
+    assert out1["theta"].shape == (500,)
+    assert 0.2 < out1["theta"].mean() < 0.3
+    # draws come from several paths
+    assert len(np.unique(out1["path__"])) > 1
+
+    # the result does not depend on the order the paths finish in
+    out2 = bernoulli_model.pathfinder(
+        BERNOULLI_DATA,
+        num_paths=8,
+        num_multi_draws=500,
+        stream_paths=True,
+        seed=7,
+        num_threads=1,
+    )
+    np.testing.assert_equal(out1.data, out2.data)
+
+    # without resampling, every draw is returned as usual
+    out3 = bernoulli_model.pathfinder(
+        BERNOULLI_DATA, num_paths=2, psis_resample=False, stream_paths=True
+    )
+    assert out3["theta"].shape == (2000,)
+
+
 def test_inits(multimodal_model, temp_json):
     # well-separated mixture of gaussians
 
@@ -0,0 +1,96 @@
+import numpy as np
+import pytest
+
+import tinystan
+from tests import (
+    BERNOULLI_DATA,
+    bernoulli_model,
+    empty_model,
+    gaussian_model,
+    multimodal_model,
+)
+
+
+def test_data(bernoulli_model):
+    out = bernoulli_model.pathfinder_sample(BERNOULLI_DATA)
+    assert 0.2 < out["theta"].mean() < 0.3
+
+
+def test_output_sizes(bernoulli_model):
+    out = bernoulli_model.pathfinder_sample(
+        BERNOULLI_DATA, num_chains=3, num_warmup=50, num_samples=123
+    )
+    assert out["theta"].shape == (3, 123)
+    assert out.stepsize.shape == (3,)
+
+    out = bernoulli_model.pathfinder_sample(
+        BERNOULLI_DATA,
+        num_chains=2,
+        num_warmup=50,
+        num_samples=12,
+        save_warmup=True,
+    )
+    assert out["theta"].shape == (2, 50 + 12)
+
+
+@pytest.mark.parametrize(
+    "metric", [tinystan.HMCMetric.DIAGONAL, tinystan.HMCMetric.DENSE]
+)
+def test_metric_initialized(gaussian_model, metric):
+    data = {"N": 3}
+    out = gaussian_model.pathfinder_sample(
+        data, metric=metric, num_warmup=0, num_samples=10, save_inv_metric=True
+    )
+    # with no warmup, the reported metric is the Pathfinder estimate
+    if metric == tinystan.HMCMetric.DENSE:
+        assert out.inv_metric.shape == (4, 3, 3)
+        diag = np.diagonal(out.inv_metric, axis1=1, axis2=2)
+    else:
+        assert out.inv_metric.shape == (4, 3)
+        diag = out.inv_metric
+    np.testing.assert_allclose(diag, 1.0, atol=0.3)
+
+
+def test_short_warmup(gaussian_model):
+    data = {"N": 5}
+    out = gaussian_model.pathfinder_sample(data, num_warmup=150, num_samples=1000)
+    np.testing.assert_allclose(out["alpha"].mean(axis=(0, 1)), 0, atol=0.2)
+    np.testing.assert_allclose(out["alpha"].std(axis=(0, 1)), 1, atol=0.2)
+
+
+def test_seed(bernoulli_model):
+    out1 = bernoulli_model.pathfinder_sample(
+        BERNOULLI_DATA, seed=123, num_warmup=50, num_samples=100
+    )
+    out2 = bernoulli_model.pathfinder_sample(
+        BERNOULLI_DATA, seed=123, num_warmup=50, num_samples=100
+    )
+    np.testing.assert_equal(out1.data, out2.data)
+
+
+def test_inits(multimodal_model):
+    # chains start from the mode Pathfinder found
+    out = multimodal_model.pathfinder_sample(inits={"mu": 1000}, num_warmup=100)
+    assert np.all(out["mu"] > 0)
+
+
+def test_empty_model(empty_model):
+    with pytest.raises(ValueError, match="no parameters"):
+        empty_model.pathfinder_sample()
+
+
+@pytest.mark.parametrize(
+    "arg, value, match",
+    [
+        ("num_chains", 0, "at least 1"),
+        ("num_paths", 0, "at least 1"),
+        ("num_warmup", -1, "non-negative"),
+        ("num_samples", 0, "at least 1"),
+        ("num_multi_draws", 1, "at least 2"),
+        ("delta", 1.1, "between 0 and 1"),
+        ("max_depth", 0, "positive"),
+    ],
+)
+def test_bad_argument(bernoulli_model, arg, value, match):
+    with pytest.raises(ValueError, match=match):
+        bernoulli_model.pathfinder_sample(BERNOULLI_DATA, **{arg: value})
@@ -0,0 +1,108 @@
+import numpy as np
+import pytest
+
+import tinystan
+from tests import BERNOULLI_DATA, bernoulli_model, empty_model, gaussian_model
+
+
+def test_data(bernoulli_model):
+    out = bernoulli_model.pooled_sample(BERNOULLI_DATA)
+    assert 0.2 < out["theta"].mean() < 0.3
+
+
+def test_save_warmup(bernoulli_model):
+    out = bernoulli_model.pooled_sample(
+        BERNOULLI_DATA, num_warmup=12, num_samples=34, save_warmup=False
+    )
+    assert out["theta"].shape[1] == 34
+
+    out = bernoulli_model.pooled_sample(
+        BERNOULLI_DATA, num_warmup=120, num_samples=34, save_warmup=True
+    )
+    assert out["theta"].shape[1] == 120 + 34
+    # early stopping is disabled when warmup is saved
+    assert out.num_warmup == 120
+
+
+@pytest.mark.parametrize(
+    "metric", [tinystan.HMCMetric.DIAGONAL, tinystan.HMCMetric.DENSE]
+)
+def test_shared_adaptation(gaussian_model, metric):
+    data = {"N": 3}
+    out = gaussian_model.pooled_sample(
+        data, num_chains=6, metric=metric, save_inv_metric=True
+    )
+    assert out.stepsize.shape == (6,)
+    np.testing.assert_equal(out.stepsize, out.stepsize[0])
+    np.testing.assert_equal(out.inv_metric, out.inv_metric[:1])
+
+    if metric == tinystan.HMCMetric.DENSE:
+        diag = np.diagonal(out.inv_metric[0])
+    else:
+        diag = out.inv_metric[0]
+    np.testing.assert_allclose(diag, 1.0, atol=0.3)
+
+
+def test_early_stopping(gaussian_model):
+    data = {"N": 5}
+    out = gaussian_model.pooled_sample(
+        data, num_chains=8, num_warmup=1000, rhat_threshold=1.1
+    )
+    assert out.num_warmup < 1000
+    np.testing.assert_allclose(out["alpha"].mean(axis=(0, 1)), 0, atol=0.2)
+    np.testing.assert_allclose(out["alpha"].std(axis=(0, 1)), 1, atol=0.2)
+
+    out = gaussian_model.pooled_sample(
+        data, num_chains=8, num_warmup=300, rhat_threshold=0
+    )
+    assert out.num_warmup == 300
+
+
+def test_seed(bernoulli_model):
+    out1 = bernoulli_model.pooled_sample(
+        BERNOULLI_DATA, seed=123, num_warmup=100, num_samples=100
+    )
+    out2 = bernoulli_model.pooled_sample(
+        BERNOULLI_DATA, seed=123, num_warmup=100, num_samples=100
+    )
+    np.testing.assert_equal(out1.data, out2.data)
+
+
+def test_init_inv_metric(gaussian_model):
+    data = {"N": 3}
+    out = gaussian_model.pooled_sample(
+        data,
+        num_warmup=0,
+        num_samples=10,
+        init_inv_metric=np.full(3, 2.0),
+        save_inv_metric=True,
+    )
+    np.testing.assert_equal(out.inv_metric, 2.0)
+
+    with pytest.raises(ValueError, match="Invalid initial metric size"):
+        gaussian_model.pooled_sample(data, init_inv_metric=np.ones((4, 3)))
+
+
+def test_model_no_params(empty_model):
+    fit = empty_model.pooled_sample(save_inv_metric=True)
+    assert len(fit.parameters) == 7  # just HMC parameters
+    assert fit.inv_metric.size == 0
+
+
+@pytest.mark.parametrize(
+    "arg, value, match",
+    [
+        ("num_chains", 0, "at least 1"),
+        ("num_warmup", -1, "non-negative"),
+        ("num_samples", 0, "at least 1"),
+        ("id", 0, "positive"),
+        ("delta", 1.1, "between 0 and 1"),
+        ("gamma", 0, "positive"),
+        ("rhat_threshold", -1, "non-negative"),
+        ("stepsize", 0.0, "positive"),
+        ("max_depth", 0, "positive"),
+    ],
+)
+def test_bad_argument(bernoulli_model, arg, value, match):
+    with pytest.raises(ValueError, match=match):
+        bernoulli_model.pooled_sample(BERNOULLI_DATA, **{arg: value})
@@ -8,6 +8,7 @@ from tests import (
     BERNOULLI_DATA,
     STAN_FOLDER,
     bernoulli_model,
+    correlated_model,
     empty_model,
     gaussian_model,
     multimodal_model,
@@ -206,6 +207,131 @@ def test_init_inv_metric_roundtrip(gaussian_model):
     np.testing.assert_allclose(out.inv_metric, diag_metric)
 
 
+def test_low_rank_metric(gaussian_model):
+    data = {"N": 5}
+    out = gaussian_model.sample(
+        data,
+        num_chains=2,
+        metric=tinystan.HMCMetric.LOW_RANK,
+        metric_rank=2,
+        save_inv_metric=True,
+    )
+    # 5 variances, 2 eigenvectors of length 5, 2 eigenvalues
+    assert out.inv_metric.shape == (2, 5 * 3 + 2)
+    np.testing.assert_allclose(out.inv_metric[:, :5], 1, atol=0.3)
+    basis = out.inv_metric[:, 5:15].reshape(2, 2, 5)
+    np.testing.assert_allclose(np.linalg.norm(basis, axis=2), 1)
+    assert np.all(out.inv_metric[:, 15:] > 0)
+    np.testing.assert_allclose(out["alpha"].mean(axis=(0, 1)), 0, atol=0.2)
+
+    # the rank is capped at the number of parameters
+    out = gaussian_model.sample(
+        data,
+        num_chains=1,
+        num_warmup=100,
+        num_samples=10,
+        metric=tinystan.HMCMetric.LOW_RANK,
+        metric_rank=100,
+        save_inv_metric=True,
+    )
+    assert out.inv_metric.shape == (1, 5 * 6 + 5)
+
+    init = np.concatenate([[1.5] * 5, np.eye(5)[0], [2.0]])
+    out = gaussian_model.sample(
+        data,
+        num_chains=1,
+        num_warmup=1,  # low enough to not adapt the metric
+        num_samples=1,
+        metric=tinystan.HMCMetric.LOW_RANK,
+        metric_rank=1,
+        init_inv_metric=init,
+        save_inv_metric=True,
+    )
+    np.testing.assert_allclose(out.inv_metric[0], init)
+
+    out = gaussian_model.pooled_sample(
+        data,
+        metric=tinystan.HMCMetric.LOW_RANK,
+        metric_rank=2,
+        save_inv_metric=True,
+    )
+    assert out.inv_metric.shape == (4, 5 * 3 + 2)
+    np.testing.assert_equal(out.inv_metric, out.inv_metric[0])
+
+    with pytest.raises(ValueError, match="Invalid initial metric size"):
+        gaussian_model.sample(
+            data,
+            metric=tinystan.HMCMetric.LOW_RANK,
+            metric_rank=2,
+            init_inv_metric=np.ones(5),
+        )
+    with pytest.raises(RuntimeError, match="unit-length"):
+        gaussian_model.sample(
+            data,
+            metric=tinystan.HMCMetric.LOW_RANK,
+            metric_rank=1,
+            init_inv_metric=np.concatenate([[1.0] * 5, [2.0] * 5, [2.0]]),
+        )
+    with pytest.raises(ValueError, match="rank"):
+        gaussian_model.sample(data, metric=tinystan.HMCMetric.LOW_RANK, metric_rank=0)
+
+
+def test_auto_metric(gaussian_model):
+    data = {"N": 5}
+    out = gaussian_model.sample(
+        data, num_chains=2, metric=tinystan.HMCMetric.AUTO, save_inv_metric=True
+    )
+    assert out.inv_metric.shape == (2, 5, 5)
+    # independent parameters do not need a dense metric
+    off_diagonal = ~np.eye(5, dtype=bool)
+    np.testing.assert_equal(out.inv_metric[:, off_diagonal], 0)
+    variances = np.diagonal(out.inv_metric, axis1=1, axis2=2)
+    np.testing.assert_allclose(variances, 1, atol=0.3)
+    np.testing.assert_allclose(out["alpha"].mean(axis=(0, 1)), 0, atol=0.2)
+
+    # without adaptation, a dense initial metric is used as is
+    init = np.eye(5) + 0.1
+    out = gaussian_model.sample(
+        data,
+        num_chains=1,
+        num_warmup=10,
+        num_samples=10,
+        metric=tinystan.HMCMetric.AUTO,
+        init_inv_metric=init,
+        adapt=False,
+    )
+    assert out["alpha"].shape == (1, 10, 5)
+
+    out = gaussian_model.pooled_sample(
+        data, metric=tinystan.HMCMetric.AUTO, save_inv_metric=True
+    )
+    assert out.inv_metric.shape == (4, 5, 5)
+    np.testing.assert_equal(out.inv_metric, out.inv_metric[0])
+
+    with pytest.raises(ValueError, match="automatic metric"):
+        gaussian_model.tempered_sample(data, metric=tinystan.HMCMetric.AUTO)
+
+
+def test_auto_metric_switch(correlated_model):
+    # strongly correlated parameters away from the origin, where the dense
+    # sampler starts
+    data = {"N": 10, "rho": 0.99, "mu": 20}
+    out = correlated_model.sample(
+        data, num_chains=2, metric=tinystan.HMCMetric.AUTO, save_inv_metric=True
+    )
+    off_diagonal = ~np.eye(10, dtype=bool)
+    assert np.all(out.inv_metric[:, off_diagonal] != 0)
+    assert out["divergent__"].sum() < 10
+    np.testing.assert_allclose(out["x"].mean(axis=(0, 1)), 20, atol=0.5)
+    assert out["treedepth__"].mean() < 4
+
+    out = correlated_model.pooled_sample(
+        data, metric=tinystan.HMCMetric.AUTO, save_inv_metric=True
+    )
+    assert np.all(out.inv_metric[0][off_diagonal] != 0)
+    np.testing.assert_allclose(out["x"].mean(axis=(0, 1)), 20, atol=0.5)
+
+
 def test_multiple_inits(multimodal_model, temp_json):
     # well-separated mixture of gaussians
     # same init for each chain
@@ -279,6 +405,51 @@ def test_bad_init(bernoulli_model):
         bernoulli_model.sample(BERNOULLI_DATA, num_chains=3, inits=inits)
 
 
+def test_isolated_chains(bernoulli_model):
+    good = {"theta": 0.2}
+    bad = {"theta": 2}  # out of bounds
+    inits = [good, bad, good]
+
+    out = bernoulli_model.sample(
+        BERNOULLI_DATA,
+        num_chains=3,
+        inits=inits,
+        num_warmup=100,
+        num_samples=100,
+        isolate_chains=True,
+    )
+    assert out.chain_errors is not None
+    assert out.chain_errors[0] is None
+    assert "Initialization failed" in out.chain_errors[1]
+    assert out.chain_errors[2] is None
+    assert np.all(np.isnan(out["theta"][1]))
+    assert np.isnan(out.stepsize[1])
+    assert 0.2 < out["theta"][[0, 2]].mean() < 0.3
+
+    # a restart begins from a random initialization instead
+    out = bernoulli_model.sample(
+        BERNOULLI_DATA,
+        num_chains=3,
+        inits=inits,
+        num_warmup=100,
+        num_samples=100,
+        isolate_chains=True,
+        max_chain_restarts=1,
+    )
+    assert out.chain_errors is None
+    assert not np.any(np.isnan(out["theta"]))
+
+    with pytest.raises(RuntimeError, match="2 of 2 chains failed"):
+        bernoulli_model.sample(
+            BERNOULLI_DATA, num_chains=2, inits=bad, isolate_chains=True
+        )
+
+    with pytest.raises(ValueError, match="non-negative"):
+        bernoulli_model.sample(
+            BERNOULLI_DATA, isolate_chains=True, max_chain_restarts=-1
+        )
+
+
 def test_bad_initial_metric_size(gaussian_model):
     data = {"N": 5}
 
@@ -346,6 +517,26 @@ def test_bad_num_warmup(bernoulli_model):
         bernoulli_model.sample(BERNOULLI_DATA, save_warmup=True, num_warmup=-1)
 
 
+def test_time_limit(bernoulli_model):
+    num_samples = 100_000
+    out = bernoulli_model.sample(
+        BERNOULLI_DATA, num_warmup=100, num_samples=num_samples, time_limit=0.05
+    )
+    assert out.draw_counts is not None
+    assert len(out.draw_counts) == 4
+    assert out.draw_counts.max() < num_samples
+    assert out["theta"].shape[1] == out.draw_counts.min()
+    # all of the returned draws were written by the sampler
+    assert np.all((out["theta"] > 0) & (out["theta"] < 1))
+
+    out = bernoulli_model.sample(BERNOULLI_DATA, time_limit=60)
+    assert out.draw_counts is None
+    assert out["theta"].shape[1] == 1000
+
+    with pytest.raises(ValueError, match="non-negative"):
+        bernoulli_model.sample(BERNOULLI_DATA, time_limit=-1)
+
+
 def test_model_no_params(empty_model):
     fit = empty_model.sample(save_inv_metric=True)
     assert len(fit.parameters) == 7  # just HMC parameters
@@ -0,0 +1,105 @@
+import numpy as np
+import pytest
+
+import tinystan
+from tests import BERNOULLI_DATA, bernoulli_model, empty_model, gaussian_model
+
+
+def test_data(bernoulli_model):
+    with bernoulli_model.sampler(BERNOULLI_DATA, num_chains=2) as sampler:
+        assert sampler.warmup(200) is None
+        out = sampler.draw(300)
+        assert out["theta"].shape == (2, 300)
+        assert 0.2 < out["theta"].mean() < 0.3
+
+
+def test_state_persists(bernoulli_model):
+    with bernoulli_model.sampler(BERNOULLI_DATA, num_chains=3, seed=4) as sampler:
+        np.testing.assert_equal(sampler.stepsize, 1.0)
+        np.testing.assert_equal(sampler.inv_metric, 1.0)
+        assert sampler.positions.shape == (3, 1)
+
+        sampler.warmup(150)
+        stepsize = sampler.stepsize
+        inv_metric = sampler.inv_metric
+        assert inv_metric.shape == (3, 1)
+        assert np.all(stepsize != 1.0)
+
+        first = sampler.draw(10)
+        np.testing.assert_equal(first["stepsize__"], stepsize[:, np.newaxis])
+        # the positions are those of the last draw
+        np.testing.assert_allclose(
+            sampler.positions[:, 0],
+            np.log(first["theta"][:, -1] / (1 - first["theta"][:, -1])),
+        )
+
+        second = sampler.draw(10)
+        np.testing.assert_equal(sampler.stepsize, stepsize)
+        np.testing.assert_equal(sampler.inv_metric, inv_metric)
+        assert not np.array_equal(first["theta"], second["theta"])
+
+
+def test_seed(bernoulli_model):
+    def run(num_threads):
+        with bernoulli_model.sampler(
+            BERNOULLI_DATA, seed=123, num_threads=num_threads
+        ) as sampler:
+            sampler.warmup(100, num_threads=num_threads)
+            return sampler.draw(50, num_threads=num_threads).data
+
+    np.testing.assert_equal(run(-1), run(1))
+
+
+def test_save_warmup(bernoulli_model):
+    with bernoulli_model.sampler(BERNOULLI_DATA, num_chains=2) as sampler:
+        out = sampler.warmup(40, save_warmup=True)
+        assert out["theta"].shape == (2, 40)
+
+
+@pytest.mark.parametrize(
+    "metric", [tinystan.HMCMetric.DENSE, tinystan.HMCMetric.LOW_RANK]
+)
+def test_metric(gaussian_model, metric):
+    data = {"N": 3}
+    with gaussian_model.sampler(data, metric=metric, metric_rank=2) as sampler:
+        sampler.warmup(300)
+        out = sampler.draw(200)
+        assert out["alpha"].shape == (4, 200, 3)
+        if metric == tinystan.HMCMetric.DENSE:
+            assert sampler.inv_metric.shape == (4, 3, 3)
+        else:
+            assert sampler.inv_metric.shape == (4, 3 * 3 + 2)
+
+
+def test_empty(empty_model):
+    with empty_model.sampler() as sampler:
+        sampler.warmup(10)
+        out = sampler.draw(10)
+        assert out.data.shape == (4, 10, 7)
+
+
+def test_closed(bernoulli_model):
+    sampler = bernoulli_model.sampler(BERNOULLI_DATA)
+    sampler.close()
+    sampler.close()
+    with pytest.raises(RuntimeError, match="closed"):
+        sampler.draw(10)
+
+
+def test_bad_args(bernoulli_model):
+    with pytest.raises(ValueError, match="num_chains"):
+        bernoulli_model.sampler(BERNOULLI_DATA, num_chains=0)
+    with pytest.raises(ValueError, match="delta"):
+        bernoulli_model.sampler(BERNOULLI_DATA, delta=2)
+    with pytest.raises(ValueError, match="threads"):
+        bernoulli_model.sampler(BERNOULLI_DATA, num_threads=0)
+    with pytest.raises(ValueError, match="metric size"):
+        bernoulli_model.sampler(BERNOULLI_DATA, init_inv_metric=np.ones(3))
+    with pytest.raises(RuntimeError, match="Initialization failed"):
+        bernoulli_model.sampler(BERNOULLI_DATA, inits={"theta": 2})
+
+    with bernoulli_model.sampler(BERNOULLI_DATA) as sampler:
+        with pytest.raises(ValueError, match="num_warmup"):
+            sampler.warmup(0)
+        with pytest.raises(ValueError, match="num_draws"):
+            sampler.draw(0)
@@ -0,0 +1,70 @@
+import numpy as np
+import pytest
+
+import tinystan
+from tests import BERNOULLI_DATA, bernoulli_model, multimodal_model
+
+
+def test_data(bernoulli_model):
+    out = bernoulli_model.tempered_sample(BERNOULLI_DATA, num_samples=500)
+    assert out["theta"].shape == (1, 500)
+    assert 0.2 < out["theta"].mean() < 0.3
+
+    assert out.temperatures.shape == (4,)
+    assert out.temperatures[0] == 1
+    assert np.all(np.diff(out.temperatures) > 0)
+    assert out.swap_rates.shape == (3,)
+    assert np.all((out.swap_rates >= 0) & (out.swap_rates <= 1))
+
+
+def test_fixed_temperatures(bernoulli_model):
+    out = bernoulli_model.tempered_sample(
+        BERNOULLI_DATA,
+        num_replicas=3,
+        max_temperature=4,
+        adapt_temperatures=False,
+        num_warmup=100,
+        num_samples=100,
+    )
+    np.testing.assert_allclose(out.temperatures, [1, 2, 4])
+
+
+def test_stepsize(bernoulli_model):
+    out = bernoulli_model.tempered_sample(
+        BERNOULLI_DATA, num_warmup=200, num_samples=100
+    )
+    assert out.stepsize.shape == (4,)
+    # the adapted step size is used for every draw after warmup
+    np.testing.assert_equal(out["stepsize__"], out.stepsize[0])
+
+
+def test_seed(bernoulli_model):
+    out1 = bernoulli_model.tempered_sample(
+        BERNOULLI_DATA, seed=123, num_warmup=100, num_samples=100
+    )
+    out2 = bernoulli_model.tempered_sample(
+        BERNOULLI_DATA, seed=123, num_warmup=100, num_samples=100, num_threads=1
+    )
+    np.testing.assert_equal(out1.data, out2.data)
+    np.testing.assert_equal(out1.swap_rates, out2.swap_rates)
+
+
+def test_multimodal(multimodal_model):
+    # NUTS started in one mode stays there, see test_sample.py
+    out = multimodal_model.tempered_sample(
+        inits={"mu": 100},
+        num_replicas=10,
+        max_temperature=1e4,
+        seed=1234,
+    )
+    upper = (out["mu"] > 0).mean()
+    assert 0.05 < upper < 0.95
+
+
+def test_bad_args(bernoulli_model):
+    with pytest.raises(ValueError, match="num_replicas"):
+        bernoulli_model.tempered_sample(BERNOULLI_DATA, num_replicas=1)
+    with pytest.raises(ValueError, match="max_temperature"):
+        bernoulli_model.tempered_sample(BERNOULLI_DATA, max_temperature=1)
+    with pytest.raises(ValueError, match="swap_interval"):
+        bernoulli_model.tempered_sample(BERNOULLI_DATA, swap_interval=0)
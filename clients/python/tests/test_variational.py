@@ -0,0 +1,101 @@
+import numpy as np
+import pytest
+
+import tinystan
+from tests import BERNOULLI_DATA, STAN_FOLDER, bernoulli_model, gaussian_model
+
+ALL_ALGORITHMS = [
+    tinystan.VariationalAlgorithm.MEANFIELD,
+    tinystan.VariationalAlgorithm.FULLRANK,
+]
+
+
+@pytest.mark.parametrize("algorithm", ALL_ALGORITHMS)
+def test_data(bernoulli_model, algorithm):
+    # data is a string
+    out1 = bernoulli_model.variational(BERNOULLI_DATA, algorithm=algorithm)
+    assert 0.2 < out1["theta"].mean() < 0.3
+
+    # data stored in a file
+    data_file = STAN_FOLDER / "bernoulli" / "bernoulli.data.json"
+    out2 = bernoulli_model.variational(data_file, algorithm=algorithm)
+    assert 0.2 < out2["theta"].mean() < 0.3
+
+
+def test_output_sizes(bernoulli_model):
+    out = bernoulli_model.variational(BERNOULLI_DATA, num_draws=234)
+    assert out["theta"].shape == (234,)
+    assert out["log_p__"].shape == (234,)
+    assert out["log_g__"].shape == (234,)
+    assert out.variational_mean.shape == (len(out.parameters),)
+    assert 0.2 < out.variational_mean[-1] < 0.3
+
+
+@pytest.mark.parametrize("algorithm", ALL_ALGORITHMS)
+def test_num_threads(gaussian_model, algorithm):
+    # gradient draws are evaluated in parallel, but the result does not depend
+    # on the thread count
+    data = {"N": 5}
+    out1 = gaussian_model.variational(
+        data, algorithm=algorithm, grad_samples=8, seed=123, num_threads=1
+    )
+    out2 = gaussian_model.variational(
+        data, algorithm=algorithm, grad_samples=8, seed=123, num_threads=4
+    )
+    np.testing.assert_equal(out1.data, out2.data)
+    np.testing.assert_equal(out1.variational_mean, out2.variational_mean)
+
+
+def test_seed(bernoulli_model):
+    out1 = bernoulli_model.variational(BERNOULLI_DATA, seed=123)
+    out2 = bernoulli_model.variational(BERNOULLI_DATA, seed=123)
+    np.testing.assert_equal(out1.data, out2.data)
+
+    out3 = bernoulli_model.variational(BERNOULLI_DATA, seed=456)
+    with pytest.raises(AssertionError):
+        np.testing.assert_equal(out1["theta"], out3["theta"])
+
+
+def test_fixed_eta(gaussian_model):
+    data = {"N": 3}
+    out = gaussian_model.variational(data, adapt_engaged=False, eta=0.1, seed=1)
+    np.testing.assert_allclose(out["alpha"].mean(axis=0), 0, atol=0.3)
+
+
+def test_bad_data(bernoulli_model):
+    data = {"N": -1}
+    with pytest.raises(RuntimeError, match="greater than or equal to 0"):
+        bernoulli_model.variational(data)
+
+    with pytest.raises(RuntimeError, match="Error in JSON parsing"):
+        bernoulli_model.variational(data="{'bad'}")
+
+
+def test_bad_init(bernoulli_model):
+    with pytest.raises(RuntimeError, match="Bounded variable is 2"):
+        bernoulli_model.variational(BERNOULLI_DATA, init={"theta": 2})
+
+
+@pytest.mark.parametrize(
+    "arg, value, match",
+    [
+        ("num_draws", 0, "at least 1"),
+        ("id", 0, "positive"),
+        ("init_radius", -0.1, "non-negative"),
+        ("grad_samples", 0, "positive"),
+        ("elbo_samples", 0, "positive"),
+        ("max_iterations", 0, "positive"),
+        ("tol_rel_obj", 0, "positive"),
+        ("eta", 0, "positive"),
+        ("adapt_iterations", 0, "positive"),
+        ("eval_elbo", 0, "positive"),
+    ],
+)
+def test_bad_argument(bernoulli_model, arg, value, match):
+    with pytest.raises(ValueError, match=match):
+        bernoulli_model.variational(BERNOULLI_DATA, **{arg: value})
+
+
+def test_time_limit(bernoulli_model):
+    with pytest.raises(TimeoutError):
+        bernoulli_model.variational(BERNOULLI_DATA, time_limit=1e-9)
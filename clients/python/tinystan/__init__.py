@@ -1,13 +1,22 @@
 from .__version import __version__ as __version__
 from .compile import compile_model, set_tinystan_path
-from .model import HMCMetric, Model, OptimizationAlgorithm
-from .output import StanOutput
+from .model import (
+    HMCMetric,
+    Model,
+    OptimizationAlgorithm,
+    Sampler,
+    VariationalAlgorithm,
+)
+from .output import LooOutput, StanOutput
 
 __all__ = [
     "Model",
+    "Sampler",
     "HMCMetric",
     "OptimizationAlgorithm",
+    "VariationalAlgorithm",
     "StanOutput",
+    "LooOutput",
     "compile_model",
     "set_tinystan_path",
 ]
@@ -1,9 +1,14 @@
+import contextlib
+import hashlib
 import os
 import platform
+import re
+import shutil
 import subprocess
+import tempfile
 import warnings
 from pathlib import Path
-from typing import List, Union
+from typing import Iterator, List, Optional, Union
 
 from .__version import __version__
 from .download import CURRENT_TINYSTAN, HOME_TINYSTAN, get_tinystan_src
@@ -13,6 +18,47 @@ IS_WINDOWS = platform.system() == "Windows"
 MAKE = os.getenv("MAKE", "make")
 WINDOWS_PATH_SET = False
 
+DEFAULT_CACHE = HOME_TINYSTAN / "cache"
+# environment variables which change the build, hashed even when the makefiles
+# which read them cannot be scanned (see _make_env_vars)
+CACHE_ENV_VARS = [
+    "CXX",
+    "CXXFLAGS",
+    "CPPFLAGS",
+    "LDFLAGS",
+    "LDLIBS",
+    "STANCFLAGS",
+    "O",
+    "STAN_THREADS",
+    "STAN_OPENCL",
+    "STAN_NO_RANGE_CHECKS",
+    "STAN_CPP_OPTIMS",
+    "PRECOMPILED_HEADERS",
+    "TINYSTAN_SERIAL",
+    "TINYSTAN_AD_HESSIAN",
+    "TINYSTAN_ALGORITHMS",
+    "TINYSTAN_WASM_THREADS",
+    "TINYSTAN_WASM_SIMD",
+]
+# variables the makefiles read which do not change the build, but which
+# differ between shells (e.g. PATH in a virtual environment)
+CACHE_IGNORED_ENV_VARS = {"PATH", "HOME", "PWD", "SHELL", "MAKEFLAGS", "MAKELEVEL"}
+# the makefiles which decide the build, relative to TinyStan
+MAKEFILES = [
+    "Makefile",
+    "make/local",
+    "stan/lib/stan_math/make/compiler_flags",
+    "stan/lib/stan_math/make/libraries",
+    "stan/lib/stan_math/make/dependencies",
+]
+INCLUDE_RE = re.compile(r'^\s*#include\s*[<"]?([^>"\s]+)[>"]?', re.MULTILINE)
+MAKE_VAR_RE = re.compile(
+    r"\$[({]([A-Za-z_]\w*)[)}]"  # $(NAME) or ${NAME}
+    r"|^\s*ifn?def\s+([A-Za-z_]\w*)"
+    r"|^\s*(?:override\s+|export\s+)?([A-Za-z_]\w*)\s*[:?+!]?=",
+    re.MULTILINE,
+)
+
 
 def verify_tinystan_path(path: str) -> None:
     folder = Path(path).resolve()
@@ -86,11 +132,209 @@ def generate_so_name(model: Path) -> Path:
     return model.with_stem(f"{name}_model").with_suffix(".so")
 
 
+def _resolve_cache(cache: Union[bool, str, os.PathLike, None]) -> Optional[Path]:
+    if cache is None:
+        env = os.getenv("TINYSTAN_CACHE", "")
+        return Path(env).expanduser() if env else None
+    if cache is True:
+        return DEFAULT_CACHE
+    if cache is False:
+        return None
+    return Path(cache).expanduser()
+
+
+def _include_dirs(stan_file: Path, stanc_args: List[str], tinystan: str) -> List[Path]:
+    """The folders stanc searches for includes, in order."""
+    dirs = [stan_file.parent]
+    for arg in stanc_args:
+        if arg.startswith("--include-paths="):
+            for folder in arg.split("=", 1)[1].split(","):
+                # relative paths are resolved where make runs
+                dirs.append(Path(tinystan, folder))
+    return dirs
+
+
+def _hash_stan_file(digest, path: Path, include_dirs: List[Path], seen: set) -> None:
+    """Hash a Stan file and the files it includes from ``include_dirs``."""
+    path = path.resolve()
+    if path in seen:
+        return
+    seen.add(path)
+    source = path.read_bytes()
+    digest.update(source)
+    for name in INCLUDE_RE.findall(source.decode("utf-8", errors="replace")):
+        for folder in include_dirs:
+            included = folder / name
+            if included.is_file():
+                _hash_stan_file(digest, included, include_dirs, seen)
+                break
+
+
+def _make_env_vars(tinystan: str) -> List[str]:
+    """
+    The environment variables which can change what TinyStan's Makefile
+    builds: those in :data:`CACHE_ENV_VARS` and every variable the makefiles
+    refer to, as make reads all of them from the environment.
+    """
+    names = set(CACHE_ENV_VARS)
+    for makefile in MAKEFILES:
+        path = Path(tinystan, makefile)
+        if path.is_file():
+            text = path.read_text(encoding="utf-8", errors="replace")
+            for match in MAKE_VAR_RE.finditer(text):
+                names.update(name for name in match.groups() if name)
+    return sorted(names - CACHE_IGNORED_ENV_VARS)
+
+
+def _stanc_path(make_args: List[str], tinystan: str) -> Path:
+    """The stanc binary used by TinyStan's Makefile."""
+    stanc = os.getenv("STANC", "")
+    for arg in make_args:
+        if arg.startswith("STANC="):
+            stanc = arg.split("=", 1)[1]
+    if stanc:
+        return Path(stanc)
+    return Path(tinystan, "bin", "stanc.exe" if IS_WINDOWS else "stanc")
+
+
+def cache_key(
+    stan_file: Path, stanc_args: List[str], make_args: List[str], tinystan: str
+) -> str:
+    """
+    Hash everything which decides the contents of a compiled model: the
+    Stan source (with the files it includes from its own folder and any
+    ``--include-paths``), the compiler arguments, any user header, the
+    TinyStan version, sources, and build settings (the makefiles and the
+    environment variables they read), the stanc binary, the Stan version,
+    and the platform.
+    """
+    digest = hashlib.sha256()
+
+    def add(value: Union[str, bytes]) -> None:
+        if isinstance(value, str):
+            value = value.encode("utf-8")
+        digest.update(len(value).to_bytes(8, "little"))
+        digest.update(value)
+
+    def add_file(path: Path) -> None:
+        add(path.read_bytes() if path.is_file() else b"")
+
+    add(__version__)
+    add(platform.system())
+    add(platform.machine())
+    _hash_stan_file(
+        digest, stan_file, _include_dirs(stan_file, stanc_args, tinystan), set()
+    )
+    add("\0".join(stanc_args))
+    add("\0".join(make_args))
+    for arg in make_args:
+        if arg.startswith("USER_HEADER="):
+            add_file(Path(arg.split("=", 1)[1]))
+    for name in _make_env_vars(tinystan):
+        if name in os.environ:
+            add(f"{name}={os.environ[name]}")
+    root = Path(tinystan)
+    for build_file in [
+        root / "Makefile",
+        root / "make" / "local",
+        root / "stan" / "src" / "stan" / "version.hpp",
+    ]:
+        add_file(build_file)
+    # a modified TinyStan checkout keeps its version number
+    for source in sorted((root / "src").glob("*")):
+        if source.suffix in (".cpp", ".h", ".hpp"):
+            add(source.name)
+            add_file(source)
+    # missing until the first build downloads it, which is then not reused
+    add_file(_stanc_path(make_args, tinystan))
+    return digest.hexdigest()
+
+
+@contextlib.contextmanager
+def _file_lock(path: Path) -> Iterator[None]:
+    """Hold an exclusive lock on ``path``, waiting for other processes."""
+    with open(path, "a+b") as f:
+        if IS_WINDOWS:
+            import msvcrt
+
+            while True:
+                try:
+                    f.seek(0)
+                    # blocks for up to 10 seconds before raising
+                    msvcrt.locking(f.fileno(), msvcrt.LK_LOCK, 1)
+                    break
+                except OSError:
+                    continue
+            try:
+                yield
+            finally:
+                f.seek(0)
+                msvcrt.locking(f.fileno(), msvcrt.LK_UNLCK, 1)
+        else:
+            import fcntl
+
+            fcntl.flock(f, fcntl.LOCK_EX)
+            try:
+                yield
+            finally:
+                fcntl.flock(f, fcntl.LOCK_UN)
+
+
+def _run_make(output: Path, stanc_args: List[str], make_args: List[str]) -> None:
+    cmd = (
+        [MAKE]
+        + make_args
+        + ["STANCFLAGS=" + " ".join(["--include-paths=."] + stanc_args)]
+        + [os.fspath(output)]
+    )
+    proc = subprocess.run(
+        cmd, cwd=get_tinystan_path(), capture_output=True, text=True, check=False
+    )
+
+    if proc.returncode:
+        error = (
+            f"Command {' '.join(cmd)} failed with code {proc.returncode}.\n"
+            f"stdout:\n{proc.stdout}\nstderr:\n{proc.stderr}"
+        )
+
+        raise RuntimeError(error)
+
+
+def _compile_cached(
+    file_path: Path, stanc_args: List[str], make_args: List[str], cache_dir: Path
+) -> Path:
+    key = cache_key(file_path, stanc_args, make_args, get_tinystan_path())
+    entry = cache_dir / key[:32]
+    output = generate_so_name(entry / file_path.name)
+    if output.exists():
+        return output
+
+    cache_dir.mkdir(parents=True, exist_ok=True)
+    with _file_lock(cache_dir / f"{key[:32]}.lock"):
+        # another process may have finished the build while we waited
+        if output.exists():
+            return output
+
+        build_dir = Path(tempfile.mkdtemp(prefix=f"{key[:32]}-", dir=cache_dir))
+        try:
+            stan_copy = build_dir / file_path.name
+            shutil.copyfile(file_path, stan_copy)
+            # includes are still found next to the original file
+            include_args = [f"--include-paths={file_path.parent}"]
+            _run_make(generate_so_name(stan_copy), include_args + stanc_args, make_args)
+            entry.mkdir(exist_ok=True)
+            os.replace(generate_so_name(stan_copy), output)
+        finally:
+            shutil.rmtree(build_dir, ignore_errors=True)
+    return output
+
+
 def compile_model(
     stan_file: Union[str, os.PathLike],
     *,
     stanc_args: List[str] = [],
     make_args: List[str] = [],
+    cache: Union[bool, str, os.PathLike, None] = None,
 ) -> Path:
     """
     Run TinyStan's Makefile on a ``.stan`` file, creating the ``.so``
@@ -111,6 +355,17 @@ def compile_model(
         A list of additional arguments to pass to Make.
         If the same flags are defined in :file:`make/local`, the versions
         passed here will take precedent.
+    cache : Union[bool, str, os.PathLike, None], optional
+        Where to cache the compiled model. If given, the ``.so`` is stored
+        in this folder (or in :file:`~/.tinystan/cache` if ``True``) under a
+        hash of the Stan source and its includes, the arguments above, the
+        TinyStan sources, the environment variables its makefiles read, the
+        stanc binary, and the TinyStan and Stan versions, so that any
+        process compiling the same
+        model can reuse it. Processes compiling the same model at once wait
+        for a single build. By default, the folder in the ``TINYSTAN_CACHE``
+        environment variable is used if it is set, and otherwise the model
+        is compiled next to ``stan_file`` as usual.
 
     Raises
     ------
@@ -133,24 +388,12 @@ def compile_model(
     if file_path.suffix != ".stan":
         raise ValueError(f"File '{stan_file}' does not end in .stan")
 
-    output = generate_so_name(file_path)
-    cmd = (
-        [MAKE]
-        + make_args
-        + ["STANCFLAGS=" + " ".join(["--include-paths=."] + stanc_args)]
-        + [os.fspath(output)]
-    )
-    proc = subprocess.run(
-        cmd, cwd=get_tinystan_path(), capture_output=True, text=True, check=False
-    )
+    cache_dir = _resolve_cache(cache)
+    if cache_dir is not None:
+        return os.fspath(_compile_cached(file_path, stanc_args, make_args, cache_dir))
 
-    if proc.returncode:
-        error = (
-            f"Command {' '.join(cmd)} failed with code {proc.returncode}.\n"
-            f"stdout:\n{proc.stdout}\nstderr:\n{proc.stderr}"
-        )
-
-        raise RuntimeError(error)
+    output = generate_so_name(file_path)
+    _run_make(output, stanc_args, make_args)
     return os.fspath(output)
 
 
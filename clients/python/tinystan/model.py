@@ -10,10 +10,11 @@ import dllist
 import numpy as np
 from numpy.ctypeslib import ndpointer
 from stanio import dump_stan_json
+from stanio.reshape import Variable, VariableType
 
 from .__version import __version_info__
 from .compile import compile_model, windows_dll_path_setup
-from .output import StanOutput
+from .output import LooOutput, StanOutput
 from .util import validate_readable
 
 # type aliases
@@ -38,6 +39,8 @@ def wrapped_ndptr(*args, **kwargs):
 
 double_array = ndpointer(dtype=ctypes.c_double, flags=("C_CONTIGUOUS"))
 nullable_double_array = wrapped_ndptr(dtype=ctypes.c_double, flags=("C_CONTIGUOUS"))
+nullable_size_array = wrapped_ndptr(dtype=ctypes.c_size_t, flags=("C_CONTIGUOUS"))
+int_array = ndpointer(dtype=ctypes.c_int, flags=("C_CONTIGUOUS"))
 err_ptr = ctypes.POINTER(ctypes.c_void_p)
 print_callback_type = ctypes.CFUNCTYPE(
     None, ctypes.POINTER(ctypes.c_char), ctypes.c_size_t, ctypes.c_bool
@@ -70,6 +73,8 @@ OPTIMIZE_VARIABLES = ["lp__", "converged__"]
 
 LAPLACE_VARIABLES = ["log_p__", "log_q__"]
 
+VARIATIONAL_VARIABLES = ["lp__", "log_p__", "log_g__"]
+
 FIXED_SAMPLER_VARIABLES = ["lp__", "accept_stat__"]
 
 
@@ -79,6 +84,8 @@ class HMCMetric(Enum):
     UNIT = 0  #: :meta hide-value:
     DENSE = 1  #: :meta hide-value:
     DIAGONAL = 2  #: :meta hide-value:
+    LOW_RANK = 3  #: :meta hide-value:
+    AUTO = 4  #: :meta hide-value:
 
 
 class OptimizationAlgorithm(Enum):
@@ -89,7 +96,34 @@ class OptimizationAlgorithm(Enum):
     LBFGS = 2  #: :meta hide-value:
 
 
-_exception_types = [RuntimeError, ValueError, KeyboardInterrupt]
+class VariationalAlgorithm(Enum):
+    """Choices for the variational family used by ADVI."""
+
+    MEANFIELD = 0  #: :meta hide-value:
+    FULLRANK = 1  #: :meta hide-value:
+
+
+def _metric_shape(metric, num_params, metric_rank):
+    """Shape of one chain's inverse metric."""
+    if metric in (HMCMetric.DENSE, HMCMetric.AUTO):
+        return (num_params, num_params)
+    if metric == HMCMetric.LOW_RANK:
+        # variances, then the eigenvectors (column-major), then eigenvalues
+        rank = min(metric_rank, num_params)
+        return (num_params * (rank + 1) + rank,)
+    return (num_params,)
+
+
+_exception_types = [
+    RuntimeError,
+    ValueError,
+    KeyboardInterrupt,
+    TimeoutError,
+    MemoryError,
+    RuntimeError,
+]
+_TIMEOUT = 3
+_PARTIAL = 5
 
 
 # TODO also allow inits from a StanOutput?
@@ -135,8 +169,18 @@ class Model:
         model: Union[str, PathLike],
         *,
         capture_stan_prints: bool = True,
+        model_output: bool = True,
+        message_batch_ms: int = 0,
+        message_queue_size: int = 1024,
+        drop_messages: bool = False,
+        tag_messages: bool = False,
+        release_memory: bool = False,
+        memory_limit: Optional[int] = None,
+        init_candidates: int = 0,
+        select_best_init: bool = False,
         stanc_args: List[str] = [],
         make_args: List[str] = [],
+        cache: Union[bool, str, PathLike, None] = None,
         warn: bool = True,
     ):
         """
@@ -155,12 +199,62 @@ class Model:
             will disable bounds checking in the Stan Math library. If the
             same flags are defined in ``make/local``, the versions passed here
             will take precedent.
+        cache : Union[bool, str, PathLike, None], optional
+            Where to cache the compiled model, if it is compiled. See
+            :func:`compile_model`.
         capture_stan_prints : bool, optional
             If ``True``, capture all ``print`` statements and output
             from Stan and print them from Python. This may have
             a performance impact. If ``False``, ``print`` statements
             from Stan will be sent to ``cout`` and will not be seen in
             Jupyter or capturable with :func:`contextlib.redirect_stdout`.
+        model_output : bool, optional
+            If ``False``, TinyStan's own algorithms (Laplace sampling and
+            reading initial values) skip the output of ``print`` statements
+            in the model, which also saves formatting it in every log
+            density evaluation. During Stan's samplers and optimizers, this
+            output is delivered with their progress messages, and is
+            silenced with ``refresh=0``. By default True.
+        message_batch_ms : int, optional
+            If positive, progress messages from the algorithms are queued
+            and delivered together every ``message_batch_ms`` milliseconds
+            (and at the end of each run), rather than one at a time by the
+            thread which produced them. With many chains and a small
+            ``refresh``, this avoids serializing the chains on the
+            interpreter lock. By default 0 (no batching).
+        message_queue_size : int, optional
+            Number of messages which can wait for delivery when batching,
+            by default 1024.
+        drop_messages : bool, optional
+            If ``True``, messages produced while the queue is full are
+            discarded (and the number discarded is reported) instead of
+            being delivered immediately. By default False.
+        tag_messages : bool, optional
+            If ``True``, batched messages are prefixed with the chain which
+            produced them (where known) and the seconds since the start of
+            the call, e.g. ``[chain 2, 1.250s]``. By default False.
+        release_memory : bool, optional
+            If ``True``, the autodiff memory Stan keeps between gradient
+            evaluations is freed at the end of each algorithm call, and
+            free heap memory is returned to the operating system where
+            possible. By default False.
+        memory_limit : int, optional
+            If given, algorithms raise a :class:`MemoryError` once the
+            resident memory of the process exceeds this many bytes. It is
+            checked once per iteration, so it is a soft limit. Memory used
+            by other calls running at the same time counts towards it.
+        init_candidates : int, optional
+            If positive, every algorithm first evaluates this many random
+            initializations for each chain (or path, or optimizer start) in
+            parallel, and starts each chain from a valid one, instead of
+            retrying one at a time until the log density is finite. Values
+            given in ``inits`` are kept, and only the missing parameters are
+            drawn. See :meth:`last_call_init_screening`. By default 0 (no
+            screening).
+        select_best_init : bool, optional
+            With ``init_candidates``, start each chain from its candidate
+            with the highest log density rather than the first valid one.
+            By default False.
         warn : bool, optional
             If ``False``, the warning about re-loading the same shared object
             is suppressed.
@@ -168,7 +262,9 @@ class Model:
         model = fspath(model)
         if model.endswith(".stan"):
             self.lib_path = fspath(
-                compile_model(model, stanc_args=stanc_args, make_args=make_args)
+                compile_model(
+                    model, stanc_args=stanc_args, make_args=make_args, cache=cache
+                )
             )
         else:
             self.lib_path = model
@@ -176,6 +272,23 @@ class Model:
         windows_dll_path_setup()
 
         self.capture_stan_prints = capture_stan_prints
+        self.model_output = model_output
+        if message_batch_ms < 0:
+            raise ValueError("message_batch_ms must be non-negative")
+        if message_queue_size < 1:
+            raise ValueError("message_queue_size must be positive")
+        self.message_batch_ms = message_batch_ms
+        self.message_queue_size = message_queue_size
+        self.drop_messages = drop_messages
+        self.tag_messages = tag_messages
+        if memory_limit is not None and memory_limit < 1:
+            raise ValueError("memory_limit must be positive")
+        self.release_memory = release_memory
+        self.memory_limit = memory_limit
+        if init_candidates < 0:
+            raise ValueError("init_candidates must be non-negative")
+        self.init_candidates = init_candidates
+        self.select_best_init = select_best_init
         if warn and hasattr(dllist, "dllist") and self.lib_path in dllist.dllist():
             warnings.warn(
                 f"Loading a shared object {self.lib_path} that has already been loaded.\n"
@@ -228,6 +341,122 @@ class Model:
         self._num_free_params.restype = ctypes.c_size_t
         self._num_free_params.argtypes = [ctypes.c_void_p]
 
+        self._num_variables = self._lib.tinystan_model_num_variables
+        self._num_variables.restype = ctypes.c_size_t
+        self._num_variables.argtypes = [ctypes.c_void_p]
+
+        self._get_variable = self._lib.tinystan_model_variable
+        self._get_variable.restype = ctypes.c_int
+        self._get_variable.argtypes = [
+            ctypes.c_void_p,  # model
+            ctypes.c_size_t,  # index
+            ctypes.POINTER(ctypes.c_char_p),  # name
+            ctypes.POINTER(ctypes.c_int),  # really enum for block
+            ctypes.POINTER(ctypes.POINTER(ctypes.c_size_t)),  # dims
+            ctypes.POINTER(ctypes.c_size_t),  # num_dims
+            ctypes.POINTER(ctypes.c_bool),  # is_complex
+            ctypes.POINTER(ctypes.c_size_t),  # offset
+            ctypes.POINTER(ctypes.c_size_t),  # length
+            err_ptr,
+        ]
+
+        self._set_message_batching = self._lib.tinystan_model_set_message_batching
+        self._set_message_batching.restype = ctypes.c_int
+        self._set_message_batching.argtypes = [
+            ctypes.c_void_p,  # model
+            ctypes.c_int,  # flush_interval_ms
+            ctypes.c_size_t,  # capacity
+            ctypes.c_bool,  # drop_when_full
+            err_ptr,
+        ]
+
+        self._set_message_tags = self._lib.tinystan_model_set_message_tags
+        self._set_message_tags.restype = None
+        self._set_message_tags.argtypes = [ctypes.c_void_p, ctypes.c_bool]
+
+        self._set_model_output = self._lib.tinystan_model_set_model_output
+        self._set_model_output.restype = None
+        self._set_model_output.argtypes = [ctypes.c_void_p, ctypes.c_bool]
+
+        self._set_memory_options = self._lib.tinystan_model_set_memory_options
+        self._set_memory_options.restype = None
+        self._set_memory_options.argtypes = [
+            ctypes.c_void_p,  # model
+            ctypes.c_bool,  # release_memory
+            ctypes.c_size_t,  # memory_limit
+        ]
+
+        self._create_call_options = self._lib.tinystan_create_call_options
+        self._create_call_options.restype = ctypes.c_void_p
+        self._create_call_options.argtypes = []
+
+        self._destroy_call_options = self._lib.tinystan_destroy_call_options
+        self._destroy_call_options.restype = None
+        self._destroy_call_options.argtypes = [ctypes.c_void_p]
+
+        self._set_time_limit = self._lib.tinystan_call_options_set_time_limit
+        self._set_time_limit.restype = ctypes.c_int
+        self._set_time_limit.argtypes = [
+            ctypes.c_void_p,  # options
+            ctypes.c_double,  # seconds
+            err_ptr,
+        ]
+
+        self._set_metric_rank = self._lib.tinystan_call_options_set_metric_rank
+        self._set_metric_rank.restype = ctypes.c_int
+        self._set_metric_rank.argtypes = [
+            ctypes.c_void_p,  # options
+            ctypes.c_size_t,  # rank
+            err_ptr,
+        ]
+
+        self._set_chain_isolation = (
+            self._lib.tinystan_call_options_set_chain_isolation
+        )
+        self._set_chain_isolation.restype = ctypes.c_int
+        self._set_chain_isolation.argtypes = [
+            ctypes.c_void_p,  # options
+            ctypes.c_bool,  # isolate
+            ctypes.c_int,  # max_restarts
+            err_ptr,
+        ]
+
+        self._set_pathfinder_streaming = (
+            self._lib.tinystan_call_options_set_pathfinder_streaming
+        )
+        self._set_pathfinder_streaming.restype = None
+        self._set_pathfinder_streaming.argtypes = [
+            ctypes.c_void_p,  # options
+            ctypes.c_bool,  # streaming
+        ]
+
+        self._set_init_screening = (
+            self._lib.tinystan_call_options_set_init_screening
+        )
+        self._set_init_screening.restype = None
+        self._set_init_screening.argtypes = [
+            ctypes.c_void_p,  # options
+            ctypes.c_size_t,  # num_candidates
+            ctypes.c_bool,  # select_best
+        ]
+
+        self._last_call_init_screening = (
+            self._lib.tinystan_last_call_init_screening
+        )
+        self._last_call_init_screening.restype = None
+        self._last_call_init_screening.argtypes = [
+            ctypes.POINTER(ctypes.c_size_t),
+            ctypes.POINTER(ctypes.c_size_t),
+        ]
+
+        self._last_call_memory = self._lib.tinystan_last_call_memory
+        self._last_call_memory.restype = None
+        self._last_call_memory.argtypes = [
+            ctypes.POINTER(ctypes.c_size_t),
+            ctypes.POINTER(ctypes.c_size_t),
+            ctypes.POINTER(ctypes.c_size_t),
+        ]
+
         self._num_req_constrained_params = (
             self._lib.tinystan_model_num_constrained_params_for_unconstraining
         )
@@ -242,10 +471,15 @@ class Model:
             ctypes.POINTER(ctypes.c_int),
         ]
 
-        self._ffi_sample = self._lib.tinystan_sample
+        self._algorithm_available = self._lib.tinystan_algorithm_available
+        self._algorithm_available.restype = ctypes.c_bool
+        self._algorithm_available.argtypes = [ctypes.c_char_p]
+
+        self._ffi_sample = self._lib.tinystan_sample_with_options
         self._ffi_sample.restype = ctypes.c_int
         self._ffi_sample.argtypes = [
             ctypes.c_void_p,  # model
+            ctypes.c_void_p,  # options
             ctypes.c_size_t,  # num_chains
             ctypes.c_char_p,  # inits
             ctypes.c_uint,  # seed
@@ -277,10 +511,152 @@ class Model:
             err_ptr,
         ]
 
-        self._ffi_pathfinder = self._lib.tinystan_pathfinder
+        self._ffi_pooled_sample = self._lib.tinystan_pooled_sample
+        self._ffi_pooled_sample.restype = ctypes.c_int
+        self._ffi_pooled_sample.argtypes = [
+            ctypes.c_void_p,  # model
+            ctypes.c_void_p,  # options
+            ctypes.c_size_t,  # num_chains
+            ctypes.c_char_p,  # inits
+            ctypes.c_uint,  # seed
+            ctypes.c_uint,  # id
+            ctypes.c_double,  # init_radius
+            ctypes.c_int,  # num_warmup
+            ctypes.c_int,  # num_samples
+            ctypes.c_int,  # really enum for metric
+            nullable_double_array,  # metric init in
+            # adaptation
+            ctypes.c_double,  # delta
+            ctypes.c_double,  # gamma
+            ctypes.c_double,  # kappa
+            ctypes.c_double,  # t0
+            ctypes.c_uint,  # init_buffer
+            ctypes.c_uint,  # term_buffer
+            ctypes.c_uint,  # window
+            ctypes.c_double,  # rhat_threshold
+            ctypes.c_bool,  # save_warmup
+            ctypes.c_double,  # stepsize
+            ctypes.c_double,  # stepsize_jitter
+            ctypes.c_int,  # max_depth
+            ctypes.c_int,  # refresh
+            ctypes.c_int,  # num_threads
+            double_array,
+            ctypes.c_size_t,  # buffer size
+            nullable_double_array,  # stepsize out
+            nullable_double_array,  # metric out
+            ctypes.POINTER(ctypes.c_int),  # num_warmup out
+            err_ptr,
+        ]
+
+        self._ffi_tempered_sample = self._lib.tinystan_tempered_sample
+        self._ffi_tempered_sample.restype = ctypes.c_int
+        self._ffi_tempered_sample.argtypes = [
+            ctypes.c_void_p,  # model
+            ctypes.c_void_p,  # options
+            ctypes.c_size_t,  # num_replicas
+            ctypes.c_char_p,  # inits
+            ctypes.c_uint,  # seed
+            ctypes.c_uint,  # id
+            ctypes.c_double,  # init_radius
+            ctypes.c_int,  # num_warmup
+            ctypes.c_int,  # num_samples
+            ctypes.c_int,  # really enum for metric
+            ctypes.c_double,  # max_temperature
+            ctypes.c_bool,  # adapt_temperatures
+            ctypes.c_int,  # swap_interval
+            # adaptation
+            ctypes.c_double,  # delta
+            ctypes.c_double,  # gamma
+            ctypes.c_double,  # kappa
+            ctypes.c_double,  # t0
+            ctypes.c_uint,  # init_buffer
+            ctypes.c_uint,  # term_buffer
+            ctypes.c_uint,  # window
+            ctypes.c_bool,  # save_warmup
+            ctypes.c_double,  # stepsize
+            ctypes.c_double,  # stepsize_jitter
+            ctypes.c_int,  # max_depth
+            ctypes.c_int,  # refresh
+            ctypes.c_int,  # num_threads
+            double_array,
+            ctypes.c_size_t,  # buffer size
+            nullable_double_array,  # stepsize out
+            nullable_double_array,  # temperatures out
+            nullable_double_array,  # swap rates out
+            err_ptr,
+        ]
+
+        self._ffi_sampler_create = self._lib.tinystan_sampler_create
+        self._ffi_sampler_create.restype = ctypes.c_void_p
+        self._ffi_sampler_create.argtypes = [
+            ctypes.c_void_p,  # model
+            ctypes.c_void_p,  # options
+            ctypes.c_size_t,  # num_chains
+            ctypes.c_char_p,  # inits
+            ctypes.c_uint,  # seed
+            ctypes.c_uint,  # id
+            ctypes.c_double,  # init_radius
+            ctypes.c_int,  # really enum for metric
+            nullable_double_array,  # metric
+            # adaptation
+            ctypes.c_double,  # delta
+            ctypes.c_double,  # gamma
+            ctypes.c_double,  # kappa
+            ctypes.c_double,  # t0
+            ctypes.c_double,  # stepsize
+            ctypes.c_double,  # stepsize_jitter
+            ctypes.c_int,  # max_depth
+            ctypes.c_int,  # num_threads
+            err_ptr,
+        ]
+
+        self._ffi_sampler_warmup = self._lib.tinystan_sampler_warmup
+        self._ffi_sampler_warmup.restype = ctypes.c_int
+        self._ffi_sampler_warmup.argtypes = [
+            ctypes.c_void_p,  # sampler
+            ctypes.c_void_p,  # options
+            ctypes.c_int,  # num_warmup
+            ctypes.c_uint,  # init_buffer
+            ctypes.c_uint,  # term_buffer
+            ctypes.c_uint,  # window
+            ctypes.c_int,  # refresh
+            ctypes.c_int,  # num_threads
+            nullable_double_array,
+            ctypes.c_size_t,  # buffer size
+            err_ptr,
+        ]
+
+        self._ffi_sampler_draw = self._lib.tinystan_sampler_draw
+        self._ffi_sampler_draw.restype = ctypes.c_int
+        self._ffi_sampler_draw.argtypes = [
+            ctypes.c_void_p,  # sampler
+            ctypes.c_void_p,  # options
+            ctypes.c_int,  # num_draws
+            ctypes.c_int,  # refresh
+            ctypes.c_int,  # num_threads
+            double_array,
+            ctypes.c_size_t,  # buffer size
+            err_ptr,
+        ]
+
+        self._ffi_sampler_state = self._lib.tinystan_sampler_state
+        self._ffi_sampler_state.restype = None
+        self._ffi_sampler_state.argtypes = [
+            ctypes.c_void_p,  # sampler
+            nullable_double_array,  # positions
+            nullable_double_array,  # stepsizes
+            nullable_double_array,  # inv_metrics
+        ]
+
+        self._ffi_sampler_destroy = self._lib.tinystan_sampler_destroy
+        self._ffi_sampler_destroy.restype = None
+        self._ffi_sampler_destroy.argtypes = [ctypes.c_void_p]
+
+        self._ffi_pathfinder = self._lib.tinystan_pathfinder_with_options
         self._ffi_pathfinder.restype = ctypes.c_int
         self._ffi_pathfinder.argtypes = [
             ctypes.c_void_p,  # model
+            ctypes.c_void_p,  # options
             ctypes.c_size_t,  # num_paths
             ctypes.c_char_p,  # inits
             ctypes.c_uint,  # seed
@@ -306,10 +682,85 @@ class Model:
             err_ptr,
         ]
 
-        self._ffi_optimize = self._lib.tinystan_optimize
+        self._ffi_pathfinder_sample = self._lib.tinystan_pathfinder_sample
+        self._ffi_pathfinder_sample.restype = ctypes.c_int
+        self._ffi_pathfinder_sample.argtypes = [
+            ctypes.c_void_p,  # model
+            ctypes.c_void_p,  # options
+            ctypes.c_size_t,  # num_chains
+            ctypes.c_size_t,  # num_paths
+            ctypes.c_char_p,  # inits
+            ctypes.c_uint,  # seed
+            ctypes.c_uint,  # id
+            ctypes.c_double,  # init_radius
+            # pathfinder
+            ctypes.c_int,  # num_draws
+            ctypes.c_int,  # max_history_size
+            ctypes.c_double,  # init_alpha
+            ctypes.c_double,  # tol_obj
+            ctypes.c_double,  # tol_rel_obj
+            ctypes.c_double,  # tol_grad
+            ctypes.c_double,  # tol_rel_grad
+            ctypes.c_double,  # tol_param
+            ctypes.c_int,  # num_iterations
+            ctypes.c_int,  # num_elbo_draws
+            ctypes.c_int,  # num_multi_draws
+            # sampler
+            ctypes.c_int,  # num_warmup
+            ctypes.c_int,  # num_samples
+            ctypes.c_int,  # really enum for metric
+            ctypes.c_double,  # delta
+            ctypes.c_double,  # gamma
+            ctypes.c_double,  # kappa
+            ctypes.c_double,  # t0
+            ctypes.c_uint,  # init_buffer
+            ctypes.c_uint,  # term_buffer
+            ctypes.c_uint,  # window
+            ctypes.c_bool,  # save_warmup
+            ctypes.c_double,  # stepsize
+            ctypes.c_double,  # stepsize_jitter
+            ctypes.c_int,  # max_depth
+            ctypes.c_int,  # refresh
+            ctypes.c_int,  # num_threads
+            double_array,
+            ctypes.c_size_t,  # buffer size
+            nullable_double_array,  # stepsize out
+            nullable_double_array,  # metric out
+            err_ptr,
+        ]
+
+        self._ffi_optimize = self._lib.tinystan_optimize_with_options
         self._ffi_optimize.restype = ctypes.c_int
         self._ffi_optimize.argtypes = [
             ctypes.c_void_p,  # model
+            ctypes.c_void_p,  # options
+            ctypes.c_char_p,  # inits
+            ctypes.c_uint,  # seed
+            ctypes.c_uint,  # id
+            ctypes.c_double,  # init_radius
+            ctypes.c_int,  # really enum for algorithm
+            ctypes.c_int,  # num_iterations
+            ctypes.c_bool,  # jacobian
+            ctypes.c_int,  # max_history_size
+            ctypes.c_double,  # init_alpha
+            ctypes.c_double,  # tol_obj
+            ctypes.c_double,  # tol_rel_obj
+            ctypes.c_double,  # tol_grad
+            ctypes.c_double,  # tol_rel_grad
+            ctypes.c_double,  # tol_param
+            ctypes.c_int,  # refresh
+            ctypes.c_int,  # num_threads
+            double_array,
+            ctypes.c_size_t,  # buffer size
+            err_ptr,
+        ]
+
+        self._ffi_optimize_multi = self._lib.tinystan_optimize_multi
+        self._ffi_optimize_multi.restype = ctypes.c_int
+        self._ffi_optimize_multi.argtypes = [
+            ctypes.c_void_p,  # model
+            ctypes.c_void_p,  # options
+            ctypes.c_size_t,  # num_starts
             ctypes.c_char_p,  # inits
             ctypes.c_uint,  # seed
             ctypes.c_uint,  # id
@@ -324,17 +775,21 @@ class Model:
             ctypes.c_double,  # tol_grad
             ctypes.c_double,  # tol_rel_grad
             ctypes.c_double,  # tol_param
+            ctypes.c_double,  # dedupe_tol
             ctypes.c_int,  # refresh
             ctypes.c_int,  # num_threads
             double_array,
             ctypes.c_size_t,  # buffer size
+            int_array,  # return codes out
+            ctypes.POINTER(ctypes.c_size_t),  # num_modes out
             err_ptr,
         ]
 
-        self._ffi_laplace = self._lib.tinystan_laplace_sample
+        self._ffi_laplace = self._lib.tinystan_laplace_sample_with_hessian
         self._ffi_laplace.restype = ctypes.c_int
         self._ffi_laplace.argtypes = [
             ctypes.c_void_p,  # model
+            ctypes.c_void_p,  # options
             nullable_double_array,  # array of constrained params
             ctypes.c_char_p,  # json of constrained params
             ctypes.c_uint,  # seed
@@ -345,16 +800,102 @@ class Model:
             ctypes.c_int,  # num_threads
             double_array,  # draws buffer
             ctypes.c_size_t,  # buffer size
+            nullable_double_array,  # hessian in
+            nullable_double_array,  # hessian out
+            err_ptr,
+        ]
+
+        self._ffi_optimize_laplace = self._lib.tinystan_optimize_laplace
+        self._ffi_optimize_laplace.restype = ctypes.c_int
+        self._ffi_optimize_laplace.argtypes = [
+            ctypes.c_void_p,  # model
+            ctypes.c_void_p,  # options
+            ctypes.c_char_p,  # inits
+            ctypes.c_uint,  # seed
+            ctypes.c_uint,  # id
+            ctypes.c_double,  # init_radius
+            ctypes.c_int,  # really enum for algorithm
+            ctypes.c_int,  # num_iterations
+            ctypes.c_bool,  # jacobian
+            ctypes.c_int,  # max_history_size
+            ctypes.c_double,  # init_alpha
+            ctypes.c_double,  # tol_obj
+            ctypes.c_double,  # tol_rel_obj
+            ctypes.c_double,  # tol_grad
+            ctypes.c_double,  # tol_rel_grad
+            ctypes.c_double,  # tol_param
+            ctypes.c_int,  # draws
+            ctypes.c_bool,  # calculate_lp
+            ctypes.c_int,  # refresh
+            ctypes.c_int,  # num_threads
+            double_array,  # mode buffer
+            ctypes.c_size_t,  # mode buffer size
+            double_array,  # draws buffer
+            ctypes.c_size_t,  # buffer size
             nullable_double_array,  # hessian out
             err_ptr,
         ]
 
+        self._ffi_variational = self._lib.tinystan_variational
+        self._ffi_variational.restype = ctypes.c_int
+        self._ffi_variational.argtypes = [
+            ctypes.c_void_p,  # model
+            ctypes.c_void_p,  # options
+            ctypes.c_int,  # really enum for algorithm
+            ctypes.c_char_p,  # init
+            ctypes.c_uint,  # seed
+            ctypes.c_uint,  # id
+            ctypes.c_double,  # init_radius
+            ctypes.c_int,  # num_draws
+            ctypes.c_int,  # grad_samples
+            ctypes.c_int,  # elbo_samples
+            ctypes.c_int,  # max_iterations
+            ctypes.c_double,  # tol_rel_obj
+            ctypes.c_double,  # eta
+            ctypes.c_bool,  # adapt_engaged
+            ctypes.c_int,  # adapt_iterations
+            ctypes.c_int,  # eval_elbo
+            ctypes.c_int,  # refresh
+            ctypes.c_int,  # num_threads
+            double_array,
+            ctypes.c_size_t,
+            err_ptr,
+        ]
+
+        self._ffi_loo = self._lib.tinystan_loo
+        self._ffi_loo.restype = ctypes.c_int
+        self._ffi_loo.argtypes = [
+            ctypes.c_void_p,  # model
+            ctypes.c_void_p,  # options
+            ctypes.c_char_p,  # variable
+            double_array,  # draws
+            ctypes.c_size_t,  # num_draws
+            ctypes.c_size_t,  # stride
+            ctypes.c_uint,  # seed
+            ctypes.c_int,  # num_threads
+            ctypes.POINTER(ctypes.c_double),  # elpd_loo
+            ctypes.POINTER(ctypes.c_double),  # se_elpd_loo
+            ctypes.POINTER(ctypes.c_double),  # p_loo
+            nullable_double_array,  # pointwise_elpd
+            nullable_double_array,  # pareto_k
+            err_ptr,
+        ]
+
         self._get_error_msg = self._lib.tinystan_get_error_message
         self._get_error_msg.restype = ctypes.c_char_p
         self._get_error_msg.argtypes = [ctypes.c_void_p]
         self._get_error_type = self._lib.tinystan_get_error_type
         self._get_error_type.restype = ctypes.c_int  # really enum
         self._get_error_type.argtypes = [ctypes.c_void_p]
+        self._get_error_draw_counts = self._lib.tinystan_get_error_draw_counts
+        self._get_error_draw_counts.restype = ctypes.c_size_t
+        self._get_error_draw_counts.argtypes = [ctypes.c_void_p, nullable_size_array]
+        self._get_error_chain_errors = self._lib.tinystan_get_error_chain_errors
+        self._get_error_chain_errors.restype = ctypes.c_size_t
+        self._get_error_chain_errors.argtypes = [
+            ctypes.c_void_p,
+            ctypes.POINTER(ctypes.c_char_p),
+        ]
         self._free_error = self._lib.tinystan_destroy_error
         self._free_error.restype = None
         self._free_error.argtypes = [ctypes.c_void_p]
@@ -375,9 +916,44 @@ class Model:
             else:
                 raise RuntimeError(f"Unknown error, function returned code {rc}")
 
-    @contextlib.contextmanager
-    def _get_model(self, data, seed):
-        err = ctypes.pointer(ctypes.c_void_p())
+    def _draws_before_timeout(self, rc: int, err) -> Optional[np.ndarray]:
+        """
+        Like :meth:`_raise_for_error`, but if a sampler reached its time
+        limit, return the number of draws each chain wrote instead of raising.
+        """
+        if rc != 0 and err.contents:
+            if self._get_error_type(err.contents) == _TIMEOUT:
+                num_chains = self._get_error_draw_counts(err.contents, None)
+                if num_chains > 0:
+                    counts = np.zeros(num_chains, dtype=ctypes.c_size_t)
+                    self._get_error_draw_counts(err.contents, counts)
+                    self._free_error(err.contents)
+                    return counts
+        self._raise_for_error(rc, err)
+        return None
+
+    def _failed_chains(self, rc: int, err) -> Optional[List[Optional[str]]]:
+        """
+        If some isolated chains failed while others succeeded, return the
+        error of each chain (``None`` for those which succeeded) instead of
+        raising. Other errors are left for :meth:`_draws_before_timeout`.
+        """
+        if rc != 0 and err.contents:
+            if self._get_error_type(err.contents) == _PARTIAL:
+                num_chains = self._get_error_chain_errors(err.contents, None)
+                messages = (ctypes.c_char_p * num_chains)()
+                self._get_error_chain_errors(err.contents, messages)
+                chain_errors = [
+                    msg.decode("utf-8") if msg is not None else None
+                    for msg in messages
+                ]
+                self._free_error(err.contents)
+                return chain_errors
+        return None
+
+    @contextlib.contextmanager
+    def _get_model(self, data, seed):
+        err = ctypes.pointer(ctypes.c_void_p())
 
         model = self._create_model(
             encode_stan_json(data),
@@ -387,10 +963,61 @@ class Model:
         )
         self._raise_for_error(not model, err)
         try:
+            if self.message_batch_ms > 0:
+                rc = self._set_message_batching(
+                    model,
+                    self.message_batch_ms,
+                    self.message_queue_size,
+                    self.drop_messages,
+                    err,
+                )
+                self._raise_for_error(rc, err)
+            if self.tag_messages:
+                self._set_message_tags(model, True)
+            if not self.model_output:
+                self._set_model_output(model, False)
+            if self.release_memory or self.memory_limit is not None:
+                self._set_memory_options(
+                    model, self.release_memory, self.memory_limit or 0
+                )
             yield model
         finally:
             self._delete_model(model)
 
+    @contextlib.contextmanager
+    def _get_options(
+        self,
+        time_limit=None,
+        metric_rank=None,
+        isolate_chains=False,
+        max_chain_restarts=0,
+        stream_pathfinder=False,
+    ):
+        err = ctypes.pointer(ctypes.c_void_p())
+
+        options = self._create_call_options()
+        try:
+            if self.init_candidates > 0:
+                self._set_init_screening(
+                    options, self.init_candidates, self.select_best_init
+                )
+            if time_limit is not None:
+                rc = self._set_time_limit(options, time_limit, err)
+                self._raise_for_error(rc, err)
+            if metric_rank is not None:
+                rc = self._set_metric_rank(options, metric_rank, err)
+                self._raise_for_error(rc, err)
+            if isolate_chains:
+                rc = self._set_chain_isolation(
+                    options, isolate_chains, max_chain_restarts, err
+                )
+                self._raise_for_error(rc, err)
+            if stream_pathfinder:
+                self._set_pathfinder_streaming(options, True)
+            yield options
+        finally:
+            self._destroy_call_options(options)
+
     def _encode_inits(self, inits, chains, seed):
         inits_encoded = None
         if inits is not None:
@@ -409,6 +1036,57 @@ class Model:
             return []
         return list(comma_separated.split(","))
 
+    def _get_variables(
+        self, model, algorithm_variables: List[str]
+    ) -> Optional[Dict[str, Variable]]:
+        """
+        Describe the columns of an algorithm's output from the model's
+        variable metadata, so that :class:`StanOutput` does not need to parse
+        the flattened names. Returns None for models with tuples, whose
+        layout can only be recovered from the names.
+        """
+        if b":" in self._get_param_names(model):
+            return None
+
+        variables = {
+            name: Variable(
+                name=name, start_idx=i, dimensions=(), type=VariableType.SCALAR
+            )
+            for i, name in enumerate(algorithm_variables)
+        }
+        name = ctypes.c_char_p()
+        dims = ctypes.POINTER(ctypes.c_size_t)()
+        num_dims = ctypes.c_size_t()
+        is_complex = ctypes.c_bool()
+        offset = ctypes.c_size_t()
+        length = ctypes.c_size_t()
+        err = ctypes.pointer(ctypes.c_void_p())
+        for i in range(self._num_variables(model)):
+            rc = self._get_variable(
+                model,
+                i,
+                ctypes.byref(name),
+                None,
+                ctypes.byref(dims),
+                ctypes.byref(num_dims),
+                ctypes.byref(is_complex),
+                ctypes.byref(offset),
+                ctypes.byref(length),
+                err,
+            )
+            self._raise_for_error(rc, err)
+            if length.value == 0:
+                # as when parsing, variables with no columns are left out
+                continue
+            var_name = name.value.decode("utf-8")
+            variables[var_name] = Variable(
+                name=var_name,
+                start_idx=len(algorithm_variables) + offset.value,
+                dimensions=tuple(dims[d] for d in range(num_dims.value)),
+                type=VariableType.COMPLEX if is_complex.value else VariableType.SCALAR,
+            )
+        return variables
+
     def api_version(self):
         """Return the version of the TinyStan API backing this model."""
         major, minor, patch = ctypes.c_int(), ctypes.c_int(), ctypes.c_int()
@@ -423,6 +1101,60 @@ class Model:
         )
         return (major.value, minor.value, patch.value)
 
+    def last_call_memory(self):
+        """
+        Return memory statistics of the last algorithm call made from the
+        current thread.
+
+        Returns
+        -------
+        Tuple[int, int, int]
+            The peak resident memory of the process during the call, in
+            bytes (0 if it cannot be measured on this platform), the peak
+            size of the autodiff arenas of the threads which ran the call,
+            and the number of bytes of draws written to the output.
+        """
+        peak, arena, output = ctypes.c_size_t(), ctypes.c_size_t(), ctypes.c_size_t()
+        self._last_call_memory(
+            ctypes.byref(peak), ctypes.byref(arena), ctypes.byref(output)
+        )
+        return (peak.value, arena.value, output.value)
+
+    def last_call_init_screening(self):
+        """
+        Return initialization screening statistics of the last algorithm call
+        made from the current thread. See the ``init_candidates`` argument of
+        :class:`Model`.
+
+        Returns
+        -------
+        Tuple[int, int]
+            The number of candidate initializations evaluated (0 if the call
+            did not screen), and the number of them with a finite log density
+            and gradient.
+        """
+        evaluated, valid = ctypes.c_size_t(), ctypes.c_size_t()
+        self._last_call_init_screening(ctypes.byref(evaluated), ctypes.byref(valid))
+        return (evaluated.value, valid.value)
+
+    def algorithm_available(self, name: str) -> bool:
+        """
+        Return whether an algorithm was compiled into this model.
+
+        Models built with the ``TINYSTAN_ALGORITHMS`` make variable only
+        contain the algorithms listed there, and raise a ``ValueError`` if
+        any other is called.
+
+        Parameters
+        ----------
+        name : str
+            One of ``"nuts_unit"``, ``"nuts_dense"``, ``"nuts_diag"``,
+            ``"nuts_lowrank"``, ``"nuts_auto"``, ``"pathfinder"``,
+            ``"newton"``, ``"bfgs"``, ``"lbfgs"``, ``"laplace"``, or
+            ``"variational"``.
+        """
+        return self._algorithm_available(name.encode("utf-8"))
+
     def sample(
         self,
         data: StanData = "",
@@ -435,6 +1167,7 @@ class Model:
         num_warmup: int = 1000,
         num_samples: int = 1000,
         metric: HMCMetric = HMCMetric.DIAGONAL,
+        metric_rank: int = 10,
         init_inv_metric: Optional[np.ndarray] = None,
         save_inv_metric: bool = False,
         adapt: bool = True,
@@ -451,6 +1184,9 @@ class Model:
         max_depth: int = 10,
         refresh: int = 0,
         num_threads: int = -1,
+        time_limit: Optional[float] = None,
+        isolate_chains: bool = False,
+        max_chain_restarts: int = 0,
     ):
         """
         Run Stan's No-U-Turn Sampler (NUTS) to sample from the posterior.
@@ -486,8 +1222,17 @@ class Model:
             Number of samples to draw after warmup, by default 1000
         metric : HMCMetric, optional
             The type of inverse mass matrix to use in the sampler.
-            The options are ``UNIT``, ``DENSE``, and ``DIAGONAL``.
-            By default HMCMetric.DIAGONAL
+            The options are ``UNIT``, ``DENSE``, ``DIAGONAL``,
+            ``LOW_RANK``, and ``AUTO``, which chooses between a diagonal and
+            a dense metric at the end of each warmup window, reporting why
+            in the progress messages. Its inverse metric is always a
+            matrix, with zeros off the diagonal if the diagonal metric was
+            chosen. By default HMCMetric.DIAGONAL
+        metric_rank : int, optional
+            Number of eigenvectors in a ``LOW_RANK`` metric, capped at the
+            number of parameters. The inverse metric is then a flat vector
+            of the variances, the eigenvectors (column-major), and their
+            eigenvalues. By default 10
         init_inv_metric : Optional[np.ndarray], optional
             Initial value for the inverse mass matrix used by the sampler.
             Valid shapes depend on the value of ``metric``. Can have
@@ -530,6 +1275,22 @@ class Model:
         num_threads : int, optional
             Number of threads to use for sampling, by default -1
             (use all available)
+        time_limit : float, optional
+            Seconds the sampler may run for. When the limit is reached,
+            the chains stop at the end of their current iteration and the
+            draws made so far are returned, truncated to the shortest
+            chain. The number of draws each chain made is in the
+            ``draw_counts`` attribute of the output. By default there is
+            no limit.
+        isolate_chains : bool, optional
+            If ``True``, each chain runs on its own, and a chain which fails
+            does not stop the others. The draws of failed chains are NaN,
+            and the error of each chain (``None`` if it succeeded) is in the
+            ``chain_errors`` attribute of the output. A ``RuntimeError`` is
+            only raised if every chain fails. By default False.
+        max_chain_restarts : int, optional
+            With ``isolate_chains``, the number of times a failed chain is
+            restarted from a new random initialization, by default 0.
 
         Returns
         -------
@@ -553,20 +1314,20 @@ class Model:
 
         seed = seed or rand_u32()
 
-        with self._get_model(data, seed) as model:
+        with self._get_model(data, seed) as model, self._get_options(
+            time_limit, metric_rank, isolate_chains, max_chain_restarts
+        ) as options:
             model_params = self._num_free_params(model)
 
             param_names = HMC_SAMPLER_VARIABLES + self._get_parameter_names(model)
 
+            variables = self._get_variables(model, HMC_SAMPLER_VARIABLES)
+
             num_params = len(param_names)
             num_draws = num_samples + num_warmup * save_warmup
             out = np.zeros((num_chains, num_draws, num_params), dtype=np.float64)
 
-            metric_size = (
-                (model_params, model_params)
-                if metric == HMCMetric.DENSE
-                else (model_params,)
-            )
+            metric_size = _metric_shape(metric, model_params, metric_rank)
 
             if init_inv_metric is not None:
                 if init_inv_metric.shape == metric_size:
@@ -594,6 +1355,7 @@ class Model:
             err = ctypes.pointer(ctypes.c_void_p())
             rc = self._ffi_sample(
                 model,
+                options,
                 num_chains,
                 self._encode_inits(inits, num_chains, seed),
                 seed,
@@ -623,205 +1385,999 @@ class Model:
                 inv_metric_out,
                 err,
             )
-            self._raise_for_error(rc, err)
-
-        output = StanOutput(param_names, out)
+            draw_counts = None
+            chain_errors = self._failed_chains(rc, err)
+            if chain_errors is None:
+                draw_counts = self._draws_before_timeout(rc, err)
+
+        if draw_counts is not None:
+            out = out[:, : draw_counts.min()]
+        output = StanOutput(param_names, out, variables)
+        output.draw_counts = draw_counts
+        output.chain_errors = chain_errors
         output.stepsize = stepsize_out
         output.inv_metric = inv_metric_out
 
         return output
 
-    def pathfinder(
+    def sampler(
         self,
         data: StanData = "",
         *,
-        num_paths: int = 4,
-        inits: Optional[StanData] = None,
+        num_chains: int = 4,
+        inits: Union[StanData, List[StanData], None] = None,
         seed: Optional[int] = None,
         id: int = 1,
         init_radius: float = 2.0,
-        num_draws: int = 1000,
-        max_history_size: int = 5,
-        init_alpha: float = 0.001,
-        tol_obj: float = 1e-12,
-        tol_rel_obj: float = 1e4,
-        tol_grad: float = 1e-8,
-        tol_rel_grad: float = 1e7,
-        tol_param: float = 1e-8,
-        num_iterations: int = 1000,
-        num_elbo_draws: int = 25,
-        num_multi_draws: int = 1000,
-        calculate_lp: bool = True,
-        psis_resample: bool = True,
-        refresh: int = 0,
+        metric: HMCMetric = HMCMetric.DIAGONAL,
+        metric_rank: int = 10,
+        init_inv_metric: Optional[np.ndarray] = None,
+        delta: float = 0.8,
+        gamma: float = 0.05,
+        kappa: float = 0.75,
+        t0: float = 10,
+        stepsize: float = 1.0,
+        stepsize_jitter: float = 0.0,
+        max_depth: int = 10,
         num_threads: int = -1,
-    ):
+        time_limit: Optional[float] = None,
+    ) -> "Sampler":
         """
-        Run the Pathfinder algorithm to approximate the posterior.
-        See https://mc-stan.org/docs/reference-manual/pathfinder.html
-        for more information on the algorithm.
+        Create NUTS chains which can be advanced over several calls.
 
-        Parameters
-        ----------
-        data : str | dict, optional
-            The data to use for the model. This can be a
-            path to a JSON file, a JSON string, or a dictionary.
-            By default, ""
-        num_paths : int, optional
-            The number of individual runs of the algorithm to run in parallel, by default 4
-        inits : str | dict | list[str | dict] | None, optional
-            Initial parameter values. This can be a single
-            path to a JSON file, a JSON string, a dictionary, or a
-            list of length ``num_paths`` of those.
-            By default, ""
-        seed : Optional[int], optional
-            The seed to use for the random number generator.
-            If not provided, a random seed will be generated.
-        id : int, optional
-            ID for the first path, by default 1
-        init_radius : float, optional
-            Radius to initialize unspecified parameters within.
-            The parameter values are drawn uniformly from the interval
-            [-init_radius, init_radius] on the unconstrained scale.
-            By default 2.0
-        num_draws : int, optional
-            Number of approximate draws drawn from each of the
-            ``num_paths`` Pathfinders, by default 1000
-        max_history_size : int, optional
-            History size used by the internal L-BFGS algorithm to
-            approximate the Hessian, by default 5
-        init_alpha : float, optional
-            Initial step size for the internal L-BFGS algorithm,
-            by default 0.001
-        tol_obj : float, optional
-            Convergence tolerance for the objective function for
-            the internal L-BFGS algorithm, by default 1e-12
-        tol_rel_obj : float, optional
-            Relative convergence tolerance for the objective function
-            for the internal L-BFGS algorithm, by default 1e4
-        tol_grad : float, optional
-            Convergence tolerance for the gradient norm for the internal
-            L-BFGS algorithm, by default 1e-8
-        tol_rel_grad : float, optional
-            Relative convergence tolerance for the gradient norm for the
-            internal L-BFGS algorithm, by default 1e7
-        tol_param : float, optional
-            Convergence tolerance for the changes in parameters for the
-            internal L-BFGS algorithm, by default 1e-8
-        num_iterations : int, optional
-            Maximum number of iterations for the internal L-BFGS algorithm,
-            by default 1000
-        num_elbo_draws : int, optional
-            Number of Monte Carlo draws used to estimate the ELBO,
-            by default 25
-        num_multi_draws : int, optional
-            Number of draws returned by Multi-Pathfinder, by default 1000
-        calculate_lp : bool, optional
-            Whether to calculate the log probability of the approximate draws.
-            If False, this also implies ``psis_resample=False``. By default True
-        psis_resample : bool, optional
-            Whether to use Pareto smoothed importance sampling on
-            the approximate draws. If False, all ``num_path * num_draws``
-            approximate samples will be returned. By default True.
-        refresh : int, optional
-            Number of iterations between progress messages, by default 0
-            (supress messages)
-        num_threads : int, optional
-            Number of threads to use for Pathfinder, by default -1
-            (use all available)
+        Unlike :meth:`sample`, which runs warmup and sampling in one call,
+        the returned :class:`Sampler` keeps the position, step size, and
+        metric of each chain, so that warmup and draws can be requested a
+        few at a time, for example until a convergence criterion is met.
+
+        Parameters are as in :meth:`sample`. The ``time_limit`` applies to
+        each call separately. Chains are initialized here, but warmup only
+        happens in :meth:`Sampler.warmup`.
 
         Returns
         -------
-        StanOutput
-            An object containing the samples and metadata from the algorithm.
+        Sampler
+            The chains. Call :meth:`Sampler.close`, or use it as a context
+            manager, to free them.
 
         Raises
         ------
         ValueError
             If any of the parameters are invalid or out of range.
         RuntimeError
-            If there is an unrecoverable error during the algorithm.
+            If the chains cannot be initialized.
         """
-        if num_draws < 1:
-            raise ValueError("num_draws must be at least 1")
-        if num_paths < 1:
-            raise ValueError("num_paths must be at least 1")
-        if num_multi_draws < 1:
-            raise ValueError("num_multi_draws must be at least 1")
-
-        if calculate_lp and psis_resample:
-            output_size = num_multi_draws
-        else:
-            output_size = num_draws * num_paths
+        if num_chains < 1:
+            raise ValueError("num_chains must be at least 1")
 
         seed = seed or rand_u32()
 
-        with self._get_model(data, seed) as model:
+        stack = contextlib.ExitStack()
+        model = stack.enter_context(self._get_model(data, seed))
+        try:
+            # the time limit applies to each later call of the sampler
+            options = stack.enter_context(self._get_options(time_limit, metric_rank))
             model_params = self._num_free_params(model)
-            if model_params == 0:
-                raise ValueError("Model has no parameters.")
-
-            param_names = PATHFINDER_VARIABLES + self._get_parameter_names(model)
+            param_names = HMC_SAMPLER_VARIABLES + self._get_parameter_names(model)
+            variables = self._get_variables(model, HMC_SAMPLER_VARIABLES)
+            metric_size = _metric_shape(metric, model_params, metric_rank)
 
-            num_params = len(param_names)
-            out = np.zeros((output_size, num_params), dtype=np.float64)
+            if init_inv_metric is not None:
+                if init_inv_metric.shape == metric_size:
+                    init_inv_metric = np.repeat(
+                        init_inv_metric[np.newaxis], num_chains, axis=0
+                    )
+                elif init_inv_metric.shape != (num_chains, *metric_size):
+                    raise ValueError(
+                        f"Invalid initial metric size. Expected a {metric_size} "
+                        f"or {(num_chains, *metric_size)} matrix."
+                    )
 
             err = ctypes.pointer(ctypes.c_void_p())
-            rc = self._ffi_pathfinder(
+            sampler = self._ffi_sampler_create(
                 model,
-                num_paths,
-                self._encode_inits(inits, num_paths, seed),
+                options,
+                num_chains,
+                self._encode_inits(inits, num_chains, seed),
                 seed,
                 id,
                 init_radius,
-                num_draws,
-                max_history_size,
-                init_alpha,
-                tol_obj,
-                tol_rel_obj,
-                tol_grad,
-                tol_rel_grad,
-                tol_param,
-                num_iterations,
-                num_elbo_draws,
-                num_multi_draws,
-                calculate_lp,
-                psis_resample,
-                refresh,
+                metric.value,
+                init_inv_metric,
+                delta,
+                gamma,
+                kappa,
+                t0,
+                stepsize,
+                stepsize_jitter,
+                max_depth,
                 num_threads,
-                out,
-                out.size,
                 err,
             )
-            self._raise_for_error(rc, err)
-
-        return StanOutput(param_names, out)
+            self._raise_for_error(not sampler, err)
+        except BaseException:
+            stack.close()
+            raise
+
+        return Sampler(
+            self,
+            stack,
+            sampler,
+            options,
+            num_chains,
+            model_params,
+            metric_size,
+            param_names,
+            variables,
+        )
 
-    def optimize(
+    def pooled_sample(
         self,
         data: StanData = "",
         *,
-        init: Optional[StanData] = None,
+        num_chains: int = 4,
+        inits: Union[StanData, List[StanData], None] = None,
         seed: Optional[int] = None,
         id: int = 1,
         init_radius: float = 2.0,
-        algorithm: OptimizationAlgorithm = OptimizationAlgorithm.LBFGS,
-        jacobian: bool = False,
-        num_iterations: int = 2000,
-        max_history_size: int = 5,
-        init_alpha: float = 0.001,
-        tol_obj: float = 1e-12,
-        tol_rel_obj: float = 1e4,
-        tol_grad: float = 1e-8,
-        tol_rel_grad: float = 1e7,
-        tol_param: float = 1e-8,
+        num_warmup: int = 1000,
+        num_samples: int = 1000,
+        metric: HMCMetric = HMCMetric.DIAGONAL,
+        metric_rank: int = 10,
+        init_inv_metric: Optional[np.ndarray] = None,
+        save_inv_metric: bool = False,
+        delta: float = 0.8,
+        gamma: float = 0.05,
+        kappa: float = 0.75,
+        t0: float = 10,
+        init_buffer: int = 75,
+        term_buffer: int = 50,
+        window: int = 25,
+        rhat_threshold: float = 1.05,
+        save_warmup: bool = False,
+        stepsize: float = 1.0,
+        stepsize_jitter: float = 0.0,
+        max_depth: int = 10,
         refresh: int = 0,
         num_threads: int = -1,
+        time_limit: Optional[float] = None,
     ):
         """
-        Optimize the model parameters using the specified algorithm.
+        Run NUTS with warmup adaptation shared between the chains.
 
-        This will find either the maximum a posteriori (MAP) estimate
+        During warmup, the chains advance together and adapt a single
+        step size and inverse metric from the draws of all chains. Warmup
+        can also end early once the chains agree, as measured by R-hat.
+        After warmup, each chain samples independently.
+
+        Parameters are the same as for :meth:`sample`, except as noted below.
+
+        Parameters
+        ----------
+        data : str | dict, optional
+            The data to use for the model. This can be a
+            path to a JSON file, a JSON string, or a dictionary.
+            By default, ""
+        num_chains : int, optional
+            The number of chains to run, by default 4
+        inits : str | dict | list[str | dict] | None, optional
+            Initial parameter values. This can be a single
+            path to a JSON file, a JSON string, a dictionary, or a
+            list of length ``num_chains`` of those.
+            By default, ""
+        seed : Optional[int], optional
+            The seed to use for the random number generator.
+            If not provided, a random seed will be generated.
+        id : int, optional
+            Chain ID for the first chain, by default 1
+        init_radius : float, optional
+            Radius to initialize unspecified parameters within.
+            By default 2.0
+        num_warmup : int, optional
+            Maximum number of warmup iterations to run, by default 1000
+        num_samples : int, optional
+            Number of samples to draw after warmup, by default 1000
+        metric : HMCMetric, optional
+            The type of inverse mass matrix to use in the sampler.
+            By default HMCMetric.DIAGONAL
+        metric_rank : int, optional
+            Number of eigenvectors in a ``LOW_RANK`` metric, capped at the
+            number of parameters. The inverse metric is then a flat vector
+            of the variances, the eigenvectors (column-major), and their
+            eigenvalues. By default 10
+        init_inv_metric : Optional[np.ndarray], optional
+            Initial value for the inverse mass matrix, shared by all chains.
+            Valid shapes depend on the value of ``metric``.
+        save_inv_metric : bool, optional
+            Whether to report the final inverse mass matrix, by default False
+        delta : float, optional
+            Target average acceptance probability, by default 0.8
+        gamma : float, optional
+            Adaptation regularization scale, by default 0.05
+        kappa : float, optional
+            Adaptation relaxation exponent, by default 0.75
+        t0 : float, optional
+            Adaptation iteration offset, by default 10
+        init_buffer : int, optional
+            Number of warmup samples to use for initial step size adaptation,
+            by default 75
+        term_buffer : int, optional
+            Number of warmup samples to use for step size adaptation
+            after the metric is adapted, by default 50
+        window : int, optional
+            Initial number of iterations to use for metric adaptation,
+            which is doubled each time the adaptation window is hit,
+            by default 25
+        rhat_threshold : float, optional
+            When a metric adaptation window ends with the R-hat of every
+            parameter across chains below this value, the metric is fixed
+            and warmup ends after ``term_buffer`` more iterations.
+            Set to 0 to always run ``num_warmup`` iterations. Early stopping
+            is also disabled if ``save_warmup`` is True. By default 1.05
+        save_warmup : bool, optional
+            Whether to save the warmup samples, by default False
+        stepsize : float, optional
+            Initial step size for the sampler, by default 1.0
+        stepsize_jitter : float, optional
+            Amount of random jitter to add to the step size, by default 0.0
+        max_depth : int, optional
+            Maximum tree depth for the sampler, by default 10
+        refresh : int, optional
+            Number of iterations between progress messages, by default 0
+            (supress messages)
+        num_threads : int, optional
+            Number of threads to use for sampling, by default -1
+            (use all available)
+        time_limit : float, optional
+            Seconds the sampler may run for. When the limit is reached,
+            the chains stop at the end of their current iteration and the
+            draws made so far are returned, truncated to the shortest
+            chain. The number of draws each chain made is in the
+            ``draw_counts`` attribute of the output. By default there is
+            no limit.
+
+        Returns
+        -------
+        StanOutput
+            An object containing the samples and metadata from the sampling run.
+            The ``num_warmup`` attribute holds the number of warmup
+            iterations which were actually run.
+
+        Raises
+        ------
+        ValueError
+            If any of the parameters are invalid or out of range.
+        RuntimeError
+            If there is an unrecoverable error during sampling.
+        """
+        # these are checked here because they're sizes for "out"
+        if num_chains < 1:
+            raise ValueError("num_chains must be at least 1")
+        if num_warmup < 0:
+            raise ValueError("num_warmup must be non-negative")
+        if num_samples < 1:
+            raise ValueError("num_samples must be at least 1")
+
+        seed = seed or rand_u32()
+
+        with self._get_model(data, seed) as model, self._get_options(
+            time_limit, metric_rank
+        ) as options:
+            model_params = self._num_free_params(model)
+
+            param_names = HMC_SAMPLER_VARIABLES + self._get_parameter_names(model)
+
+            variables = self._get_variables(model, HMC_SAMPLER_VARIABLES)
+
+            num_params = len(param_names)
+            num_draws = num_samples + num_warmup * save_warmup
+            out = np.zeros((num_chains, num_draws, num_params), dtype=np.float64)
+
+            metric_size = _metric_shape(metric, model_params, metric_rank)
+
+            if init_inv_metric is not None and init_inv_metric.shape != metric_size:
+                raise ValueError(
+                    f"Invalid initial metric size. Expected a {metric_size} matrix."
+                )
+
+            stepsize_out = np.zeros(num_chains, dtype=np.float64)
+            inv_metric_out = None
+            if save_inv_metric:
+                inv_metric_out = np.zeros((num_chains, *metric_size), dtype=np.float64)
+            num_warmup_out = ctypes.c_int()
+
+            err = ctypes.pointer(ctypes.c_void_p())
+            rc = self._ffi_pooled_sample(
+                model,
+                options,
+                num_chains,
+                self._encode_inits(inits, num_chains, seed),
+                seed,
+                id,
+                init_radius,
+                num_warmup,
+                num_samples,
+                metric.value,
+                init_inv_metric,
+                delta,
+                gamma,
+                kappa,
+                t0,
+                init_buffer,
+                term_buffer,
+                window,
+                rhat_threshold,
+                save_warmup,
+                stepsize,
+                stepsize_jitter,
+                max_depth,
+                refresh,
+                num_threads,
+                out,
+                out.size,
+                stepsize_out,
+                inv_metric_out,
+                ctypes.byref(num_warmup_out),
+                err,
+            )
+            draw_counts = self._draws_before_timeout(rc, err)
+
+        if draw_counts is not None:
+            out = out[:, : draw_counts.min()]
+        output = StanOutput(param_names, out, variables)
+        output.draw_counts = draw_counts
+        output.stepsize = stepsize_out
+        output.inv_metric = inv_metric_out
+        output.num_warmup = num_warmup_out.value
+
+        return output
+
+    def tempered_sample(
+        self,
+        data: StanData = "",
+        *,
+        num_replicas: int = 4,
+        inits: Union[StanData, List[StanData], None] = None,
+        seed: Optional[int] = None,
+        id: int = 1,
+        init_radius: float = 2.0,
+        num_warmup: int = 1000,
+        num_samples: int = 1000,
+        metric: HMCMetric = HMCMetric.DIAGONAL,
+        metric_rank: int = 10,
+        max_temperature: float = 10.0,
+        adapt_temperatures: bool = True,
+        swap_interval: int = 1,
+        delta: float = 0.8,
+        gamma: float = 0.05,
+        kappa: float = 0.75,
+        t0: float = 10,
+        init_buffer: int = 75,
+        term_buffer: int = 50,
+        window: int = 25,
+        save_warmup: bool = False,
+        stepsize: float = 1.0,
+        stepsize_jitter: float = 0.0,
+        max_depth: int = 10,
+        refresh: int = 0,
+        num_threads: int = -1,
+        time_limit: Optional[float] = None,
+    ):
+        """
+        Run NUTS with parallel tempering (replica exchange).
+
+        Each replica samples from the posterior density raised to the power
+        ``1 / T``, for a ladder of temperatures ``T`` starting at 1. The
+        replicas run in parallel and periodically try to exchange states
+        with their neighbours, which lets the untempered replica move
+        between modes that NUTS alone would not cross. Only the draws of
+        the untempered replica are returned.
+
+        Parameters are the same as for :meth:`sample`, except as noted below.
+
+        Parameters
+        ----------
+        data : str | dict, optional
+            The data to use for the model. This can be a
+            path to a JSON file, a JSON string, or a dictionary.
+            By default, ""
+        num_replicas : int, optional
+            The number of temperatures, at least 2. By default 4
+        inits : str | dict | list[str | dict] | None, optional
+            Initial parameter values. This can be a single
+            path to a JSON file, a JSON string, a dictionary, or a
+            list of length ``num_replicas`` of those.
+            By default, ""
+        id : int, optional
+            ID of the first replica, by default 1
+        max_temperature : float, optional
+            The initial temperature of the hottest replica, greater than 1.
+            The temperatures start evenly spaced on the log scale between 1
+            and this value. By default 10.0
+        adapt_temperatures : bool, optional
+            Whether to adapt the spacing of the temperatures during warmup,
+            aiming for about 23% of swaps to be accepted. This can move the
+            hottest temperature away from ``max_temperature``.
+            By default True
+        swap_interval : int, optional
+            Number of iterations between swap attempts, by default 1
+
+        Returns
+        -------
+        StanOutput
+            An object containing the draws of the untempered replica, as a
+            single chain. The ``stepsize`` attribute holds the adapted
+            step size of each replica, starting with the untempered one.
+            The ``temperatures`` attribute holds the final
+            temperatures, and the ``swap_rates`` attribute holds the
+            fraction of swaps accepted after warmup between each pair of
+            neighbouring replicas.
+
+        Raises
+        ------
+        ValueError
+            If any of the parameters are invalid or out of range.
+        RuntimeError
+            If there is an unrecoverable error during sampling.
+        """
+        # these are checked here because they're sizes for "out"
+        if num_replicas < 2:
+            raise ValueError("num_replicas must be at least 2")
+        if num_warmup < 0:
+            raise ValueError("num_warmup must be non-negative")
+        if num_samples < 1:
+            raise ValueError("num_samples must be at least 1")
+
+        seed = seed or rand_u32()
+
+        with self._get_model(data, seed) as model, self._get_options(
+            time_limit, metric_rank
+        ) as options:
+            param_names = HMC_SAMPLER_VARIABLES + self._get_parameter_names(model)
+
+            variables = self._get_variables(model, HMC_SAMPLER_VARIABLES)
+
+            num_params = len(param_names)
+            num_draws = num_samples + num_warmup * save_warmup
+            out = np.zeros((1, num_draws, num_params), dtype=np.float64)
+
+            stepsize_out = np.zeros(num_replicas, dtype=np.float64)
+            temperatures_out = np.zeros(num_replicas, dtype=np.float64)
+            swap_rates_out = np.zeros(num_replicas - 1, dtype=np.float64)
+
+            err = ctypes.pointer(ctypes.c_void_p())
+            rc = self._ffi_tempered_sample(
+                model,
+                options,
+                num_replicas,
+                self._encode_inits(inits, num_replicas, seed),
+                seed,
+                id,
+                init_radius,
+                num_warmup,
+                num_samples,
+                metric.value,
+                max_temperature,
+                adapt_temperatures,
+                swap_interval,
+                delta,
+                gamma,
+                kappa,
+                t0,
+                init_buffer,
+                term_buffer,
+                window,
+                save_warmup,
+                stepsize,
+                stepsize_jitter,
+                max_depth,
+                refresh,
+                num_threads,
+                out,
+                out.size,
+                stepsize_out,
+                temperatures_out,
+                swap_rates_out,
+                err,
+            )
+            draw_counts = self._draws_before_timeout(rc, err)
+
+        if draw_counts is not None:
+            out = out[:, : draw_counts.min()]
+        output = StanOutput(param_names, out, variables)
+        output.draw_counts = draw_counts
+        output.stepsize = stepsize_out
+        output.temperatures = temperatures_out
+        output.swap_rates = swap_rates_out
+
+        return output
+
+    def pathfinder(
+        self,
+        data: StanData = "",
+        *,
+        num_paths: int = 4,
+        inits: Optional[StanData] = None,
+        seed: Optional[int] = None,
+        id: int = 1,
+        init_radius: float = 2.0,
+        num_draws: int = 1000,
+        max_history_size: int = 5,
+        init_alpha: float = 0.001,
+        tol_obj: float = 1e-12,
+        tol_rel_obj: float = 1e4,
+        tol_grad: float = 1e-8,
+        tol_rel_grad: float = 1e7,
+        tol_param: float = 1e-8,
+        num_iterations: int = 1000,
+        num_elbo_draws: int = 25,
+        num_multi_draws: int = 1000,
+        calculate_lp: bool = True,
+        psis_resample: bool = True,
+        stream_paths: bool = False,
+        refresh: int = 0,
+        num_threads: int = -1,
+        time_limit: Optional[float] = None,
+    ):
+        """
+        Run the Pathfinder algorithm to approximate the posterior.
+        See https://mc-stan.org/docs/reference-manual/pathfinder.html
+        for more information on the algorithm.
+
+        Parameters
+        ----------
+        data : str | dict, optional
+            The data to use for the model. This can be a
+            path to a JSON file, a JSON string, or a dictionary.
+            By default, ""
+        num_paths : int, optional
+            The number of individual runs of the algorithm to run in parallel, by default 4
+        inits : str | dict | list[str | dict] | None, optional
+            Initial parameter values. This can be a single
+            path to a JSON file, a JSON string, a dictionary, or a
+            list of length ``num_paths`` of those.
+            By default, ""
+        seed : Optional[int], optional
+            The seed to use for the random number generator.
+            If not provided, a random seed will be generated.
+        id : int, optional
+            ID for the first path, by default 1
+        init_radius : float, optional
+            Radius to initialize unspecified parameters within.
+            The parameter values are drawn uniformly from the interval
+            [-init_radius, init_radius] on the unconstrained scale.
+            By default 2.0
+        num_draws : int, optional
+            Number of approximate draws drawn from each of the
+            ``num_paths`` Pathfinders, by default 1000
+        max_history_size : int, optional
+            History size used by the internal L-BFGS algorithm to
+            approximate the Hessian, by default 5
+        init_alpha : float, optional
+            Initial step size for the internal L-BFGS algorithm,
+            by default 0.001
+        tol_obj : float, optional
+            Convergence tolerance for the objective function for
+            the internal L-BFGS algorithm, by default 1e-12
+        tol_rel_obj : float, optional
+            Relative convergence tolerance for the objective function
+            for the internal L-BFGS algorithm, by default 1e4
+        tol_grad : float, optional
+            Convergence tolerance for the gradient norm for the internal
+            L-BFGS algorithm, by default 1e-8
+        tol_rel_grad : float, optional
+            Relative convergence tolerance for the gradient norm for the
+            internal L-BFGS algorithm, by default 1e7
+        tol_param : float, optional
+            Convergence tolerance for the changes in parameters for the
+            internal L-BFGS algorithm, by default 1e-8
+        num_iterations : int, optional
+            Maximum number of iterations for the internal L-BFGS algorithm,
+            by default 1000
+        num_elbo_draws : int, optional
+            Number of Monte Carlo draws used to estimate the ELBO,
+            by default 25
+        num_multi_draws : int, optional
+            Number of draws returned by Multi-Pathfinder, by default 1000
+        calculate_lp : bool, optional
+            Whether to calculate the log probability of the approximate draws.
+            If False, this also implies ``psis_resample=False``. By default True
+        psis_resample : bool, optional
+            Whether to use Pareto smoothed importance sampling on
+            the approximate draws. If False, all ``num_path * num_draws``
+            approximate samples will be returned. By default True.
+        stream_paths : bool, optional
+            If True, the draws of each path are resampled as soon as the path
+            finishes, rather than all paths being kept until the end, so
+            memory use does not grow with ``num_paths``. The importance
+            weights are then Pareto smoothed within each path rather than
+            across all of them. Only used with PSIS resampling.
+            By default False.
+        refresh : int, optional
+            Number of iterations between progress messages, by default 0
+            (supress messages)
+        num_threads : int, optional
+            Number of threads to use for Pathfinder, by default -1
+            (use all available)
+        time_limit : float, optional
+            Seconds the algorithm may run for. If the limit is reached, a
+            ``TimeoutError`` is raised. By default there is no limit.
+
+        Returns
+        -------
+        StanOutput
+            An object containing the samples and metadata from the algorithm.
+
+        Raises
+        ------
+        ValueError
+            If any of the parameters are invalid or out of range.
+        RuntimeError
+            If there is an unrecoverable error during the algorithm.
+        TimeoutError
+            If ``time_limit`` is reached.
+        """
+        if num_draws < 1:
+            raise ValueError("num_draws must be at least 1")
+        if num_paths < 1:
+            raise ValueError("num_paths must be at least 1")
+        if num_multi_draws < 1:
+            raise ValueError("num_multi_draws must be at least 1")
+
+        if calculate_lp and psis_resample:
+            output_size = num_multi_draws
+        else:
+            output_size = num_draws * num_paths
+
+        seed = seed or rand_u32()
+
+        with self._get_model(data, seed) as model, self._get_options(
+            time_limit, stream_pathfinder=stream_paths
+        ) as options:
+            model_params = self._num_free_params(model)
+            if model_params == 0:
+                raise ValueError("Model has no parameters.")
+
+            param_names = PATHFINDER_VARIABLES + self._get_parameter_names(model)
+
+            variables = self._get_variables(model, PATHFINDER_VARIABLES)
+
+            num_params = len(param_names)
+            out = np.zeros((output_size, num_params), dtype=np.float64)
+
+            err = ctypes.pointer(ctypes.c_void_p())
+            rc = self._ffi_pathfinder(
+                model,
+                options,
+                num_paths,
+                self._encode_inits(inits, num_paths, seed),
+                seed,
+                id,
+                init_radius,
+                num_draws,
+                max_history_size,
+                init_alpha,
+                tol_obj,
+                tol_rel_obj,
+                tol_grad,
+                tol_rel_grad,
+                tol_param,
+                num_iterations,
+                num_elbo_draws,
+                num_multi_draws,
+                calculate_lp,
+                psis_resample,
+                refresh,
+                num_threads,
+                out,
+                out.size,
+                err,
+            )
+            self._raise_for_error(rc, err)
+
+        return StanOutput(param_names, out, variables)
+
+    def pathfinder_sample(
+        self,
+        data: StanData = "",
+        *,
+        num_chains: int = 4,
+        num_paths: int = 4,
+        inits: Union[StanData, List[StanData], None] = None,
+        seed: Optional[int] = None,
+        id: int = 1,
+        init_radius: float = 2.0,
+        num_draws: int = 1000,
+        max_history_size: int = 5,
+        init_alpha: float = 0.001,
+        tol_obj: float = 1e-12,
+        tol_rel_obj: float = 1e4,
+        tol_grad: float = 1e-8,
+        tol_rel_grad: float = 1e7,
+        tol_param: float = 1e-8,
+        num_iterations: int = 1000,
+        num_elbo_draws: int = 25,
+        num_multi_draws: int = 1000,
+        stream_paths: bool = False,
+        num_warmup: int = 250,
+        num_samples: int = 1000,
+        metric: HMCMetric = HMCMetric.DIAGONAL,
+        metric_rank: int = 10,
+        save_inv_metric: bool = False,
+        delta: float = 0.8,
+        gamma: float = 0.05,
+        kappa: float = 0.75,
+        t0: float = 10,
+        init_buffer: int = 25,
+        term_buffer: int = 50,
+        window: int = 25,
+        save_warmup: bool = False,
+        stepsize: float = 1.0,
+        stepsize_jitter: float = 0.0,
+        max_depth: int = 10,
+        refresh: int = 0,
+        num_threads: int = -1,
+        time_limit: Optional[float] = None,
+        isolate_chains: bool = False,
+        max_chain_restarts: int = 0,
+    ):
+        """
+        Run Stan's No-U-Turn Sampler (NUTS), initialized using Pathfinder.
+
+        Multi-path Pathfinder is run first, with PSIS resampling. Each chain
+        starts from a different resampled draw, and the initial inverse mass
+        matrix is estimated from the resampled draws. Because the chains start
+        close to the typical set, a much shorter warmup is usually sufficient.
+
+        Parameters which are shared with :meth:`~Model.pathfinder` and
+        :meth:`~Model.sample` have the same meaning here.
+
+        Parameters
+        ----------
+        data : str | dict, optional
+            The data to use for the model. This can be a
+            path to a JSON file, a JSON string, or a dictionary.
+            By default, ""
+        num_chains : int, optional
+            The number of NUTS chains to run, by default 4
+        num_paths : int, optional
+            The number of Pathfinder paths to run, by default 4
+        inits : str | dict | list[str | dict] | None, optional
+            Initial parameter values for the Pathfinder paths. This can be
+            a single path to a JSON file, a JSON string, a dictionary, or a
+            list of length ``num_paths`` of those.
+            By default, ""
+        seed : Optional[int], optional
+            The seed to use for the random number generator.
+            If not provided, a random seed will be generated.
+        id : int, optional
+            ID for the first path and chain, by default 1
+        init_radius : float, optional
+            Radius to initialize unspecified parameters within, by default 2.0
+        num_draws : int, optional
+            Number of approximate draws drawn from each of the
+            ``num_paths`` Pathfinders, by default 1000
+        max_history_size : int, optional
+            History size used by the internal L-BFGS algorithm, by default 5
+        init_alpha : float, optional
+            Initial step size for the internal L-BFGS algorithm,
+            by default 0.001
+        tol_obj : float, optional
+            Convergence tolerance for the objective function, by default 1e-12
+        tol_rel_obj : float, optional
+            Relative convergence tolerance for the objective function,
+            by default 1e4
+        tol_grad : float, optional
+            Convergence tolerance for the gradient norm, by default 1e-8
+        tol_rel_grad : float, optional
+            Relative convergence tolerance for the gradient norm,
+            by default 1e7
+        tol_param : float, optional
+            Convergence tolerance for the changes in parameters,
+            by default 1e-8
+        num_iterations : int, optional
+            Maximum number of iterations for the internal L-BFGS algorithm,
+            by default 1000
+        num_elbo_draws : int, optional
+            Number of Monte Carlo draws used to estimate the ELBO,
+            by default 25
+        num_multi_draws : int, optional
+            Number of PSIS-resampled draws used to choose the initial points
+            and estimate the initial metric, by default 1000
+        num_warmup : int, optional
+            Number of warmup iterations to run, by default 250
+        num_samples : int, optional
+            Number of samples to draw after warmup, by default 1000
+        metric : HMCMetric, optional
+            The type of inverse mass matrix to use in the sampler.
+            By default HMCMetric.DIAGONAL
+        metric_rank : int, optional
+            Number of eigenvectors in a ``LOW_RANK`` metric, capped at the
+            number of parameters. The inverse metric is then a flat vector
+            of the variances, the eigenvectors (column-major), and their
+            eigenvalues. By default 10
+        save_inv_metric : bool, optional
+            Whether to report the final inverse mass matrix, by default False
+        delta : float, optional
+            Target average acceptance probability, by default 0.8
+        gamma : float, optional
+            Adaptation regularization scale, by default 0.05
+        kappa : float, optional
+            Adaptation relaxation exponent, by default 0.75
+        t0 : float, optional
+            Adaptation iteration offset, by default 10
+        init_buffer : int, optional
+            Number of warmup samples to use for initial step size adaptation,
+            by default 25
+        term_buffer : int, optional
+            Number of warmup samples to use for step size adaptation
+            after the metric is adapted, by default 50
+        window : int, optional
+            Initial number of iterations to use for metric adaptation,
+            by default 25
+        save_warmup : bool, optional
+            Whether to save the warmup samples, by default False
+        stepsize : float, optional
+            Initial step size for the sampler, by default 1.0
+        stepsize_jitter : float, optional
+            Amount of random jitter to add to the step size, by default 0.0
+        max_depth : int, optional
+            Maximum tree depth for the sampler, by default 10
+        refresh : int, optional
+            Number of iterations between progress messages, by default 0
+            (supress messages)
+        num_threads : int, optional
+            Number of threads to use, by default -1 (use all available)
+        time_limit : float, optional
+            Seconds the sampler may run for. When the limit is reached,
+            the chains stop at the end of their current iteration and the
+            draws made so far are returned, truncated to the shortest
+            chain. The number of draws each chain made is in the
+            ``draw_counts`` attribute of the output. If the limit is
+            reached during Pathfinder, a ``TimeoutError`` is raised. By
+            default there is no limit.
+        isolate_chains : bool, optional
+            If ``True``, each NUTS chain runs on its own, and a chain which
+            fails does not stop the others. The draws of failed chains are
+            NaN, and the error of each chain (``None`` if it succeeded) is in
+            the ``chain_errors`` attribute of the output. Failed paths are
+            always skipped by Pathfinder. By default False.
+        max_chain_restarts : int, optional
+            With ``isolate_chains``, the number of times a failed chain is
+            restarted from a new random initialization, by default 0.
+
+        Returns
+        -------
+        StanOutput
+            An object containing the samples and metadata from the sampling run.
+
+        Raises
+        ------
+        ValueError
+            If any of the parameters are invalid or out of range.
+        RuntimeError
+            If there is an unrecoverable error during the algorithm.
+        """
+        if num_chains < 1:
+            raise ValueError("num_chains must be at least 1")
+        if num_paths < 1:
+            raise ValueError("num_paths must be at least 1")
+        if num_warmup < 0:
+            raise ValueError("num_warmup must be non-negative")
+        if num_samples < 1:
+            raise ValueError("num_samples must be at least 1")
+
+        seed = seed or rand_u32()
+
+        with self._get_model(data, seed) as model, self._get_options(
+            time_limit,
+            metric_rank,
+            isolate_chains,
+            max_chain_restarts,
+            stream_paths,
+        ) as options:
+            model_params = self._num_free_params(model)
+            if model_params == 0:
+                raise ValueError("Model has no parameters.")
+
+            param_names = HMC_SAMPLER_VARIABLES + self._get_parameter_names(model)
+
+            variables = self._get_variables(model, HMC_SAMPLER_VARIABLES)
+
+            num_params = len(param_names)
+            num_draws_out = num_samples + num_warmup * save_warmup
+            out = np.zeros((num_chains, num_draws_out, num_params), dtype=np.float64)
+
+            metric_size = _metric_shape(metric, model_params, metric_rank)
+            stepsize_out = np.zeros(num_chains, dtype=np.float64)
+            inv_metric_out = None
+            if save_inv_metric:
+                inv_metric_out = np.zeros((num_chains, *metric_size), dtype=np.float64)
+
+            err = ctypes.pointer(ctypes.c_void_p())
+            rc = self._ffi_pathfinder_sample(
+                model,
+                options,
+                num_chains,
+                num_paths,
+                self._encode_inits(inits, num_paths, seed),
+                seed,
+                id,
+                init_radius,
+                num_draws,
+                max_history_size,
+                init_alpha,
+                tol_obj,
+                tol_rel_obj,
+                tol_grad,
+                tol_rel_grad,
+                tol_param,
+                num_iterations,
+                num_elbo_draws,
+                num_multi_draws,
+                num_warmup,
+                num_samples,
+                metric.value,
+                delta,
+                gamma,
+                kappa,
+                t0,
+                init_buffer,
+                term_buffer,
+                window,
+                save_warmup,
+                stepsize,
+                stepsize_jitter,
+                max_depth,
+                refresh,
+                num_threads,
+                out,
+                out.size,
+                stepsize_out,
+                inv_metric_out,
+                err,
+            )
+            draw_counts = None
+            chain_errors = self._failed_chains(rc, err)
+            if chain_errors is None:
+                draw_counts = self._draws_before_timeout(rc, err)
+
+        if draw_counts is not None:
+            out = out[:, : draw_counts.min()]
+        output = StanOutput(param_names, out, variables)
+        output.draw_counts = draw_counts
+        output.chain_errors = chain_errors
+        output.stepsize = stepsize_out
+        output.inv_metric = inv_metric_out
+
+        return output
+
+    def optimize(
+        self,
+        data: StanData = "",
+        *,
+        init: Optional[StanData] = None,
+        seed: Optional[int] = None,
+        id: int = 1,
+        init_radius: float = 2.0,
+        algorithm: OptimizationAlgorithm = OptimizationAlgorithm.LBFGS,
+        jacobian: bool = False,
+        num_iterations: int = 2000,
+        max_history_size: int = 5,
+        init_alpha: float = 0.001,
+        tol_obj: float = 1e-12,
+        tol_rel_obj: float = 1e4,
+        tol_grad: float = 1e-8,
+        tol_rel_grad: float = 1e7,
+        tol_param: float = 1e-8,
+        refresh: int = 0,
+        num_threads: int = -1,
+        time_limit: Optional[float] = None,
+    ):
+        """
+        Optimize the model parameters using the specified algorithm.
+
+        This will find either the maximum a posteriori (MAP) estimate
         or the maximum likelihood estimate (MLE) of the model parameters,
         depending on the value of the ``jacobian`` parameter.
         Additional parameters can be found in the Stan documentation at
@@ -833,80 +2389,503 @@ class Model:
             The data to use for the model. This can be a
             path to a JSON file, a JSON string, or a dictionary.
             By default, ""
-        init : str | dict | None, optional
-            Initial parameter values. This can be a
-            path to a JSON file, a JSON string, or a dictionary.
-            By default, ""
-        seed : Optional[int], optional
-            The seed to use for the random number generator.
-            If not provided, a random seed will be generated.
-        id : int, optional
-            ID used to offset the random number generator, by default 1
-        init_radius : float, optional
-            Radius to initialize unspecified parameters within.
-            The parameter values are drawn uniformly from the interval
-            [-init_radius, init_radius] on the unconstrained scale.
-            By default 2.0
-        algorithm : OptimizationAlgorithm, optional
-            Which optimization algorithm to use. Some of the following
-            arguments may be ignored depending on the algorithm.
-            By default OptimizationAlgorithm.LBFGS
+        init : str | dict | None, optional
+            Initial parameter values. This can be a
+            path to a JSON file, a JSON string, or a dictionary.
+            By default, ""
+        seed : Optional[int], optional
+            The seed to use for the random number generator.
+            If not provided, a random seed will be generated.
+        id : int, optional
+            ID used to offset the random number generator, by default 1
+        init_radius : float, optional
+            Radius to initialize unspecified parameters within.
+            The parameter values are drawn uniformly from the interval
+            [-init_radius, init_radius] on the unconstrained scale.
+            By default 2.0
+        algorithm : OptimizationAlgorithm, optional
+            Which optimization algorithm to use. Some of the following
+            arguments may be ignored depending on the algorithm.
+            By default OptimizationAlgorithm.LBFGS
+        jacobian : bool, optional
+            Whether to apply the Jacobian change of variables to the
+            log density. If False, the algorithm will find the MLE.
+            If True, the algorithm will find the MAP estimate.
+            By default False
+        num_iterations : int, optional
+            Maximum number of iterations to run the optimization,
+            by default 2000
+        max_history_size : int, optional
+            History size used to approximate the Hessian, by default 5
+        init_alpha : float, optional
+            Initial step size, by default 0.001
+        tol_obj : float, optional
+            Convergence tolerance for the objective function,
+            by default 1e-12
+        tol_rel_obj : float, optional
+            Relative convergence tolerance for the objective function,
+            by default 1e4
+        tol_grad : float, optional
+            Convergence tolerance for the gradient norm, by default 1e-8
+        tol_rel_grad : float, optional
+            Relative convergence tolerance for the gradient norm,
+            by default 1e7
+        tol_param : float, optional
+            Convergence tolerance for the changes in parameters,
+            by default 1e-8
+        refresh : int, optional
+            Number of iterations between progress messages, by default 0
+            (supress messages)
+        num_threads : int, optional
+            Number of threads to use for log density evaluations, by default -1
+            (use all available)
+        time_limit : float, optional
+            Seconds the algorithm may run for. If the limit is reached, a
+            ``TimeoutError`` is raised. By default there is no limit.
+
+        Returns
+        -------
+        StanOutput
+            An object containing the samples and metadata from the algorithm.
+
+        Raises
+        ------
+        ValueError
+            If any of the parameters are invalid or out of range.
+        RuntimeError
+            If there is an unrecoverable error during the algorithm.
+        TimeoutError
+            If ``time_limit`` is reached.
+        """
+        seed = seed or rand_u32()
+
+        with self._get_model(data, seed) as model, self._get_options(
+            time_limit
+        ) as options:
+            param_names = OPTIMIZE_VARIABLES + self._get_parameter_names(model)
+            variables = self._get_variables(model, OPTIMIZE_VARIABLES)
+
+            num_params = len(param_names)
+            out = np.zeros(num_params, dtype=np.float64)
+
+            err = ctypes.pointer(ctypes.c_void_p())
+            rc = self._ffi_optimize(
+                model,
+                options,
+                self._encode_inits(init, 1, seed),
+                seed,
+                id,
+                init_radius,
+                algorithm.value,
+                num_iterations,
+                jacobian,
+                max_history_size,
+                init_alpha,
+                tol_obj,
+                tol_rel_obj,
+                tol_grad,
+                tol_rel_grad,
+                tol_param,
+                refresh,
+                num_threads,
+                out,
+                out.size,
+                err,
+            )
+            self._raise_for_error(rc, err)
+
+        return StanOutput(param_names, out, variables)
+
+    def optimize_multi(
+        self,
+        data: StanData = "",
+        *,
+        num_starts: int = 8,
+        inits: Union[StanData, List[StanData], None] = None,
+        seed: Optional[int] = None,
+        id: int = 1,
+        init_radius: float = 2.0,
+        algorithm: OptimizationAlgorithm = OptimizationAlgorithm.LBFGS,
+        jacobian: bool = False,
+        num_iterations: int = 2000,
+        max_history_size: int = 5,
+        init_alpha: float = 0.001,
+        tol_obj: float = 1e-12,
+        tol_rel_obj: float = 1e4,
+        tol_grad: float = 1e-8,
+        tol_rel_grad: float = 1e7,
+        tol_param: float = 1e-8,
+        dedupe_tol: float = 1e-4,
+        refresh: int = 0,
+        num_threads: int = -1,
+        time_limit: Optional[float] = None,
+    ):
+        """
+        Optimize the model parameters from several initializations in parallel.
+
+        Each start is an independent run of :meth:`optimize`. The modes found
+        are returned sorted from highest to lowest log density.
+
+        Parameters are the same as for :meth:`optimize`, except as noted below.
+
+        Parameters
+        ----------
+        data : str | dict, optional
+            The data to use for the model. This can be a
+            path to a JSON file, a JSON string, or a dictionary.
+            By default, ""
+        num_starts : int, optional
+            The number of optimizations to run, by default 8
+        inits : str | dict | list[str | dict] | None, optional
+            Initial parameter values. This can be a single
+            path to a JSON file, a JSON string, a dictionary, or a
+            list of length ``num_starts`` of those. Parameters which
+            are not specified are initialized randomly for each start.
+            By default, ""
+        seed : Optional[int], optional
+            The seed to use for the random number generator.
+            If not provided, a random seed will be generated.
+        id : int, optional
+            ID for the first start, by default 1
+        init_radius : float, optional
+            Radius to initialize unspecified parameters within.
+            By default 2.0
+        algorithm : OptimizationAlgorithm, optional
+            Which optimization algorithm to use.
+            By default OptimizationAlgorithm.LBFGS
+        jacobian : bool, optional
+            Whether to apply the Jacobian change of variables to the
+            log density. By default False
+        num_iterations : int, optional
+            Maximum number of iterations for each start, by default 2000
+        max_history_size : int, optional
+            History size used to approximate the Hessian, by default 5
+        init_alpha : float, optional
+            Initial step size, by default 0.001
+        tol_obj : float, optional
+            Convergence tolerance for the objective function,
+            by default 1e-12
+        tol_rel_obj : float, optional
+            Relative convergence tolerance for the objective function,
+            by default 1e4
+        tol_grad : float, optional
+            Convergence tolerance for the gradient norm, by default 1e-8
+        tol_rel_grad : float, optional
+            Relative convergence tolerance for the gradient norm,
+            by default 1e7
+        tol_param : float, optional
+            Convergence tolerance for the changes in parameters,
+            by default 1e-8
+        dedupe_tol : float, optional
+            A mode is dropped if each of its parameters is within this
+            distance of a mode with a higher log density. Set to 0 to
+            return one mode per start. By default 1e-4
+        refresh : int, optional
+            Number of iterations between progress messages, by default 0
+            (supress messages)
+        num_threads : int, optional
+            Number of threads to use, by default -1 (use all available)
+        time_limit : float, optional
+            Seconds the algorithm may run for. If the limit is reached, a
+            ``TimeoutError`` is raised. By default there is no limit.
+
+        Returns
+        -------
+        StanOutput
+            An object containing one row per mode found. The ``return_codes``
+            attribute holds the optimizer's return code for each row.
+            Starts which failed before producing a result are last,
+            with every value set to NaN.
+
+        Raises
+        ------
+        ValueError
+            If any of the parameters are invalid or out of range.
+        RuntimeError
+            If every start failed.
+        TimeoutError
+            If ``time_limit`` is reached.
+        """
+        if num_starts < 1:
+            raise ValueError("num_starts must be at least 1")
+
+        seed = seed or rand_u32()
+
+        with self._get_model(data, seed) as model, self._get_options(
+            time_limit
+        ) as options:
+            param_names = OPTIMIZE_VARIABLES + self._get_parameter_names(model)
+            variables = self._get_variables(model, OPTIMIZE_VARIABLES)
+
+            num_params = len(param_names)
+            out = np.zeros((num_starts, num_params), dtype=np.float64)
+            return_codes = np.zeros(num_starts, dtype=np.int32)
+            num_modes = ctypes.c_size_t()
+
+            err = ctypes.pointer(ctypes.c_void_p())
+            rc = self._ffi_optimize_multi(
+                model,
+                options,
+                num_starts,
+                self._encode_inits(inits, num_starts, seed),
+                seed,
+                id,
+                init_radius,
+                algorithm.value,
+                num_iterations,
+                jacobian,
+                max_history_size,
+                init_alpha,
+                tol_obj,
+                tol_rel_obj,
+                tol_grad,
+                tol_rel_grad,
+                tol_param,
+                dedupe_tol,
+                refresh,
+                num_threads,
+                out,
+                out.size,
+                return_codes,
+                ctypes.byref(num_modes),
+                err,
+            )
+            self._raise_for_error(rc, err)
+
+        output = StanOutput(param_names, out[: num_modes.value], variables)
+        output.return_codes = return_codes[: num_modes.value]
+        return output
+
+    def laplace_sample(
+        self,
+        mode: Union[StanOutput, np.ndarray, StanData],
+        data: StanData = "",
+        *,
+        seed: Optional[int] = None,
+        num_draws: int = 1000,
+        jacobian: bool = True,
+        calculate_lp: bool = True,
+        hessian: Optional[np.ndarray] = None,
+        save_hessian: bool = False,
+        refresh: int = 0,
+        num_threads: int = -1,
+        time_limit: Optional[float] = None,
+    ):
+        """
+        Sample from the Laplace approximation of the posterior
+        centered at the provided mode.
+
+        Parameters
+        ----------
+        mode : Union[StanOutput, np.ndarray, StanData]
+            The mode of the Laplace approximation. This can be a
+            StanOutput object from :meth:`~Model.optimize`, a numpy
+            array, a path to a JSON file, a JSON string, or a dictionary.
+        data : str | dict, optional
+            The data to use for the model. This can be a
+            path to a JSON file, a JSON string, or a dictionary.
+            By default, ""
+        seed : Optional[int], optional
+            The seed to use for the random number generator.
+            If not provided, a random seed will be generated.
+        num_draws : int, optional
+            Number of draws, by default 1000
+        jacobian : bool, optional
+            Whether to apply the Jacobian change of variables to the
+            log density. **Note:** This should match the value used
+            when the mode was calculated.
+            By default True.
+        calculate_lp : bool, optional
+            Whether to calculate the log probability of the samples,
+            by default True
+        hessian : Optional[np.ndarray], optional
+            A Hessian matrix saved by a previous call with the same mode
+            and ``jacobian``. If provided, the Hessian is not recomputed,
+            which makes drawing more samples from the same approximation
+            much cheaper. By default None
+        save_hessian : bool, optional
+            Whether to save the Hessian matrix calculated at the mode,
+            by default False
+        refresh : int, optional
+            Number of iterations between progress messages, by default 0
+            (supress messages)
+        num_threads : int, optional
+            Number of threads to use for computing the Hessian and
+            generating draws, by default -1 (use all available). The draws
+            do not depend on the number of threads.
+        time_limit : float, optional
+            Seconds the algorithm may run for. If the limit is reached, a
+            ``TimeoutError`` is raised. By default there is no limit.
+
+        Returns
+        -------
+        StanOutput
+            An object containing the samples and metadata from the algorithm.
+
+        Raises
+        ------
+        ValueError
+            If any of the parameters are invalid or out of range.
+        RuntimeError
+            If there is an unrecoverable error during the algorithm.
+        TimeoutError
+            If ``time_limit`` is reached.
+        """
+        if num_draws < 1:
+            raise ValueError("num_draws must be at least 1")
+
+        seed = seed or rand_u32()
+
+        mode_array, mode_json = preprocess_laplace_inputs(mode)
+
+        with self._get_model(data, seed) as model, self._get_options(
+            time_limit
+        ) as options:
+            req_params = self._num_req_constrained_params(model)
+            if mode_array is not None and len(mode_array) < req_params:
+                raise ValueError(
+                    "Mode array has incorrect length. "
+                    f"Expected at least {req_params} but got {len(mode_array)}"
+                )
+
+            param_names = LAPLACE_VARIABLES + self._get_parameter_names(model)
+
+            variables = self._get_variables(model, LAPLACE_VARIABLES)
+            num_params = len(param_names)
+            out = np.zeros((num_draws, num_params), dtype=np.float64)
+
+            model_params = self._num_free_params(model)
+            if hessian is not None and hessian.shape != (model_params, model_params):
+                raise ValueError(
+                    "Invalid Hessian size. "
+                    f"Expected a {(model_params, model_params)} matrix."
+                )
+            hessian_out = (
+                np.zeros((model_params, model_params), dtype=np.float64)
+                if save_hessian
+                else None
+            )
+            err = ctypes.pointer(ctypes.c_void_p())
+
+            rc = self._ffi_laplace(
+                model,
+                options,
+                mode_array,
+                mode_json,
+                seed,
+                num_draws,
+                jacobian,
+                calculate_lp,
+                refresh,
+                num_threads,
+                out,
+                out.size,
+                hessian,
+                hessian_out,
+                err,
+            )
+            self._raise_for_error(rc, err)
+
+        output = StanOutput(param_names, out, variables)
+        if save_hessian:
+            output.hessian = hessian_out
+        return output
+
+    def optimize_laplace(
+        self,
+        data: StanData = "",
+        *,
+        init: Optional[StanData] = None,
+        seed: Optional[int] = None,
+        id: int = 1,
+        init_radius: float = 2.0,
+        algorithm: OptimizationAlgorithm = OptimizationAlgorithm.LBFGS,
+        jacobian: bool = True,
+        num_iterations: int = 2000,
+        max_history_size: int = 5,
+        init_alpha: float = 0.001,
+        tol_obj: float = 1e-12,
+        tol_rel_obj: float = 1e4,
+        tol_grad: float = 1e-8,
+        tol_rel_grad: float = 1e7,
+        tol_param: float = 1e-8,
+        num_draws: int = 1000,
+        calculate_lp: bool = True,
+        save_hessian: bool = False,
+        refresh: int = 0,
+        num_threads: int = -1,
+        time_limit: Optional[float] = None,
+    ):
+        """
+        Optimize the model parameters, then sample from the Laplace
+        approximation at the mode.
+
+        This is equivalent to calling :meth:`optimize` and passing the result
+        to :meth:`laplace_sample`, but is done in a single call, with the
+        mode kept on the unconstrained scale in between.
+
+        Parameters are the same as for :meth:`optimize` and
+        :meth:`laplace_sample`, except as noted below.
+
+        Parameters
+        ----------
+        data : str | dict, optional
+            The data to use for the model. This can be a
+            path to a JSON file, a JSON string, or a dictionary.
+            By default, ""
         jacobian : bool, optional
             Whether to apply the Jacobian change of variables to the
-            log density. If False, the algorithm will find the MLE.
-            If True, the algorithm will find the MAP estimate.
-            By default False
-        num_iterations : int, optional
-            Maximum number of iterations to run the optimization,
-            by default 2000
-        max_history_size : int, optional
-            History size used to approximate the Hessian, by default 5
-        init_alpha : float, optional
-            Initial step size, by default 0.001
-        tol_obj : float, optional
-            Convergence tolerance for the objective function,
-            by default 1e-12
-        tol_rel_obj : float, optional
-            Relative convergence tolerance for the objective function,
-            by default 1e4
-        tol_grad : float, optional
-            Convergence tolerance for the gradient norm, by default 1e-8
-        tol_rel_grad : float, optional
-            Relative convergence tolerance for the gradient norm,
-            by default 1e7
-        tol_param : float, optional
-            Convergence tolerance for the changes in parameters,
-            by default 1e-8
-        refresh : int, optional
-            Number of iterations between progress messages, by default 0
-            (supress messages)
-        num_threads : int, optional
-            Number of threads to use for log density evaluations, by default -1
-            (use all available)
+            log density, both when optimizing and when sampling.
+            By default True (the MAP estimate).
+        num_draws : int, optional
+            Number of draws, by default 1000
+        save_hessian : bool, optional
+            Whether to save the Hessian matrix calculated at the mode,
+            by default False
 
         Returns
         -------
         StanOutput
-            An object containing the samples and metadata from the algorithm.
+            The draws from the Laplace approximation. The mode, as returned
+            by :meth:`optimize`, is available as the ``mode`` attribute.
 
         Raises
         ------
         ValueError
             If any of the parameters are invalid or out of range.
         RuntimeError
-            If there is an unrecoverable error during the algorithm.
+            If there is an unrecoverable error during the algorithm,
+            including an optimization which ends with an error.
+        TimeoutError
+            If ``time_limit`` is reached.
         """
+        if num_draws < 1:
+            raise ValueError("num_draws must be at least 1")
+
         seed = seed or rand_u32()
 
-        with self._get_model(data, seed) as model:
-            param_names = OPTIMIZE_VARIABLES + self._get_parameter_names(model)
+        with self._get_model(data, seed) as model, self._get_options(
+            time_limit
+        ) as options:
+            model_names = self._get_parameter_names(model)
+            mode_names = OPTIMIZE_VARIABLES + model_names
+            mode_variables = self._get_variables(model, OPTIMIZE_VARIABLES)
+            mode_out = np.zeros(len(mode_names), dtype=np.float64)
 
-            num_params = len(param_names)
-            out = np.zeros(num_params, dtype=np.float64)
+            param_names = LAPLACE_VARIABLES + model_names
+            variables = self._get_variables(model, LAPLACE_VARIABLES)
+            out = np.zeros((num_draws, len(param_names)), dtype=np.float64)
 
+            model_params = self._num_free_params(model)
+            hessian_out = (
+                np.zeros((model_params, model_params), dtype=np.float64)
+                if save_hessian
+                else None
+            )
             err = ctypes.pointer(ctypes.c_void_p())
-            rc = self._ffi_optimize(
+            rc = self._ffi_optimize_laplace(
                 model,
+                options,
                 self._encode_inits(init, 1, seed),
                 seed,
                 id,
@@ -921,70 +2900,118 @@ class Model:
                 tol_grad,
                 tol_rel_grad,
                 tol_param,
+                num_draws,
+                calculate_lp,
                 refresh,
                 num_threads,
+                mode_out,
+                mode_out.size,
                 out,
                 out.size,
+                hessian_out,
                 err,
             )
             self._raise_for_error(rc, err)
 
-        return StanOutput(param_names, out)
+        output = StanOutput(param_names, out, variables)
+        output.mode = StanOutput(mode_names, mode_out, mode_variables)
+        if save_hessian:
+            output.hessian = hessian_out
+        return output
 
-    def laplace_sample(
+    def variational(
         self,
-        mode: Union[StanOutput, np.ndarray, StanData],
         data: StanData = "",
         *,
+        init: Optional[StanData] = None,
         seed: Optional[int] = None,
+        id: int = 1,
+        init_radius: float = 2.0,
+        algorithm: VariationalAlgorithm = VariationalAlgorithm.MEANFIELD,
         num_draws: int = 1000,
-        jacobian: bool = True,
-        calculate_lp: bool = True,
-        save_hessian: bool = False,
+        grad_samples: int = 1,
+        elbo_samples: int = 100,
+        max_iterations: int = 10000,
+        tol_rel_obj: float = 0.01,
+        eta: float = 1.0,
+        adapt_engaged: bool = True,
+        adapt_iterations: int = 50,
+        eval_elbo: int = 100,
         refresh: int = 0,
         num_threads: int = -1,
+        time_limit: Optional[float] = None,
     ):
         """
-        Sample from the Laplace approximation of the posterior
-        centered at the provided mode.
+        Approximate the posterior with automatic differentiation
+        variational inference (ADVI).
+
+        A Gaussian on the unconstrained scale is fit by stochastic gradient
+        ascent on the ELBO, and draws from it are returned. More details can
+        be found in the Stan documentation at
+        https://mc-stan.org/docs/reference-manual/vi-algorithms.html
 
         Parameters
         ----------
-        mode : Union[StanOutput, np.ndarray, StanData]
-            The mode of the Laplace approximation. This can be a
-            StanOutput object from :meth:`~Model.optimize`, a numpy
-            array, a path to a JSON file, a JSON string, or a dictionary.
         data : str | dict, optional
             The data to use for the model. This can be a
             path to a JSON file, a JSON string, or a dictionary.
             By default, ""
+        init : str | dict | None, optional
+            Initial parameter values. This can be a
+            path to a JSON file, a JSON string, or a dictionary.
+            By default, ""
         seed : Optional[int], optional
             The seed to use for the random number generator.
             If not provided, a random seed will be generated.
+        id : int, optional
+            ID used to offset the random number generator, by default 1
+        init_radius : float, optional
+            Radius to initialize unspecified parameters within.
+            The parameter values are drawn uniformly from the interval
+            [-init_radius, init_radius] on the unconstrained scale.
+            By default 2.0
+        algorithm : VariationalAlgorithm, optional
+            Whether the Gaussian has a diagonal (``MEANFIELD``) or dense
+            (``FULLRANK``) covariance, by default MEANFIELD
         num_draws : int, optional
-            Number of draws, by default 1000
-        jacobian : bool, optional
-            Whether to apply the Jacobian change of variables to the
-            log density. **Note:** This should match the value used
-            when the mode was calculated.
-            By default True.
-        calculate_lp : bool, optional
-            Whether to calculate the log probability of the samples,
-            by default True
-        save_hessian : bool, optional
-            Whether to save the Hessian matrix calculated at the mode,
-            by default False
+            Number of approximate posterior draws, by default 1000
+        grad_samples : int, optional
+            Number of draws used to estimate each ELBO gradient, by default 1.
+            These are evaluated in parallel, so larger values give less noisy
+            steps at little extra cost when threads are available.
+        elbo_samples : int, optional
+            Number of draws used to estimate the ELBO, by default 100
+        max_iterations : int, optional
+            Maximum number of iterations, by default 10000
+        tol_rel_obj : float, optional
+            Relative tolerance on the change in the ELBO for convergence,
+            by default 0.01
+        eta : float, optional
+            Step size scaling, by default 1.0. Ignored if ``adapt_engaged``
+            is True.
+        adapt_engaged : bool, optional
+            Whether to choose ``eta`` automatically, by default True
+        adapt_iterations : int, optional
+            Number of iterations used to try each candidate ``eta``,
+            by default 50
+        eval_elbo : int, optional
+            Number of iterations between convergence checks, by default 100
         refresh : int, optional
-            Number of iterations between progress messages, by default 0
-            (supress messages)
+            If 0 (the default), progress messages are suppressed.
         num_threads : int, optional
-            Number of threads to use for log density evaluations, by default -1
-            (use all available)
+            Number of threads to use for the gradient estimates, by default -1
+            (use all available). The result does not depend on the number of
+            threads.
+        time_limit : float, optional
+            Seconds the algorithm may run for. If the limit is reached, a
+            ``TimeoutError`` is raised. By default there is no limit.
 
         Returns
         -------
         StanOutput
-            An object containing the samples and metadata from the algorithm.
+            An object containing the draws. The mean of the approximation,
+            in the same layout as a draw, is in its ``variational_mean``
+            attribute.
 
         Raises
         ------
@@ -992,52 +3019,358 @@ class Model:
             If any of the parameters are invalid or out of range.
         RuntimeError
             If there is an unrecoverable error during the algorithm.
+        TimeoutError
+            If ``time_limit`` is reached.
         """
         if num_draws < 1:
             raise ValueError("num_draws must be at least 1")
 
         seed = seed or rand_u32()
 
-        mode_array, mode_json = preprocess_laplace_inputs(mode)
-
-        with self._get_model(data, seed) as model:
-            req_params = self._num_req_constrained_params(model)
-            if mode_array is not None and len(mode_array) < req_params:
-                raise ValueError(
-                    "Mode array has incorrect length. "
-                    f"Expected at least {req_params} but got {len(mode_array)}"
-                )
+        with self._get_model(data, seed) as model, self._get_options(
+            time_limit
+        ) as options:
+            param_names = VARIATIONAL_VARIABLES + self._get_parameter_names(model)
+            variables = self._get_variables(model, VARIATIONAL_VARIABLES)
 
-            param_names = LAPLACE_VARIABLES + self._get_parameter_names(model)
             num_params = len(param_names)
-            out = np.zeros((num_draws, num_params), dtype=np.float64)
+            # the first row is the mean of the approximation
+            out = np.zeros((num_draws + 1, num_params), dtype=np.float64)
 
-            model_params = self._num_free_params(model)
-            hessian_out = (
-                np.zeros((model_params, model_params), dtype=np.float64)
-                if save_hessian
-                else None
-            )
             err = ctypes.pointer(ctypes.c_void_p())
-
-            rc = self._ffi_laplace(
+            rc = self._ffi_variational(
                 model,
-                mode_array,
-                mode_json,
+                options,
+                algorithm.value,
+                self._encode_inits(init, 1, seed),
                 seed,
+                id,
+                init_radius,
                 num_draws,
-                jacobian,
-                calculate_lp,
+                grad_samples,
+                elbo_samples,
+                max_iterations,
+                tol_rel_obj,
+                eta,
+                adapt_engaged,
+                adapt_iterations,
+                eval_elbo,
                 refresh,
                 num_threads,
                 out,
                 out.size,
-                hessian_out,
                 err,
             )
             self._raise_for_error(rc, err)
 
-        output = StanOutput(param_names, out)
-        if save_hessian:
-            output.hessian = hessian_out
+        output = StanOutput(param_names, out[1:], variables)
+        output.variational_mean = out[0]
+        return output
+
+    def loo(
+        self,
+        draws: Union[StanOutput, np.ndarray],
+        data: StanData = "",
+        *,
+        variable: str = "log_lik",
+        seed: Optional[int] = None,
+        num_threads: int = -1,
+        time_limit: Optional[float] = None,
+    ) -> LooOutput:
+        """
+        Estimate leave-one-out cross-validation with Pareto smoothed
+        importance sampling (PSIS-LOO).
+
+        The pointwise log likelihood is evaluated from the parameters of each
+        draw inside the library, in parallel, rather than read from the
+        output. Observations are then smoothed in parallel.
+
+        The draws are assumed to be independent. More details can be found in
+        Vehtari, Gelman, and Gabry (2017), https://arxiv.org/abs/1507.04544
+
+        Parameters
+        ----------
+        draws : StanOutput | np.ndarray
+            The draws to use, either the output of an algorithm or an array
+            with one draw per row, in the order of the model's parameters.
+            Only the values in the parameters block are used.
+        data : str | dict, optional
+            The data to use for the model. This can be a
+            path to a JSON file, a JSON string, or a dictionary.
+            By default, ""
+        variable : str, optional
+            Name of the variable holding the pointwise log likelihood, usually
+            a generated quantity. Each of its elements is an observation.
+            By default ``"log_lik"``
+        seed : Optional[int], optional
+            The seed for random numbers used by the generated quantities.
+            If not provided, a random seed will be generated.
+        num_threads : int, optional
+            Number of threads to use, by default -1 (use all available).
+            The result does not depend on the number of threads.
+        time_limit : float, optional
+            Seconds the computation may run for. If the limit is reached, a
+            ``TimeoutError`` is raised. By default there is no limit.
+
+        Returns
+        -------
+        LooOutput
+            The estimates, with each observation's contribution and Pareto
+            shape estimate. Shapes above 0.7 indicate an unreliable estimate.
+
+        Raises
+        ------
+        ValueError
+            If the variable does not exist or the draws are the wrong shape.
+        RuntimeError
+            If the variable cannot be evaluated.
+        TimeoutError
+            If ``time_limit`` is reached.
+        """
+        seed = seed or rand_u32()
+
+        with self._get_model(data, seed) as model, self._get_options(
+            time_limit
+        ) as options:
+            model_params = self._get_parameter_names(model)
+            num_obs = sum(
+                1
+                for name in model_params
+                if name == variable or name.startswith(variable + ".")
+            )
+
+            if isinstance(draws, StanOutput):
+                all_params = draws.raw_parameters
+                # any algorithm columns precede the model's parameters
+                offset = len(all_params) - len(model_params)
+                values = draws.data.reshape((-1, len(all_params)))[:, offset:]
+            else:
+                values = np.atleast_2d(draws)
+            values = np.ascontiguousarray(values, dtype=np.float64)
+            num_draws, stride = values.shape
+
+            elpd_loo = ctypes.c_double()
+            se_elpd_loo = ctypes.c_double()
+            p_loo = ctypes.c_double()
+            pointwise = np.zeros(num_obs, dtype=np.float64) if num_obs else None
+            pareto_k = np.zeros(num_obs, dtype=np.float64) if num_obs else None
+
+            err = ctypes.pointer(ctypes.c_void_p())
+            rc = self._ffi_loo(
+                model,
+                options,
+                variable.encode(),
+                values,
+                num_draws,
+                stride,
+                seed,
+                num_threads,
+                ctypes.byref(elpd_loo),
+                ctypes.byref(se_elpd_loo),
+                ctypes.byref(p_loo),
+                pointwise,
+                pareto_k,
+                err,
+            )
+            self._raise_for_error(rc, err)
+
+        return LooOutput(
+            elpd_loo.value, se_elpd_loo.value, p_loo.value, pointwise, pareto_k
+        )
+
+
+class Sampler:
+    """
+    NUTS chains which persist between calls, created by :meth:`Model.sampler`.
+
+    Each call to :meth:`warmup` or :meth:`draw` continues the chains from
+    where the last one left them. A sampler must only be used from one
+    thread at a time. It can be used as a context manager, which calls
+    :meth:`close` on exit.
+    """
+
+    def __init__(
+        self,
+        model: Model,
+        stack: contextlib.ExitStack,
+        sampler,
+        options,
+        num_chains: int,
+        num_free_params: int,
+        metric_shape: Tuple[int, ...],
+        param_names: List[str],
+        variables: Optional[Dict[str, Variable]],
+    ):
+        self._model = model
+        self._stack = stack
+        self._sampler = sampler
+        self._options = options
+        self.num_chains = num_chains
+        self._num_free_params = num_free_params
+        self._metric_shape = metric_shape
+        self._param_names = param_names
+        self._variables = variables
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    def close(self):
+        """Free the chains. The sampler cannot be used afterwards."""
+        if getattr(self, "_sampler", None):
+            self._model._ffi_sampler_destroy(self._sampler)
+            self._sampler = None
+            self._stack.close()
+
+    def _check_open(self):
+        if not self._sampler:
+            raise RuntimeError("The sampler has been closed")
+
+    def _output(self, rc, err, out) -> StanOutput:
+        draw_counts = self._model._draws_before_timeout(rc, err)
+        if draw_counts is not None:
+            out = out[:, : draw_counts.min()]
+        output = StanOutput(self._param_names, out, self._variables)
+        output.draw_counts = draw_counts
         return output
+
+    def warmup(
+        self,
+        num_warmup: int = 1000,
+        *,
+        init_buffer: int = 75,
+        term_buffer: int = 50,
+        window: int = 25,
+        save_warmup: bool = False,
+        refresh: int = 0,
+        num_threads: int = -1,
+    ) -> Optional[StanOutput]:
+        """
+        Adapt the step size and metric of the chains.
+
+        Each call runs a complete warmup of ``num_warmup`` iterations, as in
+        :meth:`Model.sample`, starting from the current positions, step
+        sizes, and metrics, so further calls refine them. If the call fails
+        or is interrupted, the chains keep the positions they reached but
+        their step sizes and metrics from before the call.
+
+        Parameters
+        ----------
+        num_warmup : int, optional
+            Number of warmup iterations to run, by default 1000
+        init_buffer, term_buffer, window : int, optional
+            The adaptation windows, as in :meth:`Model.sample`.
+        save_warmup : bool, optional
+            Whether to return the warmup draws, by default False
+        refresh : int, optional
+            Number of iterations between progress messages, by default 0
+        num_threads : int, optional
+            Number of threads to use, by default -1 (use all available)
+
+        Returns
+        -------
+        Optional[StanOutput]
+            The warmup draws if ``save_warmup`` is True, otherwise None.
+        """
+        self._check_open()
+        if num_warmup < 1:
+            raise ValueError("num_warmup must be at least 1")
+
+        out = None
+        if save_warmup:
+            out = np.zeros(
+                (self.num_chains, num_warmup, len(self._param_names)),
+                dtype=np.float64,
+            )
+        err = ctypes.pointer(ctypes.c_void_p())
+        rc = self._model._ffi_sampler_warmup(
+            self._sampler,
+            self._options,
+            num_warmup,
+            init_buffer,
+            term_buffer,
+            window,
+            refresh,
+            num_threads,
+            out,
+            0 if out is None else out.size,
+            err,
+        )
+        if out is None:
+            self._model._raise_for_error(rc, err)
+            return None
+        return self._output(rc, err, out)
+
+    def draw(
+        self, num_draws: int = 1000, *, refresh: int = 0, num_threads: int = -1
+    ) -> StanOutput:
+        """
+        Draw from the chains without adaptation.
+
+        Parameters
+        ----------
+        num_draws : int, optional
+            Number of draws from each chain, by default 1000
+        refresh : int, optional
+            Number of iterations between progress messages, by default 0
+        num_threads : int, optional
+            Number of threads to use, by default -1 (use all available)
+
+        Returns
+        -------
+        StanOutput
+            The draws. If the time limit was reached, they are truncated as
+            in :meth:`Model.sample`.
+        """
+        self._check_open()
+        if num_draws < 1:
+            raise ValueError("num_draws must be at least 1")
+
+        out = np.zeros(
+            (self.num_chains, num_draws, len(self._param_names)), dtype=np.float64
+        )
+        err = ctypes.pointer(ctypes.c_void_p())
+        rc = self._model._ffi_sampler_draw(
+            self._sampler,
+            self._options,
+            num_draws,
+            refresh,
+            num_threads,
+            out,
+            out.size,
+            err,
+        )
+        return self._output(rc, err, out)
+
+    @property
+    def positions(self) -> np.ndarray:
+        """The position of each chain on the unconstrained scale."""
+        self._check_open()
+        positions = np.zeros(
+            (self.num_chains, self._num_free_params), dtype=np.float64
+        )
+        self._model._ffi_sampler_state(self._sampler, positions, None, None)
+        return positions
+
+    @property
+    def stepsize(self) -> np.ndarray:
+        """The step size of each chain."""
+        self._check_open()
+        stepsize = np.zeros(self.num_chains, dtype=np.float64)
+        self._model._ffi_sampler_state(self._sampler, None, stepsize, None)
+        return stepsize
+
+    @property
+    def inv_metric(self) -> np.ndarray:
+        """The inverse metric of each chain, shaped as in :meth:`Model.sample`."""
+        self._check_open()
+        inv_metric = np.zeros(
+            (self.num_chains, *self._metric_shape), dtype=np.float64
+        )
+        self._model._ffi_sampler_state(self._sampler, None, None, inv_metric)
+        return inv_metric
@@ -1,7 +1,8 @@
-from typing import Dict, List, Optional, Union
+from typing import Dict, List, NamedTuple, Optional, Union
 
 import numpy as np
 import stanio
+from stanio.reshape import Variable
 
 
 class StanOutput:
@@ -20,15 +21,38 @@ class StanOutput:
     stepsize: Optional[np.ndarray]
     inv_metric: Optional[np.ndarray]
     hessian: Optional[np.ndarray]
-
-    def __init__(self, parameters: List[str], data: np.ndarray):
+    num_warmup: Optional[int]
+    return_codes: Optional[np.ndarray]
+    draw_counts: Optional[np.ndarray]
+    chain_errors: Optional[List[Optional[str]]]
+    variational_mean: Optional[np.ndarray]
+    mode: Optional["StanOutput"]
+    temperatures: Optional[np.ndarray]
+    swap_rates: Optional[np.ndarray]
+
+    def __init__(
+        self,
+        parameters: List[str],
+        data: np.ndarray,
+        variables: Optional[Dict[str, Variable]] = None,
+    ):
         self.raw_parameters = parameters
-        self._params = stanio.parse_header(",".join(parameters))
+        if variables is None:
+            variables = stanio.parse_header(",".join(parameters))
+        self._params = variables
         self._data = data
         # algorithm-specific attributes
         self.hessian = None
         self.inv_metric = None
         self.stepsize = None
+        self.num_warmup = None
+        self.return_codes = None
+        self.draw_counts = None
+        self.chain_errors = None
+        self.variational_mean = None
+        self.mode = None
+        self.temperatures = None
+        self.swap_rates = None
 
     @property
     def data(self) -> np.ndarray:
@@ -107,3 +131,20 @@ class StanOutput:
             {name: var.extract_reshape(data[idx]) for name, var in self._params.items()}
             for idx in idxs
         ]
+
+
+class LooOutput(NamedTuple):
+    """
+    Estimates from PSIS-LOO, see :meth:`~tinystan.Model.loo`.
+    """
+
+    elpd_loo: float
+    """The expected log pointwise predictive density."""
+    se_elpd_loo: float
+    """The standard error of ``elpd_loo``."""
+    p_loo: float
+    """The effective number of parameters."""
+    pointwise: np.ndarray
+    """Each observation's contribution to ``elpd_loo``."""
+    pareto_k: np.ndarray
+    """Each observation's Pareto shape estimate."""
@@ -0,0 +1,62 @@
+// Compare sampling throughput of the serial and threaded WASM builds.
+//
+// Build the same model twice with emscripten, with
+//
+//   LDFLAGS += -sMODULARIZE -sEXPORT_ES6 -sENVIRONMENT=node,worker
+//
+// in make/local: once with TINYSTAN_SERIAL=true, and once with
+// TINYSTAN_WASM_THREADS=true and TINYSTAN_WASM_SIMD=true. The model's .o file must be deleted between
+// the two builds, and the first .js and .wasm files moved aside. Then point
+// TINYSTAN_BENCH_SERIAL and TINYSTAN_BENCH_THREADED at the two .js files
+// and run `yarn bench`. TINYSTAN_BENCH_DATA may hold the model's data as a
+// JSON string.
+import { afterAll, bench, describe } from "vitest";
+import { pathToFileURL } from "node:url";
+import StanModel from "tinystan";
+import type { ModuleFactory } from "tinystan";
+
+const NUM_CHAINS = 4;
+const NUM_SAMPLES = 1000;
+const DATA = process.env.TINYSTAN_BENCH_DATA ?? "";
+
+const loadModel = async (path: string): Promise<StanModel> => {
+  const { default: createModule } = await import(pathToFileURL(path).href);
+  return StanModel.load(createModule as ModuleFactory, () => {});
+};
+
+const variants = [
+  { name: "serial", path: process.env.TINYSTAN_BENCH_SERIAL, num_threads: 1 },
+  {
+    name: "threaded",
+    path: process.env.TINYSTAN_BENCH_THREADED,
+    num_threads: -1,
+  },
+];
+
+for (const { name, path, num_threads } of variants) {
+  describe.skipIf(path === undefined)(name, async () => {
+    const model = await loadModel(path!);
+    let draws = 0;
+    let elapsed = 0;
+
+    bench(`${NUM_CHAINS} chains x ${NUM_SAMPLES} draws`, () => {
+      const start = performance.now();
+      model.sample({
+        data: DATA,
+        num_chains: NUM_CHAINS,
+        num_samples: NUM_SAMPLES,
+        refresh: 0,
+        num_threads,
+      });
+      elapsed += performance.now() - start;
+      draws += NUM_CHAINS * NUM_SAMPLES;
+    });
+
+    afterAll(() => {
+      if (elapsed > 0) {
+        const rate = (draws / elapsed) * 1000;
+        console.log(`${name}: ${rate.toFixed(0)} draws/sec`);
+      }
+    });
+  });
+}
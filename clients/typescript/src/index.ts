@@ -4,6 +4,8 @@ import type {
   PathfinderParams,
   PrintCallback,
   StanVariableInputs,
+  ModuleFactory,
+  ModuleVariants,
 } from "./types";
 export type {
   StanDraws,
@@ -11,6 +13,8 @@ export type {
   PathfinderParams,
   PrintCallback,
   StanVariableInputs,
+  ModuleFactory,
+  ModuleVariants,
 };
 
 import StanModel from "./model";
@@ -1,4 +1,4 @@
-import { prepareStanJSON } from "./util";
+import { prepareStanJSON, simdSupported, threadsSupported } from "./util";
 import {
   HMC_SAMPLER_VARIABLES,
   PATHFINDER_VARIABLES,
@@ -14,6 +14,8 @@ import type {
   StanVariableInputs,
   PrintCallback,
   StanDraws,
+  ModuleFactory,
+  ModuleVariants,
   internalTypes,
 } from "./types";
 type WasmModule = internalTypes["WasmModule"];
@@ -32,35 +34,58 @@ export default class StanModel {
   private printErrorCallback: PrintCallback | null;
   // used to send multiple JSON values in one string
   private sep: string;
-
-  private constructor(m: WasmModule, pc: PrintCallback | null) {
+  /** Whether the loaded module is the threaded build. */
+  public readonly threaded: boolean;
+
+  private constructor(
+    m: WasmModule,
+    pc: PrintCallback | null,
+    threaded: boolean,
+  ) {
     this.m = m;
     this.printErrorCallback = pc;
     this.sep = String.fromCharCode(m._tinystan_separator_char());
+    this.threaded = threaded;
   }
 
   /**
    * Load a StanModel from a WASM module.
    *
-   * @param {Function} createModule A function that resolves to a WASM module. This is
-   * much like the one Emscripten creates for you with `-sMODULARIZE`.
+   * @param {ModuleFactory | ModuleVariants} createModule A function that resolves
+   * to a WASM module. This is much like the one Emscripten creates for you with
+   * `-sMODULARIZE`. If both a serial and a threaded build of the model are
+   * given, the threaded build is used when the environment supports it.
    * @param {PrintCallback | null} printCallback A callback that will be called
    * with any print statements from Stan. If null, this will default to `console.log`.
    * @returns {Promise<StanModel>} A promise that resolves to a `StanModel`
    */
   public static async load(
-    createModule: (moduleArg?: object) => Promise<object>,
+    createModule: ModuleFactory | ModuleVariants,
     printCallback: PrintCallback | null = null,
     printErrorCallback: PrintCallback | null = null,
   ): Promise<StanModel> {
+    let factory: ModuleFactory;
+    let threaded = false;
+    if (typeof createModule === "function") {
+      factory = createModule;
+    } else {
+      const { serial, threaded: threadedFactory } = createModule;
+      const needsSimd = createModule.threadedUsesSimd ?? true;
+      threaded =
+        threadedFactory !== undefined &&
+        threadsSupported() &&
+        (!needsSimd || simdSupported());
+      factory = threaded ? threadedFactory! : serial;
+    }
+
     // Create the initial object which will have the rest of the WASM
     // functions attached to it
     // See https://emscripten.org/docs/api_reference/module.html
     printErrorCallback = printErrorCallback ?? printCallback;
     const prototype = { print: printCallback, printErr: printErrorCallback };
 
-    const module = await createModule(prototype);
-    return new StanModel(module as WasmModule, printErrorCallback);
+    const module = await factory(prototype);
+    return new StanModel(module as WasmModule, printErrorCallback, threaded);
   }
 
   private encodeString(s: string): cstr {
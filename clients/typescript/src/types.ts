@@ -13,6 +13,33 @@ export type StanVariableInputs = Record<string, unknown>;
  */
 export type PrintCallback = (s: string) => void;
 
+/**
+ * @typedef {Function} ModuleFactory
+ * A function that resolves to a WASM module, like the one Emscripten
+ * creates for you with `-sMODULARIZE`.
+ * @param {object} [moduleArg] Initial properties of the module.
+ * @returns {Promise<object>}
+ */
+export type ModuleFactory = (moduleArg?: object) => Promise<object>;
+
+/**
+ * @typedef {Object} ModuleVariants
+ * Builds of the same model for environments with different capabilities.
+ * @property {ModuleFactory} serial A build without threads or SIMD, which
+ * works everywhere.
+ * @property {ModuleFactory} [threaded] A build made with
+ * `TINYSTAN_WASM_THREADS` (and optionally `TINYSTAN_WASM_SIMD`). This is used
+ * when the environment supports `SharedArrayBuffer` and, if it was built
+ * with `TINYSTAN_WASM_SIMD`, WebAssembly SIMD.
+ * @property {boolean} [threadedUsesSimd=true] Whether the `threaded` build
+ * requires WebAssembly SIMD.
+ */
+export type ModuleVariants = {
+  serial: ModuleFactory;
+  threaded?: ModuleFactory;
+  threadedUsesSimd?: boolean;
+};
+
 /**
  * The metric used for the HMC sampler.
  * @enum {number}
@@ -83,8 +110,8 @@ export type StanDraws = {
  * If 0, no output is printed.
  * @property {number} [num_threads=-1] Number of threads to use for sampling.
  * If -1, the number of threads is determined by the number of available CPU cores.
- * May not be supported in all environments, and requires extra configuration
- * during the Emscripten compilation.
+ * May not be supported in all environments, and requires a model built with
+ * `TINYSTAN_WASM_THREADS`.
  */
 export interface SamplerParams {
   data: string | StanVariableInputs;
@@ -176,8 +203,8 @@ interface PathfinderUniqueParams {
  * If 0, no output is printed.
  * @property {number} [num_threads=-1] Number of threads to use for Pathfinder.
  * If -1, the number of threads is determined by the number of available CPU cores.
- * May not be supported in all environments, and requires extra configuration
- * during the Emscripten compilation.
+ * May not be supported in all environments, and requires a model built with
+ * `TINYSTAN_WASM_THREADS`.
  */
 export type PathfinderParams = LBFGSConfig & PathfinderUniqueParams;
 
@@ -28,3 +28,29 @@ export const printCallbackSponge = (): {
 
   return { printCallback, getStdout, clearStdout };
 };
+
+// Threaded Emscripten builds need SharedArrayBuffer, which browsers only
+// expose to cross-origin isolated pages. Node always provides it.
+export const threadsSupported = (): boolean => {
+  if (typeof SharedArrayBuffer === "undefined") {
+    return false;
+  }
+  const isolated = (globalThis as { crossOriginIsolated?: boolean })
+    .crossOriginIsolated;
+  return isolated ?? true;
+};
+
+// The smallest module using a SIMD instruction (i8x16.splat), taken
+// from https://github.com/GoogleChromeLabs/wasm-feature-detect
+const SIMD_TEST_MODULE = new Uint8Array([
+  0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10, 10, 1, 8,
+  0, 65, 0, 253, 15, 253, 98, 11,
+]);
+
+export const simdSupported = (): boolean => {
+  try {
+    return WebAssembly.validate(SIMD_TEST_MODULE);
+  } catch {
+    return false;
+  }
+};
@@ -1,5 +1,7 @@
-import { describe, expect, test } from "vitest";
+import { afterEach, describe, expect, test, vi } from "vitest";
+import StanModel from "tinystan";
 import { getMockedModel } from "./mocking/getMockedModel";
+import { mockModule } from "./mocking/WasmModule";
 import { HMCMetric } from "tinystan/types";
 import {
   HMC_SAMPLER_VARIABLES,
@@ -15,6 +17,40 @@ describe("test tinystan code with a mocked WASM module", () => {
     expect(mockedModule._tinystan_stan_version).toHaveBeenCalledTimes(1);
   });
 
+  describe("load function", () => {
+    afterEach(() => {
+      vi.unstubAllGlobals();
+    });
+
+    test("single module is treated as serial", async () => {
+      const model = await StanModel.load(async _ => mockModule({}));
+      expect(model.threaded).toBe(false);
+    });
+
+    test("threaded module is preferred when supported", async () => {
+      const serial = vi.fn(async _ => mockModule({}));
+      const threaded = vi.fn(async _ => mockModule({}));
+      const model = await StanModel.load({
+        serial,
+        threaded,
+        threadedUsesSimd: false,
+      });
+      expect(model.threaded).toBe(true);
+      expect(threaded).toHaveBeenCalledTimes(1);
+      expect(serial).toHaveBeenCalledTimes(0);
+    });
+
+    test("serial module is used without SharedArrayBuffer", async () => {
+      vi.stubGlobal("SharedArrayBuffer", undefined);
+      const serial = vi.fn(async _ => mockModule({}));
+      const threaded = vi.fn(async _ => mockModule({}));
+      const model = await StanModel.load({ serial, threaded });
+      expect(model.threaded).toBe(false);
+      expect(threaded).toHaveBeenCalledTimes(0);
+      expect(serial).toHaveBeenCalledTimes(1);
+    });
+  });
+
   describe("sample function", () => {
     test("null call behavior", async () => {
       const { mockedModule, model } = await getMockedModel({});
@@ -1,5 +1,10 @@
-import { describe, expect, test } from "vitest";
-import { printCallbackSponge, prepareStanJSON } from "tinystan/util";
+import { afterEach, describe, expect, test, vi } from "vitest";
+import {
+  printCallbackSponge,
+  prepareStanJSON,
+  simdSupported,
+  threadsSupported,
+} from "tinystan/util";
 
 describe("tinystan prepareStanJSON", () => {
   test("prepareStanJSON does not modify string objects", () => {
@@ -40,3 +45,27 @@ describe("printCallbackSponge is functional", () => {
     expect(getStdout()).toEqual("World\n");
   });
 });
+
+describe("feature detection", () => {
+  afterEach(() => {
+    vi.unstubAllGlobals();
+  });
+
+  test("threads are supported in Node", () => {
+    expect(threadsSupported()).toBe(true);
+  });
+
+  test("threads are not supported without SharedArrayBuffer", () => {
+    vi.stubGlobal("SharedArrayBuffer", undefined);
+    expect(threadsSupported()).toBe(false);
+  });
+
+  test("threads are not supported without cross-origin isolation", () => {
+    vi.stubGlobal("crossOriginIsolated", false);
+    expect(threadsSupported()).toBe(false);
+  });
+
+  test("simd detection returns a boolean", () => {
+    expect(typeof simdSupported()).toBe("boolean");
+  });
+});
@@ -112,16 +112,20 @@ TINYSTAN_PUBLIC void tinystan_optimize_R(
       static_cast<size_t>(*out_size), err);
 }
 
-/// see \link tinystan_laplace_sample() \endlink for details
+/// see \link tinystan_laplace_sample_with_hessian() \endlink for details
 TINYSTAN_PUBLIC
 void tinystan_laplace_sample_R(int* return_code, const TinyStanModel** model,
                                int* use_array, const double* theta_hat_constr,
                                const char** theta_hat_json, unsigned int* seed,
                                int* num_draws, int* jacobian, int* calculate_lp,
                                int* refresh, int* num_threads, double* out,
-                               int* out_size, int* save_hessian,
+                               int* out_size, int* use_hessian,
+                               const double* hessian_in, int* save_hessian,
                                double* hessian_out, TinyStanError** err) {
   //  difficult to directly pass a null pointer from R
+  const double* hessian_in_ptr = nullptr;
+  if (*use_hessian)
+    hessian_in_ptr = hessian_in;
   double* hessian_out_ptr = nullptr;
   if (*save_hessian)
     hessian_out_ptr = hessian_out;
@@ -134,10 +138,11 @@ void tinystan_laplace_sample_R(int* return_code, const TinyStanModel** model,
     theta_hat_json_ptr = *theta_hat_json;
   }
 
-  *return_code = tinystan_laplace_sample(
-      *model, theta_hat_dbl_ptr, theta_hat_json_ptr, *seed, *num_draws,
-      (*jacobian != 0), (*calculate_lp != 0), *refresh, *num_threads, out,
-      static_cast<size_t>(*out_size), hessian_out_ptr, err);
+  *return_code = tinystan_laplace_sample_with_hessian(
+      *model, nullptr, theta_hat_dbl_ptr, theta_hat_json_ptr, *seed,
+      *num_draws, (*jacobian != 0), (*calculate_lp != 0), *refresh,
+      *num_threads, out, static_cast<size_t>(*out_size), hessian_in_ptr,
+      hessian_out_ptr, err);
 }
 
 /// see \link tinystan_get_error_message() \endlink for details
@@ -0,0 +1,166 @@
+#ifndef TINYSTAN_ALGORITHMS_HPP
+#define TINYSTAN_ALGORITHMS_HPP
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "tinystan_types.h"
+
+/*
+ * Which algorithms are compiled into the library.
+ *
+ * By default, everything is. Building with, e.g.,
+ * `TINYSTAN_ALGORITHMS=nuts_diag,lbfgs` defines
+ * `TINYSTAN_ALGORITHMS_SELECTED` and one `TINYSTAN_ALGORITHM_*` macro for each
+ * requested algorithm, and the Stan services for the others are never
+ * included or instantiated. Calling an algorithm which was left out is a
+ * configuration error.
+ */
+#ifndef TINYSTAN_ALGORITHMS_SELECTED
+#define TINYSTAN_ALGORITHM_NUTS_UNIT
+#define TINYSTAN_ALGORITHM_NUTS_DENSE
+#define TINYSTAN_ALGORITHM_NUTS_DIAG
+#define TINYSTAN_ALGORITHM_NUTS_LOWRANK
+#define TINYSTAN_ALGORITHM_NUTS_AUTO
+#define TINYSTAN_ALGORITHM_PATHFINDER
+#define TINYSTAN_ALGORITHM_NEWTON
+#define TINYSTAN_ALGORITHM_BFGS
+#define TINYSTAN_ALGORITHM_LBFGS
+#define TINYSTAN_ALGORITHM_LAPLACE
+#define TINYSTAN_ALGORITHM_VARIATIONAL
+#endif
+
+namespace tinystan {
+namespace algorithms {
+
+struct algorithm_info {
+  const char *name;
+  bool available;
+};
+
+constexpr algorithm_info all[] = {
+#ifdef TINYSTAN_ALGORITHM_NUTS_UNIT
+    {"nuts_unit", true},
+#else
+    {"nuts_unit", false},
+#endif
+#ifdef TINYSTAN_ALGORITHM_NUTS_DENSE
+    {"nuts_dense", true},
+#else
+    {"nuts_dense", false},
+#endif
+#ifdef TINYSTAN_ALGORITHM_NUTS_DIAG
+    {"nuts_diag", true},
+#else
+    {"nuts_diag", false},
+#endif
+#ifdef TINYSTAN_ALGORITHM_NUTS_LOWRANK
+    {"nuts_lowrank", true},
+#else
+    {"nuts_lowrank", false},
+#endif
+#ifdef TINYSTAN_ALGORITHM_NUTS_AUTO
+    {"nuts_auto", true},
+#else
+    {"nuts_auto", false},
+#endif
+#ifdef TINYSTAN_ALGORITHM_PATHFINDER
+    {"pathfinder", true},
+#else
+    {"pathfinder", false},
+#endif
+#ifdef TINYSTAN_ALGORITHM_NEWTON
+    {"newton", true},
+#else
+    {"newton", false},
+#endif
+#ifdef TINYSTAN_ALGORITHM_BFGS
+    {"bfgs", true},
+#else
+    {"bfgs", false},
+#endif
+#ifdef TINYSTAN_ALGORITHM_LBFGS
+    {"lbfgs", true},
+#else
+    {"lbfgs", false},
+#endif
+#ifdef TINYSTAN_ALGORITHM_LAPLACE
+    {"laplace", true},
+#else
+    {"laplace", false},
+#endif
+#ifdef TINYSTAN_ALGORITHM_VARIATIONAL
+    {"variational", true},
+#else
+    {"variational", false},
+#endif
+};
+
+/**
+ * Whether the named algorithm was compiled into this library. Unknown names
+ * are reported as unavailable.
+ */
+inline bool available(const char *name) {
+  if (name == nullptr) {
+    return false;
+  }
+  for (const auto &algorithm : all) {
+    if (std::strcmp(algorithm.name, name) == 0) {
+      return algorithm.available;
+    }
+  }
+  return false;
+}
+
+/**
+ * Throw the error for calling an algorithm which was not compiled in.
+ */
+[[noreturn]] inline void unavailable(const char *name) {
+  throw std::invalid_argument(
+      std::string("Algorithm '") + name
+      + "' is not available: this model was compiled without it. Rebuild "
+        "the model with it included in TINYSTAN_ALGORITHMS.");
+}
+
+/**
+ * Throw unless the named algorithm was compiled in.
+ */
+inline void require(const char *name) {
+  if (!available(name)) {
+    unavailable(name);
+  }
+}
+
+inline const char *nuts_name(TinyStanMetric metric) {
+  switch (metric) {
+    case unit:
+      return "nuts_unit";
+    case dense:
+      return "nuts_dense";
+    case diagonal:
+      return "nuts_diag";
+    case lowrank:
+      return "nuts_lowrank";
+    case automatic:
+      return "nuts_auto";
+  }
+  return "nuts";
+}
+
+inline const char *optimizer_name(TinyStanOptimizationAlgorithm algorithm) {
+  switch (algorithm) {
+    case newton:
+      return "newton";
+    case bfgs:
+      return "bfgs";
+    case lbfgs:
+      return "lbfgs";
+  }
+  return "optimize";
+}
+
+}  // namespace algorithms
+}  // namespace tinystan
+
+#endif
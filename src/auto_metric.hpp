@@ -0,0 +1,292 @@
+#ifndef TINYSTAN_AUTO_METRIC_HPP
+#define TINYSTAN_AUTO_METRIC_HPP
+
+#include <stan/callbacks/logger.hpp>
+#include <stan/callbacks/writer.hpp>
+#include <stan/math/prim/fun/Eigen.hpp>
+#include <stan/mcmc/base_mcmc.hpp>
+#include <stan/mcmc/hmc/hamiltonians/ps_point.hpp>
+#include <stan/mcmc/hmc/nuts/dense_e_nuts.hpp>
+#include <stan/mcmc/hmc/nuts/diag_e_nuts.hpp>
+#include <stan/mcmc/sample.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace tinystan {
+namespace nuts {
+
+/*
+ * The automatic metric chooses between a diagonal and a dense inverse metric
+ * at the end of each warmup window. It is stored as a dense matrix, with a
+ * diagonal choice represented by a matrix whose off-diagonal entries are
+ * all zero, so that the choice is visible in `inv_metric_out`.
+ */
+
+/**
+ * Whether an inverse metric stored densely is a diagonal choice.
+ */
+inline bool is_diagonal(const Eigen::MatrixXd &inv_metric) {
+  const Eigen::Index n = inv_metric.rows();
+  for (Eigen::Index j = 0; j < n; ++j) {
+    for (Eigen::Index i = 0; i < n; ++i) {
+      if (i != j && inv_metric(i, j) != 0.0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief NUTS which runs with either a diagonal or a dense metric.
+ *
+ * Holds one sampler of each kind, sharing the model and RNG, and forwards to
+ * the one matching the current metric (see is_diagonal()). Both have the
+ * same sampler parameters, so the output does not depend on the choice.
+ *
+ * It also times its transitions, so that the cost of a leapfrog step with
+ * each metric can be compared, see timing_for().
+ */
+template <class Model, class BaseRNG>
+class auto_e_nuts : public stan::mcmc::base_mcmc {
+ public:
+  auto_e_nuts(const Model &model, BaseRNG &rng)
+      : diag(model, rng), dense(model, rng) {}
+
+  void set_metric(const Eigen::MatrixXd &inv_metric) {
+    const bool was_dense = use_dense;
+    use_dense = !is_diagonal(inv_metric);
+    // the newly active sampler continues from the current point, for
+    // init_stepsize() and anything else reading z() before a transition
+    if (use_dense && !was_dense) {
+      dense.z() = diag.z();
+    } else if (!use_dense && was_dense) {
+      diag.z() = dense.z();
+    }
+    if (use_dense) {
+      dense.set_metric(inv_metric);
+    } else {
+      diag.set_metric(Eigen::VectorXd(inv_metric.diagonal()));
+    }
+  }
+
+  bool dense_metric() const { return use_dense; }
+
+  void set_nominal_stepsize(double e) {
+    diag.set_nominal_stepsize(e);
+    dense.set_nominal_stepsize(e);
+  }
+
+  double get_nominal_stepsize() {
+    return use_dense ? dense.get_nominal_stepsize()
+                     : diag.get_nominal_stepsize();
+  }
+
+  void set_stepsize_jitter(double j) {
+    diag.set_stepsize_jitter(j);
+    dense.set_stepsize_jitter(j);
+  }
+
+  void set_max_depth(int d) {
+    diag.set_max_depth(d);
+    dense.set_max_depth(d);
+  }
+
+  stan::mcmc::ps_point &z() {
+    if (use_dense) {
+      return dense.z();
+    }
+    return diag.z();
+  }
+
+  void init_stepsize(stan::callbacks::logger &logger) {
+    if (use_dense) {
+      dense.init_stepsize(logger);
+    } else {
+      diag.init_stepsize(logger);
+    }
+  }
+
+  stan::mcmc::sample transition(stan::mcmc::sample &init_sample,
+                                stan::callbacks::logger &logger) override {
+    auto start = std::chrono::steady_clock::now();
+    stan::mcmc::sample s = use_dense ? dense.transition(init_sample, logger)
+                                     : diag.transition(init_sample, logger);
+    std::chrono::duration<double> elapsed
+        = std::chrono::steady_clock::now() - start;
+
+    std::vector<double> params;
+    get_sampler_params(params);
+    // stepsize__, treedepth__, n_leapfrog__, divergent__, energy__
+    double leapfrogs = params.size() > 2 ? params[2] : 0;
+    timing &t = use_dense ? dense_timing : diag_timing;
+    t.seconds += elapsed.count();
+    t.leapfrogs += leapfrogs;
+    return s;
+  }
+
+  void get_sampler_param_names(std::vector<std::string> &names) override {
+    active().get_sampler_param_names(names);
+  }
+
+  void get_sampler_params(std::vector<double> &values) override {
+    active().get_sampler_params(values);
+  }
+
+  void write_sampler_state(stan::callbacks::writer &writer) override {
+    active().write_sampler_state(writer);
+  }
+
+  void get_sampler_diagnostic_names(
+      std::vector<std::string> &model_names,
+      std::vector<std::string> &names) override {
+    active().get_sampler_diagnostic_names(model_names, names);
+  }
+
+  void get_sampler_diagnostics(std::vector<double> &values) override {
+    active().get_sampler_diagnostics(values);
+  }
+
+  /**
+   * Time spent in transitions with one kind of metric.
+   */
+  struct timing {
+    double seconds = 0;
+    double leapfrogs = 0;
+  };
+
+  const timing &timing_for(bool dense_metric) const {
+    return dense_metric ? dense_timing : diag_timing;
+  }
+
+ private:
+  stan::mcmc::base_mcmc &active() {
+    if (use_dense) {
+      return dense;
+    }
+    return diag;
+  }
+
+  stan::mcmc::diag_e_nuts<Model, BaseRNG> diag;
+  stan::mcmc::dense_e_nuts<Model, BaseRNG> dense;
+  bool use_dense = false;
+  timing diag_timing;
+  timing dense_timing;
+};
+
+/**
+ * Seconds per multiplication of a vector by `inv_metric`, timed over enough
+ * repetitions to take about a tenth of a millisecond.
+ */
+inline double matvec_seconds(const Eigen::MatrixXd &inv_metric) {
+  Eigen::VectorXd x = Eigen::VectorXd::Ones(inv_metric.rows());
+  Eigen::VectorXd y(inv_metric.rows());
+  int reps = 0;
+  auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed{0};
+  do {
+    y.noalias() = inv_metric * x;
+    x(0) = y(0) * 1e-300;  // keep the product from being optimized away
+    ++reps;
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed.count() < 1e-4 && reps < 10000);
+  return elapsed.count() / reps;
+}
+
+/**
+ * @brief Choose between the diagonal and dense forms of an estimated metric.
+ *
+ * The number of leapfrog steps NUTS needs grows roughly with the square root
+ * of the condition number of the posterior covariance after scaling by the
+ * metric. A dense metric removes all of it, while a diagonal one leaves that
+ * of the correlation matrix. Even for independent parameters, the sample
+ * correlation matrix of `n` draws in `D` dimensions has a condition number
+ * of about ((1 + sqrt(D/n)) / (1 - sqrt(D/n)))^2, so only the excess over
+ * this is counted.
+ *
+ * Against the reduction in steps, a dense metric costs two extra
+ * matrix-vector products per step. The cost of a step with each metric is
+ * the time measured during warmup, or for a metric not yet used, the time
+ * of the other adjusted by the measured cost of the products.
+ *
+ * The current choice is only changed if the other is estimated to be at
+ * least 20% faster, and is kept while there are fewer than four draws per
+ * dimension. The reasoning is reported through `logger`.
+ *
+ * @param covar The regularized covariance estimate of the window.
+ * @param num_draws The number of draws it was estimated from.
+ * @param current_dense Whether the dense metric is in use.
+ * @param diag_seconds Measured seconds per leapfrog step with a diagonal
+ * metric, or zero if unknown.
+ * @param dense_seconds The same with a dense metric.
+ * @return The metric to use, dense or with zero off-diagonal entries.
+ */
+inline Eigen::MatrixXd select_metric(const Eigen::MatrixXd &covar,
+                                     size_t num_draws, bool current_dense,
+                                     double diag_seconds, double dense_seconds,
+                                     stan::callbacks::logger &logger) {
+  const double switch_margin = 1.2;
+  const Eigen::Index dims = covar.rows();
+  Eigen::MatrixXd diag_only = covar.diagonal().asDiagonal();
+  if (dims < 2) {
+    return diag_only;
+  }
+
+  std::stringstream msg;
+  msg << "Automatic metric: ";
+  const double ratio = static_cast<double>(dims) / num_draws;
+  if (ratio > 0.25) {
+    msg << "too few draws (" << num_draws << ") for " << dims
+        << " parameters to compare metrics; keeping the "
+        << (current_dense ? "dense" : "diagonal") << " metric.";
+    logger.info(msg);
+    return current_dense ? covar : diag_only;
+  }
+
+  Eigen::VectorXd inv_sd = covar.diagonal().cwiseSqrt().cwiseInverse();
+  Eigen::MatrixXd corr = inv_sd.asDiagonal() * covar * inv_sd.asDiagonal();
+  Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigen(
+      corr, Eigen::EigenvaluesOnly);
+  const double condition
+      = eigen.eigenvalues().maxCoeff()
+        / std::max(eigen.eigenvalues().minCoeff(), 1e-300);
+  const double noise = std::pow(
+      (1 + std::sqrt(ratio)) / (1 - std::sqrt(ratio)), 2);
+  const double step_ratio = std::sqrt(std::max(1.0, condition / noise));
+
+  const double products = 2 * matvec_seconds(covar);
+  if (diag_seconds <= 0 && dense_seconds <= 0) {
+    diag_seconds = products;  // no timings; assume a cheap gradient
+  }
+  if (diag_seconds <= 0) {
+    diag_seconds = std::max(dense_seconds - products, 0.1 * dense_seconds);
+  }
+  if (dense_seconds <= 0) {
+    dense_seconds = diag_seconds + products;
+  }
+
+  // relative cost of the same amount of exploration
+  const double diag_cost = step_ratio * diag_seconds;
+  const double dense_cost = dense_seconds;
+  bool use_dense = current_dense ? dense_cost * switch_margin >= diag_cost
+                                 : diag_cost >= dense_cost * switch_margin;
+
+  msg << "the correlations have condition number " << condition << " ("
+      << noise << " expected from noise), so a diagonal metric needs about "
+      << step_ratio << " times the steps of a dense one. A step takes "
+      << diag_seconds << "s with a diagonal metric and " << dense_seconds
+      << "s with a dense one. Using the "
+      << (use_dense ? "dense" : "diagonal") << " metric.";
+  logger.info(msg);
+  return use_dense ? covar : diag_only;
+}
+
+}  // namespace nuts
+}  // namespace tinystan
+
+#endif
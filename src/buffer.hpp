@@ -21,12 +21,14 @@
 #include <stan/io/array_var_context.hpp>
 #include <stan/io/empty_var_context.hpp>
 
+#include <algorithm>
 #include <vector>
 #include <memory>
 #include <stdexcept>
 #include <string>
 
 #include "tinystan_types.h"
+#include "memory.hpp"
 
 namespace tinystan {
 namespace io {
@@ -41,7 +43,8 @@ namespace io {
  */
 class buffer_writer : public stan::callbacks::writer {
  public:
-  buffer_writer(double *buf, size_t max) : buf(buf), pos(0), size(max){};
+  buffer_writer(double *buf, size_t max)
+      : buf(buf), pos(0), size(max), call(memory::call_scope::current()){};
   virtual ~buffer_writer(){};
 
   /**
@@ -57,6 +60,7 @@ class buffer_writer : public stan::callbacks::writer {
 #endif
     std::memcpy(buf + pos, v.data(), sizeof(double) * v_size);
     pos += v_size;
+    count(v_size);
   }
 
   /**
@@ -72,6 +76,7 @@ class buffer_writer : public stan::callbacks::writer {
     // copy into buffer
     Eigen::Map<Eigen::MatrixXd>(buf + pos, m.cols(), m.rows()) = m.transpose();
     pos += m.size();
+    count(m.size());
   }
 
   void operator()(const Eigen::VectorXd &v) override {
@@ -84,6 +89,7 @@ class buffer_writer : public stan::callbacks::writer {
     // copy into buffer
     Eigen::Map<Eigen::RowVectorXd>(buf + pos, v.rows()) = v.transpose();
     pos += v.size();
+    count(v.size());
   }
 
   void operator()(const Eigen::RowVectorXd &v) override {
@@ -96,18 +102,50 @@ class buffer_writer : public stan::callbacks::writer {
     // copy into buffer
     Eigen::Map<Eigen::RowVectorXd>(buf + pos, v.cols()) = v;
     pos += v.size();
+    count(v.size());
   }
 
   bool is_valid() const noexcept override { return buf != nullptr; }
 
+  /**
+   * Number of doubles written so far.
+   */
+  size_t num_written() const noexcept { return pos; }
+
   using stan::callbacks::writer::operator();
 
  private:
+  void count(size_t n) {
+    if (call != nullptr) {
+      call->add_output(sizeof(double) * n);
+    }
+  }
+
   double *buf;
   size_t pos;
   size_t size;
+  memory::call_scope *call;
 };
 
+/**
+ * @brief Count the complete rows written by each writer.
+ *
+ * Used to report how much of the output is usable when an algorithm stops
+ * early.
+ *
+ * @param writers One writer per chain.
+ * @param row_size Number of doubles in each row (draw).
+ */
+inline std::vector<size_t> rows_written(
+    const std::vector<buffer_writer> &writers, size_t row_size) {
+  std::vector<size_t> rows;
+  rows.reserve(writers.size());
+  for (const auto &writer : writers) {
+    rows.push_back(writer.num_written() / row_size);
+  }
+  return rows;
+}
+
 /**
  * @brief Writer for structured data (e.g. inv_metric) of a specific key
  *
@@ -172,7 +210,10 @@ class inv_metric_buffer_reader : public stan::io::empty_var_context {
  public:
   inv_metric_buffer_reader(const double *buf, size_t size,
                            TinyStanMetric metric_choice)
-      : buf(buf), size(size), dense(metric_choice == TinyStanMetric::dense){};
+      : buf(buf),
+        size(size),
+        dense(metric_choice == TinyStanMetric::dense
+              || metric_choice == TinyStanMetric::automatic){};
   virtual ~inv_metric_buffer_reader(){};
 
   bool contains_r(const std::string &name) const override {
@@ -211,12 +252,48 @@ class inv_metric_buffer_reader : public stan::io::empty_var_context {
   bool dense;
 };
 
+/**
+ * Number of doubles in a flattened low-rank metric of the given rank: the
+ * variances, the eigenvectors, and their eigenvalues.
+ */
+inline size_t lowrank_size(size_t num_params, size_t rank) {
+  return num_params * (rank + 1) + rank;
+}
+
+/**
+ * The rank of a flattened low-rank metric with `size` doubles.
+ */
+inline size_t lowrank_rank(size_t num_params, size_t size) {
+  return (size - num_params) / (num_params + 1);
+}
+
+/**
+ * Number of doubles in one chain's inverse metric.
+ *
+ * @param rank The requested rank of a low-rank metric. It is capped at
+ * `num_params`, and ignored for the other metrics.
+ */
+inline size_t metric_size(TinyStanMetric metric_choice, size_t num_params,
+                          size_t rank) {
+  switch (metric_choice) {
+    case (TinyStanMetric::dense):
+    case (TinyStanMetric::automatic):
+      return num_params * num_params;
+    case (TinyStanMetric::lowrank):
+      return lowrank_size(num_params, std::min(rank, num_params));
+    default:
+      return num_params;
+  }
+}
+
 using var_ctx_ptr = std::unique_ptr<stan::io::var_context>;
 
 inline var_ctx_ptr default_metric(size_t num_params,
-                                  TinyStanMetric metric_choice) {
+                                  TinyStanMetric metric_choice, size_t rank) {
   switch (metric_choice) {
     case (TinyStanMetric::dense):
+    case (TinyStanMetric::automatic):
+      // the identity is diagonal, so the automatic metric starts diagonal
       return std::make_unique<stan::io::array_var_context>(
           stan::services::util::create_unit_e_dense_inv_metric(num_params));
 
@@ -224,6 +301,17 @@ inline var_ctx_ptr default_metric(size_t num_params,
       return std::make_unique<stan::io::array_var_context>(
           stan::services::util::create_unit_e_diag_inv_metric(num_params));
 
+    case (TinyStanMetric::lowrank): {
+      // unit variances, and eigenvalues of one make the eigenvectors unused
+      size_t size = metric_size(metric_choice, num_params, rank);
+      std::vector<double> vals(size, 0.0);
+      std::fill(vals.begin(), vals.begin() + num_params, 1.0);
+      std::fill(vals.end() - lowrank_rank(num_params, size), vals.end(), 1.0);
+      return std::make_unique<stan::io::array_var_context>(
+          std::vector<std::string>{"inv_metric"}, vals,
+          std::vector<std::vector<size_t>>{{size}});
+    }
+
     default:
       return std::make_unique<stan::io::empty_var_context>();
   }
@@ -232,23 +320,23 @@ inline var_ctx_ptr default_metric(size_t num_params,
 /**
  * Returns a vector containing metric initializations for each chain.
  * If the supplied buffer is null, this uses the default in Stan (identity)
+ *
+ * @param rank The rank of a low-rank metric, see metric_size().
  */
 inline std::vector<var_ctx_ptr> make_metric_inits(
     size_t num_chains, const double *buf, size_t num_params,
-    TinyStanMetric metric_choice) {
+    TinyStanMetric metric_choice, size_t rank) {
   std::vector<var_ctx_ptr> metrics;
   metrics.reserve(num_chains);
   if (buf == nullptr) {
     for (size_t i = 0; i < num_chains; ++i) {
-      metrics.push_back(default_metric(num_params, metric_choice));
+      metrics.push_back(default_metric(num_params, metric_choice, rank));
     }
   } else {
-    int metric_size = metric_choice == TinyStanMetric::dense
-                          ? num_params * num_params
-                          : num_params;
+    size_t size = metric_size(metric_choice, num_params, rank);
     for (size_t i = 0; i < num_chains; ++i) {
       metrics.push_back(std::make_unique<inv_metric_buffer_reader>(
-          buf + (i * metric_size), metric_size, metric_choice));
+          buf + (i * size), size, metric_choice));
     }
   }
   return metrics;
@@ -0,0 +1,43 @@
+#ifndef TINYSTAN_CALL_OPTIONS_HPP
+#define TINYSTAN_CALL_OPTIONS_HPP
+
+#include <cstddef>
+
+#include "tinystan_types.h"
+
+/**
+ * Settings of individual algorithm calls. See tinystan_create_call_options().
+ *
+ * Unlike the settings of a model, these can differ between calls running at
+ * the same time with one model. Each call copies them when it starts.
+ */
+struct TinyStanCallOptions {
+  /** Seconds the call may run for. Zero means no limit. */
+  double time_limit = 0;
+  /** Rank of the low-rank metric. Capped at the number of parameters. */
+  size_t metric_rank = 10;
+  /** Whether NUTS chains fail independently of each other */
+  bool isolate_chains = false;
+  /** Number of times a failed chain is restarted when isolated */
+  int max_chain_restarts = 0;
+  /** Whether multi-path Pathfinder resamples each path as it finishes */
+  bool stream_pathfinder = false;
+  /** Candidate inits screened for each chain or path. Zero means none. */
+  size_t init_candidates = 0;
+  /** Whether screening keeps the candidate with the highest log density */
+  bool select_best_init = false;
+};
+
+namespace tinystan {
+namespace call_options {
+
+/**
+ * The options of a call, which are the defaults if `options` is null.
+ */
+inline TinyStanCallOptions resolve(const TinyStanCallOptions *options) {
+  return options == nullptr ? TinyStanCallOptions() : *options;
+}
+
+}  // namespace call_options
+}  // namespace tinystan
+#endif
@@ -6,10 +6,13 @@
 #include <sstream>
 #include <string>
 #include <cstdlib>
+#include <memory>
 #include <mutex>
 #include <stdexcept>
+#include <vector>
 
 #include "tinystan_types.h"
+#include "messages.hpp"
 #include "model.hpp"
 
 struct TinyStanError {
@@ -20,6 +23,10 @@ struct TinyStanError {
 
   std::string msg;
   TinyStanErrorType type;
+  /** For timeouts, the number of draws each chain wrote before stopping */
+  std::vector<size_t> draw_counts;
+  /** For partial failures, each chain's error, empty if it succeeded */
+  std::vector<std::string> chain_errors;
 };
 
 namespace tinystan {
@@ -31,6 +38,36 @@ namespace error {
  */
 class interrupt_exception {};
 
+/**
+ * Exception thrown when an algorithm runs past its time limit.
+ * See tinystan::interrupt::deadline for more details.
+ *
+ * Algorithms which write their draws as they go fill in `draw_counts` before
+ * letting this propagate, so that the caller can use the partial output.
+ */
+class timeout_exception {
+ public:
+  std::vector<size_t> draw_counts;
+};
+
+/**
+ * Exception thrown when the process uses more memory than a call allows.
+ * See tinystan::memory::call_scope for more details.
+ */
+class memory_limit_exception {};
+
+/**
+ * Exception thrown when some chains of a call failed while the others
+ * completed, see tinystan_call_options_set_chain_isolation(). The failed
+ * chains'
+ * errors are listed in chain order, with an empty string for each chain
+ * which succeeded.
+ */
+class chain_failure_exception {
+ public:
+  std::vector<std::string> chain_errors;
+};
+
 /**
  * Catches exceptions and stores them in a TinyStanError.
  *
@@ -46,6 +83,37 @@ inline auto catch_exceptions(TinyStanError **err, F f) {
     if (err != nullptr) {
       *err = new TinyStanError("", TinyStanErrorType::interrupt);
     }
+  } catch (const timeout_exception &e) {
+    if (err != nullptr) {
+      *err = new TinyStanError("The time limit was reached",
+                               TinyStanErrorType::timeout);
+      (*err)->draw_counts = e.draw_counts;
+    }
+  } catch (const memory_limit_exception &e) {
+    if (err != nullptr) {
+      *err = new TinyStanError("The memory limit was reached",
+                               TinyStanErrorType::memory);
+    }
+  } catch (const chain_failure_exception &e) {
+    if (err != nullptr) {
+      size_t num_failed = 0;
+      std::string first;
+      for (const auto &chain_error : e.chain_errors) {
+        if (!chain_error.empty() && num_failed++ == 0) {
+          first = chain_error;
+        }
+      }
+      // with no usable output, this is an ordinary failure
+      bool all_failed = num_failed == e.chain_errors.size();
+      std::stringstream msg;
+      msg << num_failed << " of " << e.chain_errors.size()
+          << " chains failed. The first error was:\n"
+          << first;
+      *err = new TinyStanError(msg.str().c_str(),
+                               all_failed ? TinyStanErrorType::generic
+                                          : TinyStanErrorType::partial);
+      (*err)->chain_errors = e.chain_errors;
+    }
   } catch (const std::invalid_argument &e) {
     if (err != nullptr) {
       *err = new TinyStanError(e.what(), TinyStanErrorType::config);
@@ -73,35 +141,46 @@ inline auto catch_exceptions(TinyStanError **err, F f) {
 /**
  * Logger which captures errors for later retrieval.
  * Optionally prints-non errors using tinystanmodel.info and
- * tinystanmodel.warn.
+ * tinystanmodel.warn, batched if the model's message_options ask for it.
  */
 class error_logger : public stan::callbacks::logger {
  public:
   error_logger(const TinyStanModel &model, bool print_non_errors)
-      : model(model), print(print_non_errors){};
+      : model(model), print(print_non_errors) {
+    if (print && model.message_options.flush_interval_ms > 0) {
+      batch = std::make_unique<messages::batcher>(
+          model.message_options, [&model](const std::string &s, bool bad) {
+            if (bad) {
+              model.warn(s);
+            } else {
+              model.info(s);
+            }
+          });
+    }
+  };
   virtual ~error_logger(){};
 
   void info(const std::string &s) override {
     if (print && !s.empty()) {
-      model.info(s);
+      emit(s, false);
     }
   }
 
   void info(const std::stringstream &s) override {
     if (print && !s.str().empty()) {
-      model.info(s.str());
+      emit(s.str(), false);
     }
   }
 
   void warn(const std::string &s) override {
     if (print && !s.empty()) {
-      model.warn(s);
+      emit(s, true);
     }
   }
 
   void warn(const std::stringstream &s) override {
     if (print && !s.str().empty()) {
-      model.warn(s.str());
+      emit(s.str(), true);
     }
   }
 
@@ -143,10 +222,21 @@ class error_logger : public stan::callbacks::logger {
   }
 
  private:
+  void emit(const std::string &s, bool bad) {
+    if (batch) {
+      batch->push(s, bad);
+    } else if (bad) {
+      model.warn(s);
+    } else {
+      model.info(s);
+    }
+  }
+
   std::stringstream last_error;
   std::mutex error_mutex;
   const TinyStanModel &model;
   bool print;
+  std::unique_ptr<messages::batcher> batch;
 };
 
 template <typename T>
@@ -176,6 +266,61 @@ inline void check_between(const char *name, double val, double lb, double ub) {
   }
 }
 
+/**
+ * Logger for one of several chains which fail independently. Other messages
+ * are passed on to the logger of the call, marked as the chain's (see
+ * messages::chain_scope), but errors are kept for the chain.
+ */
+class chain_logger : public stan::callbacks::logger {
+ public:
+  chain_logger(stan::callbacks::logger &parent, unsigned int chain)
+      : parent(parent), chain(chain) {}
+
+  void info(const std::string &s) override {
+    messages::chain_scope scope(chain);
+    parent.info(s);
+  }
+  void info(const std::stringstream &s) override {
+    messages::chain_scope scope(chain);
+    parent.info(s);
+  }
+  void warn(const std::string &s) override {
+    messages::chain_scope scope(chain);
+    parent.warn(s);
+  }
+  void warn(const std::stringstream &s) override {
+    messages::chain_scope scope(chain);
+    parent.warn(s);
+  }
+  void error(const std::string &s) override { append(s); }
+  void error(const std::stringstream &s) override { append(s.str()); }
+  void fatal(const std::string &s) override { append(s); }
+  void fatal(const std::stringstream &s) override { append(s.str()); }
+
+  /**
+   * The errors logged so far, or "Unknown error" if there were none.
+   */
+  std::string get_error() const {
+    auto err = errors.str();
+    if (err.empty()) {
+      return "Unknown error";
+    }
+    err.pop_back();
+    return err;
+  }
+
+ private:
+  void append(const std::string &s) {
+    if (!s.empty()) {
+      errors << s << "\n";
+    }
+  }
+
+  stan::callbacks::logger &parent;
+  unsigned int chain;
+  std::stringstream errors;
+};
+
 }  // namespace error
 }  // namespace tinystan
 
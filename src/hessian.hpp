@@ -0,0 +1,132 @@
+#ifndef TINYSTAN_HESSIAN_HPP
+#define TINYSTAN_HESSIAN_HPP
+
+#include <stan/math/prim/fun/Eigen.hpp>
+#include <stan/model/log_prob_grad.hpp>
+#include <stan/model/model_base.hpp>
+#ifdef TINYSTAN_AD_HESSIAN
+#include <stan/math/mix.hpp>
+#endif
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <ostream>
+
+namespace tinystan {
+namespace hessian {
+
+namespace internal {
+
+#ifdef TINYSTAN_AD_HESSIAN
+/**
+ * Exact Hessian by forward-over-reverse nested autodiff.
+ *
+ * Each column is an independent nested reverse pass, so the columns are
+ * computed in parallel on the TBB pool.
+ */
+template <bool jacobian>
+inline void autodiff_hessian(const stan::model::model_base &model,
+                             const Eigen::VectorXd &theta,
+                             Eigen::MatrixXd &hessian) {
+  using fvar_var = stan::math::fvar<stan::math::var>;
+  const Eigen::Index dims = theta.size();
+  hessian.resize(dims, dims);
+
+  tbb::parallel_for(
+      tbb::blocked_range<Eigen::Index>(0, dims),
+      [&](const tbb::blocked_range<Eigen::Index> &r) {
+        for (Eigen::Index i = r.begin(); i != r.end(); ++i) {
+          stan::math::nested_rev_autodiff nested;
+          Eigen::Matrix<fvar_var, Eigen::Dynamic, 1> theta_fvar(dims);
+          for (Eigen::Index j = 0; j < dims; ++j) {
+            theta_fvar(j) = fvar_var(theta(j), i == j ? 1.0 : 0.0);
+          }
+          fvar_var lp
+              = model.template log_prob<true, jacobian>(theta_fvar, nullptr);
+          stan::math::grad(lp.d_.vi_);
+          for (Eigen::Index j = 0; j < dims; ++j) {
+            hessian(j, i) = theta_fvar(j).val_.adj();
+          }
+        }
+      });
+}
+#else
+/**
+ * Hessian by central finite differences of gradients.
+ *
+ * This uses the same stencil and step size as
+ * `stan::math::internal::finite_diff_hessian_auto`, but the `2 * D`
+ * gradient evaluations are spread over the TBB pool, one column at a time.
+ */
+template <bool jacobian>
+inline void finite_diff_hessian(const stan::model::model_base &model,
+                                const Eigen::VectorXd &theta,
+                                Eigen::MatrixXd &hessian) {
+  const Eigen::Index dims = theta.size();
+  Eigen::MatrixXd diffs(dims, dims);
+  const double cbrt_epsilon
+      = std::cbrt(std::numeric_limits<double>::epsilon());
+
+  tbb::parallel_for(
+      tbb::blocked_range<Eigen::Index>(0, dims),
+      [&](const tbb::blocked_range<Eigen::Index> &r) {
+        Eigen::VectorXd x(theta);
+        Eigen::VectorXd grad_plus;
+        Eigen::VectorXd grad_minus;
+        for (Eigen::Index i = r.begin(); i != r.end(); ++i) {
+          double epsilon = cbrt_epsilon * std::max(1.0, std::fabs(theta(i)));
+          x(i) = theta(i) + epsilon;
+          stan::model::log_prob_grad<true, jacobian>(model, x, grad_plus);
+          x(i) = theta(i) - epsilon;
+          stan::model::log_prob_grad<true, jacobian>(model, x, grad_minus);
+          x(i) = theta(i);
+          diffs.col(i) = (grad_plus - grad_minus) / (2 * epsilon);
+        }
+      });
+
+  hessian = 0.5 * (diffs + diffs.transpose());
+}
+#endif
+
+}  // namespace internal
+
+/**
+ * @brief Calculate the log density, its gradient, and its Hessian.
+ *
+ * The Hessian is computed in parallel over its columns. If TinyStan was built
+ * with `TINYSTAN_AD_HESSIAN`, which compiles the model with nested autodiff
+ * support, the Hessian is exact. Otherwise it is approximated by finite
+ * differences of gradients.
+ *
+ * @tparam jacobian Whether to include the Jacobian of the constraining
+ * transforms.
+ * @param[in] model The model.
+ * @param[in] theta The unconstrained parameters.
+ * @param[out] grad The gradient of the log density.
+ * @param[out] hessian The Hessian of the log density.
+ * @param[in, out] msgs Stream for messages printed by the model during the
+ * evaluation at `theta` itself.
+ * @return The log density, dropping constants.
+ */
+template <bool jacobian>
+inline double log_prob_hessian(const stan::model::model_base &model,
+                               const Eigen::VectorXd &theta,
+                               Eigen::VectorXd &grad, Eigen::MatrixXd &hessian,
+                               std::ostream *msgs = nullptr) {
+  Eigen::VectorXd x(theta);
+  double lp = stan::model::log_prob_grad<true, jacobian>(model, x, grad, msgs);
+#ifdef TINYSTAN_AD_HESSIAN
+  internal::autodiff_hessian<jacobian>(model, theta, hessian);
+#else
+  internal::finite_diff_hessian<jacobian>(model, theta, hessian);
+#endif
+  return lp;
+}
+
+}  // namespace hessian
+}  // namespace tinystan
+
+#endif
@@ -3,9 +3,14 @@
 
 #include <stan/math/prim/fun/Eigen.hpp>
 #include <stan/callbacks/interrupt.hpp>
+#include <atomic>
+#include <chrono>
 #include <csignal>
+#include <cstring>
+#include <mutex>
 
 #include "errors.hpp"
+#include "memory.hpp"
 
 #if TINYSTAN_ON_WINDOWS
 #define WIN32_LEAN_AND_MEAN
@@ -15,7 +20,46 @@
 namespace tinystan {
 namespace interrupt {
 
-static volatile std::sig_atomic_t interrupted = false;
+/**
+ * Number of interrupt signals received while a handler was installed. Each
+ * call remembers the count when it started, so that calls running at the same
+ * time do not reset each other's interrupted state.
+ */
+inline std::atomic<unsigned int> signals_received{0};
+
+/**
+ * @brief The point in time at which an algorithm should stop.
+ *
+ * Created once at the start of each call, from the model's time limit, so
+ * that calls made up of several algorithms (e.g. Pathfinder followed by NUTS)
+ * share a single budget.
+ */
+class deadline {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  deadline() : enabled(false) {}
+
+  /**
+   * A deadline `seconds` from now. If `seconds` is zero, there is none.
+   */
+  static deadline after(double seconds) {
+    deadline d;
+    if (seconds > 0) {
+      d.enabled = true;
+      d.end = clock::now()
+              + std::chrono::duration_cast<clock::duration>(
+                  std::chrono::duration<double>(seconds));
+    }
+    return d;
+  }
+
+  bool passed() const { return enabled && clock::now() >= end; }
+
+ private:
+  bool enabled;
+  clock::time_point end;
+};
 
 /**
  * @brief Interrupt handler for Stan
@@ -23,50 +67,107 @@ static volatile std::sig_atomic_t interrupted = false;
  * Wrapper around OS-specific interrupt handling. This class is used to
  * interrupt Stan's algorithms when the user presses `Ctrl+C`.
  *
- * This uses RAII to install a custom signal handler which is later
- * removed, restoring the previous handler if one existed.
+ * This uses RAII to install a custom signal handler while any algorithm is
+ * running. When the last of any concurrent calls finishes, the previous
+ * handler is restored. An interrupt stops every call running at the time.
+ *
+ * It also stops the algorithm, by throwing a timeout_exception, once the
+ * given deadline has passed, or a memory_limit_exception once the process
+ * uses more memory than the current call allows. Stan checks the handler once
+ * per iteration, so the algorithm stops at the end of its current iteration.
  */
 class tinystan_interrupt_handler : public stan::callbacks::interrupt {
-#if !TINYSTAN_ON_WINDOWS  // POSIX signals
  public:
-  tinystan_interrupt_handler() {
-    interrupted = false;
+  explicit tinystan_interrupt_handler(const deadline &limit = deadline())
+      : limit(limit), call(memory::call_scope::current()) {
+    auto &installed = handlers();
+    std::lock_guard<std::mutex> lock(installed.mutex);
+    seen = signals_received.load();
+    install(installed, installed.active++ == 0);
+  }
 
-    memset(&custom, 0, sizeof(custom));
-    sigemptyset(&custom.sa_mask);
-    sigaddset(&custom.sa_mask, SIGINT);
-    custom.sa_flags = SA_RESETHAND;
-    custom.sa_handler = &tinystan_interrupt_handler::signal_handler;
-    sigaction(SIGINT, &custom, &before);
+  /**
+   * Restore the original signal handler once no calls are running. Important
+   * for languages like Python's REPL where `Ctrl+C` is used to interrupt the
+   * current command, not terminate the program.
+   */
+  virtual ~tinystan_interrupt_handler() {
+    auto &installed = handlers();
+    std::lock_guard<std::mutex> lock(installed.mutex);
+    if (--installed.active == 0) {
+      uninstall(installed);
+    }
   }
 
   /**
-   * Restore the original signal handler. Important for languages like Python's
-   * REPL where `Ctrl+C` is used to interrupt the current command, not terminate
-   * the program.
+   * Check if the user has interrupted the program.
    */
-  virtual ~tinystan_interrupt_handler() { sigaction(SIGINT, &before, NULL); }
+  void operator()() {
+    if (signals_received.load(std::memory_order_relaxed) != seen) {
+      throw tinystan::error::interrupt_exception();
+    }
+    if (limit.passed()) {
+      throw tinystan::error::timeout_exception();
+    }
+    if (call != nullptr && call->over_limit()) {
+      throw tinystan::error::memory_limit_exception();
+    }
+  }
 
-  static void signal_handler(int signal) { interrupted = true; }
+  tinystan_interrupt_handler(const tinystan_interrupt_handler &) = delete;
+  tinystan_interrupt_handler(tinystan_interrupt_handler &&) = delete;
+  tinystan_interrupt_handler operator=(const tinystan_interrupt_handler &)
+      = delete;
+  tinystan_interrupt_handler operator=(tinystan_interrupt_handler &&) = delete;
 
  private:
-  struct sigaction before;
-  struct sigaction custom;
-
-#else  // Windows
- public:
-  tinystan_interrupt_handler() {
-    interrupted = false;
+  /**
+   * The handler shared by all running calls.
+   */
+  struct shared_state {
+    std::mutex mutex;
+    size_t active = 0;
+#if !TINYSTAN_ON_WINDOWS
+    struct sigaction before;
+#endif
+  };
 
-    SetConsoleCtrlHandler(tinystan_interrupt_handler::signal_handler, TRUE);
+  static shared_state &handlers() {
+    static shared_state state;
+    return state;
   }
 
+#if !TINYSTAN_ON_WINDOWS  // POSIX signals
   /**
-   * Remove our custom signal handler. Important for languages like Python's
-   * REPL where `Ctrl+C` is used to interrupt the current command, not terminate
-   * the program.
+   * The handler resets itself after one signal, so that a second `Ctrl+C`
+   * terminates the program as usual. Each new call installs it again.
    */
-  virtual ~tinystan_interrupt_handler() {
+  static void install(shared_state &state, bool first) {
+    struct sigaction custom;
+    memset(&custom, 0, sizeof(custom));
+    sigemptyset(&custom.sa_mask);
+    sigaddset(&custom.sa_mask, SIGINT);
+    custom.sa_flags = SA_RESETHAND;
+    custom.sa_handler = &tinystan_interrupt_handler::signal_handler;
+    sigaction(SIGINT, &custom, first ? &state.before : nullptr);
+  }
+
+  static void uninstall(shared_state &state) {
+    sigaction(SIGINT, &state.before, nullptr);
+  }
+
+  static void signal_handler(int signal) {
+    signals_received.fetch_add(1, std::memory_order_relaxed);
+  }
+
+#else  // Windows
+  static void install(shared_state &state, bool first) {
+    if (first) {
+      SetConsoleCtrlHandler(tinystan_interrupt_handler::signal_handler, TRUE);
+    }
+  }
+
+  static void uninstall(shared_state &state) {
     SetConsoleCtrlHandler(tinystan_interrupt_handler::signal_handler, FALSE);
   }
 
@@ -74,7 +175,7 @@ class tinystan_interrupt_handler : public stan::callbacks::interrupt {
     switch (type) {
       case CTRL_C_EVENT:
       case CTRL_BREAK_EVENT:
-        interrupted = true;
+        signals_received.fetch_add(1, std::memory_order_relaxed);
         return TRUE;
       default:
         return FALSE;
@@ -82,21 +183,9 @@ class tinystan_interrupt_handler : public stan::callbacks::interrupt {
   }
 #endif
 
- public:
-  /**
-   * Check if the user has interrupted the program.
-   */
-  void operator()() {
-    if (interrupted) {
-      throw tinystan::error::interrupt_exception();
-    }
-  }
-
-  tinystan_interrupt_handler(const tinystan_interrupt_handler &) = delete;
-  tinystan_interrupt_handler(tinystan_interrupt_handler &&) = delete;
-  tinystan_interrupt_handler operator=(const tinystan_interrupt_handler &)
-      = delete;
-  tinystan_interrupt_handler operator=(tinystan_interrupt_handler &&) = delete;
+  deadline limit;
+  memory::call_scope *call;
+  unsigned int seen;
 };
 
 }  // namespace interrupt
@@ -0,0 +1,152 @@
+#ifndef TINYSTAN_LAPLACE_HPP
+#define TINYSTAN_LAPLACE_HPP
+
+#include <stan/callbacks/interrupt.hpp>
+#include <stan/callbacks/logger.hpp>
+#include <stan/callbacks/structured_writer.hpp>
+#include <stan/callbacks/writer.hpp>
+#include <stan/math/prim/fun/Eigen.hpp>
+#include <stan/math/prim/prob/std_normal_rng.hpp>
+#include <stan/model/log_prob_propto.hpp>
+#include <stan/model/model_base.hpp>
+#include <stan/services/error_codes.hpp>
+#include <stan/services/util/create_rng.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "hessian.hpp"
+#include "messages.hpp"
+
+namespace tinystan {
+namespace laplace {
+
+/**
+ * @brief Sample from the Laplace approximation at a mode.
+ *
+ * This follows `stan::services::laplace_sample`, and produces the same
+ * output, with two differences:
+ *
+ * - The Hessian is computed with hessian::log_prob_hessian(), so that its
+ * columns are evaluated in parallel. If `hessian_in` is non-null, it is used
+ * instead and the Hessian is not computed at all.
+ * - Draws are generated, evaluated, and constrained in parallel. Draw `m` uses
+ * its own random number stream (`create_rng(seed, m + 1)`), so the output does
+ * not depend on the number of threads.
+ *
+ * Output printed by the model is collected per thread and logged after the
+ * draws are generated. If `model_output` is false (or `refresh` is zero), the
+ * model is not asked to print at all.
+ *
+ * @return A code from `stan::services::error_codes`.
+ */
+template <bool jacobian>
+int laplace_sample(const stan::model::model_base &model,
+                   const Eigen::VectorXd &theta_hat, const double *hessian_in,
+                   int num_draws, bool calculate_lp, unsigned int seed,
+                   int refresh, bool model_output,
+                   stan::callbacks::interrupt &interrupt,
+                   stan::callbacks::logger &logger,
+                   stan::callbacks::writer &sample_writer,
+                   stan::callbacks::structured_writer &hessian_writer) {
+  try {
+    const Eigen::Index num_unc_params = theta_hat.size();
+
+    std::vector<std::string> names{"log_p__", "log_q__"};
+    model.constrained_param_names(names, true, true);
+    sample_writer(names);
+    const size_t draw_size = names.size();
+
+    const bool print = model_output && refresh > 0;
+    Eigen::MatrixXd hessian;
+    if (hessian_in != nullptr) {
+      hessian = Eigen::Map<const Eigen::MatrixXd>(hessian_in, num_unc_params,
+                                                  num_unc_params);
+    } else {
+      if (refresh > 0) {
+        logger.info("Calculating Hessian");
+      }
+      interrupt();
+      std::stringstream msgs;
+      Eigen::VectorXd grad;
+      hessian::log_prob_hessian<jacobian>(model, theta_hat, grad, hessian,
+                                          print ? &msgs : nullptr);
+      logger.info(msgs);
+    }
+    hessian_writer.write("Hessian", hessian);
+
+    interrupt();
+    if (refresh > 0) {
+      logger.info("Calculating Cholesky factor");
+    }
+    Eigen::LLT<Eigen::MatrixXd> llt_neg_hessian(-hessian);
+    if (llt_neg_hessian.info() != Eigen::Success) {
+      throw std::domain_error(
+          "The Hessian is not negative definite at the provided mode");
+    }
+    const auto L_neg_hessian = llt_neg_hessian.matrixL();
+    Eigen::MatrixXd half_hessian = 0.5 * hessian;
+
+    if (refresh > 0) {
+      logger.info("Generating draws");
+    }
+    Eigen::MatrixXd draws(draw_size, num_draws);
+    messages::thread_buffers msgs(print);
+    tbb::parallel_for(
+        tbb::blocked_range<int>(0, num_draws),
+        [&](const tbb::blocked_range<int> &r) {
+          Eigen::VectorXd z(num_unc_params);
+          Eigen::VectorXd unc_draw(num_unc_params);
+          Eigen::VectorXd constrained;
+          std::ostream *draw_msgs = msgs.get();
+          for (int m = r.begin(); m != r.end(); ++m) {
+            interrupt();
+            if (refresh > 0 && m % refresh == 0) {
+              logger.info("iteration: " + std::to_string(m));
+            }
+            auto rng = stan::services::util::create_rng(seed, m + 1);
+            for (Eigen::Index n = 0; n < num_unc_params; ++n) {
+              z(n) = stan::math::std_normal_rng(rng);
+            }
+            // theta_hat + L^-T z has covariance (-H)^-1
+            unc_draw = theta_hat + L_neg_hessian.transpose().solve(z);
+
+            double log_p = std::numeric_limits<double>::quiet_NaN();
+            if (calculate_lp) {
+              log_p = stan::model::log_prob_propto<jacobian>(model, unc_draw,
+                                                             draw_msgs);
+            }
+            Eigen::VectorXd diff = unc_draw - theta_hat;
+            double log_q = diff.transpose() * half_hessian * diff;
+
+            model.write_array(rng, unc_draw, constrained, true, true,
+                              draw_msgs);
+            draws(0, m) = log_p;
+            draws(1, m) = log_q;
+            draws.col(m).tail(draw_size - 2) = constrained;
+          }
+        });
+    msgs.drain(logger);
+
+    std::vector<double> draw(draw_size);
+    for (int m = 0; m < num_draws; ++m) {
+      Eigen::VectorXd::Map(draw.data(), draw_size) = draws.col(m);
+      sample_writer(draw);
+    }
+  } catch (const std::exception &e) {
+    logger.error(e.what());
+    return stan::services::error_codes::SOFTWARE;
+  }
+  return stan::services::error_codes::OK;
+}
+
+}  // namespace laplace
+}  // namespace tinystan
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef TINYSTAN_LOO_HPP
+#define TINYSTAN_LOO_HPP
+
+#include <stan/callbacks/interrupt.hpp>
+#include <stan/callbacks/logger.hpp>
+#include <stan/math/prim/fun/Eigen.hpp>
+#include <stan/math/prim/fun/log_sum_exp.hpp>
+#include <stan/model/model_base.hpp>
+#include <stan/services/util/create_rng.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "messages.hpp"
+
+namespace tinystan {
+namespace loo {
+
+/**
+ * @brief Find a variable in the output of `write_array()`.
+ *
+ * @param model The model.
+ * @param name The name of a parameter, transformed parameter, or generated
+ * quantity.
+ * @return The offset of its first element, and its number of elements.
+ * @throw std::invalid_argument If the model has no such variable.
+ */
+inline std::pair<size_t, size_t> find_variable(
+    const stan::model::model_base &model, const std::string &name) {
+  std::vector<std::string> names;
+  model.get_param_names(names, true, true);
+  std::vector<std::vector<size_t>> dims;
+  model.get_dims(dims, true, true);
+
+  size_t offset = 0;
+  for (size_t i = 0; i < names.size(); ++i) {
+    size_t size = 1;
+    for (size_t d : dims[i]) {
+      size *= d;
+    }
+    if (names[i] == name) {
+      return {offset, size};
+    }
+    offset += size;
+  }
+  throw std::invalid_argument("Variable '" + name + "' not found in model");
+}
+
+/**
+ * @brief Fit a generalized Pareto distribution to exceedances.
+ *
+ * Uses the empirical Bayes estimate of Zhang and Stephens (2009), with the
+ * weakly informative prior on the shape used by the R package loo.
+ *
+ * @param x Positive exceedances, sorted in ascending order. At least two.
+ * @return The shape `k` and scale `sigma`.
+ */
+inline std::pair<double, double> gpd_fit(const Eigen::VectorXd &x) {
+  const Eigen::Index n = x.size();
+  const double prior = 3.0;
+  const Eigen::Index m = 30 + static_cast<Eigen::Index>(std::sqrt(n));
+  const double x_star = x(static_cast<Eigen::Index>(n / 4.0 + 0.5) - 1);
+
+  Eigen::VectorXd theta(m);
+  Eigen::VectorXd profile(m);
+  for (Eigen::Index j = 0; j < m; ++j) {
+    theta(j) = 1.0 / x(n - 1)
+               + (1.0 - std::sqrt(m / (j + 0.5))) / prior / x_star;
+    double k = (-theta(j) * x.array()).log1p().mean();
+    profile(j) = n * (std::log(-theta(j) / k) - k - 1.0);
+  }
+  Eigen::VectorXd weights = (profile.array() - profile.maxCoeff()).exp();
+  double theta_hat = theta.dot(weights) / weights.sum();
+
+  double k = (-theta_hat * x.array()).log1p().mean();
+  double sigma = -k / theta_hat;
+  // shrink towards 0.5, as if there were ten more observations
+  k = (k * n + 0.5 * 10) / (n + 10);
+  return {k, sigma};
+}
+
+/**
+ * The contribution of one observation to the PSIS-LOO estimates.
+ */
+struct pointwise {
+  double elpd_loo;
+  /** Log predictive density of the full posterior */
+  double lpd;
+  double pareto_k;
+};
+
+/**
+ * @brief Pareto smooth a set of log importance weights in place.
+ *
+ * The largest weights are replaced by the expected order statistics of a
+ * generalized Pareto fit to them, and all weights are truncated at the
+ * largest raw weight, as in the R package loo.
+ *
+ * @param log_weights The log weights, shifted so that the largest is zero.
+ * @return The Pareto shape estimate, or infinity if there are too few weights
+ * to fit the tail.
+ */
+inline double psis_smooth(Eigen::Ref<Eigen::VectorXd> log_weights) {
+  const Eigen::Index num_draws = log_weights.size();
+  const auto tail_len = static_cast<Eigen::Index>(
+      std::ceil(std::min(0.2 * num_draws, 3.0 * std::sqrt(num_draws))));
+  double k = std::numeric_limits<double>::infinity();
+  if (tail_len >= 5 && tail_len < num_draws) {
+    std::vector<Eigen::Index> order(num_draws);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](auto a, auto b) {
+      return log_weights(a) < log_weights(b);
+    });
+    const Eigen::Index tail_start = num_draws - tail_len;
+    // the largest weight is one after the shift above
+    const double cutoff = std::exp(log_weights(order[tail_start - 1]));
+
+    Eigen::VectorXd exceedances(tail_len);
+    for (Eigen::Index i = 0; i < tail_len; ++i) {
+      exceedances(i) = std::exp(log_weights(order[tail_start + i])) - cutoff;
+    }
+    double sigma;
+    std::tie(k, sigma) = gpd_fit(exceedances);
+
+    if (std::isfinite(k)) {
+      // replace the tail with the expected order statistics of the fit
+      for (Eigen::Index i = 0; i < tail_len; ++i) {
+        double p = (i + 0.5) / tail_len;
+        double q = std::abs(k) < 1e-12
+                       ? -sigma * std::log1p(-p)
+                       : sigma * std::expm1(-k * std::log1p(-p)) / k;
+        log_weights(order[tail_start + i]) = std::log(q + cutoff);
+      }
+    }
+  }
+  // truncate at the largest raw weight
+  log_weights = log_weights.cwiseMin(0.0);
+  return k;
+}
+
+/**
+ * @brief Pareto smoothed importance sampling LOO for one observation.
+ *
+ * This follows Vehtari, Gelman, and Gabry (2017) and the R package loo,
+ * assuming the draws are independent (a relative efficiency of one).
+ *
+ * @param log_lik The log likelihood of the observation at each draw.
+ */
+inline pointwise psis_loo(const Eigen::Ref<const Eigen::VectorXd> &log_lik) {
+  const Eigen::Index num_draws = log_lik.size();
+  Eigen::VectorXd log_weights = -log_lik;
+  log_weights.array() -= log_weights.maxCoeff();
+  double k = psis_smooth(log_weights);
+
+  pointwise result;
+  result.elpd_loo = stan::math::log_sum_exp(log_weights + log_lik)
+                    - stan::math::log_sum_exp(log_weights);
+  result.lpd = stan::math::log_sum_exp(log_lik) - std::log(num_draws);
+  result.pareto_k = k;
+  return result;
+}
+
+/**
+ * @brief Evaluate a variable at each draw.
+ *
+ * Draws are unconstrained and passed through `write_array()` in parallel,
+ * with draw `m` using the random number stream `create_rng(seed, m + 1)`, so
+ * the result does not depend on the number of threads. Only the requested
+ * elements are kept.
+ *
+ * @param draws Constrained parameter values, `stride` doubles per draw.
+ * @return The values, one draw per row.
+ */
+inline Eigen::MatrixXd evaluate_variable(
+    const stan::model::model_base &model, const double *draws,
+    size_t num_draws, size_t stride, size_t num_params, size_t offset,
+    size_t size, unsigned int seed, bool model_output,
+    stan::callbacks::interrupt &interrupt, stan::callbacks::logger &logger) {
+  Eigen::MatrixXd values(num_draws, size);
+  messages::thread_buffers msgs(model_output);
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, num_draws),
+      [&](const tbb::blocked_range<size_t> &r) {
+        Eigen::VectorXd unc_draw;
+        Eigen::VectorXd constrained;
+        std::ostream *draw_msgs = msgs.get();
+        for (size_t m = r.begin(); m != r.end(); ++m) {
+          interrupt();
+          Eigen::VectorXd draw
+              = Eigen::Map<const Eigen::VectorXd>(draws + m * stride,
+                                                  num_params);
+          model.unconstrain_array(draw, unc_draw, draw_msgs);
+          auto rng = stan::services::util::create_rng(seed, m + 1);
+          model.write_array(rng, unc_draw, constrained, true, true,
+                            draw_msgs);
+          values.row(m) = constrained.segment(offset, size).transpose();
+        }
+      });
+  msgs.drain(logger);
+  return values;
+}
+
+/**
+ * @brief Compute PSIS-LOO from the draws of a pointwise log likelihood.
+ *
+ * Observations are smoothed in parallel.
+ *
+ * @param log_lik The log likelihood, one draw per row and one observation per
+ * column.
+ * @param[out] elpd_loo The expected log pointwise predictive density.
+ * @param[out] se_elpd_loo Its standard error. NaN with one observation.
+ * @param[out] p_loo The effective number of parameters.
+ * @param[out] pointwise_elpd Each observation's contribution to `elpd_loo`.
+ * Can be null.
+ * @param[out] pareto_k Each observation's Pareto shape estimate. Can be null.
+ */
+inline void psis_loo(const Eigen::MatrixXd &log_lik, double &elpd_loo,
+                     double &se_elpd_loo, double &p_loo,
+                     double *pointwise_elpd, double *pareto_k) {
+  const Eigen::Index num_obs = log_lik.cols();
+  Eigen::VectorXd elpd(num_obs);
+  Eigen::VectorXd p(num_obs);
+  Eigen::VectorXd k(num_obs);
+  tbb::parallel_for(tbb::blocked_range<Eigen::Index>(0, num_obs),
+                    [&](const tbb::blocked_range<Eigen::Index> &r) {
+                      for (Eigen::Index i = r.begin(); i != r.end(); ++i) {
+                        pointwise result = psis_loo(log_lik.col(i));
+                        elpd(i) = result.elpd_loo;
+                        p(i) = result.lpd - result.elpd_loo;
+                        k(i) = result.pareto_k;
+                      }
+                    });
+
+  elpd_loo = elpd.sum();
+  p_loo = p.sum();
+  if (num_obs > 1) {
+    double variance = (elpd.array() - elpd.mean()).square().sum()
+                      / (num_obs - 1);
+    se_elpd_loo = std::sqrt(num_obs * variance);
+  } else {
+    se_elpd_loo = std::numeric_limits<double>::quiet_NaN();
+  }
+  if (pointwise_elpd != nullptr) {
+    Eigen::VectorXd::Map(pointwise_elpd, num_obs) = elpd;
+  }
+  if (pareto_k != nullptr) {
+    Eigen::VectorXd::Map(pareto_k, num_obs) = k;
+  }
+}
+
+}  // namespace loo
+}  // namespace tinystan
+
+#endif
@@ -0,0 +1,297 @@
+#ifndef TINYSTAN_LOWRANK_METRIC_HPP
+#define TINYSTAN_LOWRANK_METRIC_HPP
+
+#include <stan/callbacks/logger.hpp>
+#include <stan/io/var_context.hpp>
+#include <stan/math/prim/fun/Eigen.hpp>
+#include <stan/math/prim/prob/std_normal_rng.hpp>
+#include <stan/mcmc/hmc/hamiltonians/base_hamiltonian.hpp>
+#include <stan/mcmc/hmc/hamiltonians/ps_point.hpp>
+#include <stan/mcmc/hmc/integrators/expl_leapfrog.hpp>
+#include <stan/mcmc/hmc/nuts/base_nuts.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "buffer.hpp"
+
+namespace tinystan {
+namespace nuts {
+
+/*
+ * A low-rank plus diagonal inverse metric
+ *
+ *   M^-1 = S (I + U (diag(lambda) - I) U^T) S
+ *
+ * where S is the diagonal matrix of marginal standard deviations, and the
+ * `rank` orthonormal columns of U are the leading eigenvectors of the
+ * correlation matrix left once the draws are scaled by S^-1, with eigenvalues
+ * lambda. Applying it, or drawing a momentum, takes O(D * rank) operations
+ * rather than the O(D^2) of a dense metric.
+ *
+ * It is stored flattened as in io::metric_size(): the D variances (the
+ * diagonal of S^2), then U in column-major order, then lambda.
+ */
+
+/**
+ * @brief Phase space point for the low-rank plus diagonal metric.
+ */
+class lowrank_e_point : public stan::mcmc::ps_point {
+ public:
+  explicit lowrank_e_point(int n)
+      : stan::mcmc::ps_point(n),
+        scale(Eigen::VectorXd::Ones(n)),
+        basis(n, 0),
+        eigenvalues(0) {}
+
+  /**
+   * Set the metric from its flattened form.
+   */
+  void set_metric(const Eigen::VectorXd &inv_metric) {
+    const Eigen::Index n = q.size();
+    const Eigen::Index rank = io::lowrank_rank(n, inv_metric.size());
+    scale = inv_metric.head(n).cwiseSqrt();
+    basis = Eigen::Map<const Eigen::MatrixXd>(inv_metric.data() + n, n, rank);
+    eigenvalues = inv_metric.tail(rank);
+  }
+
+  /**
+   * M^-1 p
+   */
+  Eigen::VectorXd apply_inv_metric(const Eigen::VectorXd &p) const {
+    Eigen::VectorXd y = scale.cwiseProduct(p);
+    Eigen::VectorXd coefs = basis.transpose() * y;
+    y += basis * (eigenvalues.array() - 1.0).matrix().cwiseProduct(coefs);
+    return scale.cwiseProduct(y);
+  }
+
+  /**
+   * Turn a standard normal vector into a draw with covariance M.
+   */
+  Eigen::VectorXd scale_momentum(const Eigen::VectorXd &z) const {
+    Eigen::VectorXd coefs = basis.transpose() * z;
+    Eigen::VectorXd w
+        = z
+          + basis
+                * (eigenvalues.array().rsqrt() - 1.0).matrix().cwiseProduct(
+                    coefs);
+    return w.cwiseQuotient(scale);
+  }
+
+ private:
+  Eigen::VectorXd scale;
+  Eigen::MatrixXd basis;
+  Eigen::VectorXd eigenvalues;
+};
+
+/**
+ * @brief Euclidean Hamiltonian with a low-rank plus diagonal metric.
+ *
+ * Mirrors `stan::mcmc::diag_e_metric` and `stan::mcmc::dense_e_metric`.
+ */
+template <class Model, class BaseRNG>
+class lowrank_e_metric
+    : public stan::mcmc::base_hamiltonian<Model, lowrank_e_point, BaseRNG> {
+ public:
+  explicit lowrank_e_metric(const Model &model)
+      : stan::mcmc::base_hamiltonian<Model, lowrank_e_point, BaseRNG>(model) {}
+
+  double T(lowrank_e_point &z) {
+    return 0.5 * z.p.dot(z.apply_inv_metric(z.p));
+  }
+
+  double tau(lowrank_e_point &z) { return T(z); }
+
+  double phi(lowrank_e_point &z) { return this->V(z); }
+
+  double dG_dt(lowrank_e_point &z, stan::callbacks::logger &logger) {
+    return 2 * T(z) - z.q.dot(z.g);
+  }
+
+  Eigen::VectorXd dtau_dq(lowrank_e_point &z,
+                          stan::callbacks::logger &logger) {
+    return Eigen::VectorXd::Zero(this->model_.num_params_r());
+  }
+
+  Eigen::VectorXd dtau_dp(lowrank_e_point &z) {
+    return z.apply_inv_metric(z.p);
+  }
+
+  Eigen::VectorXd dphi_dq(lowrank_e_point &z,
+                          stan::callbacks::logger &logger) {
+    return z.g;
+  }
+
+  void sample_p(lowrank_e_point &z, BaseRNG &rng) {
+    Eigen::VectorXd u(z.p.size());
+    for (Eigen::Index i = 0; i < u.size(); ++i) {
+      u(i) = stan::math::std_normal_rng(rng);
+    }
+    z.p = z.scale_momentum(u);
+  }
+};
+
+/**
+ * @brief NUTS with a low-rank plus diagonal Euclidean metric.
+ */
+template <class Model, class BaseRNG>
+class lowrank_e_nuts
+    : public stan::mcmc::base_nuts<Model, lowrank_e_metric,
+                                   stan::mcmc::expl_leapfrog, BaseRNG> {
+ public:
+  lowrank_e_nuts(const Model &model, BaseRNG &rng)
+      : stan::mcmc::base_nuts<Model, lowrank_e_metric,
+                              stan::mcmc::expl_leapfrog, BaseRNG>(model, rng) {
+    this->name_ = "NUTS with a low-rank plus diagonal Euclidean metric";
+  }
+};
+
+/**
+ * @brief Estimate a low-rank plus diagonal inverse metric from draws.
+ *
+ * The variances are regularized as in Stan's diagonal adaptation. The
+ * eigenvalues are shrunk towards one by the same amount, i.e. towards the
+ * diagonal metric. With fewer draws than dimensions, the eigenvectors are
+ * found from the (draws x draws) Gram matrix, so the cost is linear in the
+ * number of parameters. Directions which the draws cannot resolve are left
+ * with an eigenvalue of one, where they have no effect.
+ *
+ * @param draws Unconstrained draws, one per column.
+ * @param rank The number of eigenvectors to keep, at most the dimension.
+ * @return The flattened inverse metric.
+ */
+inline Eigen::VectorXd estimate_lowrank_inv_metric(
+    const Eigen::MatrixXd &draws, size_t rank) {
+  const Eigen::Index dims = draws.rows();
+  const Eigen::Index num_draws = draws.cols();
+  const Eigen::Index k = std::min<Eigen::Index>(rank, dims);
+  const double n = static_cast<double>(num_draws);
+  const double shrinkage = n / (n + 5.0);
+
+  Eigen::MatrixXd centered = draws.colwise() - draws.rowwise().mean();
+  Eigen::VectorXd var = centered.rowwise().squaredNorm() / (n - 1.0);
+  var = shrinkage * var
+        + 1e-3 * (5.0 / (n + 5.0)) * Eigen::VectorXd::Ones(dims);
+
+  // scaled so that standardized * standardized^T is the correlation matrix
+  Eigen::MatrixXd standardized
+      = var.cwiseSqrt().cwiseInverse().asDiagonal() * centered
+        / std::sqrt(n - 1.0);
+
+  Eigen::VectorXd values;
+  Eigen::MatrixXd vectors;
+  if (dims <= num_draws) {
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigen(
+        standardized * standardized.transpose());
+    values = eigen.eigenvalues();
+    vectors = eigen.eigenvectors();
+  } else {
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigen(
+        standardized.transpose() * standardized);
+    values = eigen.eigenvalues();
+    vectors = standardized * eigen.eigenvectors();
+  }
+
+  Eigen::VectorXd inv_metric(io::lowrank_size(dims, k));
+  inv_metric.head(dims) = var;
+  Eigen::Map<Eigen::MatrixXd> basis(inv_metric.data() + dims, dims, k);
+  auto eigenvalues = inv_metric.tail(k);
+  basis.setZero();
+  eigenvalues.setOnes();
+
+  // eigenvalues are in increasing order
+  const double tol = 1e-10 * std::max(1.0, values.cwiseAbs().maxCoeff());
+  for (Eigen::Index j = 0; j < std::min<Eigen::Index>(k, values.size());
+       ++j) {
+    const Eigen::Index col = values.size() - 1 - j;
+    const double value = values(col);
+    if (!(value > tol)) {
+      break;
+    }
+    basis.col(j) = vectors.col(col).normalized();
+    eigenvalues(j) = shrinkage * value + (1.0 - shrinkage);
+  }
+  return inv_metric;
+}
+
+/**
+ * @brief Collects warmup draws for estimate_lowrank_inv_metric().
+ *
+ * Unlike the Welford estimators used for the other metrics, the eigenvectors
+ * need all of the draws in a window, so they are kept until restart().
+ */
+class lowrank_estimator {
+ public:
+  explicit lowrank_estimator(size_t num_params) : num_params(num_params) {}
+
+  void add_sample(const Eigen::VectorXd &q) { samples.push_back(q); }
+
+  void restart() { samples.clear(); }
+
+  size_t num_samples() const { return samples.size(); }
+
+  /**
+   * The collected draws, one per column.
+   */
+  Eigen::MatrixXd draws() const {
+    Eigen::MatrixXd out(num_params, samples.size());
+    for (size_t i = 0; i < samples.size(); ++i) {
+      out.col(i) = samples[i];
+    }
+    return out;
+  }
+
+ private:
+  size_t num_params;
+  std::vector<Eigen::VectorXd> samples;
+};
+
+/**
+ * @brief Read and check a flattened low-rank plus diagonal inverse metric.
+ *
+ * The rank is deduced from the length of `inv_metric`.
+ */
+inline Eigen::VectorXd read_lowrank_inv_metric(
+    stan::io::var_context &init, size_t num_params,
+    stan::callbacks::logger &logger) {
+  std::vector<double> vals = init.vals_r("inv_metric");
+  if (vals.size() < num_params
+      || (vals.size() - num_params) % (num_params + 1) != 0) {
+    std::stringstream msg;
+    msg << "Cannot read a low-rank metric for " << num_params
+        << " parameters from " << vals.size() << " values";
+    logger.error(msg);
+    throw std::domain_error("Initialization failure");
+  }
+  Eigen::VectorXd inv_metric
+      = Eigen::Map<const Eigen::VectorXd>(vals.data(), vals.size());
+
+  const size_t rank = io::lowrank_rank(num_params, vals.size());
+  Eigen::Map<const Eigen::MatrixXd> basis(inv_metric.data() + num_params,
+                                          num_params, rank);
+  bool valid = inv_metric.allFinite()
+               && (inv_metric.head(num_params).array() > 0).all()
+               && (inv_metric.tail(rank).array() > 0).all();
+  // columns must be orthonormal, except unused ones (eigenvalue one)
+  for (size_t j = 0; valid && j < rank; ++j) {
+    if (inv_metric(inv_metric.size() - rank + j) == 1.0) {
+      continue;
+    }
+    valid = std::fabs(basis.col(j).squaredNorm() - 1.0) < 1e-8;
+  }
+  if (!valid) {
+    logger.error(
+        "Low-rank inverse metric must have positive variances and "
+        "eigenvalues, and unit-length eigenvectors");
+    throw std::domain_error("Initialization failure");
+  }
+  return inv_metric;
+}
+
+}  // namespace nuts
+}  // namespace tinystan
+
+#endif
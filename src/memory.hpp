@@ -0,0 +1,316 @@
+#ifndef TINYSTAN_MEMORY_HPP
+#define TINYSTAN_MEMORY_HPP
+
+#include <stan/math/rev/core/chainablestack.hpp>
+#include <stan/math/rev/core/empty_nested.hpp>
+#include <stan/math/rev/core/recover_memory.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/partitioner.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+#if defined _WIN32 || defined __MINGW32__
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#elif defined __APPLE__
+#include <mach/mach.h>
+#elif defined __linux__
+#include <unistd.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace tinystan {
+namespace memory {
+
+/**
+ * Memory settings of a model. See tinystan_model_set_memory_options().
+ */
+struct options {
+  /** Whether to free autodiff memory at the end of each call */
+  bool release = false;
+  /**
+   * Resident memory of the whole process, in bytes, above which calls fail.
+   * Zero means none.
+   */
+  size_t limit = 0;
+};
+
+/**
+ * Statistics about one call. See tinystan_last_call_memory().
+ */
+struct call_stats {
+  size_t peak_resident_bytes = 0;
+  size_t peak_arena_bytes = 0;
+  size_t output_bytes = 0;
+};
+
+/**
+ * The resident memory of the process in bytes, or zero if it cannot be
+ * measured on this platform.
+ */
+inline size_t resident_bytes() {
+#if defined _WIN32 || defined __MINGW32__
+  PROCESS_MEMORY_COUNTERS counters;
+  if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                              sizeof(counters))) {
+    return counters.WorkingSetSize;
+  }
+  return 0;
+#elif defined __APPLE__
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                reinterpret_cast<task_info_t>(&info), &count)
+      == KERN_SUCCESS) {
+    return info.resident_size;
+  }
+  return 0;
+#elif defined __linux__
+  size_t pages = 0;
+  std::FILE *statm = std::fopen("/proc/self/statm", "r");
+  if (statm != nullptr) {
+    if (std::fscanf(statm, "%*zu %zu", &pages) != 1) {
+      pages = 0;
+    }
+    std::fclose(statm);
+  }
+  return pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+  return 0;
+#endif
+}
+
+/**
+ * The size of the calling thread's autodiff arena in bytes, or zero if it
+ * has none. Stan Math keeps the blocks of the arena between gradients, so
+ * this is also the most the thread has needed.
+ */
+inline size_t arena_bytes() {
+  auto *tape = stan::math::ChainableStack::instance_;
+  return tape == nullptr ? 0 : tape->memalloc_.bytes_allocated();
+}
+
+/**
+ * @brief Free the calling thread's autodiff memory.
+ *
+ * Stan Math keeps the largest arena each thread has needed, so that later
+ * gradients do not allocate. This returns all but its first block.
+ */
+inline void release_tape() {
+  auto *tape = stan::math::ChainableStack::instance_;
+  if (tape == nullptr || !stan::math::empty_nested()) {
+    return;
+  }
+  stan::math::recover_memory();
+  tape->var_stack_.shrink_to_fit();
+  tape->var_nochain_stack_.shrink_to_fit();
+  tape->var_alloc_stack_.shrink_to_fit();
+  tape->memalloc_.free_all();
+}
+
+/**
+ * Return freed heap memory to the operating system, where the allocator
+ * supports it.
+ */
+inline void release_heap() {
+#ifdef __GLIBC__
+  malloc_trim(0);
+#endif
+}
+
+/**
+ * @brief Free the autodiff memory of every idle TBB worker thread.
+ *
+ * Workers keep their tapes after a call ends, whichever arena they worked
+ * in. This runs one task for each thread of the default pool in a new arena.
+ * Each task waits, for at most 50 milliseconds, until all have started, so
+ * that they run on different threads, and then frees its thread's tape.
+ * Workers busy in other calls do not join in, and keep their memory.
+ */
+inline void release_worker_tapes() {
+#ifdef STAN_THREADS
+  const int num_threads = std::max(1U, std::thread::hardware_concurrency());
+  const auto give_up
+      = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+  std::atomic<int> started{0};
+  tbb::task_arena arena(num_threads);
+  arena.execute([&]() {
+    tbb::parallel_for(
+        tbb::blocked_range<int>(0, num_threads, 1),
+        [&](const tbb::blocked_range<int> &r) {
+          started.fetch_add(static_cast<int>(r.size()));
+          while (started.load() < num_threads
+                 && std::chrono::steady_clock::now() < give_up) {
+            std::this_thread::yield();
+          }
+          release_tape();
+        },
+        tbb::simple_partitioner());
+  });
+#endif
+}
+
+/**
+ * @brief Memory accounting and limits for one call into the library.
+ *
+ * Created on the calling thread at the start of each algorithm, inside the
+ * call's arena (see util::with_threads()). Objects created during the call
+ * (output writers, interrupt handlers) find it with current(), and may then
+ * use it from any thread.
+ *
+ * The arena bytes of the call are the sizes of the autodiff arenas of the
+ * threads which worked on it, summed. Each thread's size is recorded when it
+ * checks the limit and when it leaves the call's arena. Arenas only grow
+ * until they are released, so this is their peak.
+ *
+ * Resident memory is sampled at most every 10 milliseconds, whenever
+ * over_limit() is called (once per iteration, by the interrupt handler). It
+ * is that of the whole process, so the limit also counts memory used by
+ * other calls running at the same time.
+ */
+class call_scope {
+ public:
+  explicit call_scope(const options &opts)
+      : opts(opts), previous(current_ptr()) {
+    current_ptr() = this;
+    sample();
+    observer.emplace(*this);
+  }
+
+  ~call_scope() {
+    sample();
+    observer.reset();
+    record_arena();
+    if (opts.release) {
+      release_tape();
+      release_worker_tapes();
+      release_heap();
+    }
+    last().peak_resident_bytes = peak.load();
+    last().peak_arena_bytes = total_arena_bytes();
+    last().output_bytes = output.load();
+    current_ptr() = previous;
+  }
+
+  call_scope(const call_scope &) = delete;
+  call_scope &operator=(const call_scope &) = delete;
+
+  /**
+   * The call running on this thread, or null outside of one.
+   */
+  static call_scope *current() { return current_ptr(); }
+
+  /**
+   * The statistics of the last call made from this thread.
+   */
+  static call_stats &last() {
+    static thread_local call_stats stats;
+    return stats;
+  }
+
+  void add_output(size_t bytes) {
+    output.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  /**
+   * Record the calling thread's arena size, sample the resident memory if
+   * it is due, and check it against the limit.
+   */
+  bool over_limit() {
+    record_arena();
+    auto now = clock::now().time_since_epoch().count();
+    auto due = next_sample.load(std::memory_order_relaxed);
+    if (now >= due
+        && next_sample.compare_exchange_strong(due, now + sample_interval)) {
+      return sample() > opts.limit && opts.limit > 0;
+    }
+    return false;
+  }
+
+ private:
+  using clock = std::chrono::steady_clock;
+  static constexpr clock::rep sample_interval
+      = std::chrono::duration_cast<clock::duration>(
+            std::chrono::milliseconds(10))
+            .count();
+
+  /**
+   * Records each worker's arena as it leaves the call's arena, and frees it
+   * if the call releases memory. Workers only leave once they have no more
+   * work, so their tapes are empty by then.
+   */
+  class worker_observer : public tbb::task_scheduler_observer {
+   public:
+    explicit worker_observer(call_scope &call) : call(call) { observe(true); }
+    ~worker_observer() { observe(false); }
+
+    void on_scheduler_exit(bool worker) override {
+      if (worker) {
+        call.record_arena();
+        if (call.opts.release) {
+          release_tape();
+        }
+      }
+    }
+
+   private:
+    call_scope &call;
+  };
+
+  static call_scope *&current_ptr() {
+    static thread_local call_scope *call = nullptr;
+    return call;
+  }
+
+  size_t sample() {
+    size_t bytes = resident_bytes();
+    size_t seen = peak.load(std::memory_order_relaxed);
+    while (bytes > seen && !peak.compare_exchange_weak(seen, bytes)) {
+    }
+    return bytes;
+  }
+
+  void record_arena() {
+    size_t bytes = arena_bytes();
+    std::lock_guard<std::mutex> lock(arena_mutex);
+    size_t &seen = thread_arena_bytes[std::this_thread::get_id()];
+    seen = std::max(seen, bytes);
+  }
+
+  size_t total_arena_bytes() {
+    std::lock_guard<std::mutex> lock(arena_mutex);
+    size_t total = 0;
+    for (const auto &entry : thread_arena_bytes) {
+      total += entry.second;
+    }
+    return total;
+  }
+
+  options opts;
+  call_scope *previous;
+  std::atomic<size_t> peak{0};
+  std::atomic<size_t> output{0};
+  std::atomic<clock::rep> next_sample{0};
+  std::mutex arena_mutex;
+  std::unordered_map<std::thread::id, size_t> thread_arena_bytes;
+  std::optional<worker_observer> observer;
+};
+
+}  // namespace memory
+}  // namespace tinystan
+
+#endif
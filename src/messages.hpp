@@ -0,0 +1,235 @@
+#ifndef TINYSTAN_MESSAGES_HPP
+#define TINYSTAN_MESSAGES_HPP
+
+#include <tbb/concurrent_queue.h>
+#include <tbb/enumerable_thread_specific.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#ifdef STAN_THREADS
+#include <condition_variable>
+#include <thread>
+#endif
+
+namespace tinystan {
+namespace messages {
+
+/**
+ * How progress and diagnostic messages reach the print callback.
+ * See tinystan_model_set_message_batching().
+ */
+struct options {
+  /** Milliseconds between deliveries. If zero, messages are not batched. */
+  int flush_interval_ms = 0;
+  /** Number of messages which can wait for delivery. */
+  size_t capacity = 1024;
+  /** Whether to drop new messages, rather than wait, when the queue is full */
+  bool drop_when_full = false;
+  /** Whether batched messages are prefixed with their chain and time */
+  bool tag = false;
+};
+
+/**
+ * The chain whose messages the calling thread is logging, or -1 if unknown.
+ * See chain_scope.
+ */
+inline long &current_chain() {
+  static thread_local long chain = -1;
+  return chain;
+}
+
+/**
+ * Marks the messages logged by this thread while it exists as belonging to
+ * a chain (or Pathfinder path), so that batched messages can be tagged.
+ */
+class chain_scope {
+ public:
+  explicit chain_scope(unsigned int chain) : previous(current_chain()) {
+    current_chain() = chain;
+  }
+  chain_scope(const chain_scope &) = delete;
+  chain_scope &operator=(const chain_scope &) = delete;
+  ~chain_scope() { current_chain() = previous; }
+
+ private:
+  long previous;
+};
+
+/**
+ * Collects messages from any number of threads and delivers them in batches.
+ *
+ * Threads only enqueue, so sampler threads do not contend on (or wait for)
+ * the print callback. Consecutive messages of the same severity are joined
+ * with newlines and delivered with a single call, either by a timer thread
+ * every `flush_interval_ms`, when the queue fills up, or when the batcher is
+ * destroyed at the end of a run.
+ *
+ * When the queue is full, the pushing thread either delivers the backlog
+ * itself or, with `drop_when_full`, discards its message. The number of
+ * dropped messages is reported as a warning with the next batch.
+ *
+ * With `tag`, each message records the chain of the thread which pushed it
+ * (see chain_scope) and when it was pushed, and is delivered prefixed with
+ * both, e.g. `[chain 2, 1.250s] `. Times are seconds since the batcher was
+ * created, that is, since the start of the call.
+ */
+class batcher {
+ public:
+  using sink_t = std::function<void(const std::string &, bool)>;
+
+  batcher(const options &opts, sink_t sink)
+      : sink(std::move(sink)),
+        drop_when_full(opts.drop_when_full),
+        tag(opts.tag),
+        start(std::chrono::steady_clock::now()) {
+    queue.set_capacity(static_cast<std::ptrdiff_t>(opts.capacity));
+#ifdef STAN_THREADS
+    timer = std::thread([this, interval = opts.flush_interval_ms]() {
+      std::unique_lock<std::mutex> lock(timer_mutex);
+      while (!timer_cv.wait_for(lock, std::chrono::milliseconds(interval),
+                                [this]() { return stopping; })) {
+        lock.unlock();
+        flush();
+        lock.lock();
+      }
+    });
+#endif
+  }
+
+  batcher(const batcher &) = delete;
+  batcher &operator=(const batcher &) = delete;
+
+  ~batcher() {
+#ifdef STAN_THREADS
+    {
+      std::lock_guard<std::mutex> lock(timer_mutex);
+      stopping = true;
+    }
+    timer_cv.notify_one();
+    timer.join();
+#endif
+    flush();
+  }
+
+  void push(std::string text, bool bad) {
+    message msg{std::move(text), bad, current_chain(),
+                std::chrono::steady_clock::now()};
+    while (!queue.try_push(msg)) {
+      if (drop_when_full) {
+        ++dropped;
+        return;
+      }
+      flush();
+    }
+  }
+
+  /**
+   * Deliver everything queued so far. Safe to call from any thread; only one
+   * thread delivers at a time, so messages keep their order.
+   */
+  void flush() {
+    std::lock_guard<std::mutex> lock(flush_mutex);
+    std::string batch;
+    bool batch_bad = false;
+    message msg;
+    while (queue.try_pop(msg)) {
+      if (!batch.empty() && msg.bad != batch_bad) {
+        sink(batch, batch_bad);
+        batch.clear();
+      }
+      if (!batch.empty()) {
+        batch += '\n';
+      }
+      if (tag) {
+        batch += prefix(msg);
+      }
+      batch += msg.text;
+      batch_bad = msg.bad;
+    }
+    if (!batch.empty()) {
+      sink(batch, batch_bad);
+    }
+    size_t num_dropped = dropped.exchange(0);
+    if (num_dropped > 0) {
+      sink(std::to_string(num_dropped)
+               + " message(s) were dropped because the queue was full",
+           true);
+    }
+  }
+
+ private:
+  struct message {
+    std::string text;
+    bool bad;
+    long chain;
+    std::chrono::steady_clock::time_point time;
+  };
+
+  std::string prefix(const message &msg) const {
+    std::chrono::duration<double> elapsed = msg.time - start;
+    std::stringstream out;
+    out << '[';
+    if (msg.chain >= 0) {
+      out << "chain " << msg.chain << ", ";
+    }
+    out << std::fixed << std::setprecision(3) << elapsed.count() << "s] ";
+    return out.str();
+  }
+
+  sink_t sink;
+  bool drop_when_full;
+  bool tag;
+  std::chrono::steady_clock::time_point start;
+  tbb::concurrent_bounded_queue<message> queue;
+  std::atomic<size_t> dropped{0};
+  std::mutex flush_mutex;
+#ifdef STAN_THREADS
+  std::mutex timer_mutex;
+  std::condition_variable timer_cv;
+  bool stopping = false;
+  std::thread timer;
+#endif
+};
+
+/**
+ * One stream per thread for output printed by the model (its `print()`
+ * statements) inside a parallel loop.
+ *
+ * Each thread writes to its own buffer without locking, and the buffers are
+ * passed to the logger together by drain() once the loop is over, rather
+ * than once per model evaluation. When disabled, get() returns a null stream,
+ * which tells the model not to format its output at all.
+ */
+class thread_buffers {
+ public:
+  explicit thread_buffers(bool enabled) : enabled(enabled) {}
+
+  std::ostream *get() { return enabled ? &buffers.local() : nullptr; }
+
+  template <typename Logger>
+  void drain(Logger &logger) {
+    for (auto &buffer : buffers) {
+      if (!buffer.str().empty()) {
+        logger.info(buffer);
+        buffer.str("");
+      }
+    }
+  }
+
+ private:
+  bool enabled;
+  tbb::enumerable_thread_specific<std::stringstream> buffers;
+};
+
+}  // namespace messages
+}  // namespace tinystan
+
+#endif
@@ -3,14 +3,20 @@
 
 #include <stan/model/model_base.hpp>
 #include <stan/io/var_context.hpp>
+#include <stan/io/array_var_context.hpp>
 #include <stan/callbacks/logger.hpp>
 
 #include <ostream>
 #include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "tinystan_types.h"
 #include "file.hpp"
+#include "memory.hpp"
+#include "messages.hpp"
 #include "util.hpp"
 
 /**
@@ -25,6 +31,84 @@
 stan::model::model_base &new_model(stan::io::var_context &data_context,
                                    unsigned int seed, std::ostream *msg_stream);
 
+namespace tinystan {
+namespace model {
+
+/**
+ * A variable of the model, and where it is in the parameter columns written
+ * by the algorithms. See tinystan_model_variable().
+ */
+struct variable {
+  std::string name;
+  TinyStanVariableBlock block;
+  /** Dimensions, not including the real and imaginary parts of complexes */
+  std::vector<size_t> dims;
+  bool is_complex;
+  size_t offset;
+  size_t length;
+};
+
+/**
+ * @brief Describe the variables of a model.
+ *
+ * @param model The model.
+ * @param flat_names The names from `constrained_param_names(names, true,
+ * true)`, which the offsets refer to.
+ */
+inline std::vector<variable> describe_variables(
+    const stan::model::model_base &model,
+    const std::vector<std::string> &flat_names) {
+  std::vector<std::string> names;
+  model.get_param_names(names, false, false);
+  const size_t num_param_vars = names.size();
+  names.clear();
+  model.get_param_names(names, true, false);
+  const size_t num_tparam_vars = names.size();
+  names.clear();
+  model.get_param_names(names, true, true);
+  std::vector<std::vector<size_t>> dims;
+  model.get_dims(dims, true, true);
+
+  // flattened names are the variable name followed by '.' (indices, or the
+  // part of a complex) or ':' (tuple elements)
+  auto belongs = [](const std::string &flat, const std::string &name) {
+    return flat.compare(0, name.size(), name) == 0
+           && (flat.size() == name.size() || flat[name.size()] == '.'
+               || flat[name.size()] == ':');
+  };
+  auto ends_with = [](const std::string &s, const std::string &suffix) {
+    return s.size() >= suffix.size()
+           && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+  };
+
+  std::vector<variable> variables;
+  variables.reserve(names.size());
+  size_t offset = 0;
+  for (size_t i = 0; i < names.size(); ++i) {
+    variable v;
+    v.name = names[i];
+    v.block = i < num_param_vars    ? param
+              : i < num_tparam_vars ? tparam
+                                    : gq;
+    v.offset = offset;
+    while (offset < flat_names.size() && belongs(flat_names[offset], v.name)) {
+      ++offset;
+    }
+    v.length = offset - v.offset;
+    v.dims = dims[i];
+    v.is_complex = v.length > 0 && ends_with(flat_names[v.offset], ".real")
+                   && flat_names[v.offset].find(':') == std::string::npos;
+    if (v.is_complex && !v.dims.empty()) {
+      v.dims.pop_back();
+    }
+    variables.push_back(std::move(v));
+  }
+  return variables;
+}
+
+}  // namespace model
+}  // namespace tinystan
+
 /**
  * Holder for the instantiated Stan model and some extra metadata
  */
@@ -32,14 +116,28 @@ struct TinyStanModel {
  public:
   TinyStanModel(const char *data, unsigned int seed,
                 TINYSTAN_PRINT_CALLBACK user_print_callback = nullptr)
-      : model(&new_model(*tinystan::io::load_data(data), seed, &std::cout)),
-        user_print_callback(user_print_callback),
-        seed(seed),
-        num_free_params(model->num_params_r()) {
+      : user_print_callback(user_print_callback), seed(seed) {
+    // output printed while the data are read (e.g. by transformed data) is
+    // passed to the callback instead of going straight to stdout
+    std::stringstream msgs;
+    try {
+      model.reset(&new_model(*tinystan::io::load_data(data), seed, &msgs));
+    } catch (...) {
+      if (!msgs.str().empty()) {
+        info(msgs.str());
+      }
+      throw;
+    }
+    if (!msgs.str().empty()) {
+      info(msgs.str());
+    }
+
+    num_free_params = model->num_params_r();
     std::vector<std::string> names;
     model->constrained_param_names(names, true, true);
     param_names = tinystan::util::to_csv(names);
     num_params = names.size();
+    variables = tinystan::model::describe_variables(*model, names);
 
     names.clear();
     model->constrained_param_names(names, false, false);
@@ -70,10 +168,15 @@ struct TinyStanModel {
 
   std::unique_ptr<stan::model::model_base> model;
   TINYSTAN_PRINT_CALLBACK user_print_callback;
+  tinystan::messages::options message_options;
+  /** Whether to deliver output printed by the model during algorithms */
+  bool model_output = true;
+  tinystan::memory::options memory_options;
   unsigned int seed;
   size_t num_free_params;
   std::string param_names;
   size_t num_params;
+  std::vector<tinystan::model::variable> variables;
   size_t num_req_constrained_params;
 };
 
@@ -98,15 +201,16 @@ inline Eigen::VectorXd unconstrain_parameters(const TinyStanModel &tmodel,
   auto &model = *tmodel.model;
 
   std::stringstream msg;
+  std::ostream *msgs = tmodel.model_output ? &msg : nullptr;
   try {
     if (theta_json != nullptr) {
       auto json_theta_hat = io::load_data(theta_json);
-      model.transform_inits(*json_theta_hat, theta_unc, &msg);
+      model.transform_inits(*json_theta_hat, theta_unc, msgs);
 
     } else if (theta != nullptr) {
       Eigen::VectorXd theta_hat_constr_vec
           = Eigen::Map<const Eigen::VectorXd>(theta, tmodel.num_params);
-      model.unconstrain_array(theta_hat_constr_vec, theta_unc, &msg);
+      model.unconstrain_array(theta_hat_constr_vec, theta_unc, msgs);
     } else {
       throw std::runtime_error("No initial value provided");
     }
@@ -123,6 +227,28 @@ inline Eigen::VectorXd unconstrain_parameters(const TinyStanModel &tmodel,
   return theta_unc;
 }
 
+/**
+ * @brief Create an initialization context from constrained parameter values
+ *
+ * This avoids a round trip through JSON when one algorithm is used to
+ * initialize another.
+ *
+ * @param tmodel TinyStanModel instance
+ * @param theta pointer to the constrained parameters, in the same order as
+ * the parameter columns written by the algorithms. At least
+ * `num_req_constrained_params` values are read.
+ */
+inline io::var_ctx_ptr make_init_context(const TinyStanModel &tmodel,
+                                         const double *theta) {
+  auto &model = *tmodel.model;
+  std::vector<std::string> names;
+  model.get_param_names(names, false, false);
+  std::vector<std::vector<size_t>> dims;
+  model.get_dims(dims, false, false);
+  std::vector<double> values(theta, theta + tmodel.num_req_constrained_params);
+  return std::make_unique<stan::io::array_var_context>(names, values, dims);
+}
+
 }  // namespace model
 }  // namespace tinystan
 
@@ -0,0 +1,435 @@
+#ifndef TINYSTAN_NUTS_HPP
+#define TINYSTAN_NUTS_HPP
+
+// first, as it decides which of the samplers below are needed
+#include "algorithms.hpp"
+
+#include <stan/callbacks/interrupt.hpp>
+#include <stan/callbacks/logger.hpp>
+#include <stan/callbacks/writer.hpp>
+#include <stan/io/empty_var_context.hpp>
+#include <stan/model/model_base.hpp>
+#ifdef TINYSTAN_ALGORITHM_NUTS_DIAG
+#include <stan/services/sample/hmc_nuts_diag_e.hpp>
+#include <stan/services/sample/hmc_nuts_diag_e_adapt.hpp>
+#endif
+#ifdef TINYSTAN_ALGORITHM_NUTS_DENSE
+#include <stan/services/sample/hmc_nuts_dense_e.hpp>
+#include <stan/services/sample/hmc_nuts_dense_e_adapt.hpp>
+#endif
+#ifdef TINYSTAN_ALGORITHM_NUTS_UNIT
+#include <stan/services/sample/hmc_nuts_unit_e.hpp>
+#include <stan/services/sample/hmc_nuts_unit_e_adapt.hpp>
+#endif
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "tinystan_types.h"
+#include "buffer.hpp"
+#include "call_options.hpp"
+#include "errors.hpp"
+#include "file.hpp"
+#include "interrupts.hpp"
+#include "model.hpp"
+#include "pooled_warmup.hpp"
+#include "screening.hpp"
+
+namespace tinystan {
+namespace nuts {
+
+/**
+ * @brief Dispatch to the NUTS implementation for the chosen metric.
+ *
+ * Runs `num_chains` chains in one call to `stan::services::sample`, or to
+ * independent_nuts() for the low-rank metric, with one writer per chain.
+ * `stepsize_out` and `inv_metric_out` are only used by the latter, as the
+ * services write them through `inv_metric_writers`.
+ *
+ * @return A code from `stan::services::error_codes`.
+ */
+inline int dispatch_nuts(
+    stan::model::model_base &model, size_t num_chains,
+    std::vector<io::var_ctx_ptr> &inits, unsigned int seed, unsigned int id,
+    double init_radius, int num_warmup, int num_samples,
+    TinyStanMetric metric_choice,
+    std::vector<io::var_ctx_ptr> &initial_metrics, bool adapt, double delta,
+    double gamma, double kappa, double t0, unsigned int init_buffer,
+    unsigned int term_buffer, unsigned int window, bool save_warmup,
+    double stepsize, double stepsize_jitter, int max_depth, int refresh,
+    stan::callbacks::interrupt &interrupt, stan::callbacks::logger &logger,
+    std::vector<io::buffer_writer> &sample_writers,
+    std::vector<io::filtered_writer> &inv_metric_writers,
+    double *stepsize_out, double *inv_metric_out, size_t metric_offset) {
+  std::vector<stan::callbacks::writer> null_writers(num_chains);
+  int return_code = 0;
+  int thin = 1;  // no thinning
+
+  switch (metric_choice) {
+    case unit:
+#ifdef TINYSTAN_ALGORITHM_NUTS_UNIT
+      if (adapt) {
+        return_code = stan::services::sample::hmc_nuts_unit_e_adapt(
+            model, num_chains, inits, seed, id, init_radius, num_warmup,
+            num_samples, thin, save_warmup, refresh, stepsize, stepsize_jitter,
+            max_depth, delta, gamma, kappa, t0, interrupt, logger,
+            null_writers, sample_writers, null_writers, inv_metric_writers);
+      } else {
+        return_code = stan::services::sample::hmc_nuts_unit_e(
+            model, num_chains, inits, seed, id, init_radius, num_warmup,
+            num_samples, thin, save_warmup, refresh, stepsize, stepsize_jitter,
+            max_depth, interrupt, logger, null_writers, sample_writers,
+            null_writers);
+      }
+#else
+      algorithms::unavailable("nuts_unit");
+#endif
+      break;
+    case dense:
+#ifdef TINYSTAN_ALGORITHM_NUTS_DENSE
+      if (adapt) {
+        return_code = stan::services::sample::hmc_nuts_dense_e_adapt(
+            model, num_chains, inits, initial_metrics, seed, id, init_radius,
+            num_warmup, num_samples, thin, save_warmup, refresh, stepsize,
+            stepsize_jitter, max_depth, delta, gamma, kappa, t0, init_buffer,
+            term_buffer, window, interrupt, logger, null_writers,
+            sample_writers, null_writers, inv_metric_writers);
+      } else {
+        return_code = stan::services::sample::hmc_nuts_dense_e(
+            model, num_chains, inits, initial_metrics, seed, id, init_radius,
+            num_warmup, num_samples, thin, save_warmup, refresh, stepsize,
+            stepsize_jitter, max_depth, interrupt, logger, null_writers,
+            sample_writers, null_writers);
+      }
+#else
+      algorithms::unavailable("nuts_dense");
+#endif
+      break;
+    case diagonal:
+#ifdef TINYSTAN_ALGORITHM_NUTS_DIAG
+      if (adapt) {
+        return_code = stan::services::sample::hmc_nuts_diag_e_adapt(
+            model, num_chains, inits, initial_metrics, seed, id, init_radius,
+            num_warmup, num_samples, thin, save_warmup, refresh, stepsize,
+            stepsize_jitter, max_depth, delta, gamma, kappa, t0, init_buffer,
+            term_buffer, window, interrupt, logger, null_writers,
+            sample_writers, null_writers, inv_metric_writers);
+      } else {
+        return_code = stan::services::sample::hmc_nuts_diag_e(
+            model, num_chains, inits, initial_metrics, seed, id, init_radius,
+            num_warmup, num_samples, thin, save_warmup, refresh, stepsize,
+            stepsize_jitter, max_depth, interrupt, logger, null_writers,
+            sample_writers, null_writers);
+      }
+#else
+      algorithms::unavailable("nuts_diag");
+#endif
+      break;
+    case lowrank:
+#ifdef TINYSTAN_ALGORITHM_NUTS_LOWRANK
+      // not in Stan's services, so each chain runs our own driver
+      return_code = independent_nuts<lowrank_metric>(
+          model, num_chains, inits, initial_metrics, seed, id, init_radius,
+          num_warmup, num_samples, adapt, delta, gamma, kappa, t0, init_buffer,
+          term_buffer, window, save_warmup, stepsize, stepsize_jitter,
+          max_depth, refresh, interrupt, logger, sample_writers, stepsize_out,
+          inv_metric_out, metric_offset);
+#else
+      algorithms::unavailable("nuts_lowrank");
+#endif
+      break;
+    case automatic:
+#ifdef TINYSTAN_ALGORITHM_NUTS_AUTO
+      // also not in Stan's services
+      return_code = independent_nuts<auto_metric>(
+          model, num_chains, inits, initial_metrics, seed, id, init_radius,
+          num_warmup, num_samples, adapt, delta, gamma, kappa, t0, init_buffer,
+          term_buffer, window, save_warmup, stepsize, stepsize_jitter,
+          max_depth, refresh, interrupt, logger, sample_writers, stepsize_out,
+          inv_metric_out, metric_offset);
+#else
+      algorithms::unavailable("nuts_auto");
+#endif
+      break;
+  }
+  return return_code;
+}
+
+/**
+ * @brief Run each chain on its own, so that one failing does not stop the
+ * others.
+ *
+ * Arguments are as in dispatch_nuts(). A chain which fails is restarted from
+ * a new random initialization up to `options.max_chain_restarts` times,
+ * using the chain id `id + i + num_chains * attempt` so its draws differ
+ * from any other chain's.
+ * The new initialization is screened as the first ones were, see
+ * screening::screen(), and the statistics are added to screening::last().
+ * Interrupts, timeouts, and the memory limit still stop every chain.
+ *
+ * @return The error of each chain, empty for those which succeeded.
+ */
+inline std::vector<std::string> isolated_nuts(
+    const TinyStanModel &tmodel, const TinyStanCallOptions &options,
+    size_t num_chains,
+    std::vector<io::var_ctx_ptr> &inits, unsigned int seed, unsigned int id,
+    double init_radius, int num_warmup, int num_samples,
+    TinyStanMetric metric_choice,
+    std::vector<io::var_ctx_ptr> &initial_metrics, bool adapt, double delta,
+    double gamma, double kappa, double t0, unsigned int init_buffer,
+    unsigned int term_buffer, unsigned int window, bool save_warmup,
+    double stepsize, double stepsize_jitter, int max_depth, int refresh,
+    stan::callbacks::interrupt &interrupt, stan::callbacks::logger &logger,
+    std::vector<io::buffer_writer> &sample_writers,
+    std::vector<io::filtered_writer> &inv_metric_writers,
+    double *stepsize_out, double *inv_metric_out, size_t metric_offset) {
+  auto &model = *tmodel.model;
+  const int max_restarts = options.max_chain_restarts;
+  std::vector<std::string> chain_errors(num_chains);
+  std::vector<screening::stats> restart_screening(num_chains);
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, num_chains, 1),
+      [&](const tbb::blocked_range<size_t> &r) {
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+          // restarts need writers which have not been written to yet
+          const io::buffer_writer fresh_writer = sample_writers[i];
+          const io::filtered_writer fresh_metric_writer
+              = inv_metric_writers[i];
+          std::vector<io::var_ctx_ptr> chain_metrics;
+          chain_metrics.push_back(std::move(initial_metrics[i]));
+
+          for (int attempt = 0; attempt <= max_restarts; ++attempt) {
+            std::vector<io::var_ctx_ptr> chain_inits;
+            if (attempt == 0) {
+              chain_inits.push_back(std::move(inits[i]));
+            } else {
+              std::stringstream msg;
+              msg << "Chain " << id + i << " failed, restarting from a new "
+                  << "initialization (attempt " << attempt << " of "
+                  << max_restarts << ")";
+              logger.info(msg);
+              chain_inits.push_back(
+                  std::make_unique<stan::io::empty_var_context>());
+            }
+            std::vector<io::buffer_writer> writers{fresh_writer};
+            std::vector<io::filtered_writer> metric_writers{
+                fresh_metric_writer};
+            unsigned int chain_id = id + i + num_chains * attempt;
+            error::chain_logger chain_logger(logger, chain_id);
+            if (attempt > 0) {
+              screening::stats screened = screening::screen(
+                  tmodel, options, chain_inits, seed, chain_id, init_radius);
+              restart_screening[i].evaluated += screened.evaluated;
+              restart_screening[i].valid += screened.valid;
+            }
+
+            int return_code = 0;
+            std::string chain_error;
+            try {
+              return_code = dispatch_nuts(
+                  model, 1, chain_inits, seed, chain_id, init_radius,
+                  num_warmup, num_samples, metric_choice, chain_metrics,
+                  adapt, delta, gamma, kappa, t0, init_buffer, term_buffer,
+                  window, save_warmup, stepsize, stepsize_jitter, max_depth,
+                  refresh, interrupt, chain_logger, writers, metric_writers,
+                  stepsize_out == nullptr ? nullptr : stepsize_out + i,
+                  inv_metric_out == nullptr
+                      ? nullptr
+                      : inv_metric_out + metric_offset * i,
+                  metric_offset);
+              if (return_code != 0) {
+                chain_error = chain_logger.get_error();
+              }
+            } catch (const std::exception &e) {
+              chain_error = e.what();
+            } catch (...) {
+              // copy the writer back so the draws written are known
+              sample_writers[i] = writers[0];
+              throw;
+            }
+            sample_writers[i] = writers[0];
+            inv_metric_writers[i] = metric_writers[0];
+            chain_errors[i] = chain_error;
+            if (chain_error.empty()) {
+              break;
+            }
+          }
+        }
+      });
+  // screening::last() is per thread, and restarts run on the workers
+  for (const auto &screened : restart_screening) {
+    screening::last().evaluated += screened.evaluated;
+    screening::last().valid += screened.valid;
+  }
+  return chain_errors;
+}
+
+/**
+ * @brief Run NUTS with already-prepared initializations.
+ *
+ * This is the shared implementation of tinystan_sample() and the other entry
+ * points which end in a NUTS run. It handles the output buffers and dispatches
+ * to the appropriate function in `stan::services::sample`.
+ *
+ * Arguments are as in tinystan_sample(), except that `inits` and
+ * `initial_metrics` must already contain one entry per chain, and `deadline`
+ * is when the chains should stop. If it passes, the number of draws each
+ * chain wrote is recorded in the timeout_exception.
+ *
+ * If the call isolates its chains, see
+ * tinystan_call_options_set_chain_isolation(), the output of each chain
+ * which still failed after its restarts is set to NaN and a
+ * chain_failure_exception is thrown once the others finish.
+ */
+inline int run_nuts(const TinyStanModel &tmodel,
+                    const TinyStanCallOptions &options, size_t num_chains,
+                    std::vector<io::var_ctx_ptr> &inits, unsigned int seed,
+                    unsigned int id, double init_radius, int num_warmup,
+                    int num_samples, TinyStanMetric metric_choice,
+                    std::vector<io::var_ctx_ptr> &initial_metrics, bool adapt,
+                    double delta, double gamma, double kappa, double t0,
+                    unsigned int init_buffer, unsigned int term_buffer,
+                    unsigned int window, bool save_warmup, double stepsize,
+                    double stepsize_jitter, int max_depth, int refresh,
+                    const interrupt::deadline &deadline, double *out,
+                    size_t out_size, double *stepsize_out,
+                    double *inv_metric_out, TinyStanError **err) {
+  auto &model = *tmodel.model;
+
+  // all HMC has 7 algorithm params
+  int num_params = tmodel.num_params + 7;
+  int draws_offset = num_params * (num_samples + num_warmup * save_warmup);
+  if (out_size < num_chains * draws_offset) {
+    std::stringstream ss;
+    ss << "Output buffer too small. Expected at least " << num_chains
+       << " chains of " << draws_offset << " doubles, got " << out_size;
+    throw std::runtime_error(ss.str());
+  }
+
+  std::vector<io::buffer_writer> sample_writers;
+  sample_writers.reserve(num_chains);
+  for (size_t i = 0; i < num_chains; ++i) {
+    sample_writers.emplace_back(out + draws_offset * i, draws_offset);
+  }
+
+  std::vector<io::filtered_writer> inv_metric_writers(num_chains);
+  int num_model_params = tmodel.num_free_params;
+  size_t metric_offset = io::metric_size(metric_choice, num_model_params,
+                                         options.metric_rank);
+  for (size_t i = 0; i < num_chains; ++i) {
+    if (inv_metric_out != nullptr) {
+      inv_metric_writers[i].add_key("inv_metric",
+                                    inv_metric_out + metric_offset * i);
+    }
+    if (stepsize_out != nullptr) {
+      inv_metric_writers[i].add_key("stepsize", stepsize_out + i);
+    }
+  }
+
+  error::error_logger logger(tmodel, refresh != 0);
+  interrupt::tinystan_interrupt_handler interrupt(deadline);
+
+  int return_code = 0;
+  std::vector<std::string> chain_errors;
+
+  try {
+    if (options.isolate_chains) {
+      chain_errors = isolated_nuts(
+          tmodel, options, num_chains, inits, seed, id, init_radius,
+          num_warmup, num_samples, metric_choice, initial_metrics, adapt,
+          delta, gamma, kappa, t0, init_buffer, term_buffer, window,
+          save_warmup, stepsize, stepsize_jitter, max_depth, refresh,
+          interrupt, logger, sample_writers, inv_metric_writers, stepsize_out,
+          inv_metric_out, metric_offset);
+    } else {
+      return_code = dispatch_nuts(
+          model, num_chains, inits, seed, id, init_radius, num_warmup,
+          num_samples, metric_choice, initial_metrics, adapt, delta, gamma,
+          kappa, t0, init_buffer, term_buffer, window, save_warmup, stepsize,
+          stepsize_jitter, max_depth, refresh, interrupt, logger,
+          sample_writers, inv_metric_writers, stepsize_out, inv_metric_out,
+          metric_offset);
+    }
+  } catch (error::timeout_exception &e) {
+    e.draw_counts = io::rows_written(sample_writers, num_params);
+    throw;
+  }
+
+  bool any_failed = false;
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  for (size_t i = 0; i < chain_errors.size(); ++i) {
+    if (chain_errors[i].empty()) {
+      continue;
+    }
+    any_failed = true;
+    std::fill_n(out + draws_offset * i, draws_offset, nan);
+    if (stepsize_out != nullptr) {
+      stepsize_out[i] = nan;
+    }
+    if (inv_metric_out != nullptr) {
+      std::fill_n(inv_metric_out + metric_offset * i, metric_offset, nan);
+    }
+  }
+  if (any_failed) {
+    throw error::chain_failure_exception{std::move(chain_errors)};
+  }
+
+  if (return_code != 0) {
+    if (err != nullptr) {
+      *err = logger.get_error();
+    }
+  }
+
+  return return_code;
+}
+
+/**
+ * @brief Estimate an inverse metric from a set of draws.
+ *
+ * Uses the same regularization as Stan's windowed adaptation, shrinking the
+ * estimate towards a small multiple of the identity.
+ *
+ * @param draws Unconstrained draws, one per column.
+ * @param metric_choice Whether to return the diagonal, dense, or low-rank
+ * estimate. The automatic metric starts from the dense one.
+ * @param rank The rank of a low-rank estimate.
+ * @return The flattened inverse metric, in the layout expected by
+ * io::make_metric_inits().
+ */
+inline std::vector<double> estimate_inv_metric(const Eigen::MatrixXd &draws,
+                                               TinyStanMetric metric_choice,
+                                               size_t rank) {
+  const auto dims = draws.rows();
+  const double n = static_cast<double>(draws.cols());
+  Eigen::MatrixXd centered = draws.colwise() - draws.rowwise().mean();
+  double shrinkage = n / (n + 5.0);
+  double ridge = 1e-3 * (5.0 / (n + 5.0));
+
+  std::vector<double> inv_metric;
+  if (metric_choice == lowrank) {
+    Eigen::VectorXd packed = estimate_lowrank_inv_metric(draws, rank);
+    inv_metric.assign(packed.data(), packed.data() + packed.size());
+  } else if (metric_choice == dense || metric_choice == automatic) {
+    Eigen::MatrixXd covar = centered * centered.transpose() / (n - 1.0);
+    covar = shrinkage * covar
+            + ridge * Eigen::MatrixXd::Identity(dims, dims);
+    inv_metric.assign(covar.data(), covar.data() + covar.size());
+  } else {
+    Eigen::VectorXd var = centered.rowwise().squaredNorm() / (n - 1.0);
+    var = shrinkage * var + ridge * Eigen::VectorXd::Ones(dims);
+    inv_metric.assign(var.data(), var.data() + var.size());
+  }
+  return inv_metric;
+}
+
+}  // namespace nuts
+}  // namespace tinystan
+
+#endif
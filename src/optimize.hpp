@@ -0,0 +1,535 @@
+#ifndef TINYSTAN_OPTIMIZE_HPP
+#define TINYSTAN_OPTIMIZE_HPP
+
+// first, as it decides which of the optimizers below are needed
+#include "algorithms.hpp"
+
+#include <stan/callbacks/interrupt.hpp>
+#include <stan/callbacks/logger.hpp>
+#include <stan/callbacks/writer.hpp>
+#include <stan/io/var_context.hpp>
+#include <stan/model/model_base.hpp>
+#ifdef TINYSTAN_ALGORITHM_BFGS
+#include <stan/services/optimize/bfgs.hpp>
+#endif
+#ifdef TINYSTAN_ALGORITHM_LBFGS
+#include <stan/services/optimize/lbfgs.hpp>
+#endif
+#if defined TINYSTAN_ALGORITHM_BFGS || defined TINYSTAN_ALGORITHM_LBFGS
+#include <stan/optimization/bfgs.hpp>
+#endif
+#include <stan/model/log_prob_grad.hpp>
+#include <stan/optimization/newton.hpp>
+#include <stan/services/error_codes.hpp>
+#include <stan/services/util/create_rng.hpp>
+#include <stan/services/util/initialize.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "tinystan_types.h"
+#include "buffer.hpp"
+#include "errors.hpp"
+#include "file.hpp"
+#include "hessian.hpp"
+#include "interrupts.hpp"
+#include "model.hpp"
+
+namespace tinystan {
+namespace optimize {
+
+/**
+ * @brief Take one Newton step, with a backtracking line search.
+ *
+ * Equivalent to `stan::optimization::newton_step`, except that the Hessian
+ * is computed by hessian::log_prob_hessian().
+ *
+ * @return The log density (dropping constants) at the new point.
+ */
+template <bool jacobian>
+double newton_step(const stan::model::model_base &model,
+                   Eigen::VectorXd &params_r) {
+  Eigen::VectorXd gradient;
+  Eigen::MatrixXd hessian;
+  double f0 = hessian::log_prob_hessian<jacobian>(model, params_r, gradient,
+                                                  hessian);
+  stan::optimization::make_negative_definite_and_solve(hessian, gradient);
+
+  Eigen::VectorXd new_params_r(params_r.size());
+  double step_size = 2;
+  double min_step_size = 1e-50;
+  double f1 = -1e100;
+
+  while (f1 < f0) {
+    step_size *= 0.5;
+    if (step_size < min_step_size) {
+      return f0;
+    }
+    new_params_r = params_r - step_size * gradient;
+    try {
+      Eigen::VectorXd new_gradient;
+      f1 = stan::model::log_prob_grad<true, jacobian>(model, new_params_r,
+                                                      new_gradient);
+    } catch (const std::exception &e) {
+      f1 = -1e100;
+    }
+  }
+  params_r = new_params_r;
+  return f1;
+}
+
+/**
+ * @brief Run Newton steps until the log density stops improving.
+ *
+ * @param[in,out] cont_params The unconstrained starting point, replaced by the
+ * last point reached.
+ * @param[out] lp The log density at that point.
+ * @return Whether the iterations converged.
+ */
+template <bool jacobian>
+bool newton_iterations(const stan::model::model_base &model,
+                       Eigen::VectorXd &cont_params, double &lp,
+                       int num_iterations,
+                       stan::callbacks::interrupt &interrupt,
+                       stan::callbacks::logger &logger) {
+  {
+    std::stringstream initial_msg;
+    lp = model.template log_prob<false, jacobian>(cont_params, &initial_msg);
+    logger.info(initial_msg);
+  }
+
+  std::stringstream msg;
+  msg << "Initial log joint probability = " << lp;
+  logger.info(msg);
+
+  double lastlp = lp;
+  for (int m = 0; m < num_iterations; m++) {
+    interrupt();
+    lastlp = lp;
+    lp = newton_step<jacobian>(model, cont_params);
+
+    std::stringstream msg2;
+    msg2 << "Iteration " << std::setw(2) << (m + 1) << "."
+         << " Log joint probability = " << std::setw(10) << lp
+         << ". Improved by " << (lp - lastlp) << ".";
+    logger.info(msg2);
+
+    if (std::fabs(lp - lastlp) < 1e-8) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Write the `lp__`, `converged__`, and constrained values of a mode.
+ */
+template <typename RNG>
+void write_mode(const stan::model::model_base &model, RNG &rng,
+                Eigen::VectorXd &cont_params, double lp, bool converged,
+                stan::callbacks::logger &logger,
+                stan::callbacks::writer &parameter_writer) {
+  Eigen::VectorXd values;
+  std::stringstream ss;
+  model.write_array(rng, cont_params, values, true, true, &ss);
+  if (ss.str().length() > 0) {
+    logger.info(ss);
+  }
+  std::vector<double> row{lp, static_cast<double>(converged)};
+  row.insert(row.end(), values.data(), values.data() + values.size());
+  parameter_writer(row);
+}
+
+/**
+ * @brief Newton's method, with the Hessian computed in parallel.
+ *
+ * Mirrors `stan::services::optimize::newton` and writes the same output.
+ *
+ * @return A code from `stan::services::error_codes`.
+ */
+template <bool jacobian>
+int newton(stan::model::model_base &model, stan::io::var_context &init,
+           unsigned int seed, unsigned int id, double init_radius,
+           int num_iterations, stan::callbacks::interrupt &interrupt,
+           stan::callbacks::logger &logger,
+           stan::callbacks::writer &parameter_writer) {
+  auto rng = stan::services::util::create_rng(seed, id);
+
+  stan::callbacks::writer init_writer;
+  std::vector<double> cont_vector;
+  try {
+    cont_vector = stan::services::util::initialize<false>(
+        model, init, rng, init_radius, false, logger, init_writer);
+  } catch (const std::exception &e) {
+    logger.error(e.what());
+    return stan::services::error_codes::CONFIG;
+  }
+  Eigen::VectorXd cont_params
+      = Eigen::Map<Eigen::VectorXd>(cont_vector.data(), cont_vector.size());
+
+  std::vector<std::string> names{"lp__", "converged__"};
+  model.constrained_param_names(names, true, true);
+  parameter_writer(names);
+
+  double lp = 0;
+  bool converged = newton_iterations<jacobian>(model, cont_params, lp,
+                                               num_iterations, interrupt,
+                                               logger);
+  write_mode(model, rng, cont_params, lp, converged, logger,
+             parameter_writer);
+  return stan::services::error_codes::OK;
+}
+
+#if defined TINYSTAN_ALGORITHM_BFGS || defined TINYSTAN_ALGORITHM_LBFGS
+/**
+ * @brief Run a quasi-Newton optimizer to termination.
+ *
+ * The iterations of `stan::services::optimize::bfgs` and `lbfgs`, keeping the
+ * result on the unconstrained scale.
+ *
+ * @param[in,out] cont_params The unconstrained starting point, replaced by the
+ * last point reached.
+ * @param[out] lp The log density at that point.
+ * @param[out] converged Whether one of the convergence tests was met.
+ * @return A code from `stan::services::error_codes`.
+ */
+template <typename Optimizer>
+int quasi_newton_iterations(Optimizer &optimizer, std::stringstream &msgs,
+                            Eigen::VectorXd &cont_params, double &lp,
+                            bool &converged, int refresh,
+                            stan::callbacks::interrupt &interrupt,
+                            stan::callbacks::logger &logger) {
+  lp = optimizer.logp();
+  std::stringstream initial_msg;
+  initial_msg << "Initial log joint probability = " << lp;
+  logger.info(initial_msg);
+
+  int ret = 0;
+  while (ret == 0) {
+    interrupt();
+    ret = optimizer.step();
+    lp = optimizer.logp();
+    if (refresh > 0
+        && (optimizer.iter_num() == 1 || optimizer.iter_num() % refresh == 0
+            || ret != 0)) {
+      std::stringstream msg;
+      msg << "Iteration " << std::setw(4) << optimizer.iter_num() << "."
+          << " Log joint probability = " << std::setw(10) << lp << ".";
+      logger.info(msg);
+      logger.info(msgs);
+    }
+    msgs.str("");
+  }
+
+  std::vector<double> cont_vector;
+  optimizer.params_r(cont_vector);
+  cont_params = Eigen::Map<Eigen::VectorXd>(cont_vector.data(),
+                                            cont_vector.size());
+  converged = ret > 0 && ret != stan::optimization::TERM_MAXIT;
+  if (ret < 0) {
+    logger.error("Optimization terminated with error: "
+                 + optimizer.get_code_string(ret));
+    return stan::services::error_codes::SOFTWARE;
+  }
+  if (refresh > 0) {
+    logger.info("Optimization terminated normally: "
+                + optimizer.get_code_string(ret));
+  }
+  return stan::services::error_codes::OK;
+}
+#endif
+
+/**
+ * @brief Find a mode, and keep it on the unconstrained scale.
+ *
+ * Runs the same iterations as run_optimizer(), but also returns the mode
+ * itself, so that it can be used without unconstraining the output again.
+ * One row (`lp__`, `converged__`, and the constrained values) is written.
+ *
+ * @param[out] mode The mode on the unconstrained scale.
+ * @return A code from `stan::services::error_codes`.
+ */
+template <bool jacobian>
+int find_mode(stan::model::model_base &model, stan::io::var_context &init,
+              unsigned int seed, unsigned int id, double init_radius,
+              TinyStanOptimizationAlgorithm algorithm, int num_iterations,
+              int max_history_size, double init_alpha, double tol_obj,
+              double tol_rel_obj, double tol_grad, double tol_rel_grad,
+              double tol_param, int refresh,
+              stan::callbacks::interrupt &interrupt,
+              stan::callbacks::logger &logger,
+              stan::callbacks::writer &mode_writer, Eigen::VectorXd &mode) {
+  auto rng = stan::services::util::create_rng(seed, id);
+
+  stan::callbacks::writer init_writer;
+  std::vector<double> cont_vector;
+  try {
+    cont_vector = stan::services::util::initialize<false>(
+        model, init, rng, init_radius, false, logger, init_writer);
+  } catch (const std::exception &e) {
+    logger.error(e.what());
+    return stan::services::error_codes::CONFIG;
+  }
+  mode = Eigen::Map<Eigen::VectorXd>(cont_vector.data(), cont_vector.size());
+
+  std::vector<std::string> names{"lp__", "converged__"};
+  model.constrained_param_names(names, true, true);
+  mode_writer(names);
+
+  double lp = 0;
+  bool converged = false;
+  int return_code = stan::services::error_codes::OK;
+  std::vector<int> disc_vector;
+  std::stringstream msgs;
+  switch (algorithm) {
+    case newton:
+#ifdef TINYSTAN_ALGORITHM_NEWTON
+      converged = newton_iterations<jacobian>(model, mode, lp, num_iterations,
+                                              interrupt, logger);
+#else
+      algorithms::unavailable("newton");
+#endif
+      break;
+    case bfgs: {
+#ifdef TINYSTAN_ALGORITHM_BFGS
+      stan::optimization::BFGSLineSearch<
+          stan::model::model_base, stan::optimization::BFGSUpdate_HInv<>,
+          double, Eigen::Dynamic, jacobian>
+          optimizer(model, cont_vector, disc_vector, &msgs);
+      optimizer._ls_opts.alpha0 = init_alpha;
+      optimizer._conv_opts.tolAbsF = tol_obj;
+      optimizer._conv_opts.tolRelF = tol_rel_obj;
+      optimizer._conv_opts.tolAbsGrad = tol_grad;
+      optimizer._conv_opts.tolRelGrad = tol_rel_grad;
+      optimizer._conv_opts.tolAbsX = tol_param;
+      optimizer._conv_opts.maxIts = num_iterations;
+      return_code = quasi_newton_iterations(optimizer, msgs, mode, lp,
+                                            converged, refresh, interrupt,
+                                            logger);
+#else
+      algorithms::unavailable("bfgs");
+#endif
+      break;
+    }
+    case lbfgs: {
+#ifdef TINYSTAN_ALGORITHM_LBFGS
+      stan::optimization::BFGSLineSearch<
+          stan::model::model_base, stan::optimization::LBFGSUpdate<>, double,
+          Eigen::Dynamic, jacobian>
+          optimizer(model, cont_vector, disc_vector, &msgs);
+      optimizer.get_qnupdate().set_history_size(max_history_size);
+      optimizer._ls_opts.alpha0 = init_alpha;
+      optimizer._conv_opts.tolAbsF = tol_obj;
+      optimizer._conv_opts.tolRelF = tol_rel_obj;
+      optimizer._conv_opts.tolAbsGrad = tol_grad;
+      optimizer._conv_opts.tolRelGrad = tol_rel_grad;
+      optimizer._conv_opts.tolAbsX = tol_param;
+      optimizer._conv_opts.maxIts = num_iterations;
+      return_code = quasi_newton_iterations(optimizer, msgs, mode, lp,
+                                            converged, refresh, interrupt,
+                                            logger);
+#else
+      algorithms::unavailable("lbfgs");
+#endif
+      break;
+    }
+  }
+  if (return_code != stan::services::error_codes::OK) {
+    return return_code;
+  }
+
+  write_mode(model, rng, mode, lp, converged, logger, mode_writer);
+  return stan::services::error_codes::OK;
+}
+
+/**
+ * @brief Run one of Stan's optimizers from a single initialization.
+ *
+ * Dispatches to the appropriate function in `stan::services::optimize`, or
+ * to newton() above. Arguments are as in tinystan_optimize().
+ *
+ * @return A code from `stan::services::error_codes`.
+ */
+inline int run_optimizer(stan::model::model_base &model,
+                         stan::io::var_context &init, unsigned int seed,
+                         unsigned int id, double init_radius,
+                         TinyStanOptimizationAlgorithm algorithm,
+                         int num_iterations, bool jacobian,
+                         int max_history_size, double init_alpha,
+                         double tol_obj, double tol_rel_obj, double tol_grad,
+                         double tol_rel_grad, double tol_param, int refresh,
+                         stan::callbacks::interrupt &interrupt,
+                         stan::callbacks::logger &logger,
+                         stan::callbacks::writer &sample_writer) {
+  stan::callbacks::writer null_writer;
+
+  bool save_iterations = false;
+
+  int return_code = 0;
+  switch (algorithm) {
+    case newton:
+#ifdef TINYSTAN_ALGORITHM_NEWTON
+      if (jacobian)
+        return_code
+            = newton<true>(model, init, seed, id, init_radius, num_iterations,
+                           interrupt, logger, sample_writer);
+      else
+        return_code
+            = newton<false>(model, init, seed, id, init_radius, num_iterations,
+                            interrupt, logger, sample_writer);
+#else
+      algorithms::unavailable("newton");
+#endif
+      break;
+    case bfgs:
+#ifdef TINYSTAN_ALGORITHM_BFGS
+      if (jacobian)
+        return_code
+            = stan::services::optimize::bfgs<stan::model::model_base, true>(
+                model, init, seed, id, init_radius, init_alpha, tol_obj,
+                tol_rel_obj, tol_grad, tol_rel_grad, tol_param, num_iterations,
+                save_iterations, refresh, interrupt, logger, null_writer,
+                sample_writer);
+      else
+        return_code
+            = stan::services::optimize::bfgs<stan::model::model_base, false>(
+                model, init, seed, id, init_radius, init_alpha, tol_obj,
+                tol_rel_obj, tol_grad, tol_rel_grad, tol_param, num_iterations,
+                save_iterations, refresh, interrupt, logger, null_writer,
+                sample_writer);
+#else
+      algorithms::unavailable("bfgs");
+#endif
+      break;
+    case lbfgs:
+#ifdef TINYSTAN_ALGORITHM_LBFGS
+      if (jacobian)
+        return_code
+            = stan::services::optimize::lbfgs<stan::model::model_base, true>(
+                model, init, seed, id, init_radius, max_history_size,
+                init_alpha, tol_obj, tol_rel_obj, tol_grad, tol_rel_grad,
+                tol_param, num_iterations, save_iterations, refresh, interrupt,
+                logger, null_writer, sample_writer);
+      else
+        return_code
+            = stan::services::optimize::lbfgs<stan::model::model_base, false>(
+                model, init, seed, id, init_radius, max_history_size,
+                init_alpha, tol_obj, tol_rel_obj, tol_grad, tol_rel_grad,
+                tol_param, num_iterations, save_iterations, refresh, interrupt,
+                logger, null_writer, sample_writer);
+#else
+      algorithms::unavailable("lbfgs");
+#endif
+      break;
+  }
+  return return_code;
+}
+
+/**
+ * @brief Run several optimizations in parallel and collect their modes.
+ *
+ * Start `i` uses chain ID `id + i` and the `i`th initialization. Each row of
+ * the output holds `lp__`, `converged__`, and the model parameters, as written
+ * by the optimizers. Rows are sorted by decreasing `lp__`, with starts that
+ * produced no result last. If `dedupe_tol` is positive, a row is dropped when
+ * all of its (constrained) parameters are within `dedupe_tol` of a row already
+ * kept.
+ *
+ * @return The number of rows written to `out`, or zero if every start failed.
+ */
+inline size_t run_multi_start(
+    const TinyStanModel &tmodel, size_t num_starts,
+    std::vector<io::var_ctx_ptr> &inits, unsigned int seed, unsigned int id,
+    double init_radius, TinyStanOptimizationAlgorithm algorithm,
+    int num_iterations, bool jacobian, int max_history_size,
+    double init_alpha, double tol_obj, double tol_rel_obj, double tol_grad,
+    double tol_rel_grad, double tol_param, double dedupe_tol, int refresh,
+    stan::callbacks::interrupt &interrupt, stan::callbacks::logger &logger,
+    double *out, int *return_codes_out) {
+  auto &model = *tmodel.model;
+
+  // lp__ and converged__ precede the model parameters
+  const size_t offset = 2;
+  const size_t width = tmodel.num_params + offset;
+
+  std::vector<double> modes(width * num_starts,
+                            std::numeric_limits<double>::quiet_NaN());
+  std::vector<int> return_codes(num_starts);
+
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, num_starts, 1),
+      [&](const tbb::blocked_range<size_t> &r) {
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+          io::buffer_writer writer(modes.data() + width * i, width);
+          return_codes[i] = run_optimizer(
+              model, *inits[i], seed, id + i, init_radius, algorithm,
+              num_iterations, jacobian, max_history_size, init_alpha, tol_obj,
+              tol_rel_obj, tol_grad, tol_rel_grad, tol_param, refresh,
+              interrupt, logger, writer);
+        }
+      });
+
+  auto lp = [&](size_t i) {
+    double value = modes[width * i];
+    return std::isnan(value) ? -std::numeric_limits<double>::infinity()
+                             : value;
+  };
+  std::vector<size_t> order(num_starts);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](size_t a, size_t b) { return lp(a) > lp(b); });
+
+  // only the parameters block is compared, as generated quantities may be
+  // random
+  const size_t compared = offset + tmodel.num_req_constrained_params;
+  auto same_mode = [&](size_t a, size_t b) {
+    for (size_t j = offset; j < compared; ++j) {
+      if (!(std::fabs(modes[width * a + j] - modes[width * b + j])
+            <= dedupe_tol)) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  std::vector<size_t> kept;
+  size_t num_succeeded = 0;
+  for (size_t i : order) {
+    if (std::isnan(modes[width * i])) {
+      kept.push_back(i);
+      continue;
+    }
+    ++num_succeeded;
+    if (dedupe_tol > 0
+        && std::any_of(kept.begin(), kept.end(),
+                       [&](size_t k) { return same_mode(i, k); })) {
+      continue;
+    }
+    kept.push_back(i);
+  }
+
+  if (num_succeeded == 0) {
+    return 0;
+  }
+
+  for (size_t row = 0; row < kept.size(); ++row) {
+    std::copy_n(modes.data() + width * kept[row], width, out + width * row);
+    if (return_codes_out != nullptr) {
+      return_codes_out[row] = return_codes[kept[row]];
+    }
+  }
+  return kept.size();
+}
+
+}  // namespace optimize
+}  // namespace tinystan
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef TINYSTAN_PATHFINDER_HPP
+#define TINYSTAN_PATHFINDER_HPP
+
+#include <stan/callbacks/interrupt.hpp>
+#include <stan/callbacks/logger.hpp>
+#include <stan/callbacks/structured_writer.hpp>
+#include <stan/callbacks/writer.hpp>
+#include <stan/io/var_context.hpp>
+#include <stan/math/prim/fun/Eigen.hpp>
+#include <stan/math/prim/fun/log_sum_exp.hpp>
+#include <stan/model/model_base.hpp>
+#include <stan/services/error_codes.hpp>
+#include <stan/services/pathfinder/single.hpp>
+#include <stan/services/util/create_rng.hpp>
+#include <boost/random/discrete_distribution.hpp>
+#include <boost/random/exponential_distribution.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "file.hpp"
+#include "loo.hpp"
+#include "messages.hpp"
+
+namespace tinystan {
+namespace pathfinder {
+
+/**
+ * @brief Importance resampling of draws which arrive in batches.
+ *
+ * Keeps `num_slots` draws, each an independent draw (with replacement) from
+ * all the draws added so far, with probability proportional to their
+ * importance weights. Each slot holds a random key, and a batch with total
+ * weight `W` replaces the slot's draw if its exponential key with rate `W`
+ * is smaller, which happens with probability `W` over the total weight.
+ * The replacement is then chosen within the batch by its own weights.
+ *
+ * The keys and choices for a batch come from its own random number stream,
+ * so the result does not depend on the order in which batches are added.
+ * Memory use is that of the slots, however many batches are added.
+ */
+class resampler {
+ public:
+  explicit resampler(size_t num_slots)
+      : keys(num_slots, std::numeric_limits<double>::infinity()) {}
+
+  /**
+   * @brief Offer a batch of draws.
+   *
+   * Within the batch, the weights are Pareto smoothed (see
+   * loo::psis_smooth()). The batch as a whole keeps the total of its raw
+   * weights, so batches are weighted as if all draws were smoothed together.
+   *
+   * @param log_ratios The log importance ratio of each draw.
+   * @param batch The draws, one per column.
+   * @param rng The batch's random number generator.
+   */
+  template <typename RNG>
+  void add(const Eigen::Ref<const Eigen::VectorXd> &log_ratios,
+           const Eigen::Ref<const Eigen::MatrixXd> &batch, RNG &rng) {
+    Eigen::VectorXd log_weights = log_ratios.unaryExpr([](double x) {
+      return std::isnan(x) ? -std::numeric_limits<double>::infinity() : x;
+    });
+    const double log_mass = stan::math::log_sum_exp(log_weights);
+    if (!std::isfinite(log_mass)) {
+      return;  // no weight, or an infinite one which cannot be compared
+    }
+    log_weights.array() -= log_weights.maxCoeff();
+    loo::psis_smooth(log_weights);
+    Eigen::VectorXd weights = log_weights.array().exp();
+
+    boost::random::exponential_distribution<double> exponential;
+    boost::random::discrete_distribution<Eigen::Index, double> choose(
+        weights.data(), weights.data() + weights.size());
+    std::vector<double> batch_keys(keys.size());
+    std::vector<Eigen::Index> choices(keys.size());
+    for (size_t s = 0; s < keys.size(); ++s) {
+      batch_keys[s] = std::log(exponential(rng)) - log_mass;
+      choices[s] = choose(rng);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (draws.size() == 0) {
+      draws.resize(batch.rows(), keys.size());
+    }
+    for (size_t s = 0; s < keys.size(); ++s) {
+      if (batch_keys[s] < keys[s]) {
+        keys[s] = batch_keys[s];
+        draws.col(s) = batch.col(choices[s]);
+      }
+    }
+  }
+
+  /**
+   * Whether every slot holds a draw.
+   */
+  bool full() const {
+    for (double key : keys) {
+      if (key == std::numeric_limits<double>::infinity()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Write the draws, one per slot.
+   */
+  void write(stan::callbacks::writer &writer) const {
+    for (Eigen::Index s = 0; s < draws.cols(); ++s) {
+      writer(Eigen::VectorXd(draws.col(s)));
+    }
+  }
+
+ private:
+  Eigen::MatrixXd draws;
+  std::vector<double> keys;
+  std::mutex mutex;
+};
+
+/**
+ * @brief Multi-path Pathfinder with PSIS resampling in bounded memory.
+ *
+ * Like `stan::services::pathfinder::pathfinder_lbfgs_multi()` with
+ * `psis_resample` and `calculate_lp`, but each path's draws are passed to a
+ * resampler as soon as the path finishes, and then freed. Peak memory is
+ * then `num_multi_draws` draws plus the draws of the paths running at once,
+ * rather than the draws of every path.
+ *
+ * The importance weights are Pareto smoothed within each path rather than
+ * across all paths, so the result is close to, but not the same as, that of
+ * Stan's implementation.
+ *
+ * Arguments are as in `pathfinder_lbfgs_multi()`.
+ *
+ * @return A code from `stan::services::error_codes`.
+ */
+inline int streaming_pathfinder(
+    stan::model::model_base &model, std::vector<io::var_ctx_ptr> &inits,
+    unsigned int seed, unsigned int id, double init_radius,
+    int max_history_size, double init_alpha, double tol_obj,
+    double tol_rel_obj, double tol_grad, double tol_rel_grad, double tol_param,
+    int num_iterations, int num_elbo_draws, int num_draws,
+    int num_multi_draws, size_t num_paths, int refresh,
+    stan::callbacks::interrupt &interrupt, stan::callbacks::logger &logger,
+    stan::callbacks::writer &parameter_writer) {
+  resampler resampled(num_multi_draws);
+  std::atomic<size_t> num_successful{0};
+
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, num_paths, 1),
+      [&](const tbb::blocked_range<size_t> &r) {
+        for (size_t path = r.begin(); path != r.end(); ++path) {
+          messages::chain_scope scope(id + path);
+          stan::callbacks::writer init_writer;
+          stan::callbacks::writer path_writer;
+          stan::callbacks::structured_writer diagnostic_writer;
+          auto result
+              = stan::services::pathfinder::pathfinder_lbfgs_single<true>(
+                  model, *inits[path], seed, id + path, init_radius,
+                  max_history_size, init_alpha, tol_obj, tol_rel_obj,
+                  tol_grad, tol_rel_grad, tol_param, num_iterations,
+                  num_elbo_draws, num_draws, false, refresh, interrupt,
+                  logger, init_writer, path_writer, diagnostic_writer, true);
+          if (std::get<0>(result) != stan::services::error_codes::OK) {
+            logger.error("Pathfinder iteration: " + std::to_string(path)
+                         + " failed.");
+            continue;
+          }
+          ++num_successful;
+          // a stream of its own, distinct from those of the paths
+          auto rng = stan::services::util::create_rng(
+              seed, id + num_paths + path);
+          resampled.add(std::get<1>(result).matrix(),
+                        std::get<2>(result).matrix(), rng);
+        }
+      });
+
+  if (num_successful == 0) {
+    logger.error("No pathfinders ran successfully");
+    return stan::services::error_codes::SOFTWARE;
+  }
+  if (!resampled.full()) {
+    logger.error(
+        "Every Pathfinder draw had an importance weight of zero or infinity");
+    return stan::services::error_codes::SOFTWARE;
+  }
+  resampled.write(parameter_writer);
+  return stan::services::error_codes::OK;
+}
+
+}  // namespace pathfinder
+}  // namespace tinystan
+
+#endif
@@ -0,0 +1,721 @@
+#ifndef TINYSTAN_POOLED_WARMUP_HPP
+#define TINYSTAN_POOLED_WARMUP_HPP
+
+#include <stan/callbacks/interrupt.hpp>
+#include <stan/callbacks/logger.hpp>
+#include <stan/callbacks/writer.hpp>
+#include <stan/io/var_context.hpp>
+#include <stan/math/prim/fun/welford_covar_estimator.hpp>
+#include <stan/math/prim/fun/welford_var_estimator.hpp>
+#include <stan/mcmc/hmc/nuts/dense_e_nuts.hpp>
+#include <stan/mcmc/hmc/nuts/diag_e_nuts.hpp>
+#include <stan/mcmc/hmc/nuts/unit_e_nuts.hpp>
+#include <stan/mcmc/sample.hpp>
+#include <stan/mcmc/stepsize_adaptation.hpp>
+#include <stan/mcmc/windowed_adaptation.hpp>
+#include <stan/model/model_base.hpp>
+#include <stan/services/error_codes.hpp>
+#include <stan/services/util/create_rng.hpp>
+#include <stan/services/util/generate_transitions.hpp>
+#include <stan/services/util/initialize.hpp>
+#include <stan/services/util/mcmc_writer.hpp>
+#include <stan/services/util/read_dense_inv_metric.hpp>
+#include <stan/services/util/read_diag_inv_metric.hpp>
+#include <stan/services/util/validate_dense_inv_metric.hpp>
+#include <stan/services/util/validate_diag_inv_metric.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "tinystan_types.h"
+#include "algorithms.hpp"
+#include "auto_metric.hpp"
+#include "buffer.hpp"
+#include "errors.hpp"
+#include "file.hpp"
+#include "interrupts.hpp"
+#include "lowrank_metric.hpp"
+#include "model.hpp"
+
+namespace tinystan {
+namespace nuts {
+
+/**
+ * The random number generator type used by Stan's services.
+ */
+using rng_t = decltype(stan::services::util::create_rng(0u, 0u));
+
+/**
+ * @brief Stan's warmup window schedule, advanced by the caller.
+ *
+ * Exposes the bookkeeping of `stan::mcmc::windowed_adaptation` so that one
+ * schedule can drive the metric adaptation of several chains at once.
+ */
+class window_schedule : public stan::mcmc::windowed_adaptation {
+ public:
+  window_schedule() : stan::mcmc::windowed_adaptation("metric") {}
+
+  /**
+   * Move on to the next warmup iteration.
+   */
+  void advance() { ++adapt_window_counter_; }
+
+  unsigned int term_buffer() const { return adapt_term_buffer_; }
+};
+
+/**
+ * @brief Compile-time description of each of the NUTS metrics.
+ *
+ * Each provides the sampler type, the estimator used during the adaptation
+ * windows, and functions to read, regularize, and write the inverse metric.
+ */
+struct unit_metric {
+  template <typename Model, typename RNG>
+  using sampler_t = stan::mcmc::unit_e_nuts<Model, RNG>;
+  using estimator_t = stan::math::welford_var_estimator;
+  using metric_t = Eigen::VectorXd;
+
+  static constexpr bool adapts = false;
+  static constexpr bool selects = false;
+};
+
+struct diag_metric {
+  template <typename Model, typename RNG>
+  using sampler_t = stan::mcmc::diag_e_nuts<Model, RNG>;
+  using estimator_t = stan::math::welford_var_estimator;
+  using metric_t = Eigen::VectorXd;
+
+  static constexpr bool adapts = true;
+  static constexpr bool selects = false;
+
+  static metric_t read(stan::io::var_context &init, size_t num_params,
+                       stan::callbacks::logger &logger) {
+    metric_t metric = stan::services::util::read_diag_inv_metric(
+        init, num_params, logger);
+    stan::services::util::validate_diag_inv_metric(metric, logger);
+    return metric;
+  }
+
+  static metric_t estimate(estimator_t &estimator, const metric_t &current) {
+    metric_t var;
+    estimator.sample_variance(var);
+    double n = static_cast<double>(estimator.num_samples());
+    return (n / (n + 5.0)) * var
+           + 1e-3 * (5.0 / (n + 5.0)) * metric_t::Ones(var.size());
+  }
+};
+
+struct dense_metric {
+  template <typename Model, typename RNG>
+  using sampler_t = stan::mcmc::dense_e_nuts<Model, RNG>;
+  using estimator_t = stan::math::welford_covar_estimator;
+  using metric_t = Eigen::MatrixXd;
+
+  static constexpr bool adapts = true;
+  static constexpr bool selects = false;
+
+  static metric_t read(stan::io::var_context &init, size_t num_params,
+                       stan::callbacks::logger &logger) {
+    metric_t metric = stan::services::util::read_dense_inv_metric(
+        init, num_params, logger);
+    stan::services::util::validate_dense_inv_metric(metric, logger);
+    return metric;
+  }
+
+  static metric_t estimate(estimator_t &estimator, const metric_t &current) {
+    metric_t covar;
+    estimator.sample_covariance(covar);
+    double n = static_cast<double>(estimator.num_samples());
+    return (n / (n + 5.0)) * covar
+           + 1e-3 * (5.0 / (n + 5.0))
+                 * metric_t::Identity(covar.rows(), covar.cols());
+  }
+};
+
+struct lowrank_metric {
+  template <typename Model, typename RNG>
+  using sampler_t = lowrank_e_nuts<Model, RNG>;
+  using estimator_t = lowrank_estimator;
+  using metric_t = Eigen::VectorXd;
+
+  static constexpr bool adapts = true;
+  static constexpr bool selects = false;
+
+  static metric_t read(stan::io::var_context &init, size_t num_params,
+                       stan::callbacks::logger &logger) {
+    return read_lowrank_inv_metric(init, num_params, logger);
+  }
+
+  /**
+   * The estimate keeps the rank of the metric it replaces.
+   */
+  static metric_t estimate(estimator_t &estimator, const metric_t &current) {
+    Eigen::MatrixXd draws = estimator.draws();
+    return estimate_lowrank_inv_metric(
+        draws, io::lowrank_rank(draws.rows(), current.size()));
+  }
+};
+
+/**
+ * The automatic metric, see select_metric(). It is read, estimated, and
+ * written like the dense metric, and after each estimate select() decides
+ * whether to keep only its diagonal.
+ */
+struct auto_metric {
+  template <typename Model, typename RNG>
+  using sampler_t = auto_e_nuts<Model, RNG>;
+  using estimator_t = stan::math::welford_covar_estimator;
+  using metric_t = Eigen::MatrixXd;
+
+  static constexpr bool adapts = true;
+  static constexpr bool selects = true;
+
+  static metric_t read(stan::io::var_context &init, size_t num_params,
+                       stan::callbacks::logger &logger) {
+    return dense_metric::read(init, num_params, logger);
+  }
+
+  static metric_t estimate(estimator_t &estimator, const metric_t &current) {
+    return dense_metric::estimate(estimator, current);
+  }
+
+  /**
+   * Choose the form of `estimate`, using the step times of `chains`.
+   */
+  template <typename Chains>
+  static metric_t select(const metric_t &estimate, size_t num_draws,
+                         const Chains &chains,
+                         stan::callbacks::logger &logger) {
+    double seconds[2] = {0, 0};
+    double leapfrogs[2] = {0, 0};
+    for (const auto &c : chains) {
+      for (bool dense : {false, true}) {
+        const auto &t = c->sampler.timing_for(dense);
+        seconds[dense] += t.seconds;
+        leapfrogs[dense] += t.leapfrogs;
+      }
+    }
+    return select_metric(
+        estimate, num_draws, chains[0]->sampler.dense_metric(),
+        leapfrogs[0] > 0 ? seconds[0] / leapfrogs[0] : 0,
+        leapfrogs[1] > 0 ? seconds[1] / leapfrogs[1] : 0, logger);
+  }
+};
+
+/**
+ * @brief One chain of a lockstep NUTS run.
+ *
+ * The sampler keeps a reference to the RNG (and the model), so chains are
+ * held by pointer and never moved once constructed.
+ */
+template <typename Metric, typename Model = stan::model::model_base>
+struct chain {
+  using sampler_t = typename Metric::template sampler_t<Model, rng_t>;
+
+  chain(const Model &model, unsigned int seed, unsigned int chain_id)
+      : rng(stan::services::util::create_rng(seed, chain_id)),
+        sampler(model, rng),
+        draw(Eigen::VectorXd(0), 0, 0) {}
+
+  rng_t rng;
+  sampler_t sampler;
+  stan::mcmc::sample draw;
+};
+
+/**
+ * Largest potential scale reduction factor (R-hat) over all parameters,
+ * computed from the per-chain running estimates of one warmup window.
+ *
+ * @return The largest R-hat, or infinity if it cannot be computed.
+ */
+inline double max_rhat(std::vector<stan::math::welford_var_estimator> &chains,
+                       size_t num_params) {
+  const size_t num_chains = chains.size();
+  const double n = static_cast<double>(chains[0].num_samples());
+  if (num_chains < 2 || n < 2 || num_params == 0) {
+    return std::numeric_limits<double>::infinity();
+  }
+
+  Eigen::MatrixXd means(num_params, num_chains);
+  Eigen::MatrixXd vars(num_params, num_chains);
+  for (size_t i = 0; i < num_chains; ++i) {
+    Eigen::VectorXd mean, var;
+    chains[i].sample_mean(mean);
+    chains[i].sample_variance(var);
+    means.col(i) = mean;
+    vars.col(i) = var;
+  }
+
+  Eigen::VectorXd within = vars.rowwise().mean();
+  Eigen::VectorXd between
+      = (means.colwise() - means.rowwise().mean()).rowwise().squaredNorm()
+        / (num_chains - 1.0);
+  Eigen::VectorXd var_plus = (n - 1.0) / n * within + between;
+  Eigen::VectorXd rhat = (var_plus.array() / within.array()).sqrt();
+  if (!rhat.allFinite()) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return rhat.maxCoeff();
+}
+
+/**
+ * @brief NUTS with warmup shared between all chains.
+ *
+ * During warmup the chains advance in lockstep. After every iteration a single
+ * dual averaging adaptation, fed the mean acceptance statistic of all chains,
+ * sets one step size for every chain. Within Stan's metric adaptation windows
+ * the draws of all chains are pooled into one variance (or covariance)
+ * estimate, which becomes the metric of every chain at the end of the window.
+ *
+ * If `rhat_threshold` is positive, the cross-chain R-hat of each metric
+ * window's draws is checked when the window closes. Once it falls below the
+ * threshold, metric adaptation stops and warmup ends after the terminal
+ * step size buffer. Early stopping is disabled when warmup draws are saved,
+ * so that the output always has the requested shape.
+ *
+ * After warmup the chains sample independently in parallel.
+ *
+ * If `adapt` is false, neither the step size nor the metric are adapted, and
+ * the warmup iterations are run with the initial values.
+ *
+ * @param[out] warmup_run The number of warmup iterations actually run.
+ * @return A code from `stan::services::error_codes`.
+ */
+template <typename Metric>
+int pooled_nuts(stan::model::model_base &model, size_t num_chains,
+                std::vector<io::var_ctx_ptr> &inits,
+                stan::io::var_context &initial_metric, unsigned int seed,
+                unsigned int id, double init_radius, int num_warmup,
+                int num_samples, bool adapt, double delta, double gamma,
+                double kappa, double t0, unsigned int init_buffer,
+                unsigned int term_buffer, unsigned int window,
+                double rhat_threshold, bool save_warmup, double stepsize,
+                double stepsize_jitter, int max_depth, int refresh,
+                stan::callbacks::interrupt &interrupt,
+                stan::callbacks::logger &logger,
+                std::vector<io::buffer_writer> &sample_writers,
+                double *stepsize_out, double *inv_metric_out,
+                int &warmup_run) {
+  using metric_t = typename Metric::metric_t;
+  using estimator_t = typename Metric::estimator_t;
+
+  std::vector<std::unique_ptr<chain<Metric>>> chains;
+  chains.reserve(num_chains);
+  for (size_t i = 0; i < num_chains; ++i) {
+    chains.push_back(std::make_unique<chain<Metric>>(model, seed, id + i));
+  }
+
+  const size_t num_params = model.num_params_r();
+
+  stan::callbacks::writer null_writer;
+  metric_t metric;
+  std::vector<std::vector<double>> cont_vectors;
+  cont_vectors.reserve(num_chains);
+  try {
+    if constexpr (Metric::adapts) {
+      metric = Metric::read(initial_metric, num_params, logger);
+    }
+    for (size_t i = 0; i < num_chains; ++i) {
+      cont_vectors.emplace_back(stan::services::util::initialize(
+          model, *inits[i], chains[i]->rng, init_radius, true, logger,
+          null_writer));
+    }
+  } catch (const std::exception &e) {
+    logger.error(e.what());
+    return stan::services::error_codes::CONFIG;
+  }
+
+  std::vector<stan::services::util::mcmc_writer> writers;
+  writers.reserve(num_chains);
+  for (size_t i = 0; i < num_chains; ++i) {
+    auto &c = *chains[i];
+    auto &cont_vector = cont_vectors[i];
+    Eigen::Map<Eigen::VectorXd> cont_params(cont_vector.data(),
+                                            cont_vector.size());
+
+    if constexpr (Metric::adapts) {
+      c.sampler.set_metric(metric);
+    }
+    c.sampler.set_nominal_stepsize(stepsize);
+    c.sampler.set_stepsize_jitter(stepsize_jitter);
+    c.sampler.set_max_depth(max_depth);
+    c.sampler.z().q = cont_params;
+    c.draw = stan::mcmc::sample(cont_params, 0, 0);
+
+    writers.emplace_back(sample_writers[i], null_writer, logger);
+    writers[i].write_sample_names(c.draw, c.sampler, model);
+  }
+
+  // every chain proposes a step size, and they agree on the geometric mean
+  stan::mcmc::stepsize_adaptation stepsize_adaptation;
+  stepsize_adaptation.set_delta(delta);
+  stepsize_adaptation.set_gamma(gamma);
+  stepsize_adaptation.set_kappa(kappa);
+  stepsize_adaptation.set_t0(t0);
+
+  auto agree_on_stepsize = [&]() {
+    if (num_params == 0) {
+      return;  // the step size heuristic diverges without parameters
+    }
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_chains, 1),
+                      [&](const tbb::blocked_range<size_t> &r) {
+                        for (size_t i = r.begin(); i != r.end(); ++i) {
+                          chains[i]->sampler.init_stepsize(logger);
+                        }
+                      });
+    double log_stepsize = 0;
+    for (auto &c : chains) {
+      log_stepsize += std::log(c->sampler.get_nominal_stepsize());
+    }
+    double shared = std::exp(log_stepsize / num_chains);
+    for (auto &c : chains) {
+      c->sampler.set_nominal_stepsize(shared);
+    }
+    stepsize_adaptation.set_mu(std::log(10 * shared));
+    stepsize_adaptation.restart();
+  };
+
+  try {
+    if (adapt) {
+      agree_on_stepsize();
+    }
+  } catch (const std::exception &e) {
+    logger.error("Exception initializing step size.");
+    logger.error(e.what());
+    return stan::services::error_codes::SOFTWARE;
+  }
+
+  window_schedule schedule;
+  estimator_t pooled(num_params);
+  std::vector<stan::math::welford_var_estimator> per_chain(
+      num_chains, stan::math::welford_var_estimator(num_params));
+  bool adapt_metric = Metric::adapts && adapt;
+  if (adapt_metric) {
+    schedule.set_window_params(num_warmup, init_buffer, term_buffer, window,
+                               logger);
+    schedule.restart();
+  }
+
+  const bool stop_early = rhat_threshold > 0 && !save_warmup && num_chains > 1;
+  const int num_iterations = num_warmup + num_samples;
+  const int it_print_width = std::ceil(std::log10(num_iterations)) + 1;
+
+  int warmup_end = num_warmup;
+  for (int m = 0; m < warmup_end; ++m) {
+    interrupt();
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_chains, 1),
+                      [&](const tbb::blocked_range<size_t> &r) {
+                        for (size_t i = r.begin(); i != r.end(); ++i) {
+                          auto &c = *chains[i];
+                          c.draw = c.sampler.transition(c.draw, logger);
+                        }
+                      });
+
+    double accept_stat = 0;
+    for (auto &c : chains) {
+      accept_stat += c->draw.accept_stat();
+    }
+    if (adapt) {
+      double shared = chains[0]->sampler.get_nominal_stepsize();
+      stepsize_adaptation.learn_stepsize(shared, accept_stat / num_chains);
+      for (auto &c : chains) {
+        c->sampler.set_nominal_stepsize(shared);
+      }
+    }
+
+    if constexpr (Metric::adapts) {
+      if (adapt_metric) {
+        if (schedule.adaptation_window()) {
+          for (size_t i = 0; i < num_chains; ++i) {
+            pooled.add_sample(chains[i]->draw.cont_params());
+            per_chain[i].add_sample(chains[i]->draw.cont_params());
+          }
+        }
+        if (schedule.end_adaptation_window()) {
+          schedule.compute_next_window();
+          metric = Metric::estimate(pooled, metric);
+          if (!metric.allFinite()) {
+            throw std::runtime_error(
+                "Numerical overflow in metric adaptation. This occurs when the "
+                "sampler encounters extreme values on the unconstrained space; "
+                "this may happen when the posterior density function is too "
+                "wide or improper. There may be problems with your model "
+                "specification.");
+          }
+          if constexpr (Metric::selects) {
+            metric = Metric::select(metric, pooled.num_samples(), chains,
+                                    logger);
+          }
+          pooled.restart();
+          for (auto &c : chains) {
+            c->sampler.set_metric(metric);
+          }
+          agree_on_stepsize();
+
+          if (stop_early && max_rhat(per_chain, num_params) < rhat_threshold) {
+            adapt_metric = false;
+            warmup_end = std::min(
+                num_warmup, m + 1 + static_cast<int>(schedule.term_buffer()));
+            std::stringstream msg;
+            msg << "Warmup R-hat below " << rhat_threshold << " after "
+                << m + 1 << " iterations; ending warmup after "
+                << warmup_end - m - 1 << " more iterations.";
+            logger.info(msg);
+          }
+          for (auto &e : per_chain) {
+            e.restart();
+          }
+        }
+        schedule.advance();
+      }
+    }
+
+    if (save_warmup) {
+      for (size_t i = 0; i < num_chains; ++i) {
+        auto &c = *chains[i];
+        writers[i].write_sample_params(c.rng, c.draw, c.sampler, model);
+      }
+    }
+
+    if (refresh > 0 && (m + 1 == warmup_end || m == 0
+                        || (m + 1) % refresh == 0)) {
+      std::stringstream msg;
+      msg << "Iteration: " << std::setw(it_print_width) << m + 1 << " / "
+          << num_iterations << " [" << std::setw(3)
+          << static_cast<int>((100.0 * (m + 1)) / num_iterations) << "%] "
+          << (num_chains > 1 ? " (Warmup, all chains)" : " (Warmup)");
+      logger.info(msg);
+    }
+  }
+
+  double final_stepsize = chains[0]->sampler.get_nominal_stepsize();
+  if (warmup_end > 0 && adapt) {
+    stepsize_adaptation.complete_adaptation(final_stepsize);
+  }
+  for (size_t i = 0; i < num_chains; ++i) {
+    chains[i]->sampler.set_nominal_stepsize(final_stepsize);
+    if (stepsize_out != nullptr) {
+      stepsize_out[i] = final_stepsize;
+    }
+    if constexpr (Metric::adapts) {
+      if (inv_metric_out != nullptr) {
+        std::copy(metric.data(), metric.data() + metric.size(),
+                  inv_metric_out + metric.size() * i);
+      }
+    }
+  }
+
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, num_chains, 1),
+      [&](const tbb::blocked_range<size_t> &r) {
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+          messages::chain_scope scope(id + i);
+          auto &c = *chains[i];
+          stan::services::util::generate_transitions(
+              c.sampler, num_samples, warmup_end, warmup_end + num_samples, 1,
+              refresh,
+              true, false, writers[i], c.draw, model, c.rng, interrupt,
+              logger, id + i, num_chains);
+        }
+      });
+
+  warmup_run = warmup_end;
+  return stan::services::error_codes::OK;
+}
+
+/**
+ * @brief NUTS with each chain adapting on its own.
+ *
+ * For metrics which Stan's services do not provide, this runs pooled_nuts()
+ * with a single chain for each chain in parallel, which is equivalent to
+ * Stan's usual windowed adaptation. Arguments are as in pooled_nuts(), except
+ * that there is one initial metric per chain, and `inv_metric_out` holds
+ * `metric_size` doubles per chain.
+ *
+ * @return The first non-zero code returned by a chain, or zero.
+ */
+template <typename Metric>
+int independent_nuts(stan::model::model_base &model, size_t num_chains,
+                     std::vector<io::var_ctx_ptr> &inits,
+                     std::vector<io::var_ctx_ptr> &initial_metrics,
+                     unsigned int seed, unsigned int id, double init_radius,
+                     int num_warmup, int num_samples, bool adapt, double delta,
+                     double gamma, double kappa, double t0,
+                     unsigned int init_buffer, unsigned int term_buffer,
+                     unsigned int window, bool save_warmup, double stepsize,
+                     double stepsize_jitter, int max_depth, int refresh,
+                     stan::callbacks::interrupt &interrupt,
+                     stan::callbacks::logger &logger,
+                     std::vector<io::buffer_writer> &sample_writers,
+                     double *stepsize_out, double *inv_metric_out,
+                     size_t metric_size) {
+  std::vector<int> return_codes(num_chains, 0);
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, num_chains, 1),
+      [&](const tbb::blocked_range<size_t> &r) {
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+          messages::chain_scope scope(id + i);
+          std::vector<io::var_ctx_ptr> chain_inits;
+          chain_inits.push_back(std::move(inits[i]));
+          std::vector<io::buffer_writer> writers{sample_writers[i]};
+          int warmup_run = 0;
+          // copy the writer back even on failure, so the number of draws
+          // written is known when the deadline passes
+          try {
+            return_codes[i] = pooled_nuts<Metric>(
+                model, 1, chain_inits, *initial_metrics[i], seed, id + i,
+                init_radius, num_warmup, num_samples, adapt, delta, gamma,
+                kappa, t0, init_buffer, term_buffer, window, 0, save_warmup,
+                stepsize, stepsize_jitter, max_depth, refresh, interrupt,
+                logger, writers,
+                stepsize_out == nullptr ? nullptr : stepsize_out + i,
+                inv_metric_out == nullptr ? nullptr
+                                          : inv_metric_out + metric_size * i,
+                warmup_run);
+          } catch (...) {
+            sample_writers[i] = writers[0];
+            throw;
+          }
+          sample_writers[i] = writers[0];
+        }
+      });
+  for (int code : return_codes) {
+    if (code != 0) {
+      return code;
+    }
+  }
+  return stan::services::error_codes::OK;
+}
+
+/**
+ * @brief Run NUTS with cross-chain pooled warmup.
+ *
+ * Handles the output buffers and the deadline in the same way as run_nuts()
+ * and dispatches to pooled_nuts() for the chosen metric.
+ */
+inline int run_pooled_nuts(
+    const TinyStanModel &tmodel, size_t num_chains,
+    std::vector<io::var_ctx_ptr> &inits, stan::io::var_context &initial_metric,
+    unsigned int seed, unsigned int id, double init_radius, int num_warmup,
+    int num_samples, TinyStanMetric metric_choice, double delta, double gamma,
+    double kappa, double t0, unsigned int init_buffer, unsigned int term_buffer,
+    unsigned int window, double rhat_threshold, bool save_warmup,
+    double stepsize, double stepsize_jitter, int max_depth, int refresh,
+    const interrupt::deadline &deadline, double *out, size_t out_size,
+    double *stepsize_out, double *inv_metric_out, int *num_warmup_out,
+    TinyStanError **err) {
+  auto &model = *tmodel.model;
+
+  // all HMC has 7 algorithm params
+  int num_params = tmodel.num_params + 7;
+  int draws_offset = num_params * (num_samples + num_warmup * save_warmup);
+  if (out_size < num_chains * draws_offset) {
+    std::stringstream ss;
+    ss << "Output buffer too small. Expected at least " << num_chains
+       << " chains of " << draws_offset << " doubles, got " << out_size;
+    throw std::runtime_error(ss.str());
+  }
+
+  std::vector<io::buffer_writer> sample_writers;
+  sample_writers.reserve(num_chains);
+  for (size_t i = 0; i < num_chains; ++i) {
+    sample_writers.emplace_back(out + draws_offset * i, draws_offset);
+  }
+
+  error::error_logger logger(tmodel, refresh != 0);
+  interrupt::tinystan_interrupt_handler interrupt(deadline);
+
+  int return_code = 0;
+  int warmup_run = 0;
+  try {
+    switch (metric_choice) {
+      case unit:
+#ifdef TINYSTAN_ALGORITHM_NUTS_UNIT
+        return_code = pooled_nuts<unit_metric>(
+            model, num_chains, inits, initial_metric, seed, id, init_radius,
+            num_warmup, num_samples, true, delta, gamma, kappa, t0,
+            init_buffer, term_buffer, window, rhat_threshold, save_warmup,
+            stepsize, stepsize_jitter, max_depth, refresh, interrupt, logger,
+            sample_writers, stepsize_out, inv_metric_out, warmup_run);
+#else
+        algorithms::unavailable("nuts_unit");
+#endif
+        break;
+      case dense:
+#ifdef TINYSTAN_ALGORITHM_NUTS_DENSE
+        return_code = pooled_nuts<dense_metric>(
+            model, num_chains, inits, initial_metric, seed, id, init_radius,
+            num_warmup, num_samples, true, delta, gamma, kappa, t0,
+            init_buffer, term_buffer, window, rhat_threshold, save_warmup,
+            stepsize, stepsize_jitter, max_depth, refresh, interrupt, logger,
+            sample_writers, stepsize_out, inv_metric_out, warmup_run);
+#else
+        algorithms::unavailable("nuts_dense");
+#endif
+        break;
+      case diagonal:
+#ifdef TINYSTAN_ALGORITHM_NUTS_DIAG
+        return_code = pooled_nuts<diag_metric>(
+            model, num_chains, inits, initial_metric, seed, id, init_radius,
+            num_warmup, num_samples, true, delta, gamma, kappa, t0,
+            init_buffer, term_buffer, window, rhat_threshold, save_warmup,
+            stepsize, stepsize_jitter, max_depth, refresh, interrupt, logger,
+            sample_writers, stepsize_out, inv_metric_out, warmup_run);
+#else
+        algorithms::unavailable("nuts_diag");
+#endif
+        break;
+      case lowrank:
+#ifdef TINYSTAN_ALGORITHM_NUTS_LOWRANK
+        return_code = pooled_nuts<lowrank_metric>(
+            model, num_chains, inits, initial_metric, seed, id, init_radius,
+            num_warmup, num_samples, true, delta, gamma, kappa, t0,
+            init_buffer, term_buffer, window, rhat_threshold, save_warmup,
+            stepsize, stepsize_jitter, max_depth, refresh, interrupt, logger,
+            sample_writers, stepsize_out, inv_metric_out, warmup_run);
+#else
+        algorithms::unavailable("nuts_lowrank");
+#endif
+        break;
+      case automatic:
+#ifdef TINYSTAN_ALGORITHM_NUTS_AUTO
+        return_code = pooled_nuts<auto_metric>(
+            model, num_chains, inits, initial_metric, seed, id, init_radius,
+            num_warmup, num_samples, true, delta, gamma, kappa, t0,
+            init_buffer, term_buffer, window, rhat_threshold, save_warmup,
+            stepsize, stepsize_jitter, max_depth, refresh, interrupt, logger,
+            sample_writers, stepsize_out, inv_metric_out, warmup_run);
+#else
+        algorithms::unavailable("nuts_auto");
+#endif
+        break;
+    }
+  } catch (error::timeout_exception &e) {
+    e.draw_counts = io::rows_written(sample_writers, num_params);
+    throw;
+  }
+  if (return_code != 0) {
+    if (err != nullptr) {
+      *err = logger.get_error();
+    }
+  } else if (num_warmup_out != nullptr) {
+    *num_warmup_out = warmup_run;
+  }
+
+  return return_code;
+}
+
+}  // namespace nuts
+}  // namespace tinystan
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef TINYSTAN_SCREENING_HPP
+#define TINYSTAN_SCREENING_HPP
+
+#include <stan/io/chained_var_context.hpp>
+#include <stan/io/random_var_context.hpp>
+#include <stan/io/var_context.hpp>
+#include <stan/math/prim/fun/Eigen.hpp>
+#include <stan/model/log_prob_grad.hpp>
+#include <stan/model/model_base.hpp>
+#include <stan/services/util/create_rng.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "call_options.hpp"
+#include "file.hpp"
+#include "model.hpp"
+#include "util.hpp"
+
+namespace tinystan {
+namespace screening {
+
+/**
+ * Statistics about the screening of one call. See
+ * tinystan_last_call_init_screening().
+ */
+struct stats {
+  size_t evaluated = 0;
+  size_t valid = 0;
+};
+
+/**
+ * The statistics of the last call made from this thread.
+ */
+inline stats &last() {
+  static thread_local stats s;
+  return s;
+}
+
+/**
+ * Whether `init` gives a value for every parameter, so that there is nothing
+ * random left to screen.
+ */
+inline bool is_complete(const stan::model::model_base &model,
+                        const stan::io::var_context &init) {
+  std::vector<std::string> names;
+  model.get_param_names(names, false, false);
+  for (const auto &name : names) {
+    if (!init.contains_r(name)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Make a candidate initialization on the unconstrained scale.
+ *
+ * As in `stan::services::util::initialize()`, parameters missing from `init`
+ * are drawn uniformly from `(-init_radius, init_radius)` on the unconstrained
+ * scale. Throws if `init` holds invalid values.
+ */
+template <typename RNG>
+Eigen::VectorXd make_candidate(stan::model::model_base &model,
+                               const stan::io::var_context &init, RNG &rng,
+                               double init_radius) {
+  stan::io::random_var_context random(model, rng, init_radius, false);
+  stan::io::chained_var_context context(init, random);
+  Eigen::VectorXd unconstrained;
+  model.transform_inits(context, unconstrained, nullptr);
+  return unconstrained;
+}
+
+/**
+ * @brief The seed of the candidates' random number streams.
+ *
+ * A hash of `seed`, so that the candidate streams are apart from the
+ * streams of chains, restarts, and paths, which all use `seed` itself.
+ */
+inline unsigned int candidate_seed(unsigned int seed) {
+  // the finalizer of MurmurHash3, salted so that 0 is not a fixed point
+  std::uint32_t h = seed ^ 0x9e3779b9u;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+/**
+ * @brief Replace initializations with screened candidates.
+ *
+ * If the call screens initializations (see
+ * tinystan_call_options_set_init_screening()), `init_candidates` candidates
+ * are made for each entry of `inits` which does not already give every
+ * parameter, and all of them are evaluated in parallel. A candidate is valid
+ * if its log density (with the Jacobian) and gradient are finite. Each entry
+ * is then replaced by its first valid candidate, or its valid candidate with
+ * the highest log density, so that Stan's serial retries are not needed.
+ * Entries without a valid candidate are kept, leaving Stan to retry as
+ * before.
+ *
+ * Each entry gets its own candidates, rather than sharing the best of all of
+ * them, so that chains or paths still start from dispersed points.
+ * Candidate `j` of entry `i` uses the random number stream
+ * `(id + i) * init_candidates + j` of candidate_seed(), so the choice does not
+ * depend on the number of threads, and no two chain ids share a candidate.
+ *
+ * @return The statistics of the screening, see last().
+ */
+inline stats screen(const TinyStanModel &tmodel,
+                    const TinyStanCallOptions &options,
+                    std::vector<io::var_ctx_ptr> &inits, unsigned int seed,
+                    unsigned int id, double init_radius) {
+  // the candidates are evaluated by the call's threads, which have tapes
+  assert(util::in_call_arena() && "screening outside util::with_threads()");
+  stats result;
+  const size_t per_init = options.init_candidates;
+  if (per_init == 0 || tmodel.num_free_params == 0) {
+    return result;
+  }
+  auto &model = *tmodel.model;
+  const size_t num_inits = inits.size();
+  const bool select_best = options.select_best_init;
+
+  std::vector<char> screened(num_inits);
+  for (size_t i = 0; i < num_inits; ++i) {
+    screened[i] = !is_complete(model, *inits[i]);
+  }
+
+  const unsigned int salted_seed = candidate_seed(seed);
+  auto stream = [&](size_t k) {
+    return stan::services::util::create_rng(salted_seed, id * per_init + k);
+  };
+
+  // NaN marks an invalid candidate
+  const size_t num_candidates = num_inits * per_init;
+  std::vector<double> log_density(num_candidates,
+                                  std::numeric_limits<double>::quiet_NaN());
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, num_candidates, 1),
+      [&](const tbb::blocked_range<size_t> &r) {
+        for (size_t k = r.begin(); k != r.end(); ++k) {
+          const size_t i = k / per_init;
+          if (!screened[i]) {
+            continue;
+          }
+          try {
+            auto rng = stream(k);
+            Eigen::VectorXd x
+                = make_candidate(model, *inits[i], rng, init_radius);
+            Eigen::VectorXd grad;
+            double lp = stan::model::log_prob_grad<true, true>(model, x, grad);
+            if (std::isfinite(lp) && grad.allFinite()) {
+              log_density[k] = lp;
+            }
+          } catch (const std::exception &) {
+            // an invalid candidate, as in Stan's own retries
+          }
+        }
+      });
+
+  for (size_t i = 0; i < num_inits; ++i) {
+    if (!screened[i]) {
+      continue;
+    }
+    result.evaluated += per_init;
+    size_t winner = num_candidates;
+    for (size_t k = i * per_init; k < (i + 1) * per_init; ++k) {
+      if (std::isnan(log_density[k])) {
+        continue;
+      }
+      ++result.valid;
+      if (winner == num_candidates
+          || (select_best && log_density[k] > log_density[winner])) {
+        winner = k;
+      }
+    }
+    if (winner == num_candidates) {
+      continue;
+    }
+    // candidates are not kept, but can be made again from their stream
+    auto rng = stream(winner);
+    Eigen::VectorXd x = make_candidate(model, *inits[i], rng, init_radius);
+    Eigen::VectorXd constrained;
+    model.write_array(rng, x, constrained, false, false, nullptr);
+    inits[i] = model::make_init_context(tmodel, constrained.data());
+  }
+  return result;
+}
+
+/**
+ * Screen initializations as in screen(), recording the statistics for
+ * last(). They are recorded even without screening.
+ */
+inline void screen_inits(const TinyStanModel &tmodel,
+                         const TinyStanCallOptions &options,
+                         std::vector<io::var_ctx_ptr> &inits,
+                         unsigned int seed, unsigned int id,
+                         double init_radius) {
+  last() = screen(tmodel, options, inits, seed, id, init_radius);
+}
+
+/**
+ * Screen a single initialization, see screen_inits().
+ */
+inline void screen_init(const TinyStanModel &tmodel,
+                        const TinyStanCallOptions &options,
+                        io::var_ctx_ptr &init, unsigned int seed,
+                        unsigned int id, double init_radius) {
+  std::vector<io::var_ctx_ptr> inits;
+  inits.push_back(std::move(init));
+  screen_inits(tmodel, options, inits, seed, id, init_radius);
+  init = std::move(inits[0]);
+}
+
+}  // namespace screening
+}  // namespace tinystan
+
+#endif
@@ -0,0 +1,454 @@
+#ifndef TINYSTAN_SESSION_HPP
+#define TINYSTAN_SESSION_HPP
+
+#include <stan/callbacks/interrupt.hpp>
+#include <stan/callbacks/logger.hpp>
+#include <stan/callbacks/writer.hpp>
+#include <stan/io/var_context.hpp>
+#include <stan/mcmc/sample.hpp>
+#include <stan/mcmc/stepsize_adaptation.hpp>
+#include <stan/services/util/generate_transitions.hpp>
+#include <stan/services/util/initialize.hpp>
+#include <stan/services/util/mcmc_writer.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "tinystan_types.h"
+#include "algorithms.hpp"
+#include "buffer.hpp"
+#include "errors.hpp"
+#include "file.hpp"
+#include "interrupts.hpp"
+#include "model.hpp"
+#include "pooled_warmup.hpp"
+
+/**
+ * @brief NUTS chains which persist between calls.
+ *
+ * The positions, step sizes, and metrics of the chains are kept between calls
+ * to warmup() and draw(), so that a caller can sample incrementally. See
+ * tinystan_sampler_create(). The model must outlive the sampler.
+ */
+struct TinyStanSampler {
+  TinyStanSampler(const TinyStanModel &tmodel, size_t num_chains,
+                  size_t metric_size)
+      : tmodel(tmodel), num_chains(num_chains), metric_size(metric_size) {}
+  virtual ~TinyStanSampler() = default;
+
+  /**
+   * Run a complete warmup schedule of `num_warmup` iterations in each chain.
+   * If `writers` is not empty, the draws of chain `i` go to `writers[i]`.
+   */
+  virtual void warmup(int num_warmup, unsigned int init_buffer,
+                      unsigned int term_buffer, unsigned int window,
+                      int refresh, stan::callbacks::interrupt &interrupt,
+                      stan::callbacks::logger &logger,
+                      std::vector<tinystan::io::buffer_writer> &writers)
+      = 0;
+
+  /**
+   * Draw `num_draws` times from each chain without adaptation.
+   */
+  virtual void draw(int num_draws, int refresh,
+                    stan::callbacks::interrupt &interrupt,
+                    stan::callbacks::logger &logger,
+                    std::vector<tinystan::io::buffer_writer> &writers)
+      = 0;
+
+  /**
+   * Copy out the state of the chains. Any argument can be null.
+   */
+  virtual void state(double *positions, double *stepsizes,
+                     double *inv_metrics) const
+      = 0;
+
+  const TinyStanModel &tmodel;
+  const size_t num_chains;
+  /** Number of doubles in the inverse metric of one chain */
+  const size_t metric_size;
+};
+
+namespace tinystan {
+namespace nuts {
+
+/**
+ * @brief A sampler session for one metric.
+ *
+ * Each chain adapts on its own, as in independent_nuts(). Every call to
+ * warmup() restarts the step size adaptation from the current step size, and
+ * the metric windows from the current metric, so repeated calls refine them.
+ * The step size and metric are only updated if warmup() finishes; if it is
+ * interrupted, the chains keep their new positions but their previous step
+ * size and metric.
+ */
+template <typename Metric>
+class session : public TinyStanSampler {
+  using metric_t = typename Metric::metric_t;
+  using estimator_t = typename Metric::estimator_t;
+
+ public:
+  /**
+   * Initialize the chains. Throws if the metrics cannot be read or no initial
+   * values are found, with the details reported through `logger`.
+   * `interrupt` is checked before each chain is initialized.
+   */
+  session(const TinyStanModel &tmodel, size_t num_chains,
+          std::vector<io::var_ctx_ptr> &inits,
+          std::vector<io::var_ctx_ptr> &initial_metrics, size_t metric_size,
+          unsigned int seed, unsigned int id, double init_radius,
+          double delta, double gamma, double kappa, double t0,
+          double stepsize, double stepsize_jitter, int max_depth,
+          stan::callbacks::interrupt &interrupt,
+          stan::callbacks::logger &logger)
+      : TinyStanSampler(tmodel, num_chains, metric_size),
+        id(id),
+        delta(delta),
+        gamma(gamma),
+        kappa(kappa),
+        t0(t0),
+        stepsizes(num_chains, stepsize) {
+    auto &model = *tmodel.model;
+    const size_t num_params = model.num_params_r();
+    stan::callbacks::writer null_writer;
+    chains.reserve(num_chains);
+    metrics.reserve(num_chains);
+    for (size_t i = 0; i < num_chains; ++i) {
+      interrupt();
+      auto c = std::make_unique<chain<Metric>>(model, seed, id + i);
+      if constexpr (Metric::adapts) {
+        metrics.push_back(
+            Metric::read(*initial_metrics[i], num_params, logger));
+        c->sampler.set_metric(metrics[i]);
+      } else {
+        metrics.push_back(metric_t::Ones(num_params));
+      }
+      std::vector<double> cont_vector = stan::services::util::initialize(
+          model, *inits[i], c->rng, init_radius, true, logger, null_writer);
+      Eigen::Map<Eigen::VectorXd> cont_params(cont_vector.data(),
+                                              cont_vector.size());
+      c->sampler.set_nominal_stepsize(stepsize);
+      c->sampler.set_stepsize_jitter(stepsize_jitter);
+      c->sampler.set_max_depth(max_depth);
+      c->sampler.z().q = cont_params;
+      c->draw = stan::mcmc::sample(cont_params, 0, 0);
+      chains.push_back(std::move(c));
+    }
+  }
+
+  void warmup(int num_warmup, unsigned int init_buffer,
+              unsigned int term_buffer, unsigned int window, int refresh,
+              stan::callbacks::interrupt &interrupt,
+              stan::callbacks::logger &logger,
+              std::vector<io::buffer_writer> &writers) override {
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_chains, 1),
+                      [&](const tbb::blocked_range<size_t> &r) {
+                        for (size_t i = r.begin(); i != r.end(); ++i) {
+                          messages::chain_scope scope(id + i);
+                          warmup_chain(i, num_warmup, init_buffer,
+                                       term_buffer, window, refresh,
+                                       interrupt, logger, writers);
+                        }
+                      });
+  }
+
+  void draw(int num_draws, int refresh, stan::callbacks::interrupt &interrupt,
+            stan::callbacks::logger &logger,
+            std::vector<io::buffer_writer> &writers) override {
+    auto &model = *tmodel.model;
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, num_chains, 1),
+        [&](const tbb::blocked_range<size_t> &r) {
+          for (size_t i = r.begin(); i != r.end(); ++i) {
+            messages::chain_scope scope(id + i);
+            auto &c = *chains[i];
+            stan::callbacks::writer null_writer;
+            stan::services::util::mcmc_writer writer(writers[i], null_writer,
+                                                     logger);
+            stan::services::util::generate_transitions(
+                c.sampler, num_draws, 0, num_draws, 1, refresh, true, false,
+                writer, c.draw, model, c.rng, interrupt, logger, id + i,
+                num_chains);
+          }
+        });
+  }
+
+  void state(double *positions, double *stepsizes_out,
+             double *inv_metrics) const override {
+    for (size_t i = 0; i < num_chains; ++i) {
+      if (positions != nullptr) {
+        Eigen::VectorXd q = chains[i]->draw.cont_params();
+        std::copy(q.data(), q.data() + q.size(), positions + q.size() * i);
+      }
+      if (stepsizes_out != nullptr) {
+        stepsizes_out[i] = stepsizes[i];
+      }
+      if (inv_metrics != nullptr) {
+        const metric_t &metric = metrics[i];
+        std::copy(metric.data(), metric.data() + metric.size(),
+                  inv_metrics + metric_size * i);
+      }
+    }
+  }
+
+ private:
+  void warmup_chain(size_t i, int num_warmup, unsigned int init_buffer,
+                    unsigned int term_buffer, unsigned int window, int refresh,
+                    stan::callbacks::interrupt &interrupt,
+                    stan::callbacks::logger &logger,
+                    std::vector<io::buffer_writer> &writers) {
+    auto &model = *tmodel.model;
+    const size_t num_params = model.num_params_r();
+    auto &c = *chains[i];
+
+    stan::mcmc::stepsize_adaptation adaptation;
+    adaptation.set_delta(delta);
+    adaptation.set_gamma(gamma);
+    adaptation.set_kappa(kappa);
+    adaptation.set_t0(t0);
+    auto restart_stepsize = [&]() {
+      if (num_params > 0) {
+        c.sampler.init_stepsize(logger);
+      }
+      adaptation.set_mu(std::log(10 * c.sampler.get_nominal_stepsize()));
+      adaptation.restart();
+    };
+
+    window_schedule schedule;
+    estimator_t estimator(num_params);
+    if constexpr (Metric::adapts) {
+      schedule.set_window_params(num_warmup, init_buffer, term_buffer, window,
+                                 logger);
+      schedule.restart();
+    }
+
+    stan::callbacks::writer null_writer;
+    std::optional<stan::services::util::mcmc_writer> writer;
+    if (!writers.empty()) {
+      writer.emplace(writers[i], null_writer, logger);
+    }
+    const int it_print_width = std::ceil(std::log10(num_warmup)) + 1;
+
+    metric_t metric = metrics[i];
+    try {
+      restart_stepsize();
+      for (int m = 0; m < num_warmup; ++m) {
+        interrupt();
+        c.draw = c.sampler.transition(c.draw, logger);
+
+        double eps = c.sampler.get_nominal_stepsize();
+        adaptation.learn_stepsize(eps, c.draw.accept_stat());
+        c.sampler.set_nominal_stepsize(eps);
+
+        if constexpr (Metric::adapts) {
+          if (schedule.adaptation_window()) {
+            estimator.add_sample(c.draw.cont_params());
+          }
+          if (schedule.end_adaptation_window()) {
+            schedule.compute_next_window();
+            metric = Metric::estimate(estimator, metric);
+            if (!metric.allFinite()) {
+              throw std::runtime_error(
+                  "Numerical overflow in metric adaptation. This occurs when "
+                  "the sampler encounters extreme values on the unconstrained "
+                  "space; this may happen when the posterior density function "
+                  "is too wide or improper. There may be problems with your "
+                  "model specification.");
+            }
+            if constexpr (Metric::selects) {
+              std::vector<chain<Metric> *> self{&c};
+              metric = Metric::select(metric, estimator.num_samples(), self,
+                                      logger);
+            }
+            estimator.restart();
+            c.sampler.set_metric(metric);
+            restart_stepsize();
+          }
+          schedule.advance();
+        }
+
+        if (writer) {
+          writer->write_sample_params(c.rng, c.draw, c.sampler, model);
+        }
+
+        if (refresh > 0
+            && (m + 1 == num_warmup || m == 0 || (m + 1) % refresh == 0)) {
+          std::stringstream msg;
+          if (num_chains > 1) {
+            msg << "Chain [" << id + i << "] ";
+          }
+          msg << "Iteration: " << std::setw(it_print_width) << m + 1 << " / "
+              << num_warmup << " [" << std::setw(3)
+              << static_cast<int>((100.0 * (m + 1)) / num_warmup)
+              << "%]  (Warmup)";
+          logger.info(msg);
+        }
+      }
+    } catch (...) {
+      c.sampler.set_nominal_stepsize(stepsizes[i]);
+      if constexpr (Metric::adapts) {
+        c.sampler.set_metric(metrics[i]);
+      }
+      throw;
+    }
+
+    double final_stepsize = c.sampler.get_nominal_stepsize();
+    adaptation.complete_adaptation(final_stepsize);
+    c.sampler.set_nominal_stepsize(final_stepsize);
+    stepsizes[i] = final_stepsize;
+    metrics[i] = std::move(metric);
+  }
+
+  const unsigned int id;
+  const double delta;
+  const double gamma;
+  const double kappa;
+  const double t0;
+  // chains are held by pointer, see chain
+  std::vector<std::unique_ptr<chain<Metric>>> chains;
+  std::vector<double> stepsizes;
+  std::vector<metric_t> metrics;
+};
+
+/**
+ * @brief Create a sampler session for the chosen metric.
+ *
+ * @return The session, or null if the chains could not be initialized, in
+ * which case the reason has been reported to `logger` as an error.
+ */
+inline std::unique_ptr<TinyStanSampler> make_session(
+    const TinyStanModel &tmodel, size_t num_chains,
+    std::vector<io::var_ctx_ptr> &inits,
+    std::vector<io::var_ctx_ptr> &initial_metrics, unsigned int seed,
+    unsigned int id, double init_radius, TinyStanMetric metric_choice,
+    size_t metric_rank, double delta, double gamma, double kappa, double t0,
+    double stepsize, double stepsize_jitter, int max_depth,
+    const interrupt::deadline &deadline, error::error_logger &logger) {
+  interrupt::tinystan_interrupt_handler interrupt(deadline);
+  const size_t metric_size = io::metric_size(
+      metric_choice, tmodel.num_free_params, metric_rank);
+  auto make = [&](auto metric) -> std::unique_ptr<TinyStanSampler> {
+    using Metric = decltype(metric);
+    try {
+      return std::make_unique<session<Metric>>(
+          tmodel, num_chains, inits, initial_metrics, metric_size, seed, id,
+          init_radius, delta, gamma, kappa, t0, stepsize, stepsize_jitter,
+          max_depth, interrupt, logger);
+    } catch (const std::exception &e) {
+      logger.error(e.what());
+      return nullptr;
+    }
+  };
+
+  switch (metric_choice) {
+    case unit:
+#ifdef TINYSTAN_ALGORITHM_NUTS_UNIT
+      return make(unit_metric{});
+#else
+      algorithms::unavailable("nuts_unit");
+#endif
+    case dense:
+#ifdef TINYSTAN_ALGORITHM_NUTS_DENSE
+      return make(dense_metric{});
+#else
+      algorithms::unavailable("nuts_dense");
+#endif
+    case diagonal:
+#ifdef TINYSTAN_ALGORITHM_NUTS_DIAG
+      return make(diag_metric{});
+#else
+      algorithms::unavailable("nuts_diag");
+#endif
+    case lowrank:
+#ifdef TINYSTAN_ALGORITHM_NUTS_LOWRANK
+      return make(lowrank_metric{});
+#else
+      algorithms::unavailable("nuts_lowrank");
+#endif
+    case automatic:
+#ifdef TINYSTAN_ALGORITHM_NUTS_AUTO
+      return make(auto_metric{});
+#else
+      algorithms::unavailable("nuts_auto");
+#endif
+  }
+  return nullptr;
+}
+
+/**
+ * Make one writer per chain for `num_draws` draws each into `out`, checking
+ * that it is large enough.
+ */
+inline std::vector<io::buffer_writer> session_writers(
+    const TinyStanSampler &sampler, int num_draws, double *out,
+    size_t out_size) {
+  // all HMC has 7 algorithm params
+  size_t draws_offset = (sampler.tmodel.num_params + 7) * num_draws;
+  if (out_size < sampler.num_chains * draws_offset) {
+    std::stringstream ss;
+    ss << "Output buffer too small. Expected at least " << sampler.num_chains
+       << " chains of " << draws_offset << " doubles, got " << out_size;
+    throw std::runtime_error(ss.str());
+  }
+  std::vector<io::buffer_writer> writers;
+  writers.reserve(sampler.num_chains);
+  for (size_t i = 0; i < sampler.num_chains; ++i) {
+    writers.emplace_back(out + draws_offset * i, draws_offset);
+  }
+  return writers;
+}
+
+/**
+ * Run warmup in a session, handling the output buffer and the deadline as
+ * in run_nuts(). `out` can be null.
+ */
+inline void session_warmup(TinyStanSampler &sampler, int num_warmup,
+                           unsigned int init_buffer, unsigned int term_buffer,
+                           unsigned int window, int refresh,
+                           const interrupt::deadline &deadline, double *out,
+                           size_t out_size) {
+  std::vector<io::buffer_writer> writers;
+  if (out != nullptr) {
+    writers = session_writers(sampler, num_warmup, out, out_size);
+  }
+  error::error_logger logger(sampler.tmodel, refresh != 0);
+  interrupt::tinystan_interrupt_handler interrupt(deadline);
+  try {
+    sampler.warmup(num_warmup, init_buffer, term_buffer, window, refresh,
+                   interrupt, logger, writers);
+  } catch (error::timeout_exception &e) {
+    e.draw_counts = io::rows_written(writers, sampler.tmodel.num_params + 7);
+    throw;
+  }
+}
+
+/**
+ * Draw from a session, handling the output buffer and the deadline as in
+ * run_nuts().
+ */
+inline void session_draw(TinyStanSampler &sampler, int num_draws, int refresh,
+                         const interrupt::deadline &deadline, double *out,
+                         size_t out_size) {
+  auto writers = session_writers(sampler, num_draws, out, out_size);
+  error::error_logger logger(sampler.tmodel, refresh != 0);
+  interrupt::tinystan_interrupt_handler interrupt(deadline);
+  try {
+    sampler.draw(num_draws, refresh, interrupt, logger, writers);
+  } catch (error::timeout_exception &e) {
+    e.draw_counts = io::rows_written(writers, sampler.tmodel.num_params + 7);
+    throw;
+  }
+}
+
+}  // namespace nuts
+}  // namespace tinystan
+
+#endif
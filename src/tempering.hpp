@@ -0,0 +1,501 @@
+#ifndef TINYSTAN_TEMPERING_HPP
+#define TINYSTAN_TEMPERING_HPP
+
+#include <stan/callbacks/interrupt.hpp>
+#include <stan/callbacks/logger.hpp>
+#include <stan/callbacks/writer.hpp>
+#include <stan/io/var_context.hpp>
+#include <stan/math/prim/fun/Eigen.hpp>
+#include <stan/math/prim/prob/uniform_rng.hpp>
+#include <stan/mcmc/sample.hpp>
+#include <stan/mcmc/stepsize_adaptation.hpp>
+#include <stan/model/model_base.hpp>
+#include <stan/services/error_codes.hpp>
+#include <stan/services/util/create_rng.hpp>
+#include <stan/services/util/initialize.hpp>
+#include <stan/services/util/mcmc_writer.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "tinystan_types.h"
+#include "algorithms.hpp"
+#include "buffer.hpp"
+#include "errors.hpp"
+#include "file.hpp"
+#include "interrupts.hpp"
+#include "model.hpp"
+#include "pooled_warmup.hpp"
+
+namespace tinystan {
+namespace nuts {
+
+/**
+ * @brief A model whose log density is raised to the power `beta`.
+ *
+ * Provides the parts of the model interface which Stan's samplers use, so
+ * that they can be instantiated with it in place of the model itself. The
+ * whole density (prior included) is tempered, and `beta` can be changed
+ * between transitions.
+ */
+class tempered_model {
+ public:
+  tempered_model(const stan::model::model_base &model, double beta)
+      : model(model), beta(beta) {}
+
+  size_t num_params_r() const { return model.num_params_r(); }
+
+  template <bool propto, bool jacobian, typename T>
+  T log_prob(Eigen::Matrix<T, Eigen::Dynamic, 1> &params_r,
+             std::ostream *msgs) const {
+    return beta * model.template log_prob<propto, jacobian>(params_r, msgs);
+  }
+
+  const stan::model::model_base &model;
+  /** The inverse temperature */
+  double beta;
+};
+
+/**
+ * The swap acceptance rate targeted when adapting the temperatures.
+ */
+constexpr double target_swap_rate = 0.234;
+
+/**
+ * @brief NUTS with replica exchange (parallel tempering).
+ *
+ * Replica `k` runs NUTS on the density raised to the power `1 / T_k`, with
+ * `T_0 = 1` and the temperatures initially spaced geometrically up to
+ * `max_temperature`. The replicas take one transition each in parallel, and
+ * every `swap_interval` iterations states are exchanged between neighbouring
+ * temperatures with the usual Metropolis probability. Swaps alternate
+ * between the even and the odd pairs.
+ *
+ * During warmup each replica adapts its own step size and metric as in
+ * Stan's windowed adaptation. If `adapt_temperatures` is true, the gaps
+ * between neighbouring temperatures are also adapted, on the log scale with
+ * a Robbins-Monro schedule (Miasojedow, Moulines, and Vihola, 2013), towards
+ * a swap acceptance rate of target_swap_rate. The ladder is fixed after
+ * warmup.
+ *
+ * Only the draws of the untempered replica are written, in the format of
+ * Stan's samplers.
+ *
+ * @param[out] stepsize_out The step size of each replica after warmup. Can be
+ * null.
+ * @param[out] temperatures_out The final temperatures. Can be null.
+ * @param[out] swap_rates_out The fraction of swaps between replicas `k` and
+ * `k + 1` accepted after warmup. Can be null.
+ * @return A code from `stan::services::error_codes`.
+ */
+template <typename Metric>
+int tempered_nuts(stan::model::model_base &model, size_t num_replicas,
+                  std::vector<io::var_ctx_ptr> &inits,
+                  stan::io::var_context &initial_metric, unsigned int seed,
+                  unsigned int id, double init_radius, int num_warmup,
+                  int num_samples, double max_temperature,
+                  bool adapt_temperatures, int swap_interval, double delta,
+                  double gamma, double kappa, double t0,
+                  unsigned int init_buffer, unsigned int term_buffer,
+                  unsigned int window, bool save_warmup, double stepsize,
+                  double stepsize_jitter, int max_depth, int refresh,
+                  stan::callbacks::interrupt &interrupt,
+                  stan::callbacks::logger &logger,
+                  io::buffer_writer &sample_writer, double *stepsize_out,
+                  double *temperatures_out, double *swap_rates_out) {
+  using metric_t = typename Metric::metric_t;
+  using estimator_t = typename Metric::estimator_t;
+  using replica_t = chain<Metric, tempered_model>;
+
+  std::vector<double> temperatures(num_replicas);
+  for (size_t k = 0; k < num_replicas; ++k) {
+    temperatures[k] = std::pow(max_temperature, k / (num_replicas - 1.0));
+  }
+  // the log gaps between temperatures, which are what is adapted
+  std::vector<double> log_gaps(num_replicas - 1);
+  for (size_t k = 0; k + 1 < num_replicas; ++k) {
+    log_gaps[k] = std::log(temperatures[k + 1] - temperatures[k]);
+  }
+
+  // samplers keep a reference to their model
+  std::vector<std::unique_ptr<tempered_model>> tempered;
+  std::vector<std::unique_ptr<replica_t>> replicas;
+  tempered.reserve(num_replicas);
+  replicas.reserve(num_replicas);
+  for (size_t k = 0; k < num_replicas; ++k) {
+    tempered.push_back(
+        std::make_unique<tempered_model>(model, 1.0 / temperatures[k]));
+    replicas.push_back(
+        std::make_unique<replica_t>(*tempered[k], seed, id + k));
+  }
+  rng_t swap_rng = stan::services::util::create_rng(seed, id + num_replicas);
+
+  const size_t num_params = model.num_params_r();
+
+  stan::callbacks::writer null_writer;
+  std::vector<metric_t> metrics(num_replicas);
+  std::vector<std::vector<double>> cont_vectors;
+  cont_vectors.reserve(num_replicas);
+  try {
+    if constexpr (Metric::adapts) {
+      std::fill(metrics.begin(), metrics.end(),
+                Metric::read(initial_metric, num_params, logger));
+    }
+    for (size_t k = 0; k < num_replicas; ++k) {
+      cont_vectors.emplace_back(stan::services::util::initialize(
+          model, *inits[k], replicas[k]->rng, init_radius, true, logger,
+          null_writer));
+    }
+  } catch (const std::exception &e) {
+    logger.error(e.what());
+    return stan::services::error_codes::CONFIG;
+  }
+
+  for (size_t k = 0; k < num_replicas; ++k) {
+    auto &r = *replicas[k];
+    Eigen::Map<Eigen::VectorXd> cont_params(cont_vectors[k].data(),
+                                            cont_vectors[k].size());
+    if constexpr (Metric::adapts) {
+      r.sampler.set_metric(metrics[k]);
+    }
+    r.sampler.set_nominal_stepsize(stepsize);
+    r.sampler.set_stepsize_jitter(stepsize_jitter);
+    r.sampler.set_max_depth(max_depth);
+    r.sampler.z().q = cont_params;
+    r.draw = stan::mcmc::sample(cont_params, 0, 0);
+  }
+
+  stan::services::util::mcmc_writer writer(sample_writer, null_writer, logger);
+  writer.write_sample_names(replicas[0]->draw, replicas[0]->sampler, model);
+
+  std::vector<stan::mcmc::stepsize_adaptation> stepsize_adaptations(
+      num_replicas);
+  for (auto &adaptation : stepsize_adaptations) {
+    adaptation.set_delta(delta);
+    adaptation.set_gamma(gamma);
+    adaptation.set_kappa(kappa);
+    adaptation.set_t0(t0);
+  }
+  auto restart_stepsizes = [&]() {
+    if (num_params == 0) {
+      return;  // the step size heuristic diverges without parameters
+    }
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_replicas, 1),
+                      [&](const tbb::blocked_range<size_t> &r) {
+                        for (size_t k = r.begin(); k != r.end(); ++k) {
+                          replicas[k]->sampler.init_stepsize(logger);
+                        }
+                      });
+    for (size_t k = 0; k < num_replicas; ++k) {
+      stepsize_adaptations[k].set_mu(
+          std::log(10 * replicas[k]->sampler.get_nominal_stepsize()));
+      stepsize_adaptations[k].restart();
+    }
+  };
+
+  try {
+    restart_stepsizes();
+  } catch (const std::exception &e) {
+    logger.error("Exception initializing step size.");
+    logger.error(e.what());
+    return stan::services::error_codes::SOFTWARE;
+  }
+
+  window_schedule schedule;
+  std::vector<estimator_t> estimators(num_replicas, estimator_t(num_params));
+  if constexpr (Metric::adapts) {
+    schedule.set_window_params(num_warmup, init_buffer, term_buffer, window,
+                               logger);
+    schedule.restart();
+  }
+
+  // the untempered log density of each replica's current state
+  std::vector<double> log_density(num_replicas);
+  std::vector<size_t> swaps_attempted(num_replicas - 1, 0);
+  std::vector<size_t> swaps_accepted(num_replicas - 1, 0);
+  size_t swap_round = 0;
+
+  const int num_iterations = num_warmup + num_samples;
+  const int it_print_width = std::ceil(std::log10(num_iterations)) + 1;
+
+  for (int m = 0; m < num_iterations; ++m) {
+    interrupt();
+    const bool warmup = m < num_warmup;
+
+    // as in pooled_nuts(), the step sizes are fixed before the first draw
+    if (m == num_warmup && num_warmup > 0) {
+      for (size_t k = 0; k < num_replicas; ++k) {
+        auto &sampler = replicas[k]->sampler;
+        double eps = sampler.get_nominal_stepsize();
+        stepsize_adaptations[k].complete_adaptation(eps);
+        sampler.set_nominal_stepsize(eps);
+      }
+    }
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_replicas, 1),
+                      [&](const tbb::blocked_range<size_t> &r) {
+                        for (size_t k = r.begin(); k != r.end(); ++k) {
+                          auto &c = *replicas[k];
+                          c.draw = c.sampler.transition(c.draw, logger);
+                        }
+                      });
+    for (size_t k = 0; k < num_replicas; ++k) {
+      log_density[k] = replicas[k]->draw.log_prob() / tempered[k]->beta;
+    }
+
+    if (warmup) {
+      for (size_t k = 0; k < num_replicas; ++k) {
+        auto &sampler = replicas[k]->sampler;
+        double eps = sampler.get_nominal_stepsize();
+        stepsize_adaptations[k].learn_stepsize(
+            eps, replicas[k]->draw.accept_stat());
+        sampler.set_nominal_stepsize(eps);
+      }
+
+      if constexpr (Metric::adapts) {
+        if (schedule.adaptation_window()) {
+          for (size_t k = 0; k < num_replicas; ++k) {
+            estimators[k].add_sample(replicas[k]->draw.cont_params());
+          }
+        }
+        if (schedule.end_adaptation_window()) {
+          schedule.compute_next_window();
+          for (size_t k = 0; k < num_replicas; ++k) {
+            metrics[k] = Metric::estimate(estimators[k], metrics[k]);
+            if (!metrics[k].allFinite()) {
+              throw std::runtime_error(
+                  "Numerical overflow in metric adaptation. This occurs when "
+                  "the sampler encounters extreme values on the unconstrained "
+                  "space; this may happen when the posterior density function "
+                  "is too wide or improper. There may be problems with your "
+                  "model specification.");
+            }
+            estimators[k].restart();
+            replicas[k]->sampler.set_metric(metrics[k]);
+          }
+          restart_stepsizes();
+        }
+        schedule.advance();
+      }
+    }
+
+    // written before swapping, so the sampler parameters match the draw
+    if (!warmup || save_warmup) {
+      auto &cold = *replicas[0];
+      writer.write_sample_params(cold.rng, cold.draw, cold.sampler, model);
+    }
+
+    if ((m + 1) % swap_interval == 0) {
+      const double gain = std::pow(swap_round / 2 + 1.0, -0.6);
+      for (size_t k = swap_round % 2; k + 1 < num_replicas; k += 2) {
+        double log_ratio = (tempered[k]->beta - tempered[k + 1]->beta)
+                           * (log_density[k + 1] - log_density[k]);
+        bool accept = std::log(stan::math::uniform_rng(0.0, 1.0, swap_rng))
+                      < log_ratio;
+        if (accept) {
+          auto &lo = *replicas[k];
+          auto &hi = *replicas[k + 1];
+          Eigen::VectorXd q = lo.draw.cont_params();
+          double lo_accept = lo.draw.accept_stat();
+          lo.draw = stan::mcmc::sample(
+              hi.draw.cont_params(),
+              tempered[k]->beta * log_density[k + 1], hi.draw.accept_stat());
+          hi.draw = stan::mcmc::sample(
+              q, tempered[k + 1]->beta * log_density[k], lo_accept);
+          std::swap(log_density[k], log_density[k + 1]);
+        }
+
+        if (!warmup) {
+          ++swaps_attempted[k];
+          swaps_accepted[k] += accept;
+        } else if (adapt_temperatures) {
+          double rate = std::isnan(log_ratio)
+                            ? 0.0
+                            : std::exp(std::min(0.0, log_ratio));
+          log_gaps[k] += gain * (rate - target_swap_rate);
+        }
+      }
+      ++swap_round;
+
+      if (warmup && adapt_temperatures) {
+        for (size_t k = 0; k + 1 < num_replicas; ++k) {
+          temperatures[k + 1] = temperatures[k] + std::exp(log_gaps[k]);
+          tempered[k + 1]->beta = 1.0 / temperatures[k + 1];
+        }
+        // the stored log densities are untempered, so states stay valid
+        for (size_t k = 1; k < num_replicas; ++k) {
+          auto &r = *replicas[k];
+          r.draw = stan::mcmc::sample(r.draw.cont_params(),
+                                      tempered[k]->beta * log_density[k],
+                                      r.draw.accept_stat());
+        }
+      }
+    }
+
+    if (refresh > 0
+        && (m == 0 || m + 1 == num_iterations || (m + 1) % refresh == 0)) {
+      std::stringstream msg;
+      msg << "Iteration: " << std::setw(it_print_width) << m + 1 << " / "
+          << num_iterations << " [" << std::setw(3)
+          << static_cast<int>((100.0 * (m + 1)) / num_iterations) << "%] "
+          << (warmup ? " (Warmup)" : " (Sampling)");
+      logger.info(msg);
+    }
+  }
+
+  if (refresh > 0) {
+    std::stringstream msg;
+    msg << "Swap acceptance rates:";
+    for (size_t k = 0; k + 1 < num_replicas; ++k) {
+      msg << " " << std::setprecision(2)
+          << static_cast<double>(swaps_accepted[k])
+                 / std::max<size_t>(swaps_attempted[k], 1);
+    }
+    logger.info(msg);
+  }
+  for (size_t k = 0; k < num_replicas; ++k) {
+    if (stepsize_out != nullptr) {
+      stepsize_out[k] = replicas[k]->sampler.get_nominal_stepsize();
+    }
+    if (temperatures_out != nullptr) {
+      temperatures_out[k] = temperatures[k];
+    }
+    if (swap_rates_out != nullptr && k + 1 < num_replicas) {
+      swap_rates_out[k]
+          = swaps_attempted[k] == 0
+                ? std::numeric_limits<double>::quiet_NaN()
+                : static_cast<double>(swaps_accepted[k]) / swaps_attempted[k];
+    }
+  }
+
+  return stan::services::error_codes::OK;
+}
+
+/**
+ * @brief Run parallel tempering with the chosen metric.
+ *
+ * Handles the output buffer and the deadline in the same way as
+ * run_pooled_nuts(), and dispatches to tempered_nuts().
+ */
+inline int run_tempered_nuts(
+    const TinyStanModel &tmodel, size_t num_replicas,
+    std::vector<io::var_ctx_ptr> &inits, unsigned int seed, unsigned int id,
+    double init_radius, int num_warmup, int num_samples,
+    TinyStanMetric metric_choice, size_t metric_rank, double max_temperature,
+    bool adapt_temperatures, int swap_interval, double delta, double gamma,
+    double kappa, double t0, unsigned int init_buffer, unsigned int term_buffer,
+    unsigned int window, bool save_warmup, double stepsize,
+    double stepsize_jitter, int max_depth, int refresh,
+    const interrupt::deadline &deadline, double *out, size_t out_size,
+    double *stepsize_out, double *temperatures_out, double *swap_rates_out,
+    TinyStanError **err) {
+  auto &model = *tmodel.model;
+
+  // all HMC has 7 algorithm params
+  int num_params = tmodel.num_params + 7;
+  int draws_size = num_params * (num_samples + num_warmup * save_warmup);
+  if (out_size < static_cast<size_t>(draws_size)) {
+    std::stringstream ss;
+    ss << "Output buffer too small. Expected at least " << draws_size
+       << " doubles, got " << out_size;
+    throw std::runtime_error(ss.str());
+  }
+
+  std::vector<io::buffer_writer> sample_writers;
+  sample_writers.emplace_back(out, draws_size);
+  auto initial_metric = io::default_metric(tmodel.num_free_params,
+                                           metric_choice, metric_rank);
+
+  error::error_logger logger(tmodel, refresh != 0);
+  interrupt::tinystan_interrupt_handler interrupt(deadline);
+
+  int return_code = 0;
+  try {
+    switch (metric_choice) {
+      case unit:
+#ifdef TINYSTAN_ALGORITHM_NUTS_UNIT
+        return_code = tempered_nuts<unit_metric>(
+            model, num_replicas, inits, *initial_metric, seed, id,
+            init_radius, num_warmup, num_samples, max_temperature,
+            adapt_temperatures, swap_interval, delta, gamma, kappa, t0,
+            init_buffer, term_buffer, window, save_warmup, stepsize,
+            stepsize_jitter, max_depth, refresh, interrupt, logger,
+            sample_writers[0], stepsize_out, temperatures_out,
+            swap_rates_out);
+#else
+        algorithms::unavailable("nuts_unit");
+#endif
+        break;
+      case dense:
+#ifdef TINYSTAN_ALGORITHM_NUTS_DENSE
+        return_code = tempered_nuts<dense_metric>(
+            model, num_replicas, inits, *initial_metric, seed, id,
+            init_radius, num_warmup, num_samples, max_temperature,
+            adapt_temperatures, swap_interval, delta, gamma, kappa, t0,
+            init_buffer, term_buffer, window, save_warmup, stepsize,
+            stepsize_jitter, max_depth, refresh, interrupt, logger,
+            sample_writers[0], stepsize_out, temperatures_out,
+            swap_rates_out);
+#else
+        algorithms::unavailable("nuts_dense");
+#endif
+        break;
+      case diagonal:
+#ifdef TINYSTAN_ALGORITHM_NUTS_DIAG
+        return_code = tempered_nuts<diag_metric>(
+            model, num_replicas, inits, *initial_metric, seed, id,
+            init_radius, num_warmup, num_samples, max_temperature,
+            adapt_temperatures, swap_interval, delta, gamma, kappa, t0,
+            init_buffer, term_buffer, window, save_warmup, stepsize,
+            stepsize_jitter, max_depth, refresh, interrupt, logger,
+            sample_writers[0], stepsize_out, temperatures_out,
+            swap_rates_out);
+#else
+        algorithms::unavailable("nuts_diag");
+#endif
+        break;
+      case lowrank:
+#ifdef TINYSTAN_ALGORITHM_NUTS_LOWRANK
+        return_code = tempered_nuts<lowrank_metric>(
+            model, num_replicas, inits, *initial_metric, seed, id,
+            init_radius, num_warmup, num_samples, max_temperature,
+            adapt_temperatures, swap_interval, delta, gamma, kappa, t0,
+            init_buffer, term_buffer, window, save_warmup, stepsize,
+            stepsize_jitter, max_depth, refresh, interrupt, logger,
+            sample_writers[0], stepsize_out, temperatures_out,
+            swap_rates_out);
+#else
+        algorithms::unavailable("nuts_lowrank");
+#endif
+        break;
+      case automatic:
+        // rejected by tinystan_tempered_sample() before any work is done
+        throw std::invalid_argument(
+            "The automatic metric is not supported by tempered sampling");
+    }
+  } catch (error::timeout_exception &e) {
+    e.draw_counts = io::rows_written(sample_writers, num_params);
+    throw;
+  }
+  if (return_code != 0) {
+    if (err != nullptr) {
+      *err = logger.get_error();
+    }
+  }
+
+  return return_code;
+}
+
+}  // namespace nuts
+}  // namespace tinystan
+
+#endif
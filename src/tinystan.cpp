@@ -1,20 +1,19 @@
+// first, as it decides which of the algorithms below are needed
+#include "algorithms.hpp"
+
 #include <stan/callbacks/writer.hpp>
 #include <stan/callbacks/structured_writer.hpp>
 #include <stan/model/model_base.hpp>
+#ifdef TINYSTAN_ALGORITHM_PATHFINDER
 #include <stan/services/pathfinder/multi.hpp>
 #include <stan/services/pathfinder/single.hpp>
-#include <stan/services/optimize/bfgs.hpp>
-#include <stan/services/optimize/lbfgs.hpp>
-#include <stan/services/optimize/newton.hpp>
-#include <stan/services/optimize/laplace_sample.hpp>
-#include <stan/services/sample/hmc_nuts_diag_e.hpp>
-#include <stan/services/sample/hmc_nuts_diag_e_adapt.hpp>
-#include <stan/services/sample/hmc_nuts_dense_e.hpp>
-#include <stan/services/sample/hmc_nuts_dense_e_adapt.hpp>
-#include <stan/services/sample/hmc_nuts_unit_e.hpp>
-#include <stan/services/sample/hmc_nuts_unit_e_adapt.hpp>
+#endif
+#include <stan/services/util/create_rng.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
 #include <stan/version.hpp>
 
+#include <algorithm>
+#include <numeric>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -25,9 +24,27 @@
 #include "errors.hpp"
 #include "file.hpp"
 #include "buffer.hpp"
+#include "call_options.hpp"
 #include "interrupts.hpp"
+#include "memory.hpp"
 #include "util.hpp"
 #include "model.hpp"
+#ifdef TINYSTAN_ALGORITHM_LAPLACE
+#include "laplace.hpp"
+#endif
+#include "loo.hpp"
+#include "nuts.hpp"
+#include "optimize.hpp"
+#ifdef TINYSTAN_ALGORITHM_PATHFINDER
+#include "pathfinder.hpp"
+#endif
+#include "pooled_warmup.hpp"
+#include "screening.hpp"
+#include "session.hpp"
+#include "tempering.hpp"
+#ifdef TINYSTAN_ALGORITHM_VARIATIONAL
+#include "variational.hpp"
+#endif
 #include "version.hpp"
 
 #include "R_shims.cpp"
@@ -59,6 +76,157 @@ size_t tinystan_model_num_free_params(const TinyStanModel *model) {
   return model->num_free_params;
 }
 
+size_t tinystan_model_num_variables(const TinyStanModel *model) {
+  return model->variables.size();
+}
+
+int tinystan_model_variable(const TinyStanModel *model, size_t index,
+                            const char **name, TinyStanVariableBlock *block,
+                            const size_t **dims, size_t *num_dims,
+                            bool *is_complex, size_t *offset, size_t *length,
+                            TinyStanError **err) {
+  return error::catch_exceptions(err, [&]() {
+    if (index >= model->variables.size()) {
+      std::stringstream ss;
+      ss << "Variable index " << index << " out of range, model has "
+         << model->variables.size() << " variables";
+      throw std::invalid_argument(ss.str());
+    }
+    const auto &v = model->variables[index];
+    if (name != nullptr) {
+      *name = v.name.c_str();
+    }
+    if (block != nullptr) {
+      *block = v.block;
+    }
+    if (dims != nullptr) {
+      *dims = v.dims.data();
+    }
+    if (num_dims != nullptr) {
+      *num_dims = v.dims.size();
+    }
+    if (is_complex != nullptr) {
+      *is_complex = v.is_complex;
+    }
+    if (offset != nullptr) {
+      *offset = v.offset;
+    }
+    if (length != nullptr) {
+      *length = v.length;
+    }
+    return 0;
+  });
+}
+
+int tinystan_model_set_message_batching(TinyStanModel *model,
+                                        int flush_interval_ms, size_t capacity,
+                                        bool drop_when_full,
+                                        TinyStanError **err) {
+  return error::catch_exceptions(err, [&]() {
+    error::check_nonnegative("flush_interval_ms", flush_interval_ms);
+    error::check_positive("capacity", capacity);
+    model->message_options.flush_interval_ms = flush_interval_ms;
+    model->message_options.capacity = capacity;
+    model->message_options.drop_when_full = drop_when_full;
+    return 0;
+  });
+}
+
+void tinystan_model_set_message_tags(TinyStanModel *model, bool tag) {
+  model->message_options.tag = tag;
+}
+
+void tinystan_model_set_model_output(TinyStanModel *model, bool enabled) {
+  model->model_output = enabled;
+}
+
+void tinystan_model_set_memory_options(TinyStanModel *model,
+                                       bool release_memory,
+                                       size_t memory_limit) {
+  model->memory_options.release = release_memory;
+  model->memory_options.limit = memory_limit;
+}
+
+TinyStanCallOptions *tinystan_create_call_options() {
+  return new TinyStanCallOptions();
+}
+
+void tinystan_destroy_call_options(TinyStanCallOptions *options) {
+  delete options;
+}
+
+int tinystan_call_options_set_time_limit(TinyStanCallOptions *options,
+                                         double seconds, TinyStanError **err) {
+  return error::catch_exceptions(err, [&]() {
+    error::check_nonnegative("seconds", seconds);
+    options->time_limit = seconds;
+    return 0;
+  });
+}
+
+int tinystan_call_options_set_metric_rank(TinyStanCallOptions *options,
+                                          size_t rank, TinyStanError **err) {
+  return error::catch_exceptions(err, [&]() {
+    error::check_positive("rank", rank);
+    options->metric_rank = rank;
+    return 0;
+  });
+}
+
+int tinystan_call_options_set_chain_isolation(TinyStanCallOptions *options,
+                                              bool isolate, int max_restarts,
+                                              TinyStanError **err) {
+  return error::catch_exceptions(err, [&]() {
+    error::check_nonnegative("max_restarts", max_restarts);
+    options->isolate_chains = isolate;
+    options->max_chain_restarts = max_restarts;
+    return 0;
+  });
+}
+
+void tinystan_call_options_set_pathfinder_streaming(
+    TinyStanCallOptions *options, bool streaming) {
+  options->stream_pathfinder = streaming;
+}
+
+void tinystan_call_options_set_init_screening(TinyStanCallOptions *options,
+                                              size_t num_candidates,
+                                              bool select_best) {
+  options->init_candidates = num_candidates;
+  options->select_best_init = select_best;
+}
+
+void tinystan_last_call_memory(size_t *peak_resident_bytes,
+                               size_t *peak_arena_bytes,
+                               size_t *output_bytes) {
+  const auto &stats = memory::call_scope::last();
+  if (peak_resident_bytes != nullptr) {
+    *peak_resident_bytes = stats.peak_resident_bytes;
+  }
+  if (peak_arena_bytes != nullptr) {
+    *peak_arena_bytes = stats.peak_arena_bytes;
+  }
+  if (output_bytes != nullptr) {
+    *output_bytes = stats.output_bytes;
+  }
+}
+
+void tinystan_last_call_init_screening(size_t *evaluated, size_t *valid) {
+  const auto &stats = screening::last();
+  if (evaluated != nullptr) {
+    *evaluated = stats.evaluated;
+  }
+  if (valid != nullptr) {
+    *valid = stats.valid;
+  }
+}
+
+void tinystan_release_memory() {
+  memory::release_tape();
+  memory::release_worker_tapes();
+  memory::release_heap();
+}
+
 int tinystan_sample(const TinyStanModel *tmodel, size_t num_chains,
                     const char *inits, unsigned int seed, unsigned int id,
                     double init_radius, int num_warmup, int num_samples,
@@ -71,7 +239,29 @@ int tinystan_sample(const TinyStanModel *tmodel, size_t num_chains,
                     int num_threads, double *out, size_t out_size,
                     double *stepsize_out, double *inv_metric_out,
                     TinyStanError **err) {
-  return error::catch_exceptions(err, [&]() {
+  return tinystan_sample_with_options(
+      tmodel, nullptr, num_chains, inits, seed, id, init_radius, num_warmup,
+      num_samples, metric_choice, init_inv_metric, adapt, delta, gamma, kappa,
+      t0, init_buffer, term_buffer, window, save_warmup, stepsize,
+      stepsize_jitter, max_depth, refresh, num_threads, out, out_size,
+      stepsize_out, inv_metric_out, err);
+}
+
+int tinystan_sample_with_options(
+    const TinyStanModel *tmodel, const TinyStanCallOptions *options,
+    size_t num_chains, const char *inits, unsigned int seed, unsigned int id,
+    double init_radius, int num_warmup, int num_samples,
+    TinyStanMetric metric_choice, const double *init_inv_metric,
+    /* adaptation params */ bool adapt, double delta, double gamma,
+    double kappa, double t0, unsigned int init_buffer, unsigned int term_buffer,
+    unsigned int window, bool save_warmup, double stepsize,
+    double stepsize_jitter, int max_depth, int refresh, int num_threads,
+    double *out, size_t out_size, double *stepsize_out, double *inv_metric_out,
+    TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(tmodel->memory_options);
     error::check_positive("num_chains", num_chains);
     error::check_positive("id", id);
     error::check_nonnegative("init_radius", init_radius);
@@ -86,116 +276,207 @@ int tinystan_sample(const TinyStanModel *tmodel, size_t num_chains,
     error::check_positive("stepsize", stepsize);
     error::check_between("stepsize_jitter", stepsize_jitter, 0, 1);
     error::check_positive("max_depth", max_depth);
-
-    util::init_threading(num_threads);
+    algorithms::require(algorithms::nuts_name(metric_choice));
 
     auto json_inits = io::load_inits(num_chains, inits);
+    screening::screen_inits(*tmodel, opts, json_inits, seed, id, init_radius);
 
-    auto &model = *tmodel->model;
+    int num_model_params = tmodel->num_free_params;
+    auto initial_metrics =
+        io::make_metric_inits(num_chains, init_inv_metric, num_model_params,
+                              metric_choice, opts.metric_rank);
 
-    // all HMC has 7 algorithm params
-    int num_params = tmodel->num_params + 7;
-    int draws_offset = num_params * (num_samples + num_warmup * save_warmup);
-    if (out_size < num_chains * draws_offset) {
-      std::stringstream ss;
-      ss << "Output buffer too small. Expected at least " << num_chains
-         << " chains of " << draws_offset << " doubles, got " << out_size;
-      throw std::runtime_error(ss.str());
-    }
+    return nuts::run_nuts(*tmodel, opts, num_chains, json_inits, seed, id,
+                          init_radius, num_warmup, num_samples, metric_choice,
+                          initial_metrics, adapt, delta, gamma, kappa, t0,
+                          init_buffer, term_buffer, window, save_warmup,
+                          stepsize, stepsize_jitter, max_depth, refresh,
+                          deadline, out, out_size, stepsize_out,
+                          inv_metric_out, err);
+  }));
+}
 
-    std::vector<io::buffer_writer> sample_writers;
-    sample_writers.reserve(num_chains);
-    for (size_t i = 0; i < num_chains; ++i) {
-      sample_writers.emplace_back(out + draws_offset * i, draws_offset);
-    }
+int tinystan_pooled_sample(
+    const TinyStanModel *tmodel, const TinyStanCallOptions *options,
+    size_t num_chains, const char *inits, unsigned int seed, unsigned int id,
+    double init_radius, int num_warmup, int num_samples,
+    TinyStanMetric metric_choice, const double *init_inv_metric, double delta,
+    double gamma, double kappa, double t0, unsigned int init_buffer,
+    unsigned int term_buffer, unsigned int window, double rhat_threshold,
+    bool save_warmup, double stepsize, double stepsize_jitter, int max_depth,
+    int refresh, int num_threads, double *out, size_t out_size,
+    double *stepsize_out, double *inv_metric_out, int *num_warmup_out,
+    TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(tmodel->memory_options);
+    error::check_positive("num_chains", num_chains);
+    error::check_positive("id", id);
+    error::check_nonnegative("init_radius", init_radius);
+    error::check_nonnegative("num_warmup", num_warmup);
+    error::check_positive("num_samples", num_samples);
+    error::check_between("delta", delta, 0, 1);
+    error::check_positive("gamma", gamma);
+    error::check_positive("kappa", kappa);
+    error::check_positive("t0", t0);
+    error::check_nonnegative("rhat_threshold", rhat_threshold);
+    error::check_positive("stepsize", stepsize);
+    error::check_between("stepsize_jitter", stepsize_jitter, 0, 1);
+    error::check_positive("max_depth", max_depth);
+    algorithms::require(algorithms::nuts_name(metric_choice));
+
+    auto json_inits = io::load_inits(num_chains, inits);
+    screening::screen_inits(*tmodel, opts, json_inits, seed, id, init_radius);
 
-    std::vector<io::filtered_writer> inv_metric_writers(num_chains);
     int num_model_params = tmodel->num_free_params;
-    int metric_offset = metric_choice == dense
-                            ? num_model_params * num_model_params
-                            : num_model_params;
-    for (size_t i = 0; i < num_chains; ++i) {
-      if (inv_metric_out != nullptr) {
-        inv_metric_writers[i].add_key("inv_metric",
-                                      inv_metric_out + metric_offset * i);
-      }
-      if (stepsize_out != nullptr) {
-        inv_metric_writers[i].add_key("stepsize", stepsize_out + i);
-      }
+    auto initial_metric =
+        io::make_metric_inits(1, init_inv_metric, num_model_params,
+                              metric_choice, opts.metric_rank);
+
+    return nuts::run_pooled_nuts(
+        *tmodel, num_chains, json_inits, *initial_metric[0], seed, id,
+        init_radius, num_warmup, num_samples, metric_choice, delta, gamma,
+        kappa, t0, init_buffer, term_buffer, window, rhat_threshold,
+        save_warmup, stepsize, stepsize_jitter, max_depth, refresh, deadline,
+        out, out_size, stepsize_out, inv_metric_out, num_warmup_out, err);
+  }));
+}
+
+int tinystan_tempered_sample(
+    const TinyStanModel *tmodel, const TinyStanCallOptions *options,
+    size_t num_replicas, const char *inits, unsigned int seed, unsigned int id,
+    double init_radius, int num_warmup, int num_samples,
+    TinyStanMetric metric_choice, double max_temperature,
+    bool adapt_temperatures, int swap_interval, double delta, double gamma,
+    double kappa, double t0, unsigned int init_buffer, unsigned int term_buffer,
+    unsigned int window, bool save_warmup, double stepsize,
+    double stepsize_jitter, int max_depth, int refresh, int num_threads,
+    double *out, size_t out_size, double *stepsize_out,
+    double *temperatures_out, double *swap_rates_out, TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(tmodel->memory_options);
+    if (num_replicas < 2) {
+      throw std::invalid_argument("num_replicas must be at least 2");
+    }
+    if (!(max_temperature > 1)) {
+      std::stringstream msg;
+      msg << "max_temperature must be greater than 1, was "
+          << max_temperature;
+      throw std::invalid_argument(msg.str());
+    }
+    error::check_positive("swap_interval", swap_interval);
+    error::check_positive("id", id);
+    error::check_nonnegative("init_radius", init_radius);
+    error::check_nonnegative("num_warmup", num_warmup);
+    error::check_positive("num_samples", num_samples);
+    error::check_between("delta", delta, 0, 1);
+    error::check_positive("gamma", gamma);
+    error::check_positive("kappa", kappa);
+    error::check_positive("t0", t0);
+    error::check_positive("stepsize", stepsize);
+    error::check_between("stepsize_jitter", stepsize_jitter, 0, 1);
+    error::check_positive("max_depth", max_depth);
+    if (metric_choice == automatic) {
+      // each replica would choose its own metric
+      throw std::invalid_argument(
+          "The automatic metric is not supported by tempered sampling");
     }
+    algorithms::require(algorithms::nuts_name(metric_choice));
 
-    auto initial_metrics = io::make_metric_inits(
-        num_chains, init_inv_metric, num_model_params, metric_choice);
+    auto json_inits = io::load_inits(num_replicas, inits);
+    screening::screen_inits(*tmodel, opts, json_inits, seed, id, init_radius);
 
-    error::error_logger logger(*tmodel, refresh != 0);
-    interrupt::tinystan_interrupt_handler interrupt;
+    return nuts::run_tempered_nuts(
+        *tmodel, num_replicas, json_inits, seed, id, init_radius, num_warmup,
+        num_samples, metric_choice, opts.metric_rank, max_temperature,
+        adapt_temperatures, swap_interval, delta, gamma, kappa, t0,
+        init_buffer, term_buffer, window, save_warmup, stepsize,
+        stepsize_jitter, max_depth, refresh, deadline, out, out_size,
+        stepsize_out, temperatures_out, swap_rates_out, err);
+  }));
+}
 
-    std::vector<stan::callbacks::writer> null_writers(num_chains);
+TinyStanSampler *tinystan_sampler_create(
+    const TinyStanModel *tmodel, const TinyStanCallOptions *options,
+    size_t num_chains, const char *inits, unsigned int seed, unsigned int id,
+    double init_radius, TinyStanMetric metric_choice,
+    const double *init_inv_metric, double delta, double gamma, double kappa,
+    double t0, double stepsize, double stepsize_jitter, int max_depth,
+    int num_threads, TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(tmodel->memory_options);
+    error::check_positive("num_chains", num_chains);
+    error::check_positive("id", id);
+    error::check_nonnegative("init_radius", init_radius);
+    error::check_between("delta", delta, 0, 1);
+    error::check_positive("gamma", gamma);
+    error::check_positive("kappa", kappa);
+    error::check_positive("t0", t0);
+    error::check_positive("stepsize", stepsize);
+    error::check_between("stepsize_jitter", stepsize_jitter, 0, 1);
+    error::check_positive("max_depth", max_depth);
+    algorithms::require(algorithms::nuts_name(metric_choice));
 
-    int return_code = 0;
+    auto json_inits = io::load_inits(num_chains, inits);
+    screening::screen_inits(*tmodel, opts, json_inits, seed, id, init_radius);
+    auto initial_metrics = io::make_metric_inits(
+        num_chains, init_inv_metric, tmodel->num_free_params, metric_choice,
+        opts.metric_rank);
 
-    int thin = 1;  // no thinning
-
-    switch (metric_choice) {
-      case unit:
-        if (adapt) {
-          return_code = stan::services::sample::hmc_nuts_unit_e_adapt(
-              model, num_chains, json_inits, seed, id, init_radius, num_warmup,
-              num_samples, thin, save_warmup, refresh, stepsize,
-              stepsize_jitter, max_depth, delta, gamma, kappa, t0, interrupt,
-              logger, null_writers, sample_writers, null_writers,
-              inv_metric_writers);
-        } else {
-          return_code = stan::services::sample::hmc_nuts_unit_e(
-              model, num_chains, json_inits, seed, id, init_radius, num_warmup,
-              num_samples, thin, save_warmup, refresh, stepsize,
-              stepsize_jitter, max_depth, interrupt, logger, null_writers,
-              sample_writers, null_writers);
-        }
-        break;
-      case dense:
-        if (adapt) {
-          return_code = stan::services::sample::hmc_nuts_dense_e_adapt(
-              model, num_chains, json_inits, initial_metrics, seed, id,
-              init_radius, num_warmup, num_samples, thin, save_warmup, refresh,
-              stepsize, stepsize_jitter, max_depth, delta, gamma, kappa, t0,
-              init_buffer, term_buffer, window, interrupt, logger, null_writers,
-              sample_writers, null_writers, inv_metric_writers);
-        } else {
-          return_code = stan::services::sample::hmc_nuts_dense_e(
-              model, num_chains, json_inits, initial_metrics, seed, id,
-              init_radius, num_warmup, num_samples, thin, save_warmup, refresh,
-              stepsize, stepsize_jitter, max_depth, interrupt, logger,
-              null_writers, sample_writers, null_writers);
-        }
-        break;
-      case diagonal:
-        if (adapt) {
-          return_code = stan::services::sample::hmc_nuts_diag_e_adapt(
-              model, num_chains, json_inits, initial_metrics, seed, id,
-              init_radius, num_warmup, num_samples, thin, save_warmup, refresh,
-              stepsize, stepsize_jitter, max_depth, delta, gamma, kappa, t0,
-              init_buffer, term_buffer, window, interrupt, logger, null_writers,
-              sample_writers, null_writers, inv_metric_writers);
-        } else {
-          return_code = stan::services::sample::hmc_nuts_diag_e(
-              model, num_chains, json_inits, initial_metrics, seed, id,
-              init_radius, num_warmup, num_samples, thin, save_warmup, refresh,
-              stepsize, stepsize_jitter, max_depth, interrupt, logger,
-              null_writers, sample_writers, null_writers);
-        }
-        break;
-    }
-    if (return_code != 0) {
-      if (err != nullptr) {
-        *err = logger.get_error();
-      }
+    error::error_logger logger(*tmodel, false);
+    auto sampler = nuts::make_session(
+        *tmodel, num_chains, json_inits, initial_metrics, seed, id,
+        init_radius, metric_choice, opts.metric_rank, delta, gamma, kappa, t0,
+        stepsize, stepsize_jitter, max_depth, deadline, logger);
+    if (sampler == nullptr && err != nullptr) {
+      *err = logger.get_error();
     }
+    return sampler.release();
+  }));
+}
 
-    return return_code;
-  });
+int tinystan_sampler_warmup(
+    TinyStanSampler *sampler, const TinyStanCallOptions *options,
+    int num_warmup, unsigned int init_buffer, unsigned int term_buffer,
+    unsigned int window, int refresh, int num_threads, double *out,
+    size_t out_size, TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(sampler->tmodel.memory_options);
+    error::check_positive("num_warmup", num_warmup);
+    nuts::session_warmup(*sampler, num_warmup, init_buffer, term_buffer,
+                         window, refresh, deadline, out, out_size);
+    return 0;
+  }));
 }
 
+int tinystan_sampler_draw(
+    TinyStanSampler *sampler, const TinyStanCallOptions *options, int num_draws,
+    int refresh, int num_threads, double *out, size_t out_size,
+    TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(sampler->tmodel.memory_options);
+    error::check_positive("num_draws", num_draws);
+    nuts::session_draw(*sampler, num_draws, refresh, deadline, out, out_size);
+    return 0;
+  }));
+}
+
+void tinystan_sampler_state(const TinyStanSampler *sampler, double *positions,
+                            double *stepsizes, double *inv_metrics) {
+  sampler->state(positions, stepsizes, inv_metrics);
+}
+
+void tinystan_sampler_destroy(TinyStanSampler *sampler) { delete sampler; }
+
 int tinystan_pathfinder(const TinyStanModel *tmodel, size_t num_paths,
                         const char *inits, unsigned int seed, unsigned int id,
                         double init_radius, int num_draws,
@@ -206,7 +487,26 @@ int tinystan_pathfinder(const TinyStanModel *tmodel, size_t num_paths,
                         int num_multi_draws, bool calculate_lp,
                         bool psis_resample, int refresh, int num_threads,
                         double *out, size_t out_size, TinyStanError **err) {
-  return error::catch_exceptions(err, [&]() {
+  return tinystan_pathfinder_with_options(
+      tmodel, nullptr, num_paths, inits, seed, id, init_radius, num_draws,
+      max_history_size, init_alpha, tol_obj, tol_rel_obj, tol_grad,
+      tol_rel_grad, tol_param, num_iterations, num_elbo_draws, num_multi_draws,
+      calculate_lp, psis_resample, refresh, num_threads, out, out_size, err);
+}
+
+int tinystan_pathfinder_with_options(
+    const TinyStanModel *tmodel, const TinyStanCallOptions *options,
+    size_t num_paths, const char *inits, unsigned int seed, unsigned int id,
+    double init_radius, int num_draws, /* tuning params */ int max_history_size,
+    double init_alpha, double tol_obj, double tol_rel_obj, double tol_grad,
+    double tol_rel_grad, double tol_param, int num_iterations,
+    int num_elbo_draws, int num_multi_draws, bool calculate_lp,
+    bool psis_resample, int refresh, int num_threads, double *out,
+    size_t out_size, TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(tmodel->memory_options);
     error::check_positive("num_paths", num_paths);
     error::check_positive("num_draws", num_draws);
     error::check_positive("id", id);
@@ -221,17 +521,18 @@ int tinystan_pathfinder(const TinyStanModel *tmodel, size_t num_paths,
     error::check_positive("num_iterations", num_iterations);
     error::check_positive("num_elbo_draws", num_elbo_draws);
     error::check_positive("num_multi_draws", num_multi_draws);
-
-    util::init_threading(num_threads);
+    algorithms::require("pathfinder");
 
     auto json_inits = io::load_inits(num_paths, inits);
+    screening::screen_inits(*tmodel, opts, json_inits, seed, id, init_radius);
 
+#ifdef TINYSTAN_ALGORITHM_PATHFINDER
     auto &model = *tmodel->model;
 
     io::buffer_writer pathfinder_writer(out, out_size);
     error::error_logger logger(*tmodel, refresh != 0);
 
-    interrupt::tinystan_interrupt_handler interrupt;
+    interrupt::tinystan_interrupt_handler interrupt(deadline);
     stan::callbacks::structured_writer dummy_json_writer;
 
     bool save_iterations = false;
@@ -246,6 +547,12 @@ int tinystan_pathfinder(const TinyStanModel *tmodel, size_t num_paths,
           num_iterations, num_elbo_draws, num_draws, save_iterations, refresh,
           interrupt, logger, null_writer, pathfinder_writer, dummy_json_writer,
           calculate_lp);
+    } else if (opts.stream_pathfinder && psis_resample && calculate_lp) {
+      return_code = pathfinder::streaming_pathfinder(
+          model, json_inits, seed, id, init_radius, max_history_size,
+          init_alpha, tol_obj, tol_rel_obj, tol_grad, tol_rel_grad, tol_param,
+          num_iterations, num_elbo_draws, num_draws, num_multi_draws, num_paths,
+          refresh, interrupt, logger, pathfinder_writer);
     } else {
       std::vector<stan::callbacks::writer> null_writers(num_paths);
       std::vector<stan::callbacks::structured_writer> null_structured_writers(
@@ -266,7 +573,169 @@ int tinystan_pathfinder(const TinyStanModel *tmodel, size_t num_paths,
     }
 
     return return_code;
-  });
+#else
+    return -1;  // unreachable, algorithms::require() throws above
+#endif
+  }));
+}
+
+int tinystan_pathfinder_sample(
+    const TinyStanModel *tmodel, const TinyStanCallOptions *options,
+    size_t num_chains, size_t num_paths, const char *inits, unsigned int seed,
+    unsigned int id, double init_radius, /* pathfinder params */ int num_draws,
+    int max_history_size, double init_alpha, double tol_obj, double tol_rel_obj,
+    double tol_grad, double tol_rel_grad, double tol_param, int num_iterations,
+    int num_elbo_draws, int num_multi_draws,
+    /* sampler params */ int num_warmup, int num_samples,
+    TinyStanMetric metric_choice, double delta, double gamma, double kappa,
+    double t0, unsigned int init_buffer, unsigned int term_buffer,
+    unsigned int window, bool save_warmup, double stepsize,
+    double stepsize_jitter, int max_depth, int refresh, int num_threads,
+    double *out, size_t out_size, double *stepsize_out, double *inv_metric_out,
+    TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(tmodel->memory_options);
+    error::check_positive("num_chains", num_chains);
+    error::check_positive("num_paths", num_paths);
+    error::check_positive("id", id);
+    error::check_nonnegative("init_radius", init_radius);
+    error::check_positive("num_draws", num_draws);
+    error::check_positive("max_history_size", max_history_size);
+    error::check_positive("init_alpha", init_alpha);
+    error::check_positive("tol_obj", tol_obj);
+    error::check_positive("tol_rel_obj", tol_rel_obj);
+    error::check_positive("tol_grad", tol_grad);
+    error::check_positive("tol_rel_grad", tol_rel_grad);
+    error::check_positive("tol_param", tol_param);
+    error::check_positive("num_iterations", num_iterations);
+    error::check_positive("num_elbo_draws", num_elbo_draws);
+    if (num_multi_draws < 2) {
+      std::stringstream msg;
+      msg << "num_multi_draws must be at least 2 to estimate a metric, was "
+          << num_multi_draws;
+      throw std::invalid_argument(msg.str());
+    }
+    error::check_nonnegative("num_warmup", num_warmup);
+    error::check_positive("num_samples", num_samples);
+    error::check_between("delta", delta, 0, 1);
+    error::check_positive("gamma", gamma);
+    error::check_positive("kappa", kappa);
+    error::check_positive("t0", t0);
+    error::check_positive("stepsize", stepsize);
+    error::check_between("stepsize_jitter", stepsize_jitter, 0, 1);
+    error::check_positive("max_depth", max_depth);
+    algorithms::require("pathfinder");
+    algorithms::require(algorithms::nuts_name(metric_choice));
+
+    auto json_inits = io::load_inits(num_paths, inits);
+    screening::screen_inits(*tmodel, opts, json_inits, seed, id, init_radius);
+
+#ifdef TINYSTAN_ALGORITHM_PATHFINDER
+    auto &model = *tmodel->model;
+
+    // lp_approx__, lp__, and path__ precede the model parameters
+    const size_t pathfinder_offset = 3;
+    const size_t pathfinder_width = tmodel->num_params + pathfinder_offset;
+    std::vector<double> pathfinder_draws(pathfinder_width * num_multi_draws);
+
+    {
+      io::buffer_writer pathfinder_writer(pathfinder_draws.data(),
+                                          pathfinder_draws.size());
+      error::error_logger logger(*tmodel, refresh != 0);
+
+      interrupt::tinystan_interrupt_handler interrupt(deadline);
+      stan::callbacks::structured_writer dummy_json_writer;
+      std::vector<stan::callbacks::writer> null_writers(num_paths);
+      std::vector<stan::callbacks::structured_writer> null_structured_writers(
+          num_paths);
+
+      bool save_iterations = false;
+      bool calculate_lp = true;
+      bool psis_resample = true;
+
+      int return_code = 0;
+      if (opts.stream_pathfinder) {
+        return_code = pathfinder::streaming_pathfinder(
+            model, json_inits, seed, id, init_radius, max_history_size,
+            init_alpha, tol_obj, tol_rel_obj, tol_grad, tol_rel_grad,
+            tol_param, num_iterations, num_elbo_draws, num_draws,
+            num_multi_draws, num_paths, refresh, interrupt, logger,
+            pathfinder_writer);
+      } else {
+        return_code = stan::services::pathfinder::pathfinder_lbfgs_multi(
+            model, json_inits, seed, id, init_radius, max_history_size,
+            init_alpha, tol_obj, tol_rel_obj, tol_grad, tol_rel_grad,
+            tol_param, num_iterations, num_elbo_draws, num_draws,
+            num_multi_draws, num_paths, save_iterations, refresh, interrupt,
+            logger, null_writers, null_writers, null_structured_writers,
+            pathfinder_writer, dummy_json_writer, calculate_lp,
+            psis_resample);
+      }
+
+      if (return_code != 0) {
+        if (err != nullptr) {
+          *err = logger.get_error();
+        }
+        return return_code;
+      }
+    }
+
+    // the PSIS-resampled draws are approximately from the posterior, so
+    // we can use them both as initial points and to estimate the metric
+    Eigen::MatrixXd unc_draws(tmodel->num_free_params, num_multi_draws);
+    for (int i = 0; i < num_multi_draws; ++i) {
+      unc_draws.col(i) = model::unconstrain_parameters(
+          *tmodel,
+          pathfinder_draws.data() + i * pathfinder_width + pathfinder_offset,
+          nullptr);
+    }
+
+    // pick distinct draws for each chain, reusing some if there are not enough
+    std::vector<size_t> order(num_multi_draws);
+    std::iota(order.begin(), order.end(), 0);
+    auto rng = stan::services::util::create_rng(seed, id);
+    for (size_t i = order.size() - 1; i > 0; --i) {
+      boost::random::uniform_int_distribution<size_t> pick(0, i);
+      std::swap(order[i], order[pick(rng)]);
+    }
+
+    std::vector<io::var_ctx_ptr> chain_inits;
+    chain_inits.reserve(num_chains);
+    for (size_t i = 0; i < num_chains; ++i) {
+      size_t draw = order[i % order.size()];
+      chain_inits.push_back(model::make_init_context(
+          *tmodel, pathfinder_draws.data() + draw * pathfinder_width
+                       + pathfinder_offset));
+    }
+
+    std::vector<double> inv_metric_inits;
+    if (metric_choice != unit) {
+      auto inv_metric = nuts::estimate_inv_metric(unc_draws, metric_choice,
+                                                  opts.metric_rank);
+      inv_metric_inits.reserve(inv_metric.size() * num_chains);
+      for (size_t i = 0; i < num_chains; ++i) {
+        inv_metric_inits.insert(inv_metric_inits.end(), inv_metric.begin(),
+                                inv_metric.end());
+      }
+    }
+    auto initial_metrics = io::make_metric_inits(
+        num_chains, metric_choice == unit ? nullptr : inv_metric_inits.data(),
+        tmodel->num_free_params, metric_choice, opts.metric_rank);
+
+    bool adapt = true;
+    return nuts::run_nuts(*tmodel, opts, num_chains, chain_inits, seed, id,
+                          init_radius, num_warmup, num_samples, metric_choice,
+                          initial_metrics, adapt, delta, gamma, kappa, t0,
+                          init_buffer, term_buffer, window, save_warmup,
+                          stepsize, stepsize_jitter, max_depth, refresh,
+                          deadline, out, out_size, stepsize_out,
+                          inv_metric_out, err);
+#else
+    return -1;  // unreachable, algorithms::require() throws above
+#endif
+  }));
 }
 
 int tinystan_optimize(const TinyStanModel *tmodel, const char *init,
@@ -278,7 +747,24 @@ int tinystan_optimize(const TinyStanModel *tmodel, const char *init,
                       double tol_grad, double tol_rel_grad, double tol_param,
                       int refresh, int num_threads, double *out,
                       size_t out_size, TinyStanError **err) {
-  return error::catch_exceptions(err, [&]() {
+  return tinystan_optimize_with_options(
+      tmodel, nullptr, init, seed, id, init_radius, algorithm, num_iterations,
+      jacobian, max_history_size, init_alpha, tol_obj, tol_rel_obj, tol_grad,
+      tol_rel_grad, tol_param, refresh, num_threads, out, out_size, err);
+}
+
+int tinystan_optimize_with_options(
+    const TinyStanModel *tmodel, const TinyStanCallOptions *options,
+    const char *init, unsigned int seed, unsigned int id, double init_radius,
+    TinyStanOptimizationAlgorithm algorithm, int num_iterations, bool jacobian,
+    /* tuning params */ int max_history_size, double init_alpha, double tol_obj,
+    double tol_rel_obj, double tol_grad, double tol_rel_grad, double tol_param,
+    int refresh, int num_threads, double *out, size_t out_size,
+    TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(tmodel->memory_options);
     error::check_positive("id", id);
     error::check_positive("num_iterations", num_iterations);
     error::check_nonnegative("init_radius", init_radius);
@@ -294,69 +780,20 @@ int tinystan_optimize(const TinyStanModel *tmodel, const char *init,
       error::check_positive("tol_rel_grad", tol_rel_grad);
       error::check_positive("tol_param", tol_param);
     }
-
-    util::init_threading(num_threads);
+    algorithms::require(algorithms::optimizer_name(algorithm));
 
     auto json_init = io::load_data(init);
-    auto &model = *tmodel->model;
+    screening::screen_init(*tmodel, opts, json_init, seed, id, init_radius);
     io::buffer_writer sample_writer(out, out_size);
     error::error_logger logger(*tmodel, refresh != 0);
 
-    interrupt::tinystan_interrupt_handler interrupt;
-    stan::callbacks::writer null_writer;
+    interrupt::tinystan_interrupt_handler interrupt(deadline);
 
-    bool save_iterations = false;
-
-    int return_code = 0;
-    switch (algorithm) {
-      case newton:
-        if (jacobian)
-          return_code
-              = stan::services::optimize::newton<stan::model::model_base, true>(
-                  model, *json_init, seed, id, init_radius, num_iterations,
-                  save_iterations, interrupt, logger, null_writer,
-                  sample_writer);
-        else
-          return_code
-              = stan::services::optimize::newton<stan::model::model_base,
-                                                 false>(
-                  model, *json_init, seed, id, init_radius, num_iterations,
-                  save_iterations, interrupt, logger, null_writer,
-                  sample_writer);
-        break;
-      case bfgs:
-        if (jacobian)
-          return_code
-              = stan::services::optimize::bfgs<stan::model::model_base, true>(
-                  model, *json_init, seed, id, init_radius, init_alpha, tol_obj,
-                  tol_rel_obj, tol_grad, tol_rel_grad, tol_param,
-                  num_iterations, save_iterations, refresh, interrupt, logger,
-                  null_writer, sample_writer);
-        else
-          return_code
-              = stan::services::optimize::bfgs<stan::model::model_base, false>(
-                  model, *json_init, seed, id, init_radius, init_alpha, tol_obj,
-                  tol_rel_obj, tol_grad, tol_rel_grad, tol_param,
-                  num_iterations, save_iterations, refresh, interrupt, logger,
-                  null_writer, sample_writer);
-        break;
-      case lbfgs:
-        if (jacobian)
-          return_code
-              = stan::services::optimize::lbfgs<stan::model::model_base, true>(
-                  model, *json_init, seed, id, init_radius, max_history_size,
-                  init_alpha, tol_obj, tol_rel_obj, tol_grad, tol_rel_grad,
-                  tol_param, num_iterations, save_iterations, refresh,
-                  interrupt, logger, null_writer, sample_writer);
-        else
-          return_code
-              = stan::services::optimize::lbfgs<stan::model::model_base, false>(
-                  model, *json_init, seed, id, init_radius, max_history_size,
-                  init_alpha, tol_obj, tol_rel_obj, tol_grad, tol_rel_grad,
-                  tol_param, num_iterations, save_iterations, refresh,
-                  interrupt, logger, null_writer, sample_writer);
-        break;
-    }
+    int return_code = optimize::run_optimizer(
+        *tmodel->model, *json_init, seed, id, init_radius, algorithm,
+        num_iterations, jacobian, max_history_size, init_alpha, tol_obj,
+        tol_rel_obj, tol_grad, tol_rel_grad, tol_param, refresh, interrupt,
+        logger, sample_writer);
 
     if (return_code != 0) {
       if (err != nullptr) {
@@ -365,7 +802,75 @@ int tinystan_optimize(const TinyStanModel *tmodel, const char *init,
     }
 
     return return_code;
-  });
+  }));
+}
+
+int tinystan_optimize_multi(
+    const TinyStanModel *tmodel, const TinyStanCallOptions *options,
+    size_t num_starts, const char *inits, unsigned int seed, unsigned int id,
+    double init_radius, TinyStanOptimizationAlgorithm algorithm,
+    int num_iterations, bool jacobian, /* tuning params */ int max_history_size,
+    double init_alpha, double tol_obj, double tol_rel_obj, double tol_grad,
+    double tol_rel_grad, double tol_param, double dedupe_tol, int refresh,
+    int num_threads, double *out, size_t out_size, int *return_codes_out,
+    size_t *num_modes_out, TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(tmodel->memory_options);
+    error::check_positive("num_starts", num_starts);
+    error::check_positive("id", id);
+    error::check_positive("num_iterations", num_iterations);
+    error::check_nonnegative("init_radius", init_radius);
+    error::check_nonnegative("dedupe_tol", dedupe_tol);
+
+    if (algorithm == lbfgs) {
+      error::check_positive("max_history_size", max_history_size);
+    }
+    if (algorithm == bfgs || algorithm == lbfgs) {
+      error::check_positive("init_alpha", init_alpha);
+      error::check_positive("tol_obj", tol_obj);
+      error::check_positive("tol_rel_obj", tol_rel_obj);
+      error::check_positive("tol_grad", tol_grad);
+      error::check_positive("tol_rel_grad", tol_rel_grad);
+      error::check_positive("tol_param", tol_param);
+    }
+    algorithms::require(algorithms::optimizer_name(algorithm));
+
+    // lp__ and converged__ precede the model parameters
+    size_t num_params = tmodel->num_params + 2;
+    if (out_size < num_starts * num_params) {
+      std::stringstream ss;
+      ss << "Output buffer too small. Expected at least " << num_starts
+         << " modes of " << num_params << " doubles, got " << out_size;
+      throw std::runtime_error(ss.str());
+    }
+
+    auto json_inits = io::load_inits(num_starts, inits);
+    screening::screen_inits(*tmodel, opts, json_inits, seed, id, init_radius);
+    error::error_logger logger(*tmodel, refresh != 0);
+
+    interrupt::tinystan_interrupt_handler interrupt(deadline);
+
+    size_t num_modes = optimize::run_multi_start(
+        *tmodel, num_starts, json_inits, seed, id, init_radius, algorithm,
+        num_iterations, jacobian, max_history_size, init_alpha, tol_obj,
+        tol_rel_obj, tol_grad, tol_rel_grad, tol_param, dedupe_tol, refresh,
+        interrupt, logger, out, return_codes_out);
+
+    if (num_modes_out != nullptr) {
+      *num_modes_out = num_modes;
+    }
+
+    if (num_modes == 0) {
+      if (err != nullptr) {
+        *err = logger.get_error();
+      }
+      return 1;
+    }
+
+    return 0;
+  }));
 }
 
 int tinystan_laplace_sample(const TinyStanModel *tmodel,
@@ -375,30 +880,47 @@ int tinystan_laplace_sample(const TinyStanModel *tmodel,
                             int refresh, int num_threads, double *out,
                             size_t out_size, double *hessian_out,
                             TinyStanError **err) {
-  return error::catch_exceptions(err, [&]() {
-    error::check_positive("num_draws", num_draws);
+  return tinystan_laplace_sample_with_hessian(
+      tmodel, nullptr, theta_hat_constr, theta_hat_json, seed, num_draws,
+      jacobian, calculate_lp, refresh, num_threads, out, out_size, nullptr,
+      hessian_out, err);
+}
 
-    util::init_threading(num_threads);
+int tinystan_laplace_sample_with_hessian(
+    const TinyStanModel *tmodel, const TinyStanCallOptions *options,
+    const double *theta_hat_constr, const char *theta_hat_json,
+    unsigned int seed, int num_draws, bool jacobian, bool calculate_lp,
+    int refresh, int num_threads, double *out, size_t out_size,
+    const double *hessian_in, double *hessian_out, TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(tmodel->memory_options);
+    error::check_positive("num_draws", num_draws);
+    algorithms::require("laplace");
 
+#ifdef TINYSTAN_ALGORITHM_LAPLACE
     auto &model = *tmodel->model;
     io::buffer_writer sample_writer(out, out_size);
     io::filtered_writer hessian_writer;
     hessian_writer.add_key("Hessian", hessian_out);
     error::error_logger logger(*tmodel, refresh != 0);
-    interrupt::tinystan_interrupt_handler interrupt;
+    interrupt::tinystan_interrupt_handler interrupt(deadline);
 
     Eigen::VectorXd theta_hat = model::unconstrain_parameters(
         *tmodel, theta_hat_constr, theta_hat_json);
 
     int return_code;
     if (jacobian) {
-      return_code = stan::services::laplace_sample<true>(
-          model, theta_hat, num_draws, calculate_lp, seed, refresh, interrupt,
-          logger, sample_writer, hessian_writer);
+      return_code = laplace::laplace_sample<true>(
+          model, theta_hat, hessian_in, num_draws, calculate_lp, seed,
+          refresh, tmodel->model_output, interrupt, logger, sample_writer,
+          hessian_writer);
     } else {
-      return_code = stan::services::laplace_sample<false>(
-          model, theta_hat, num_draws, calculate_lp, seed, refresh, interrupt,
-          logger, sample_writer, hessian_writer);
+      return_code = laplace::laplace_sample<false>(
+          model, theta_hat, hessian_in, num_draws, calculate_lp, seed,
+          refresh, tmodel->model_output, interrupt, logger, sample_writer,
+          hessian_writer);
     }
 
     if (return_code != 0) {
@@ -407,7 +929,195 @@ int tinystan_laplace_sample(const TinyStanModel *tmodel,
       }
     }
     return return_code;
-  });
+#else
+    return -1;  // unreachable, algorithms::require() throws above
+#endif
+  }));
+}
+
+int tinystan_optimize_laplace(
+    const TinyStanModel *tmodel, const TinyStanCallOptions *options,
+    const char *init, unsigned int seed, unsigned int id, double init_radius,
+    TinyStanOptimizationAlgorithm algorithm, int num_iterations, bool jacobian,
+    /* tuning params */ int max_history_size, double init_alpha, double tol_obj,
+    double tol_rel_obj, double tol_grad, double tol_rel_grad, double tol_param,
+    int num_draws, bool calculate_lp, int refresh, int num_threads,
+    double *mode_out, size_t mode_size, double *out, size_t out_size,
+    double *hessian_out, TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(tmodel->memory_options);
+    error::check_positive("id", id);
+    error::check_positive("num_iterations", num_iterations);
+    error::check_nonnegative("init_radius", init_radius);
+    error::check_positive("num_draws", num_draws);
+
+    if (algorithm == lbfgs) {
+      error::check_positive("max_history_size", max_history_size);
+    }
+    if (algorithm == bfgs || algorithm == lbfgs) {
+      error::check_positive("init_alpha", init_alpha);
+      error::check_positive("tol_obj", tol_obj);
+      error::check_positive("tol_rel_obj", tol_rel_obj);
+      error::check_positive("tol_grad", tol_grad);
+      error::check_positive("tol_rel_grad", tol_rel_grad);
+      error::check_positive("tol_param", tol_param);
+    }
+    algorithms::require(algorithms::optimizer_name(algorithm));
+    algorithms::require("laplace");
+
+#ifdef TINYSTAN_ALGORITHM_LAPLACE
+    auto &model = *tmodel->model;
+    auto json_init = io::load_data(init);
+    screening::screen_init(*tmodel, opts, json_init, seed, id, init_radius);
+    io::buffer_writer mode_writer(mode_out, mode_size);
+    io::buffer_writer sample_writer(out, out_size);
+    io::filtered_writer hessian_writer;
+    hessian_writer.add_key("Hessian", hessian_out);
+    error::error_logger logger(*tmodel, refresh != 0);
+    interrupt::tinystan_interrupt_handler interrupt(deadline);
+
+    Eigen::VectorXd mode;
+    int return_code;
+    if (jacobian) {
+      return_code = optimize::find_mode<true>(
+          model, *json_init, seed, id, init_radius, algorithm, num_iterations,
+          max_history_size, init_alpha, tol_obj, tol_rel_obj, tol_grad,
+          tol_rel_grad, tol_param, refresh, interrupt, logger, mode_writer,
+          mode);
+      if (return_code == 0) {
+        return_code = laplace::laplace_sample<true>(
+            model, mode, nullptr, num_draws, calculate_lp, seed, refresh,
+            tmodel->model_output, interrupt, logger, sample_writer,
+            hessian_writer);
+      }
+    } else {
+      return_code = optimize::find_mode<false>(
+          model, *json_init, seed, id, init_radius, algorithm, num_iterations,
+          max_history_size, init_alpha, tol_obj, tol_rel_obj, tol_grad,
+          tol_rel_grad, tol_param, refresh, interrupt, logger, mode_writer,
+          mode);
+      if (return_code == 0) {
+        return_code = laplace::laplace_sample<false>(
+            model, mode, nullptr, num_draws, calculate_lp, seed, refresh,
+            tmodel->model_output, interrupt, logger, sample_writer,
+            hessian_writer);
+      }
+    }
+
+    if (return_code != 0) {
+      if (err != nullptr) {
+        *err = logger.get_error();
+      }
+    }
+    return return_code;
+#else
+    return -1;  // unreachable, algorithms::require() throws above
+#endif
+  }));
+}
+
+int tinystan_variational(
+    const TinyStanModel *tmodel, const TinyStanCallOptions *options,
+    TinyStanVariationalAlgorithm algorithm, const char *init, unsigned int seed,
+    unsigned int id, double init_radius, int num_draws,
+    /* tuning params */ int grad_samples, int elbo_samples, int max_iterations,
+    double tol_rel_obj, double eta, bool adapt_engaged, int adapt_iterations,
+    int eval_elbo, int refresh, int num_threads, double *out, size_t out_size,
+    TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(tmodel->memory_options);
+    error::check_positive("id", id);
+    error::check_nonnegative("init_radius", init_radius);
+    error::check_positive("num_draws", num_draws);
+    error::check_positive("grad_samples", grad_samples);
+    error::check_positive("elbo_samples", elbo_samples);
+    error::check_positive("max_iterations", max_iterations);
+    error::check_positive("tol_rel_obj", tol_rel_obj);
+    error::check_positive("eta", eta);
+    if (adapt_engaged) {
+      error::check_positive("adapt_iterations", adapt_iterations);
+    }
+    error::check_positive("eval_elbo", eval_elbo);
+    algorithms::require("variational");
+
+    // lp__, log_p__ and log_g__ precede the model parameters, and the mean
+    // of the approximation precedes the draws
+    size_t num_params = tmodel->num_params + 3;
+    if (out_size < (num_draws + 1) * num_params) {
+      std::stringstream ss;
+      ss << "Output buffer too small. Expected at least " << num_draws + 1
+         << " rows of " << num_params << " doubles, got " << out_size;
+      throw std::runtime_error(ss.str());
+    }
+
+#ifdef TINYSTAN_ALGORITHM_VARIATIONAL
+    auto json_init = io::load_data(init);
+    screening::screen_init(*tmodel, opts, json_init, seed, id, init_radius);
+    io::buffer_writer sample_writer(out, out_size);
+    error::error_logger logger(*tmodel, refresh != 0);
+    interrupt::tinystan_interrupt_handler interrupt(deadline);
+
+    int return_code;
+    if (algorithm == fullrank) {
+      return_code = variational::run_advi<variational::parallel_fullrank>(
+          *tmodel->model, *json_init, seed, id, init_radius, grad_samples,
+          elbo_samples, max_iterations, tol_rel_obj, eta, adapt_engaged,
+          adapt_iterations, eval_elbo, num_draws, tmodel->model_output,
+          interrupt, logger, sample_writer);
+    } else {
+      return_code = variational::run_advi<variational::parallel_meanfield>(
+          *tmodel->model, *json_init, seed, id, init_radius, grad_samples,
+          elbo_samples, max_iterations, tol_rel_obj, eta, adapt_engaged,
+          adapt_iterations, eval_elbo, num_draws, tmodel->model_output,
+          interrupt, logger, sample_writer);
+    }
+
+    if (return_code != 0) {
+      if (err != nullptr) {
+        *err = logger.get_error();
+      }
+    }
+    return return_code;
+#else
+    return -1;  // unreachable, algorithms::require() throws above
+#endif
+  }));
+}
+
+int tinystan_loo(
+    const TinyStanModel *tmodel, const TinyStanCallOptions *options,
+    const char *variable, const double *draws, size_t num_draws, size_t stride,
+    unsigned int seed, int num_threads, double *elpd_loo, double *se_elpd_loo,
+    double *p_loo, double *pointwise_elpd, double *pareto_k,
+    TinyStanError **err) {
+  return error::catch_exceptions(err, util::with_threads(num_threads, [&]() {
+    const auto opts = call_options::resolve(options);
+    auto deadline = interrupt::deadline::after(opts.time_limit);
+    memory::call_scope call(tmodel->memory_options);
+    error::check_positive("num_draws", num_draws);
+    if (stride < tmodel->num_req_constrained_params) {
+      std::stringstream ss;
+      ss << "stride must be at least the number of parameters ("
+         << tmodel->num_req_constrained_params << "), was " << stride;
+      throw std::invalid_argument(ss.str());
+    }
+    auto [offset, size] = loo::find_variable(*tmodel->model, variable);
+
+    error::error_logger logger(*tmodel, true);
+    interrupt::tinystan_interrupt_handler interrupt(deadline);
+
+    Eigen::MatrixXd log_lik = loo::evaluate_variable(
+        *tmodel->model, draws, num_draws, stride,
+        tmodel->num_req_constrained_params, offset, size, seed,
+        tmodel->model_output, interrupt, logger);
+    loo::psis_loo(log_lik, *elpd_loo, *se_elpd_loo, *p_loo, pointwise_elpd,
+                  pareto_k);
+    return 0;
+  }));
 }
 
 const char *tinystan_get_error_message(const TinyStanError *err) {
@@ -424,8 +1134,37 @@ TinyStanErrorType tinystan_get_error_type(const TinyStanError *err) {
   return err->type;
 }
 
+size_t tinystan_get_error_draw_counts(const TinyStanError *err,
+                                      size_t *counts) {
+  if (err == nullptr) {
+    return 0;
+  }
+  if (counts != nullptr) {
+    std::copy(err->draw_counts.begin(), err->draw_counts.end(), counts);
+  }
+  return err->draw_counts.size();
+}
+
+size_t tinystan_get_error_chain_errors(const TinyStanError *err,
+                                       const char **messages) {
+  if (err == nullptr) {
+    return 0;
+  }
+  if (messages != nullptr) {
+    for (size_t i = 0; i < err->chain_errors.size(); ++i) {
+      const auto &msg = err->chain_errors[i];
+      messages[i] = msg.empty() ? nullptr : msg.c_str();
+    }
+  }
+  return err->chain_errors.size();
+}
+
 void tinystan_destroy_error(TinyStanError *err) { delete (err); }
 
+bool tinystan_algorithm_available(const char *name) {
+  return algorithms::available(name);
+}
+
 char tinystan_separator_char() { return io::SEPARATOR; }
 
 void tinystan_api_version(int *major, int *minor, int *patch) {
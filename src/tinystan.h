@@ -41,6 +41,20 @@ TINYSTAN_PUBLIC void tinystan_api_version(int *major, int *minor, int *patch);
  */
 TINYSTAN_PUBLIC void tinystan_stan_version(int *major, int *minor, int *patch);
 
+/**
+ * Check whether an algorithm was compiled into this library.
+ *
+ * Libraries built with the `TINYSTAN_ALGORITHMS` make variable only contain
+ * the algorithms listed there. Calling one of the others fails with a `config`
+ * error.
+ *
+ * @param[in] name One of `"nuts_unit"`, `"nuts_dense"`, `"nuts_diag"`,
+ * `"nuts_lowrank"`, `"nuts_auto"`, `"pathfinder"`, `"newton"`, `"bfgs"`,
+ * `"lbfgs"`, `"laplace"`, or `"variational"`.
+ * @return Whether the algorithm is available. Always false for other names.
+ */
+TINYSTAN_PUBLIC bool tinystan_algorithm_available(const char *name);
+
 /**
  * Instantiate a model from JSON-encoded data.
  *
@@ -49,11 +63,22 @@ TINYSTAN_PUBLIC void tinystan_stan_version(int *major, int *minor, int *patch);
  * of free parameters. This is essential for constructing output
  * buffers of appropriate size.
  *
+ * The algorithm functions can be called concurrently with the same model
+ * from several threads. Each call runs in its own pool of `num_threads`
+ * threads, so concurrent calls neither resize each other's pools nor share
+ * threads, and each call has its own settings (see
+ * tinystan_create_call_options()) and interrupted state. A `Ctrl+C` stops
+ * every call running when it arrives. The model must not be reconfigured
+ * (e.g. by tinystan_model_set_memory_options()) while calls are running, and
+ * concurrent calls need a library built with threading support, which is the
+ * default.
+ *
  * @param[in] data A path to a JSON file or a string containing JSON-encoded
  * data. Can be `NULL` or an empty string if the model does not require data.
  * @param[in] seed Random seed.
  * @param[in] user_print_callback Callback function for printing messages. Can
- * be `NULL`, in which case cout/cerr are used instead.
+ * be `NULL`, in which case cout/cerr are used instead. Output printed by the
+ * model while it reads the data is also passed to this callback.
  * @param[out] err Error information. Can be `NULL`.
  * @return A pointer to the model. Must later be freed with
  * tinystan_destroy_model(). Returns `NULL` on error.
@@ -89,6 +114,53 @@ TINYSTAN_PUBLIC const char *tinystan_model_param_names(
 TINYSTAN_PUBLIC size_t
 tinystan_model_num_free_params(const TinyStanModel *model);
 
+/**
+ * Get the number of variables (parameters, transformed parameters, and
+ * generated quantities) declared by the model.
+ *
+ * @param[in] model The model.
+ * @return The number of variables, for use with tinystan_model_variable().
+ */
+TINYSTAN_PUBLIC size_t
+tinystan_model_num_variables(const TinyStanModel *model);
+
+/**
+ * Describe one variable of the model and where its values are in the output.
+ *
+ * This is the structured equivalent of tinystan_model_param_names(), from
+ * which shaped views of the output buffers can be made without parsing the
+ * flattened names. Variables are in declaration order, parameters first.
+ *
+ * Each variable occupies `length` consecutive columns, starting `offset`
+ * columns into the names returned by tinystan_model_param_names(). In the
+ * output of the algorithms these names are preceded by the algorithm's own
+ * columns (e.g. 7 for tinystan_sample()), which must be added to `offset`.
+ * The elements are stored in column-major order. For complex variables, the
+ * real and imaginary parts of each element are adjacent, so `length` is twice
+ * the product of `dims`. A tuple is described as one variable with the
+ * dimensions reported by Stan, and the layout of its elements must be
+ * recovered from the names.
+ *
+ * Every output argument can be `NULL` if not needed. Strings and arrays
+ * returned are owned by the model and valid until it is destroyed.
+ *
+ * @param[in] model The model.
+ * @param[in] index Which variable, less than tinystan_model_num_variables().
+ * @param[out] name The name of the variable.
+ * @param[out] block The block the variable is declared in.
+ * @param[out] dims The dimensions of the variable. Empty for scalars.
+ * @param[out] num_dims The number of dimensions.
+ * @param[out] is_complex Whether the elements are complex numbers.
+ * @param[out] offset The first column of the variable.
+ * @param[out] length The number of columns of the variable.
+ * @param[out] err Error information. Can be `NULL`.
+ * @return Zero on success, non-zero if `index` is out of range.
+ */
+TINYSTAN_PUBLIC int tinystan_model_variable(
+    const TinyStanModel *model, size_t index, const char **name,
+    TinyStanVariableBlock *block, const size_t **dims, size_t *num_dims,
+    bool *is_complex, size_t *offset, size_t *length, TinyStanError **err);
+
 /**
  * Get the number of constrained parameters, excluding tparams and
  * generated quantities. This is e.g. the length that the mode vector
@@ -100,6 +172,299 @@ TINYSTAN_PUBLIC
 size_t tinystan_model_num_constrained_params_for_unconstraining(
     const TinyStanModel *model);
 
+/**
+ * Deliver progress and diagnostic messages in batches.
+ *
+ * By default, each message is passed to the print callback (or written to
+ * stdout/stderr) by the thread which produced it, as soon as it is produced.
+ * With many threads, this serializes them on the callback. When batching is
+ * enabled, threads only queue their messages, and these are delivered
+ * together every `flush_interval_ms`, whenever the queue is full, and at the
+ * end of each algorithm. Consecutive messages of the same kind are joined
+ * with newlines into a single callback invocation. In libraries built without
+ * threading support, messages are only delivered when the queue is full and at
+ * the end of each algorithm.
+ *
+ * @param[in] model The model.
+ * @param[in] flush_interval_ms Milliseconds between deliveries. Zero disables
+ * batching.
+ * @param[in] capacity Number of messages which can wait for delivery.
+ * @param[in] drop_when_full If true, messages produced while the queue is full
+ * are discarded (and the number discarded is reported) rather than delivered
+ * by the producing thread.
+ * @param[out] err Error information. Can be `NULL`.
+ * @return Zero on success, non-zero if the arguments are invalid.
+ */
+TINYSTAN_PUBLIC int tinystan_model_set_message_batching(
+    TinyStanModel *model, int flush_interval_ms, size_t capacity,
+    bool drop_when_full, TinyStanError **err);
+
+/**
+ * Prefix batched messages with the chain which produced them and when.
+ *
+ * Each message queued by tinystan_model_set_message_batching() records the
+ * chain (or Pathfinder path) ID of the thread which produced it, where one
+ * is known, and the time since the start of the call. They are delivered as
+ * e.g. `[chain 2, 1.250s] Iteration: 100 / 2000 [  5%]  (Warmup)`, or
+ * without the chain for messages which do not belong to a single chain,
+ * including those from the chains of Stan's own multi-chain samplers.
+ * Messages which are not batched are not tagged.
+ *
+ * @param[in] model The model.
+ * @param[in] tag Whether to tag messages. The default is false.
+ */
+TINYSTAN_PUBLIC void tinystan_model_set_message_tags(TinyStanModel *model,
+                                                     bool tag);
+
+/**
+ * Choose whether output printed by the model's own `print()` statements is
+ * delivered while algorithms run.
+ *
+ * This output is passed to the print callback along with the algorithm's
+ * progress messages. TinyStan's parallel algorithms buffer it per thread and
+ * deliver it once the parallel section has finished. When disabled, the
+ * model is not asked to print at all, which avoids the cost of formatting
+ * output in the log density evaluations.
+ *
+ * Output printed while Stan's own samplers and optimizers run is always
+ * delivered with their progress messages, so it is silenced by `refresh = 0`.
+ * Output printed while the model is constructed is delivered by
+ * tinystan_create_model().
+ *
+ * @param[in] model The model.
+ * @param[in] enabled Whether to deliver the model's output. The default is
+ * true.
+ */
+TINYSTAN_PUBLIC void tinystan_model_set_model_output(TinyStanModel *model,
+                                                     bool enabled);
+
+/**
+ * Control the memory used by later algorithm calls with this model.
+ *
+ * Stan keeps the autodiff memory each thread has needed, so that later
+ * gradients do not allocate. After a large model, this can keep gigabytes
+ * in use. If `release_memory` is true, each call frees the memory of the
+ * threads it ran on, and of any idle worker threads, when it finishes, and
+ * returns free heap memory to the operating system where possible. The next
+ * call then allocates it again.
+ *
+ * If `memory_limit` is non-zero, algorithms stop with an error of type
+ * `memory` once the resident memory of the process exceeds it. Like the time
+ * limit, this is checked once per iteration, sampling the resident memory at
+ * most every 10 milliseconds, so it is a soft limit. The limit is on the
+ * whole process: calls running at the same time (with this model or any
+ * other) count towards it, and may make each other fail.
+ *
+ * @param[in] model The model.
+ * @param[in] release_memory Whether to free autodiff memory after each call.
+ * The default is false.
+ * @param[in] memory_limit The limit, in bytes. Zero (the default) means no
+ * limit.
+ */
+TINYSTAN_PUBLIC void tinystan_model_set_memory_options(TinyStanModel *model,
+                                                       bool release_memory,
+                                                       size_t memory_limit);
+
+/**
+ * Create the settings of individual algorithm calls.
+ *
+ * Each algorithm function takes an `options` argument. Unlike the settings
+ * of a model, these can differ between calls running at the same time with
+ * one model. A call copies them when it starts, so the same options can be
+ * passed to any number of calls, and changed or destroyed once the calls
+ * have started. Passing `NULL` uses the defaults, which are those of a new
+ * options object.
+ *
+ * @return A pointer to the options. Must later be freed with
+ * tinystan_destroy_call_options().
+ */
+TINYSTAN_PUBLIC TinyStanCallOptions *tinystan_create_call_options();
+
+/**
+ * Deallocate call options.
+ *
+ * @param[in] options The options to destroy.
+ */
+TINYSTAN_PUBLIC void tinystan_destroy_call_options(
+    TinyStanCallOptions *options);
+
+/**
+ * Limit how long a call may run.
+ *
+ * The limit is measured from the start of the call. Algorithms check it once
+ * per iteration. When it has passed, they stop and return an error of type
+ * `timeout`.
+ *
+ * The samplers (tinystan_sample(), tinystan_pooled_sample(), and the NUTS
+ * stage of tinystan_pathfinder_sample()) write their draws as they go. When
+ * they time out, the draws already written to `out` are valid, and
+ * tinystan_get_error_draw_counts() reports how many each chain wrote. The
+ * other algorithms write their output at the end, so nothing is returned.
+ *
+ * @param[in] options The options.
+ * @param[in] seconds The limit, in seconds. Zero (the default) means no limit.
+ * @param[out] err Error information. Can be `NULL`.
+ * @return Zero on success, non-zero if `seconds` is negative.
+ */
+TINYSTAN_PUBLIC int tinystan_call_options_set_time_limit(
+    TinyStanCallOptions *options, double seconds, TinyStanError **err);
+
+/**
+ * Set the rank of the `lowrank` metric used by NUTS.
+ *
+ * The `lowrank` inverse metric is a diagonal matrix of variances, corrected
+ * along the `rank` directions in which the draws, once standardized, vary the
+ * most (the leading eigenvectors of their correlation matrix).
+ * Like a diagonal metric, using it costs O(`rank` * D) per gradient for D
+ * free parameters, but it can also adapt to strong correlations, which
+ * otherwise require a dense metric.
+ *
+ * Flattened, the metric of each chain is `D * (rank + 1) + rank` doubles:
+ * the D variances, then the `rank` eigenvectors (D doubles each), then their
+ * eigenvalues. Eigenvectors whose eigenvalue is one have no effect. This is
+ * the layout of the `init_inv_metric` and `inv_metric_out` arguments of the
+ * sampling functions.
+ *
+ * @param[in] options The options.
+ * @param[in] rank The rank. It is capped at the number of free parameters.
+ * The default is 10.
+ * @param[out] err Error information. Can be `NULL`.
+ * @return Zero on success, non-zero if `rank` is zero.
+ */
+TINYSTAN_PUBLIC int tinystan_call_options_set_metric_rank(
+    TinyStanCallOptions *options, size_t rank, TinyStanError **err);
+
+/**
+ * Let the NUTS chains of a call fail independently of each other.
+ *
+ * By default, a chain which fails (for example, because no valid
+ * initialization was found) stops tinystan_sample() and the NUTS stage of
+ * tinystan_pathfinder_sample() with an error. With isolation, each chain
+ * runs on its own. A failed chain is restarted from a new random
+ * initialization up to `max_restarts` times, with a chain ID offset by a
+ * multiple of `num_chains`.
+ *
+ * If some chains still fail, the call returns an error of type `partial`.
+ * The output of the other chains is valid, while that of the failed chains
+ * (including their step sizes and metrics) is set to NaN, and
+ * tinystan_get_error_chain_errors() gives each chain's error. If every chain
+ * fails, the error is `generic`.
+ *
+ * Interrupts, time limits, and memory limits still stop every chain.
+ * tinystan_pathfinder() already tolerates failed paths, and only fails if
+ * every path does.
+ *
+ * @param[in] options The options.
+ * @param[in] isolate Whether to isolate chains. The default is false.
+ * @param[in] max_restarts The number of times to restart each failed chain.
+ * The default is zero.
+ * @param[out] err Error information. Can be `NULL`.
+ * @return Zero on success, non-zero if `max_restarts` is negative.
+ */
+TINYSTAN_PUBLIC int tinystan_call_options_set_chain_isolation(
+    TinyStanCallOptions *options, bool isolate, int max_restarts,
+    TinyStanError **err);
+
+/**
+ * Choose whether multi-path Pathfinder keeps the draws of every path.
+ *
+ * With PSIS resampling, tinystan_pathfinder() and
+ * tinystan_pathfinder_sample() normally keep all `num_paths * num_draws`
+ * draws until every path has finished, and then resample `num_multi_draws`
+ * of them. When streaming, each path's draws are resampled as soon as the
+ * path finishes and then freed, so memory use no longer grows with the
+ * number of paths.
+ *
+ * The resampled draws are still independent draws with probability
+ * proportional to their importance weights, and do not depend on the order
+ * in which the paths finish or the number of threads. The weights are
+ * Pareto smoothed within each path rather than across all of them, so the
+ * draws differ from those made without streaming. Runs without PSIS
+ * resampling are not affected.
+ *
+ * @param[in] options The options.
+ * @param[in] streaming Whether to resample paths as they finish. The default
+ * is false.
+ */
+TINYSTAN_PUBLIC void tinystan_call_options_set_pathfinder_streaming(
+    TinyStanCallOptions *options, bool streaming);
+
+/**
+ * Screen random initializations in parallel at the start of a call.
+ *
+ * Without initial values, each chain (or path, or optimizer start) draws
+ * parameters uniformly from `(-init_radius, init_radius)` on the
+ * unconstrained scale, and retries serially, up to 100 times, until the log
+ * density and its gradient are finite. With screening, every algorithm
+ * first makes `num_candidates` such candidates for each chain and evaluates
+ * all of them in parallel. Each chain then starts from its first valid
+ * candidate, or with `select_best`, the valid candidate with the highest log
+ * density (including the Jacobian). A chain with no valid candidate falls
+ * back to the usual retries.
+ *
+ * Candidates fill in the parameters missing from the user's initial values,
+ * and chains whose initial values give every parameter are not screened.
+ * Chains restarted after a failure (see
+ * tinystan_call_options_set_chain_isolation()) are screened too. The
+ * candidates depend on `seed` and each chain's ID but not on the number of
+ * threads, and use random number streams of their own, which no chain or
+ * other candidate shares.
+ * The number of candidates evaluated is reported by
+ * tinystan_last_call_init_screening().
+ *
+ * @param[in] options The options.
+ * @param[in] num_candidates The number of candidates for each chain. Zero
+ * (the default) disables screening.
+ * @param[in] select_best Whether to choose the candidate with the highest
+ * log density rather than the first valid one. The default is false.
+ */
+TINYSTAN_PUBLIC void tinystan_call_options_set_init_screening(
+    TinyStanCallOptions *options, size_t num_candidates, bool select_best);
+
+/**
+ * Get initialization screening statistics of the last algorithm call made
+ * from this thread. See tinystan_call_options_set_init_screening().
+ *
+ * @param[out] evaluated The number of candidates evaluated. Zero if the call
+ * did not screen. Can be `NULL`.
+ * @param[out] valid The number with finite log density and gradient. Can be
+ * `NULL`.
+ */
+TINYSTAN_PUBLIC void tinystan_last_call_init_screening(size_t *evaluated,
+                                                       size_t *valid);
+
+/**
+ * Get memory statistics of the last algorithm call made from this thread.
+ *
+ * The peak resident memory is the largest resident memory of the whole
+ * process seen during the call, sampled as described in
+ * tinystan_model_set_memory_options(), so it includes memory used by other
+ * threads and calls. The peak arena memory only counts this call: it is the
+ * size of the autodiff arenas of the threads which ran the call, summed.
+ * Stan keeps these arenas between calls (unless they are released), so a
+ * thread's arena may have grown in an earlier call.
+ *
+ * @param[out] peak_resident_bytes The peak resident memory, in bytes. Zero if
+ * it cannot be measured on this platform. Can be `NULL`.
+ * @param[out] peak_arena_bytes The peak autodiff arena memory, in bytes. Can
+ * be `NULL`.
+ * @param[out] output_bytes The number of bytes of draws written to the
+ * output buffers. Can be `NULL`.
+ */
+TINYSTAN_PUBLIC void tinystan_last_call_memory(size_t *peak_resident_bytes,
+                                               size_t *peak_arena_bytes,
+                                               size_t *output_bytes);
+
+/**
+ * Free the autodiff memory of the calling thread and of every idle TBB worker
+ * thread, and return free heap memory to the operating system where
+ * possible. Workers which are running other calls keep their memory.
+ *
+ * This is done automatically after each call if enabled with
+ * tinystan_model_set_memory_options().
+ */
+TINYSTAN_PUBLIC void tinystan_release_memory();
+
 /**
  * Returns the separator character which must be used
  * to provide multiple initialization files or json strings.
@@ -115,6 +480,15 @@ TINYSTAN_PUBLIC char tinystan_separator_char();
  * Same-named arguments should be interpreted as having the same meaning as in
  * the Stan documentation.
  *
+ * The `automatic` metric adapts a dense metric, but at the end of each
+ * warmup window decides whether to use only its diagonal. A dense metric
+ * needs fewer leapfrog steps when the parameters are correlated, roughly by
+ * the square root of the condition number of their correlation matrix, but
+ * each step costs O(D^2) instead of O(D). The choice compares these using the
+ * step times measured during warmup, and is explained in an info message.
+ * It is stored as a dense matrix, with zero off-diagonal entries if the
+ * diagonal metric was chosen.
+ *
  * @param[in] model The TinyStanModel to use for the sampling.
  * @param[in] num_chains The number of chains to run.
  * @param[in] inits Initial parameter values. This should be a path
@@ -130,8 +504,9 @@ TINYSTAN_PUBLIC char tinystan_separator_char();
  * sampler.
  * @param[in] init_inv_metric Initial value for the inverse mass matrix used
  * by the sampler. Depending on `metric_choice`, this should be a flattened
- * matrix for a dense metric, or a vector for a diagonal one. If `NULL`, the
- * sampler will use the identity matrix.
+ * matrix for a dense or automatic metric, or a vector for a diagonal one (or
+ * a low-rank one, see tinystan_call_options_set_metric_rank()). If `NULL`,
+ * the sampler will use the identity matrix.
  * @param[in] adapt Whether the sampler should adapt the step size and metric.
  * @param[in] delta Target average acceptance probability.
  * @param[in] gamma Adaptation regularization scale.
@@ -157,8 +532,10 @@ TINYSTAN_PUBLIC char tinystan_separator_char();
  * `NULL`. If non-NULL, the buffer should be of length `num_chains`
  * @param[out] inv_metric_out Buffer to store the inverse metric. Can be `NULL`.
  * If non-NULL, the buffer should be large enough to store `num_chains` *
- * `tinystan_model_num_free_params()` doubles if using a diagonal matrix, and
- * `num_chains` * the free parameters squared if using a dense one.
+ * `tinystan_model_num_free_params()` doubles if using a diagonal matrix,
+ * `num_chains` * the free parameters squared if using a dense or automatic
+ * one, and `num_chains` times the size given in
+ * tinystan_call_options_set_metric_rank() for a low-rank one.
  * @param[out] err Error information. Can be `NULL`.
  *
  * @return Zero on success, non-zero on error. If an error occurs, `err`
@@ -176,6 +553,338 @@ TINYSTAN_PUBLIC int tinystan_sample(
     double *out, size_t out_size, double *stepsize_out, double *inv_metric_out,
     TinyStanError **err);
 
+/**
+ * @brief Run NUTS with settings for this call.
+ *
+ * The same as tinystan_sample(), with an additional `options` argument. It is a
+ * separate function so that the signature of tinystan_sample() stays compatible
+ * with existing bindings.
+ *
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Can be `NULL` for the defaults.
+ *
+ * Other arguments and the return value are as in tinystan_sample().
+ */
+TINYSTAN_PUBLIC int tinystan_sample_with_options(
+    const TinyStanModel *model, const TinyStanCallOptions *options,
+    size_t num_chains, const char *inits, unsigned int seed,
+    unsigned int chain_id, double init_radius, int num_warmup, int num_samples,
+    TinyStanMetric metric_choice, const double *init_inv_metric, bool adapt,
+    double delta, double gamma, double kappa, double t0,
+    unsigned int init_buffer, unsigned int term_buffer, unsigned int window,
+    bool save_warmup, double stepsize, double stepsize_jitter, int max_depth,
+    int refresh, int num_threads, double *out, size_t out_size,
+    double *stepsize_out, double *inv_metric_out, TinyStanError **err);
+
+/**
+ * @brief Run NUTS with warmup adaptation shared between the chains.
+ *
+ * During warmup the chains advance in lockstep. They share a single step size,
+ * adapted from the mean acceptance statistic of all chains, and a single
+ * inverse metric, estimated from the pooled draws of all chains in each of
+ * Stan's adaptation windows. After warmup the chains sample independently.
+ *
+ * If `rhat_threshold` is positive, warmup may also end early: when a metric
+ * adaptation window closes with the cross-chain R-hat of all parameters below
+ * the threshold, the metric is fixed and warmup ends after `term_buffer` more
+ * iterations. Early stopping requires more than one chain and is disabled
+ * when `save_warmup` is true.
+ *
+ * Arguments which appear in tinystan_sample() have the same meaning here,
+ * except as noted below.
+ *
+ * @param[in] model The TinyStanModel to use for the sampling.
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Can be `NULL` for the defaults.
+ * @param[in] num_chains The number of chains to run.
+ * @param[in] inits Initial parameter values. This should be a path
+ * to a JSON file or a JSON string. If `num_chains` is greater than 1,
+ * this can be a list of paths or JSON strings separated by the
+ * separator character returned by tinystan_separator_char().
+ * @param[in] seed The seed to use for the random number generator.
+ * @param[in] chain_id Chain ID for the first chain.
+ * @param[in] init_radius Radius to initialize unspecified parameters within.
+ * @param[in] num_warmup Maximum number of warmup iterations to run.
+ * @param[in] num_samples Number of samples to draw after warmup.
+ * @param[in] metric_choice The type of inverse mass matrix to use in the
+ * sampler.
+ * @param[in] init_inv_metric Initial value for the inverse mass matrix, shared
+ * by all chains. Unlike tinystan_sample(), this holds a single metric: a
+ * flattened matrix for a dense or automatic metric, or a vector for a
+ * diagonal one (or a low-rank one, see
+ * tinystan_call_options_set_metric_rank()). If `NULL`, the sampler will use
+ * the identity matrix.
+ * @param[in] delta Target average acceptance probability.
+ * @param[in] gamma Adaptation regularization scale.
+ * @param[in] kappa Adaptation relaxation exponent.
+ * @param[in] t0 Adaptation iteration offset.
+ * @param[in] init_buffer Number of warmup samples to use for initial step size
+ * adaptation.
+ * @param[in] term_buffer Number of warmup samples to use for step size
+ * adaptation after the metric is adapted.
+ * @param[in] window Initial number of iterations to use for metric adaptation.
+ * @param[in] rhat_threshold R-hat below which warmup ends early. Zero disables
+ * early stopping.
+ * @param[in] save_warmup Whether to save the warmup samples.
+ * @param[in] stepsize Initial step size for the sampler.
+ * @param[in] stepsize_jitter Amount of random jitter to add to the step size.
+ * @param[in] max_depth Maximum tree depth for the sampler.
+ * @param[in] refresh Number of iterations between progress messages.
+ * @param[in] num_threads Number of threads to use for sampling.
+ * @param[out] out Buffer to store the samples, laid out as in
+ * tinystan_sample().
+ * @param[in] out_size Size of the buffer in doubles. Used for bounds checking
+ * unless TINYSTAN_NO_BOUNDS_CHECK is defined, in which case it is ignored.
+ * @param[out] stepsize_out Buffer to store the adapted stepsizes. Can be
+ * `NULL`. If non-NULL, the buffer should be of length `num_chains`. All
+ * chains receive the same value.
+ * @param[out] inv_metric_out Buffer to store the inverse metric. Can be
+ * `NULL`. Sized as in tinystan_sample(). All chains receive the same value.
+ * @param[out] num_warmup_out The number of warmup iterations actually run.
+ * Can be `NULL`.
+ * @param[out] err Error information. Can be `NULL`.
+ *
+ * @return Zero on success, non-zero on error. If an error occurs, `err`
+ * will be set to a non-NULL value which must be freed with
+ * tinystan_destroy_error().
+ */
+TINYSTAN_PUBLIC int tinystan_pooled_sample(
+    const TinyStanModel *model, const TinyStanCallOptions *options,
+    size_t num_chains, const char *inits, unsigned int seed,
+    unsigned int chain_id, double init_radius, int num_warmup, int num_samples,
+    TinyStanMetric metric_choice, const double *init_inv_metric, double delta,
+    double gamma, double kappa, double t0, unsigned int init_buffer,
+    unsigned int term_buffer, unsigned int window, double rhat_threshold,
+    bool save_warmup, double stepsize, double stepsize_jitter, int max_depth,
+    int refresh, int num_threads, double *out, size_t out_size,
+    double *stepsize_out, double *inv_metric_out, int *num_warmup_out,
+    TinyStanError **err);
+
+/**
+ * @brief Run NUTS with parallel tempering (replica exchange).
+ *
+ * Each of `num_replicas` replicas runs NUTS on the posterior density raised
+ * to the power `1 / T`, for a ladder of temperatures `T` starting at 1. The
+ * hotter replicas move between modes more easily. The replicas run in
+ * parallel, and every `swap_interval` iterations neighbouring replicas try
+ * to exchange their states. Only the draws of the replica at temperature 1
+ * are returned, and they are draws from the posterior.
+ *
+ * The temperatures start spaced geometrically between 1 and
+ * `max_temperature`. If `adapt_temperatures` is true, the gaps between them
+ * are adapted during warmup so that about 23% of swaps are accepted, which
+ * can move the hottest temperature away from `max_temperature`. Each replica
+ * adapts its own step size and metric during warmup.
+ *
+ * Arguments which appear in tinystan_sample() have the same meaning here,
+ * except as noted below.
+ *
+ * @param[in] model The TinyStanModel to use for the sampling.
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Can be `NULL` for the defaults.
+ * @param[in] num_replicas The number of temperatures. At least 2.
+ * @param[in] inits Initial parameter values. This should be a path
+ * to a JSON file or a JSON string. This can also be a list of
+ * `num_replicas` paths or JSON strings separated by the separator character
+ * returned by tinystan_separator_char().
+ * @param[in] seed The seed to use for the random number generator.
+ * @param[in] chain_id ID of the first replica. Replica `k` uses ID
+ * `chain_id + k`.
+ * @param[in] init_radius Radius to initialize unspecified parameters within.
+ * @param[in] num_warmup Number of warmup iterations to run.
+ * @param[in] num_samples Number of samples to draw after warmup.
+ * @param[in] metric_choice The type of inverse mass matrix to use in the
+ * sampler. Every replica starts from the identity matrix. The `automatic`
+ * metric is not supported.
+ * @param[in] max_temperature The initial temperature of the hottest replica.
+ * Must be greater than 1.
+ * @param[in] adapt_temperatures Whether to adapt the temperatures during
+ * warmup.
+ * @param[in] swap_interval Number of iterations between swap attempts.
+ * @param[in] delta Target average acceptance probability.
+ * @param[in] gamma Adaptation regularization scale.
+ * @param[in] kappa Adaptation relaxation exponent.
+ * @param[in] t0 Adaptation iteration offset.
+ * @param[in] init_buffer Number of warmup samples to use for initial step size
+ * adaptation.
+ * @param[in] term_buffer Number of warmup samples to use for step size
+ * adaptation after the metric is adapted.
+ * @param[in] window Initial number of iterations to use for metric adaptation.
+ * @param[in] save_warmup Whether to save the warmup samples.
+ * @param[in] stepsize Initial step size for the sampler.
+ * @param[in] stepsize_jitter Amount of random jitter to add to the step size.
+ * @param[in] max_depth Maximum tree depth for the sampler.
+ * @param[in] refresh Number of iterations between progress messages.
+ * @param[in] num_threads Number of threads to use for sampling.
+ * @param[out] out Buffer to store the samples, laid out as a single chain of
+ * tinystan_sample().
+ * @param[in] out_size Size of the buffer in doubles. Used for bounds checking
+ * unless TINYSTAN_NO_BOUNDS_CHECK is defined, in which case it is ignored.
+ * @param[out] stepsize_out Buffer to store the adapted step size of each
+ * replica, starting with the untempered one. Can be `NULL`. If non-NULL, the
+ * buffer should be of length `num_replicas`.
+ * @param[out] temperatures_out Buffer to store the final temperatures. Can be
+ * `NULL`. If non-NULL, the buffer should be of length `num_replicas`.
+ * @param[out] swap_rates_out Buffer to store the fraction of swaps accepted
+ * after warmup between replicas `k` and `k + 1`. Can be `NULL`. If non-NULL,
+ * the buffer should be of length `num_replicas - 1`.
+ * @param[out] err Error information. Can be `NULL`.
+ *
+ * @return Zero on success, non-zero on error. If an error occurs, `err`
+ * will be set to a non-NULL value which must be freed with
+ * tinystan_destroy_error().
+ */
+TINYSTAN_PUBLIC int tinystan_tempered_sample(
+    const TinyStanModel *model, const TinyStanCallOptions *options,
+    size_t num_replicas, const char *inits, unsigned int seed,
+    unsigned int chain_id, double init_radius, int num_warmup, int num_samples,
+    TinyStanMetric metric_choice, double max_temperature,
+    bool adapt_temperatures, int swap_interval, double delta, double gamma,
+    double kappa, double t0, unsigned int init_buffer, unsigned int term_buffer,
+    unsigned int window, bool save_warmup, double stepsize,
+    double stepsize_jitter, int max_depth, int refresh, int num_threads,
+    double *out, size_t out_size, double *stepsize_out,
+    double *temperatures_out, double *swap_rates_out, TinyStanError **err);
+
+/**
+ * @brief Create NUTS chains which can be advanced over several calls.
+ *
+ * Where tinystan_sample() runs warmup and sampling in one call and then
+ * discards the chains, a sampler keeps the position, step size, and metric
+ * of each chain between calls to tinystan_sampler_warmup() and
+ * tinystan_sampler_draw(). This suits callers which decide how many draws
+ * they need as they go, for example by monitoring convergence, or which
+ * alternate sampling with other work.
+ *
+ * This only finds the initial values of the chains. Their initial step size
+ * and metric are `stepsize` and `init_inv_metric` until adapted by
+ * tinystan_sampler_warmup().
+ *
+ * Each chain adapts on its own, as in tinystan_sample(). The chains are not
+ * isolated (see tinystan_call_options_set_chain_isolation()), and each call,
+ * including this one, has its own time limit. A sampler must only be used by
+ * one call at a time.
+ *
+ * Arguments have the same meaning as in tinystan_sample().
+ *
+ * @param[in] model The TinyStanModel to use for the sampling. It must not be
+ * destroyed before the sampler.
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Can be `NULL` for the defaults. The metric rank applies to the sampler
+ * from then on, and the time limit only to this call.
+ * @param[in] num_chains The number of chains to run.
+ * @param[in] inits Initial parameter values, as in tinystan_sample().
+ * @param[in] seed The seed to use for the random number generator.
+ * @param[in] chain_id Chain ID for the first chain.
+ * @param[in] init_radius Radius to initialize unspecified parameters within.
+ * @param[in] metric_choice The type of inverse mass matrix to use in the
+ * sampler.
+ * @param[in] init_inv_metric Initial value for the inverse mass matrix, as in
+ * tinystan_sample(). Can be `NULL`.
+ * @param[in] delta Target average acceptance probability.
+ * @param[in] gamma Adaptation regularization scale.
+ * @param[in] kappa Adaptation relaxation exponent.
+ * @param[in] t0 Adaptation iteration offset.
+ * @param[in] stepsize Initial step size for the sampler.
+ * @param[in] stepsize_jitter Amount of random jitter to add to the step size.
+ * @param[in] max_depth Maximum tree depth for the sampler.
+ * @param[in] num_threads Number of threads to use while initializing the
+ * chains.
+ * @param[out] err Error information. Can be `NULL`.
+ * @return A pointer to the sampler. Must later be freed with
+ * tinystan_sampler_destroy(). Returns `NULL` on error.
+ */
+TINYSTAN_PUBLIC TinyStanSampler *tinystan_sampler_create(
+    const TinyStanModel *model, const TinyStanCallOptions *options,
+    size_t num_chains, const char *inits, unsigned int seed,
+    unsigned int chain_id, double init_radius, TinyStanMetric metric_choice,
+    const double *init_inv_metric, double delta, double gamma, double kappa,
+    double t0, double stepsize, double stepsize_jitter, int max_depth,
+    int num_threads, TinyStanError **err);
+
+/**
+ * @brief Adapt the step size and metric of a sampler's chains.
+ *
+ * Each call runs a complete warmup of `num_warmup` iterations, with Stan's
+ * usual adaptation windows, starting from the current positions, step sizes,
+ * and metrics. Calling it again continues to refine them. If the call fails
+ * or is interrupted, the chains keep the positions they reached but their
+ * step sizes and metrics from before the call.
+ *
+ * @param[in] sampler The sampler.
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Only the time limit is used. Can be `NULL` for no limit.
+ * @param[in] num_warmup Number of warmup iterations to run.
+ * @param[in] init_buffer Number of warmup samples to use for initial step size
+ * adaptation.
+ * @param[in] term_buffer Number of warmup samples to use for step size
+ * adaptation after the metric is adapted.
+ * @param[in] window Initial number of iterations to use for metric adaptation.
+ * @param[in] refresh Number of iterations between progress messages.
+ * @param[in] num_threads Number of threads to use.
+ * @param[out] out Buffer to store the warmup draws, laid out as in
+ * tinystan_sample() with `num_samples` set to `num_warmup`. Can be `NULL` if
+ * they are not needed.
+ * @param[in] out_size Size of the buffer in doubles.
+ * @param[out] err Error information. Can be `NULL`.
+ * @return Zero on success, non-zero on error. If an error occurs, `err`
+ * will be set to a non-NULL value which must be freed with
+ * tinystan_destroy_error().
+ */
+TINYSTAN_PUBLIC int tinystan_sampler_warmup(
+    TinyStanSampler *sampler, const TinyStanCallOptions *options,
+    int num_warmup, unsigned int init_buffer, unsigned int term_buffer,
+    unsigned int window, int refresh, int num_threads, double *out,
+    size_t out_size, TinyStanError **err);
+
+/**
+ * @brief Draw from a sampler's chains without adaptation.
+ *
+ * The chains continue from where the previous call left them.
+ *
+ * @param[in] sampler The sampler.
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Only the time limit is used. Can be `NULL` for no limit.
+ * @param[in] num_draws Number of draws from each chain.
+ * @param[in] refresh Number of iterations between progress messages.
+ * @param[in] num_threads Number of threads to use.
+ * @param[out] out Buffer to store the draws, laid out as in tinystan_sample()
+ * with `num_samples` set to `num_draws`.
+ * @param[in] out_size Size of the buffer in doubles.
+ * @param[out] err Error information. Can be `NULL`.
+ * @return Zero on success, non-zero on error. If an error occurs, `err`
+ * will be set to a non-NULL value which must be freed with
+ * tinystan_destroy_error().
+ */
+TINYSTAN_PUBLIC int tinystan_sampler_draw(
+    TinyStanSampler *sampler, const TinyStanCallOptions *options, int num_draws,
+    int refresh, int num_threads, double *out, size_t out_size,
+    TinyStanError **err);
+
+/**
+ * Get the current state of a sampler's chains.
+ *
+ * @param[in] sampler The sampler.
+ * @param[out] positions Buffer to store the position of each chain on the
+ * unconstrained scale, `num_chains * tinystan_model_num_free_params()`
+ * doubles. Can be `NULL`.
+ * @param[out] stepsizes Buffer to store the step size of each chain,
+ * `num_chains` doubles. Can be `NULL`.
+ * @param[out] inv_metrics Buffer to store the inverse metric of each chain,
+ * sized as the `inv_metric_out` argument of tinystan_sample(). For the unit
+ * metric, this is a vector of ones. Can be `NULL`.
+ */
+TINYSTAN_PUBLIC void tinystan_sampler_state(const TinyStanSampler *sampler,
+                                            double *positions,
+                                            double *stepsizes,
+                                            double *inv_metrics);
+
+/**
+ * Deallocate a sampler.
+ * @param[in] sampler The sampler to deallocate.
+ */
+TINYSTAN_PUBLIC void tinystan_sampler_destroy(TinyStanSampler *sampler);
+
 /**
  * @brief Run the Pathfinder algorithm to approximate the posterior.
  *
@@ -239,6 +948,119 @@ TINYSTAN_PUBLIC int tinystan_pathfinder(
     bool calculate_lp, bool psis_resample, int refresh, int num_threads,
     double *out, size_t out_size, TinyStanError **err);
 
+/**
+ * @brief Run Pathfinder with settings for this call.
+ *
+ * The same as tinystan_pathfinder(), with an additional `options` argument. It
+ * is a separate function so that the signature of tinystan_pathfinder() stays
+ * compatible with existing bindings.
+ *
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Can be `NULL` for the defaults.
+ *
+ * Other arguments and the return value are as in tinystan_pathfinder().
+ */
+TINYSTAN_PUBLIC int tinystan_pathfinder_with_options(
+    const TinyStanModel *model, const TinyStanCallOptions *options,
+    size_t num_paths, const char *inits, unsigned int seed, unsigned int id,
+    double init_radius, int num_draws, /* tuning params */ int max_history_size,
+    double init_alpha, double tol_obj, double tol_rel_obj, double tol_grad,
+    double tol_rel_grad, double tol_param, int num_iterations,
+    int num_elbo_draws, int num_multi_draws, bool calculate_lp,
+    bool psis_resample, int refresh, int num_threads, double *out,
+    size_t out_size, TinyStanError **err);
+
+/**
+ * @brief Run NUTS, initialized using multi-path Pathfinder.
+ *
+ * Pathfinder is run with PSIS resampling enabled. Each chain is initialized
+ * at a distinct resampled draw, and the initial inverse metric is estimated
+ * from the resampled draws. NUTS then runs with adaptation enabled, which
+ * typically needs far fewer warmup iterations than when starting from a
+ * random initialization.
+ *
+ * Arguments which appear in tinystan_pathfinder() or tinystan_sample() have
+ * the same meaning here, except as noted below.
+ *
+ * @param[in] model The TinyStanModel to use for the sampling.
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Can be `NULL` for the defaults.
+ * @param[in] num_chains The number of NUTS chains to run.
+ * @param[in] num_paths The number of Pathfinder paths to run.
+ * @param[in] inits Initial parameter values for the Pathfinder paths.
+ * This should be a path to a JSON file or a JSON string. If `num_paths` is
+ * greater than 1, this can be a list of paths or JSON strings separated by
+ * the separator character returned by tinystan_separator_char().
+ * @param[in] seed The seed to use for the random number generator.
+ * @param[in] id ID for the first path and chain.
+ * @param[in] init_radius Radius to initialize unspecified parameters within.
+ * @param[in] num_draws Number of approximate draws drawn from each of the
+ * `num_paths` Pathfinders.
+ * @param[in] max_history_size History size used by the internal L-BFGS
+ * algorithm to approximate the Hessian.
+ * @param[in] init_alpha Initial step size for the internal L-BFGS algorithm.
+ * @param[in] tol_obj Convergence tolerance for the objective function.
+ * @param[in] tol_rel_obj Relative convergence tolerance for the objective
+ * function.
+ * @param[in] tol_grad Convergence tolerance for the gradient norm.
+ * @param[in] tol_rel_grad Relative convergence tolerance for the gradient norm.
+ * @param[in] tol_param Convergence tolerance for the changes in parameters.
+ * @param[in] num_iterations Maximum number of iterations for the internal
+ * L-BFGS algorithm.
+ * @param[in] num_elbo_draws Number of Monte Carlo draws used to estimate the
+ * ELBO.
+ * @param[in] num_multi_draws Number of PSIS-resampled draws used to pick the
+ * initial points and estimate the metric. Must be at least 2.
+ * @param[in] num_warmup Number of warmup iterations to run.
+ * @param[in] num_samples Number of samples to draw after warmup.
+ * @param[in] metric_choice The type of inverse mass matrix to use in the
+ * sampler. For `diagonal` and `dense`, the initial value is estimated from
+ * the Pathfinder draws. The `automatic` metric starts from the dense
+ * estimate.
+ * @param[in] delta Target average acceptance probability.
+ * @param[in] gamma Adaptation regularization scale.
+ * @param[in] kappa Adaptation relaxation exponent.
+ * @param[in] t0 Adaptation iteration offset.
+ * @param[in] init_buffer Number of warmup samples to use for initial step size
+ * adaptation.
+ * @param[in] term_buffer Number of warmup samples to use for step size
+ * adaptation after the metric is adapted.
+ * @param[in] window Initial number of iterations to use for metric adaptation.
+ * @param[in] save_warmup Whether to save the warmup samples.
+ * @param[in] stepsize Initial step size for the sampler.
+ * @param[in] stepsize_jitter Amount of random jitter to add to the step size.
+ * @param[in] max_depth Maximum tree depth for the sampler.
+ * @param[in] refresh Number of iterations between progress messages.
+ * @param[in] num_threads Number of threads to use.
+ * @param[out] out Buffer to store the samples, laid out as in
+ * tinystan_sample().
+ * @param[in] out_size Size of the buffer in doubles. Used for bounds checking
+ * unless TINYSTAN_NO_BOUNDS_CHECK is defined, in which case it is ignored.
+ * @param[out] stepsize_out Buffer to store the adapted stepsizes. Can be
+ * `NULL`. If non-NULL, the buffer should be of length `num_chains`
+ * @param[out] inv_metric_out Buffer to store the inverse metric. Can be
+ * `NULL`. Sized as in tinystan_sample().
+ * @param[out] err Error information. Can be `NULL`.
+ *
+ * @return Zero on success, non-zero on error. If an error occurs, `err`
+ * will be set to a non-NULL value which must be freed with
+ * tinystan_destroy_error().
+ */
+TINYSTAN_PUBLIC int tinystan_pathfinder_sample(
+    const TinyStanModel *model, const TinyStanCallOptions *options,
+    size_t num_chains, size_t num_paths, const char *inits, unsigned int seed,
+    unsigned int id, double init_radius, /* pathfinder params */ int num_draws,
+    int max_history_size, double init_alpha, double tol_obj, double tol_rel_obj,
+    double tol_grad, double tol_rel_grad, double tol_param, int num_iterations,
+    int num_elbo_draws, int num_multi_draws,
+    /* sampler params */ int num_warmup, int num_samples,
+    TinyStanMetric metric_choice, double delta, double gamma, double kappa,
+    double t0, unsigned int init_buffer, unsigned int term_buffer,
+    unsigned int window, bool save_warmup, double stepsize,
+    double stepsize_jitter, int max_depth, int refresh, int num_threads,
+    double *out, size_t out_size, double *stepsize_out, double *inv_metric_out,
+    TinyStanError **err);
+
 /**
  * @brief Optimize the model parameters using the specified algorithm.
  *
@@ -288,6 +1110,93 @@ TINYSTAN_PUBLIC int tinystan_optimize(
     int refresh, int num_threads, double *out, size_t out_size,
     TinyStanError **err);
 
+/**
+ * @brief Run an optimizer with settings for this call.
+ *
+ * The same as tinystan_optimize(), with an additional `options` argument. It is
+ * a separate function so that the signature of tinystan_optimize() stays
+ * compatible with existing bindings.
+ *
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Can be `NULL` for the defaults.
+ *
+ * Other arguments and the return value are as in tinystan_optimize().
+ */
+TINYSTAN_PUBLIC int tinystan_optimize_with_options(
+    const TinyStanModel *model, const TinyStanCallOptions *options,
+    const char *init, unsigned int seed, unsigned int id, double init_radius,
+    TinyStanOptimizationAlgorithm algorithm, int num_iterations, bool jacobian,
+    /* tuning params */ int max_history_size, double init_alpha, double tol_obj,
+    double tol_rel_obj, double tol_grad, double tol_rel_grad, double tol_param,
+    int refresh, int num_threads, double *out, size_t out_size,
+    TinyStanError **err);
+
+/**
+ * @brief Optimize the model parameters from several initializations in
+ * parallel.
+ *
+ * Each start is an independent run of the optimizer used by
+ * tinystan_optimize(), with start `i` using ID `id + i`. The resulting modes
+ * are sorted by decreasing log density. Starts which failed before producing a
+ * result are reported last, with all of their values set to NaN.
+ *
+ * Arguments which appear in tinystan_optimize() have the same meaning here,
+ * except as noted below.
+ *
+ * @param[in] model The TinyStanModel to use for the optimization.
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Can be `NULL` for the defaults.
+ * @param[in] num_starts The number of optimizations to run.
+ * @param[in] inits Initial parameter values. This should be a path
+ * to a JSON file or a JSON string. If `num_starts` is greater than 1,
+ * this can be a list of paths or JSON strings separated by the
+ * separator character returned by tinystan_separator_char().
+ * @param[in] seed The seed to use for the random number generator.
+ * @param[in] id ID for the first start.
+ * @param[in] init_radius Radius to initialize unspecified parameters within.
+ * @param[in] algorithm Which optimization algorithm to use.
+ * @param[in] num_iterations Maximum number of iterations for each start.
+ * @param[in] jacobian Whether to apply the Jacobian change of variables to the
+ * log density.
+ * @param[in] max_history_size History size used to approximate the Hessian.
+ * @param[in] init_alpha Initial step size.
+ * @param[in] tol_obj Convergence tolerance for the objective function.
+ * @param[in] tol_rel_obj Relative convergence tolerance for the objective
+ * function.
+ * @param[in] tol_grad Convergence tolerance for the gradient norm.
+ * @param[in] tol_rel_grad Relative convergence tolerance for the gradient norm.
+ * @param[in] tol_param Convergence tolerance for the changes in parameters.
+ * @param[in] dedupe_tol If positive, a mode is dropped when every one of its
+ * parameters is within this distance of a mode with a higher log density.
+ * Zero keeps every mode.
+ * @param[in] refresh Number of iterations between progress messages.
+ * @param[in] num_threads Number of threads to use.
+ * @param[out] out Buffer to store the modes. The buffer should be large
+ * enough to store `num_starts * num_params` doubles. Only the first
+ * `*num_modes_out` rows are written.
+ * @param[in] out_size Size of the buffer in doubles. Used for bounds checking
+ * unless TINYSTAN_NO_BOUNDS_CHECK is defined, in which case it is ignored.
+ * @param[out] return_codes_out Buffer to store the return code of the
+ * optimizer for each row of `out`. Can be `NULL`. If non-NULL, the buffer
+ * should be of length `num_starts`.
+ * @param[out] num_modes_out The number of rows written to `out`. Can be
+ * `NULL`.
+ * @param[out] err Error information. Can be `NULL`.
+ *
+ * @return Zero if at least one start succeeded, non-zero otherwise. If an
+ * error occurs, `err` will be set to a non-NULL value which must be freed
+ * with tinystan_destroy_error().
+ */
+TINYSTAN_PUBLIC int tinystan_optimize_multi(
+    const TinyStanModel *model, const TinyStanCallOptions *options,
+    size_t num_starts, const char *inits, unsigned int seed, unsigned int id,
+    double init_radius, TinyStanOptimizationAlgorithm algorithm,
+    int num_iterations, bool jacobian, /* tuning params */ int max_history_size,
+    double init_alpha, double tol_obj, double tol_rel_obj, double tol_grad,
+    double tol_rel_grad, double tol_param, double dedupe_tol, int refresh,
+    int num_threads, double *out, size_t out_size, int *return_codes_out,
+    size_t *num_modes_out, TinyStanError **err);
+
 /**
  * @brief Sample from the Laplace approximation of the posterior centered at the
  * provided mode.
@@ -313,7 +1222,8 @@ TINYSTAN_PUBLIC int tinystan_optimize(
  * @param[in] calculate_lp Whether to calculate the log probability of the
  * samples.
  * @param[in] refresh Number of iterations between progress messages.
- * @param[in] num_threads Number of threads to use for log density evaluations.
+ * @param[in] num_threads Number of threads to use for computing the Hessian
+ * and generating draws. The draws do not depend on the number of threads.
  * @param[out] out Buffer to store the samples. The buffer should be large
  * enough to store `num_draws * num_params` doubles.
  * @param[in] out_size Size of the buffer in doubles. Used for bounds checking
@@ -334,6 +1244,212 @@ int tinystan_laplace_sample(const TinyStanModel *tmodel,
                             size_t out_size, double *hessian_out,
                             TinyStanError **err);
 
+/**
+ * @brief Sample from the Laplace approximation, optionally reusing a Hessian.
+ *
+ * The same as tinystan_laplace_sample(), with additional `options` and
+ * `hessian_in` arguments. It is a separate function so that the signature of
+ * tinystan_laplace_sample() stays compatible with existing bindings.
+ *
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Can be `NULL` for the defaults.
+ * @param[in] hessian_in A Hessian matrix previously returned in `hessian_out`
+ * for the same mode and value of `jacobian`. If this is non-`NULL`, the Hessian
+ * is not recomputed, which makes drawing more samples from the same
+ * approximation much cheaper. Must be a square matrix with side length
+ * `tinystan_model_num_free_params()`. Can be `NULL`.
+ * @param[out] hessian_out Buffer to store the Hessian matrix used for the
+ * approximation. Can be `NULL`.
+ *
+ * Other arguments and the return value are as in tinystan_laplace_sample().
+ */
+TINYSTAN_PUBLIC
+int tinystan_laplace_sample_with_hessian(
+    const TinyStanModel *tmodel, const TinyStanCallOptions *options,
+    const double *theta_hat_constr, const char *theta_hat_json,
+    unsigned int seed, int num_draws, bool jacobian, bool calculate_lp,
+    int refresh, int num_threads, double *out, size_t out_size,
+    const double *hessian_in, double *hessian_out, TinyStanError **err);
+
+/**
+ * @brief Optimize the model parameters, then sample from the Laplace
+ * approximation at the mode.
+ *
+ * Equivalent to tinystan_optimize() followed by tinystan_laplace_sample() with
+ * the resulting mode, but the mode is kept on the unconstrained scale rather
+ * than being constrained and unconstrained again.
+ *
+ * Arguments which appear in tinystan_optimize() and tinystan_laplace_sample()
+ * have the same meaning here, except as noted below. Unlike
+ * tinystan_optimize(), an optimization which ends with an error is not
+ * followed by sampling, and this returns non-zero.
+ *
+ * @param[in] model The TinyStanModel to use.
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Can be `NULL` for the defaults.
+ * @param[in] init Initial parameter values for the optimization. This should
+ * be a path to a JSON file or a JSON string.
+ * @param[in] seed The seed to use for the random number generator.
+ * @param[in] id ID used to offset the random number generator of the
+ * optimization.
+ * @param[in] init_radius Radius to initialize unspecified parameters within.
+ * @param[in] algorithm Which optimization algorithm to use.
+ * @param[in] num_iterations Maximum number of iterations to run the
+ * optimization.
+ * @param[in] jacobian Whether to apply the Jacobian change of variables to the
+ * log density, both when optimizing and when sampling.
+ * @param[in] max_history_size History size used to approximate the Hessian.
+ * @param[in] init_alpha Initial step size.
+ * @param[in] tol_obj Convergence tolerance for the objective function.
+ * @param[in] tol_rel_obj Relative convergence tolerance for the objective
+ * function.
+ * @param[in] tol_grad Convergence tolerance for the gradient norm.
+ * @param[in] tol_rel_grad Relative convergence tolerance for the gradient norm.
+ * @param[in] tol_param Convergence tolerance for the changes in parameters.
+ * @param[in] num_draws Number of draws.
+ * @param[in] calculate_lp Whether to calculate the log probability of the
+ * samples.
+ * @param[in] refresh Number of iterations between progress messages.
+ * @param[in] num_threads Number of threads to use.
+ * @param[out] mode_out Buffer to store the mode, as written by
+ * tinystan_optimize(). The buffer should be large enough to store
+ * `num_params` doubles.
+ * @param[in] mode_size Size of `mode_out` in doubles.
+ * @param[out] out Buffer to store the samples. The buffer should be large
+ * enough to store `num_draws * num_params` doubles, using the `num_params`
+ * of tinystan_laplace_sample().
+ * @param[in] out_size Size of `out` in doubles.
+ * @param[out] hessian_out Buffer to store the Hessian matrix at the mode. Can
+ * be `NULL`.
+ * @param[out] err Error information. Can be `NULL`.
+ *
+ * @return Zero on success, non-zero on error. If an error occurs, `err` will be
+ * set to a non-NULL value which must be freed with tinystan_destroy_error().
+ */
+TINYSTAN_PUBLIC int tinystan_optimize_laplace(
+    const TinyStanModel *model, const TinyStanCallOptions *options,
+    const char *init, unsigned int seed, unsigned int id, double init_radius,
+    TinyStanOptimizationAlgorithm algorithm, int num_iterations, bool jacobian,
+    /* tuning params */ int max_history_size, double init_alpha, double tol_obj,
+    double tol_rel_obj, double tol_grad, double tol_rel_grad, double tol_param,
+    int num_draws, bool calculate_lp, int refresh, int num_threads,
+    double *mode_out, size_t mode_size, double *out, size_t out_size,
+    double *hessian_out, TinyStanError **err);
+
+/**
+ * @brief Approximate the posterior with automatic differentiation variational
+ * inference (ADVI).
+ *
+ * Equivalent to the functions in the `stan::services::experimental::advi`
+ * namespace. Same-named arguments should be interpreted as having the same
+ * meaning as in the Stan documentation.
+ *
+ * Each iteration estimates the gradient of the ELBO from `grad_samples`
+ * draws. Their log density gradients are evaluated in parallel, so raising
+ * `grad_samples` above Stan's default of 1 reduces the noise in each step at
+ * little cost in time when threads are available. The result does not depend
+ * on the number of threads.
+ *
+ * @param[in] model The TinyStanModel to use.
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Can be `NULL` for the defaults.
+ * @param[in] algorithm Whether to fit a Gaussian with a diagonal (`meanfield`)
+ * or dense (`fullrank`) covariance on the unconstrained scale.
+ * @param[in] init Initial parameter values. This should be a path
+ * to a JSON file or a JSON string.
+ * @param[in] seed The seed to use for the random number generator.
+ * @param[in] id ID used to offset the random number generator.
+ * @param[in] init_radius Radius to initialize unspecified parameters within.
+ * @param[in] num_draws Number of approximate posterior draws to make.
+ * @param[in] grad_samples Number of draws used to estimate each gradient.
+ * @param[in] elbo_samples Number of draws used to estimate the ELBO.
+ * @param[in] max_iterations Maximum number of iterations.
+ * @param[in] tol_rel_obj Relative tolerance on the change in the ELBO for
+ * convergence.
+ * @param[in] eta Step size scaling. Ignored if `adapt_engaged` is true.
+ * @param[in] adapt_engaged Whether to choose `eta` by a short search before
+ * the main run.
+ * @param[in] adapt_iterations Number of iterations for each candidate `eta`.
+ * @param[in] eval_elbo Number of iterations between ELBO evaluations, which
+ * check for convergence.
+ * @param[in] refresh If zero, progress messages are suppressed.
+ * @param[in] num_threads Number of threads to use for the gradient estimates.
+ * @param[out] out Buffer to store the output. The buffer should be large
+ * enough to store `(num_draws + 1) * num_params` doubles, where the
+ * parameters are preceded by `lp__` (always zero), `log_p__`, and `log_g__`.
+ * The first row is the mean of the approximation, with zero `log_p__` and
+ * `log_g__`, and is followed by the draws.
+ * @param[in] out_size Size of the buffer in doubles. Used for bounds checking
+ * unless TINYSTAN_NO_BOUNDS_CHECK is defined, in which case it is ignored.
+ * @param[out] err Error information. Can be `NULL`.
+ *
+ * @return Zero on success, non-zero on error. If an error occurs, `err` will be
+ * set to a non-NULL value which must be freed with tinystan_destroy_error().
+ */
+TINYSTAN_PUBLIC int tinystan_variational(
+    const TinyStanModel *model, const TinyStanCallOptions *options,
+    TinyStanVariationalAlgorithm algorithm, const char *init, unsigned int seed,
+    unsigned int id, double init_radius, int num_draws,
+    /* tuning params */ int grad_samples, int elbo_samples, int max_iterations,
+    double tol_rel_obj, double eta, bool adapt_engaged, int adapt_iterations,
+    int eval_elbo, int refresh, int num_threads, double *out, size_t out_size,
+    TinyStanError **err);
+
+/**
+ * Estimate leave-one-out cross-validation with Pareto smoothed importance
+ * sampling (PSIS-LOO).
+ *
+ * The pointwise log likelihood is a variable of the model, usually a
+ * generated quantity `log_lik` with one element per observation. Rather than
+ * reading it from the output of an algorithm, it is evaluated here from each
+ * draw's parameters, in parallel across draws. The draws can therefore be
+ * read in place from any algorithm's output buffer, and the full matrix of
+ * log likelihoods never needs to be passed across the API. The observations
+ * are then smoothed in parallel.
+ *
+ * This assumes the draws are independent, i.e. a relative efficiency of one.
+ * Pareto shape estimates above 0.7 indicate that the estimate for that
+ * observation is unreliable. With fewer than 25 draws, no smoothing is done
+ * and every shape estimate is infinite.
+ *
+ * @param[in] model The TinyStanModel to use.
+ * @param[in] options Settings of the call, see tinystan_create_call_options().
+ * Only the time limit is used. Can be `NULL` for no limit.
+ * @param[in] variable The name of the pointwise log likelihood variable. May
+ * be a transformed parameter or generated quantity of any shape, whose
+ * elements are taken as the observations.
+ * @param[in] draws The constrained parameter values of each draw. Each draw
+ * starts `stride` doubles after the previous one, in the order of
+ * tinystan_model_param_names(). Only the leading values for the parameters
+ * block are read; transformed parameters and generated quantities may be
+ * present or not. For example, the output of tinystan_sample() can be passed
+ * as `out + 7` with a stride of the full row length.
+ * @param[in] num_draws Number of draws.
+ * @param[in] stride Distance in doubles between consecutive draws.
+ * @param[in] seed The seed for any random numbers used by generated
+ * quantities. Draw `m` uses its own stream, so the results do not depend
+ * on the number of threads.
+ * @param[in] num_threads Number of threads to use.
+ * @param[out] elpd_loo The expected log pointwise predictive density.
+ * @param[out] se_elpd_loo The standard error of `elpd_loo`. NaN if there is
+ * only one observation.
+ * @param[out] p_loo The effective number of parameters.
+ * @param[out] pointwise_elpd Each observation's contribution to `elpd_loo`.
+ * Can be `NULL`. Otherwise, it must hold one double per observation.
+ * @param[out] pareto_k Each observation's Pareto shape estimate. Can be
+ * `NULL`. Otherwise, it must hold one double per observation.
+ * @param[out] err Error information. Can be `NULL`.
+ *
+ * @return Zero on success, non-zero on error. If an error occurs, `err` will be
+ * set to a non-NULL value which must be freed with tinystan_destroy_error().
+ */
+TINYSTAN_PUBLIC int tinystan_loo(
+    const TinyStanModel *model, const TinyStanCallOptions *options,
+    const char *variable, const double *draws, size_t num_draws, size_t stride,
+    unsigned int seed, int num_threads, double *elpd_loo, double *se_elpd_loo,
+    double *p_loo, double *pointwise_elpd, double *pareto_k,
+    TinyStanError **err);
+
 /**
  * Get the error message from an error object.
  *
@@ -356,6 +1472,36 @@ TINYSTAN_PUBLIC const char *tinystan_get_error_message(
 TINYSTAN_PUBLIC TinyStanErrorType
 tinystan_get_error_type(const TinyStanError *err);
 
+/**
+ * Get the number of draws each chain wrote before a `timeout`.
+ *
+ * For errors of other types, or from algorithms which do not return partial
+ * output, there are no counts.
+ *
+ * @param[in] err The error object.
+ * @param[out] counts Buffer for the counts, one per chain. Can be `NULL`, in
+ * which case only the number of counts is returned.
+ * @return The number of counts.
+ */
+TINYSTAN_PUBLIC size_t tinystan_get_error_draw_counts(const TinyStanError *err,
+                                                      size_t *counts);
+
+/**
+ * Get the error of each chain after some of them failed.
+ *
+ * Set for errors of type `partial`, and for a `generic` error when every
+ * isolated chain failed. See tinystan_call_options_set_chain_isolation().
+ *
+ * @param[in] err The error object.
+ * @param[out] messages Buffer for one message per chain, `NULL` for the
+ * chains which succeeded. Can be `NULL`, in which case only the number of
+ * chains is returned. The messages will be freed when the error object is
+ * freed.
+ * @return The number of chains, or zero for other errors.
+ */
+TINYSTAN_PUBLIC size_t tinystan_get_error_chain_errors(
+    const TinyStanError *err, const char **messages);
+
 /**
  * Free the error object.
  *
@@ -7,6 +7,8 @@
 #include <cstddef>
 struct TinyStanError;
 struct TinyStanModel;
+struct TinyStanSampler;
+struct TinyStanCallOptions;
 #else
 #include <stddef.h>
 #include <stdbool.h>
@@ -26,25 +28,59 @@ struct TinyStanModel;
  */
 typedef struct TinyStanError TinyStanError;
 typedef struct TinyStanModel TinyStanModel;  ///< Opaque type for models
+/**
+ * Opaque type for NUTS chains which persist between calls. See
+ * tinystan_sampler_create().
+ */
+typedef struct TinyStanSampler TinyStanSampler;
+/**
+ * Opaque type for the settings of individual algorithm calls. See
+ * tinystan_create_call_options().
+ */
+typedef struct TinyStanCallOptions TinyStanCallOptions;
 #endif
 
 /**
  * Choice of metric for HMC.
  */
-typedef enum { unit = 0, dense = 1, diagonal = 2 } TinyStanMetric;
+typedef enum {
+  unit = 0,
+  dense = 1,
+  diagonal = 2,
+  lowrank = 3,   ///< Diagonal plus a low-rank correction. See
+                 ///< tinystan_call_options_set_metric_rank().
+  automatic = 4  ///< Diagonal or dense, chosen during warmup. See
+                 ///< tinystan_sample().
+} TinyStanMetric;
 
 /**
  * Choice of optimization algorithm.
  */
 typedef enum { newton = 0, bfgs = 1, lbfgs = 2 } TinyStanOptimizationAlgorithm;
 
+/**
+ * Choice of variational family for ADVI.
+ */
+typedef enum { meanfield = 0, fullrank = 1 } TinyStanVariationalAlgorithm;
+
+/**
+ * The block a variable is declared in. See tinystan_model_variable().
+ */
+typedef enum { param = 0, tparam = 1, gq = 2 } TinyStanVariableBlock;
+
 /**
  * An enum representing different kinds of errors TinyStan can generate.
  */
 typedef enum {
   generic = 0,   ///< A generic runtime error from Stan.
   config = 1,    ///< An invalid configuration for the algorithm.
-  interrupt = 2  ///< The user interrupted the algorithm with `Ctrl+C`.
+  interrupt = 2,  ///< The user interrupted the algorithm with `Ctrl+C`.
+  timeout = 3,    ///< The algorithm ran past its time limit. See
+                  ///< tinystan_call_options_set_time_limit().
+  memory = 4,     ///< The process used more memory than the model's limit.
+                  ///< See tinystan_model_set_memory_options().
+  partial = 5     ///< Some chains failed, but the output of the others is
+                  ///< valid. See tinystan_call_options_set_chain_isolation().
 } TinyStanErrorType;
 
 /**
@@ -1,24 +1,26 @@
 #ifndef TINYSTAN_UTIL_HPP
 #define TINYSTAN_UTIL_HPP
 
-#include <stan/math/prim/core/init_threadpool_tbb.hpp>
+#include <stan/math/rev/core/init_chainablestack.hpp>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
 
+#include <algorithm>
 #include <vector>
 #include <sstream>
 #include <string>
 #include <stdexcept>
 #include <thread>
+#include <utility>
 
 namespace tinystan {
 namespace util {
 
 /**
- * Initialize the threading pool with the specified number of threads.
- *
- * NOTE: Repeated calls to this function may not override the number of threads
- * previously set.
+ * Check the number of threads requested, resolving -1 to the number of
+ * available cores.
  */
-inline void init_threading(int num_threads) {
+inline int resolve_num_threads(int num_threads) {
 #ifndef STAN_THREADS
   if (num_threads == -1) {
     num_threads = 1;
@@ -33,13 +35,83 @@ inline void init_threading(int num_threads) {
     num_threads = std::max(1U, std::thread::hardware_concurrency());
   }
 #endif
-  if (num_threads > 0) {
-    stan::math::init_threadpool_tbb(num_threads);
-  } else {
+  if (num_threads <= 0) {
     throw std::invalid_argument(
         "Number of threads requested must be a positive integer or -1"
         " (for all available cores).");
   }
+  return num_threads;
+}
+
+/**
+ * Whether this thread is working on a call, inside the arena made for it by
+ * with_threads(). Only tracked in debug builds, for assertions.
+ */
+inline bool &in_call_arena() {
+  static thread_local bool in_call = false;
+  return in_call;
+}
+
+#ifndef NDEBUG
+/**
+ * Sets in_call_arena() for the calling thread and for each worker while it
+ * is in the call's arena.
+ */
+class call_arena_marker : public tbb::task_scheduler_observer {
+ public:
+  explicit call_arena_marker(tbb::task_arena &arena)
+      : tbb::task_scheduler_observer(arena), caller(in_call_arena()) {
+    in_call_arena() = true;
+    observe(true);
+  }
+
+  ~call_arena_marker() {
+    observe(false);
+    in_call_arena() = caller;
+  }
+
+  void on_scheduler_entry(bool worker) override {
+    if (worker) {
+      in_call_arena() = true;
+    }
+  }
+
+  void on_scheduler_exit(bool worker) override {
+    if (worker) {
+      in_call_arena() = false;
+    }
+  }
+
+ private:
+  bool caller;
+};
+#endif
+
+/**
+ * @brief Wrap `f` to run in its own TBB task arena of `num_threads` threads.
+ *
+ * Each call gets its own arena, rather than resizing the global thread pool,
+ * so concurrent calls each use the number of threads they asked for without
+ * affecting one another. Threads joining the arena are given their own
+ * autodiff tapes, as Stan does for the global pool.
+ *
+ * The number of threads is checked when the result is called, so errors can
+ * be caught by error::catch_exceptions().
+ */
+template <typename F>
+auto with_threads(int num_threads, F f) {
+  return [num_threads, f = std::move(f)]() {
+    tbb::task_arena arena(resolve_num_threads(num_threads));
+    return arena.execute([&]() {
+#ifdef STAN_THREADS
+      stan::math::ad_tape_observer tapes;
+#endif
+#ifndef NDEBUG
+      call_arena_marker marker(arena);
+#endif
+      return f();
+    });
+  };
 }
 
 /**
@@ -0,0 +1,255 @@
+#ifndef TINYSTAN_VARIATIONAL_HPP
+#define TINYSTAN_VARIATIONAL_HPP
+
+#include <stan/callbacks/interrupt.hpp>
+#include <stan/callbacks/logger.hpp>
+#include <stan/callbacks/writer.hpp>
+#include <stan/io/var_context.hpp>
+#include <stan/math/prim/err/check_finite.hpp>
+#include <stan/math/prim/prob/normal_rng.hpp>
+#include <stan/model/gradient.hpp>
+#include <stan/model/model_base.hpp>
+#include <stan/services/error_codes.hpp>
+#include <stan/services/util/create_rng.hpp>
+#include <stan/services/util/initialize.hpp>
+#include <stan/variational/advi.hpp>
+#include <stan/variational/families/normal_fullrank.hpp>
+#include <stan/variational/families/normal_meanfield.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <atomic>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "tinystan_types.h"
+#include "messages.hpp"
+
+namespace tinystan {
+namespace variational {
+
+/**
+ * The random number generator type used by Stan's services.
+ */
+using rng_t = decltype(stan::services::util::create_rng(0u, 0u));
+
+/**
+ * @brief State for the families below which Stan's ADVI does not pass along.
+ *
+ * `stan::variational::advi` constructs the families itself, and never checks
+ * for interrupts. The families' gradients, computed once per iteration, read
+ * the current run's settings from here instead. It is thread-local because
+ * ADVI runs on the calling thread.
+ */
+struct run_context {
+  stan::callbacks::interrupt *interrupt = nullptr;
+  bool model_output = true;
+
+  static run_context &current() {
+    static thread_local run_context context;
+    return context;
+  }
+};
+
+/**
+ * @brief Sets the run_context for the lifetime of a run.
+ */
+class context_scope {
+ public:
+  context_scope(stan::callbacks::interrupt &interrupt, bool model_output)
+      : saved(run_context::current()) {
+    run_context::current().interrupt = &interrupt;
+    run_context::current().model_output = model_output;
+  }
+
+  ~context_scope() { run_context::current() = saved; }
+
+  context_scope(const context_scope &) = delete;
+  context_scope &operator=(const context_scope &) = delete;
+
+ private:
+  run_context saved;
+};
+
+/**
+ * @brief Gradients of the log density at Monte Carlo draws from a family.
+ *
+ * The standard normal draws are made in order from `rng`, exactly as in
+ * Stan's families, and the gradients are then evaluated in parallel. The
+ * result therefore does not depend on the number of threads.
+ *
+ * @param[out] etas The standard normal draws, one per column.
+ * @return The gradients, one per column.
+ * @throw std::domain_error If any gradient cannot be evaluated, as in Stan.
+ */
+template <typename Family, typename M, typename BaseRNG>
+Eigen::MatrixXd monte_carlo_gradients(const Family &family, M &model,
+                                      int num_draws, BaseRNG &rng,
+                                      stan::callbacks::logger &logger,
+                                      Eigen::MatrixXd &etas,
+                                      const char *function) {
+  auto &context = run_context::current();
+  if (context.interrupt != nullptr) {
+    (*context.interrupt)();
+  }
+
+  const int dims = family.dimension();
+  etas.resize(dims, num_draws);
+  for (int i = 0; i < num_draws; ++i) {
+    for (int d = 0; d < dims; ++d) {
+      etas(d, i) = stan::math::normal_rng(0, 1, rng);
+    }
+  }
+
+  Eigen::MatrixXd gradients(dims, num_draws);
+  std::atomic<bool> failed{false};
+  messages::thread_buffers model_output(context.model_output);
+  tbb::parallel_for(tbb::blocked_range<int>(0, num_draws),
+                    [&](const tbb::blocked_range<int> &r) {
+                      Eigen::VectorXd zeta, gradient;
+                      double lp = 0;
+                      for (int i = r.begin(); i != r.end(); ++i) {
+                        zeta = family.transform(etas.col(i));
+                        try {
+                          stan::model::gradient(model, zeta, lp, gradient,
+                                                model_output.get());
+                          stan::math::check_finite(function, "Gradient of mu",
+                                                   gradient);
+                          gradients.col(i) = gradient;
+                        } catch (const std::exception &e) {
+                          failed = true;
+                        }
+                      }
+                    });
+  model_output.drain(logger);
+
+  if (failed) {
+    std::stringstream msg;
+    msg << function
+        << ": The number of dropped evaluations has reached its maximum "
+           "amount ("
+        << num_draws
+        << "). Your model may be either severely ill-conditioned or "
+           "misspecified.";
+    throw std::domain_error(msg.str());
+  }
+  return gradients;
+}
+
+/**
+ * @brief Stan's mean-field Gaussian family, with a parallel ELBO gradient.
+ *
+ * Used in place of `stan::variational::normal_meanfield` by
+ * `stan::variational::advi`, which is templated on the family.
+ */
+class parallel_meanfield : public stan::variational::normal_meanfield {
+ public:
+  using stan::variational::normal_meanfield::normal_meanfield;
+  // the arithmetic operators of the base class return the base class
+  parallel_meanfield(const stan::variational::normal_meanfield &other)
+      : stan::variational::normal_meanfield(other) {}
+
+  template <class Grad, class M, class Params, class BaseRNG>
+  void calc_grad(Grad &elbo_grad, M &m, Params &cont_params,
+                 int n_monte_carlo_grad, BaseRNG &rng,
+                 stan::callbacks::logger &logger) const {
+    Eigen::MatrixXd etas;
+    Eigen::MatrixXd gradients = monte_carlo_gradients(
+        *this, m, n_monte_carlo_grad, rng, logger, etas,
+        "stan::variational::normal_meanfield::calc_grad");
+
+    Eigen::VectorXd mu_grad = gradients.rowwise().mean();
+    Eigen::VectorXd omega_grad
+        = gradients.cwiseProduct(etas).rowwise().mean();
+    // the entropy adds one to each log standard deviation's gradient
+    omega_grad.array() = omega_grad.array() * omega().array().exp() + 1.0;
+
+    elbo_grad.set_mu(mu_grad);
+    elbo_grad.set_omega(omega_grad);
+  }
+};
+
+/**
+ * @brief Stan's full-rank Gaussian family, with a parallel ELBO gradient.
+ *
+ * Used in place of `stan::variational::normal_fullrank`.
+ */
+class parallel_fullrank : public stan::variational::normal_fullrank {
+ public:
+  using stan::variational::normal_fullrank::normal_fullrank;
+  parallel_fullrank(const stan::variational::normal_fullrank &other)
+      : stan::variational::normal_fullrank(other) {}
+
+  template <class Grad, class M, class Params, class BaseRNG>
+  void calc_grad(Grad &elbo_grad, M &m, Params &cont_params,
+                 int n_monte_carlo_grad, BaseRNG &rng,
+                 stan::callbacks::logger &logger) const {
+    Eigen::MatrixXd etas;
+    Eigen::MatrixXd gradients = monte_carlo_gradients(
+        *this, m, n_monte_carlo_grad, rng, logger, etas,
+        "stan::variational::normal_fullrank::calc_grad");
+
+    Eigen::VectorXd mu_grad = gradients.rowwise().mean();
+    Eigen::MatrixXd L_grad = gradients * etas.transpose() / n_monte_carlo_grad;
+    L_grad.triangularView<Eigen::StrictlyUpper>().setZero();
+    // gradient of the entropy
+    L_grad.diagonal().array() += L_chol().diagonal().array().inverse();
+
+    elbo_grad.set_mu(mu_grad);
+    elbo_grad.set_L_chol(L_grad);
+  }
+};
+
+/**
+ * @brief Run ADVI with the given family.
+ *
+ * Equivalent to `stan::services::experimental::advi::meanfield` and
+ * `fullrank`, but with the families above. The first row written is the
+ * mean of the approximation, followed by `output_samples` draws.
+ *
+ * @return A code from `stan::services::error_codes`.
+ */
+template <typename Family>
+int run_advi(stan::model::model_base &model, const stan::io::var_context &init,
+             unsigned int seed, unsigned int id, double init_radius,
+             int grad_samples, int elbo_samples, int max_iterations,
+             double tol_rel_obj, double eta, bool adapt_engaged,
+             int adapt_iterations, int eval_elbo, int output_samples,
+             bool model_output, stan::callbacks::interrupt &interrupt,
+             stan::callbacks::logger &logger,
+             stan::callbacks::writer &parameter_writer) {
+  stan::callbacks::writer null_writer;
+  rng_t rng = stan::services::util::create_rng(seed, id);
+
+  std::vector<double> cont_vector;
+  try {
+    cont_vector = stan::services::util::initialize(
+        model, init, rng, init_radius, true, logger, null_writer);
+  } catch (const std::exception &e) {
+    logger.error(e.what());
+    return stan::services::error_codes::CONFIG;
+  }
+
+  std::vector<std::string> names{"lp__", "log_p__", "log_g__"};
+  model.constrained_param_names(names, true, true);
+  parameter_writer(names);
+
+  Eigen::VectorXd cont_params
+      = Eigen::Map<Eigen::VectorXd>(cont_vector.data(), cont_vector.size());
+
+  context_scope scope(interrupt, model_output);
+  stan::variational::advi<stan::model::model_base, Family, rng_t> advi(
+      model, cont_params, rng, grad_samples, elbo_samples, eval_elbo,
+      output_samples);
+  advi.run(eta, adapt_engaged, adapt_iterations, tol_rel_obj, max_iterations,
+           logger, parameter_writer, null_writer);
+
+  return stan::services::error_codes::OK;
+}
+
+}  // namespace variational
+}  // namespace tinystan
+
+#endif